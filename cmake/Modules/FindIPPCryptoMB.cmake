@@ -0,0 +1,21 @@
+# Try to find the multi-buffer part of Intel ipp-crypto (crypto_mb)
+# See https://github.com/intel/ipp-crypto
+
+if (IPPCRYPTOMB_INCLUDES AND IPPCRYPTOMB_LIBRARIES)
+  set(IPPCRYPTOMB_FIND_QUIETLY TRUE)
+endif (IPPCRYPTOMB_INCLUDES AND IPPCRYPTOMB_LIBRARIES)
+
+find_path(IPPCRYPTOMB_INCLUDES
+  NAMES
+  crypto_mb/rsa.h
+  PATHS
+  $ENV{IPPCRYPTOROOT}/include
+  ${INCLUDE_INSTALL_DIR}
+)
+
+find_library(IPPCRYPTOMB_LIBRARIES crypto_mb PATHS $ENV{IPPCRYPTOROOT}/lib ${LIB_INSTALL_DIR})
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(IPPCryptoMB DEFAULT_MSG
+                                  IPPCRYPTOMB_INCLUDES IPPCRYPTOMB_LIBRARIES)
+mark_as_advanced(IPPCRYPTOMB_INCLUDES IPPCRYPTOMB_LIBRARIES)
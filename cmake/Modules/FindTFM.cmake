@@ -0,0 +1,22 @@
+# Try to find TomsFastMath (TFM)
+# See https://github.com/libtom/tomsfastmath
+
+if (TFM_INCLUDES AND TFM_LIBRARIES)
+  set(TFM_FIND_QUIETLY TRUE)
+endif (TFM_INCLUDES AND TFM_LIBRARIES)
+
+find_path(TFM_INCLUDES
+  NAMES
+  tfm.h
+  PATHS
+  $ENV{TFMDIR}
+  $ENV{TFMDIR}/src/headers
+  ${INCLUDE_INSTALL_DIR}
+)
+
+find_library(TFM_LIBRARIES tfm PATHS $ENV{TFMDIR} ${LIB_INSTALL_DIR})
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(TFM DEFAULT_MSG
+                                  TFM_INCLUDES TFM_LIBRARIES)
+mark_as_advanced(TFM_INCLUDES TFM_LIBRARIES)
@@ -21,9 +21,20 @@
 #include "accel.h"
 
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
 
+#include <openssl/bn.h>
+#include <openssl/crypto.h>
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
+#include <openssl/evp.h>
+#include <openssl/obj_mac.h>
 #include <openssl/rsa.h>
 
 #include <common/compiler.h>
@@ -31,42 +42,207 @@
 #include <accessl-common/cmd.h>
 #include <accessl-common/log.h>
 #include <accessl-common/stat.h>
-#include <accessl-common/test_keys.h>
+#include <accessl-common/testrsa.h>
 
 #include "accel_base.h"
+#include "accel_bg.h"
 #include "accel_mod_exp.h"
 #include "accel_gmp.h"
 #include "accel_tfm.h"
 #include "accel_bn.h"
+#include "accel_cpu.h"
+#include "accel_ed25519.h"
+#include "accel_evp.h"
 #include "accel_ipp.h"
+#include "accel_p256.h"
+#include "accel_pad.h"
+#include "accel_par.h"
+#include "accel_profile.h"
+#include "accel_ticket.h"
+
+#define ACCEL_MAX_METHODS  8
 
 LOG_MODULE_DEFINE;
 
-accelerator *rsa_accel = NULL;
+struct accel_key_t {
+    int type;
+    int bits;
+    accelerator *accel;
+    void *priv;
+    struct stat_t ops;
+
+    struct accel_key_t *next;
+};
+typedef struct accel_key_t accel_key;
+
+// benchmarked RSA key size, keys of other sizes use the closest one
+struct accel_rsa_size_t {
+    int bits;
+    unsigned char *der;
+    size_t der_len;
+
+    uint64_t speed[ACCEL_MAX_METHODS];
+    int order[ACCEL_MAX_METHODS]; // methods from the fastest
+};
+typedef struct accel_rsa_size_t accel_rsa_size;
+
+static accel_rsa_size rsa_sizes[] = {
+    { 512, test512, sizeof(test512), {0}, {0} },
+    { 1024, test1024, sizeof(test1024), {0}, {0} },
+    { 2048, test2048, sizeof(test2048), {0}, {0} },
+    { 3072, test3072, sizeof(test3072), {0}, {0} },
+    { 4096, test4096, sizeof(test4096), {0}, {0} },
+};
+static const int rsa_size_count = (int)(sizeof(rsa_sizes) / sizeof(rsa_sizes[0]));
+
+static accelerator *rsa_methods[ACCEL_MAX_METHODS];
+static int rsa_method_count = 0;
+
+// EC keys have a single curve per method, the first one accepting a key gets it
+static accelerator *ec_methods[ACCEL_MAX_METHODS];
+static int ec_method_count = 0;
+
+// Ed25519 methods from the fastest, the rest take keys the first one refuses
+#define ED25519_PROFILE_BITS  0 // Ed25519 entries of the profile, RSA ones carry the key size
+static accelerator *ed25519_methods[ACCEL_MAX_METHODS];
+static uint64_t ed25519_speed[ACCEL_MAX_METHODS];
+static int ed25519_method_count = 0;
 
-static void *setup_test_key(accelerator *method)
+// ticket keys, the first one loaded seals and all of them open
+static accelerator *ticket_methods[ACCEL_MAX_METHODS];
+static int ticket_method_count = 0;
+
+// PSS salts
+static int urandom_fd = -1;
+
+// key pairs handed out through CMD_OP_KEYSHARE
+static struct stat_t keyshare_pairs;
+
+// RFC 8032 7.1 test 1, signing the empty message
+static const unsigned char ed25519_test_seed[32] = {
+    0x9d, 0x61, 0xb1, 0x9d, 0xef, 0xfd, 0x5a, 0x60, 0xba, 0x84, 0x4a, 0xf4, 0x92, 0xec, 0x2c, 0xc4,
+    0x44, 0x49, 0xc5, 0x69, 0x7b, 0x32, 0x69, 0x19, 0x70, 0x3b, 0xac, 0x03, 0x1c, 0xae, 0x7f, 0x60,
+};
+static const unsigned char ed25519_test_pub[32] = {
+    0xd7, 0x5a, 0x98, 0x01, 0x82, 0xb1, 0x0a, 0xb7, 0xd5, 0x4b, 0xfe, 0xd3, 0xc9, 0x64, 0x07, 0x3a,
+    0x0e, 0xe1, 0x72, 0xf3, 0xda, 0xa6, 0x23, 0x25, 0xaf, 0x02, 0x1a, 0x68, 0xf7, 0x07, 0x51, 0x1a,
+};
+static const unsigned char ed25519_test_sig[64] = {
+    0xe5, 0x56, 0x43, 0x00, 0xc3, 0x60, 0xac, 0x72, 0x90, 0x86, 0xe2, 0xcc, 0x80, 0x6e, 0x82, 0x8a,
+    0x84, 0x87, 0x7f, 0x1e, 0xb8, 0xe5, 0xd9, 0x74, 0xd8, 0x73, 0xe0, 0x65, 0x22, 0x49, 0x01, 0x55,
+    0x5f, 0xb8, 0x82, 0x15, 0x90, 0xa3, 0x3b, 0xac, 0xc6, 0x1e, 0x39, 0x70, 0x1c, 0xf9, 0xb4, 0x6b,
+    0xd2, 0x5b, 0xf5, 0xf0, 0x59, 0x5b, 0xbe, 0x24, 0x65, 0x51, 0x41, 0x43, 0x8e, 0x7a, 0x10, 0x0b,
+};
+
+// RFC 6979 A.2.5 key, signing SHA-256 of "sample"
+static const unsigned char p256_test_d[32] = {
+    0xc9, 0xaf, 0xa9, 0xd8, 0x45, 0xba, 0x75, 0x16, 0x6b, 0x5c, 0x21, 0x57, 0x67, 0xb1, 0xd6, 0x93,
+    0x4e, 0x50, 0xc3, 0xdb, 0x36, 0xe8, 0x9b, 0x12, 0x7b, 0x8a, 0x62, 0x2b, 0x12, 0x0f, 0x67, 0x21,
+};
+static const unsigned char p256_test_pub[65] = {
+    0x04, 0x60, 0xfe, 0xd4, 0xba, 0x25, 0x5a, 0x9d, 0x31, 0xc9, 0x61, 0xeb, 0x74, 0xc6, 0x35, 0x6d,
+    0x68, 0xc0, 0x49, 0xb8, 0x92, 0x3b, 0x61, 0xfa, 0x6c, 0xe6, 0x69, 0x62, 0x2e, 0x60, 0xf2, 0x9f,
+    0xb6, 0x79, 0x03, 0xfe, 0x10, 0x08, 0xb8, 0xbc, 0x99, 0xa4, 0x1a, 0xe9, 0xe9, 0x56, 0x28, 0xbc,
+    0x64, 0xf2, 0xf1, 0xb2, 0x0c, 0x2d, 0x7e, 0x9f, 0x51, 0x77, 0xa3, 0xc2, 0x94, 0xd4, 0x46, 0x22,
+    0x99,
+};
+static const unsigned char p256_test_dgst[32] = {
+    0xaf, 0x2b, 0xdb, 0xe1, 0xaa, 0x9b, 0x6e, 0xc1, 0xe2, 0xad, 0xe1, 0xd6, 0x94, 0xf4, 0x1f, 0xc7,
+    0x1a, 0x83, 0x1d, 0x02, 0x68, 0xe9, 0x89, 0x15, 0x62, 0x11, 0x3d, 0x8a, 0x62, 0xad, 0xd1, 0xbf,
+};
+
+static accel_key *keys = NULL;
+
+static size_t serialize_bn(const BIGNUM *bn, unsigned char *ptr)
 {
-    void *key = accelerator_add_key(method, CMD_KEY_RSA, sizeof(test_key_rsa1024), test_key_rsa1024);
+    vli *v = (vli *)ptr;
+
+    v->len = htonl(BN_num_bytes(bn));
+    BN_bn2bin(bn, v->data);
 
-    return key;
+    return sizeof(uint32_t) + BN_num_bytes(bn);
 }
 
-static int benchmark(accelerator *accel)
+static unsigned char *serialize_rsa_key(const RSA *rsa, size_t *len)
 {
-    const int iterations = 1000;
+    const BIGNUM *elems[] = {
+        rsa->n, rsa->e, rsa->d, rsa->p, rsa->q, rsa->dmp1, rsa->dmq1, rsa->iqmp
+    };
+    const int elem_count = (int)(sizeof(elems) / sizeof(elems[0]));
+    unsigned char *data, *ptr;
+    int i;
+
+    *len = 0;
+    for (i = 0; i < elem_count; ++i)
+        *len += sizeof(uint32_t) + BN_num_bytes(elems[i]);
+
+    data = malloc(*len);
+    if (!data)
+        return NULL;
+
+    ptr = data;
+    for (i = 0; i < elem_count; ++i)
+        ptr += serialize_bn(elems[i], ptr);
+
+    return data;
+}
+
+// modulus is the first element of serialized RSA key
+static int rsa_key_bits(size_t len, const unsigned char *data)
+{
+    const vli *n = (const vli *)data;
+    size_t n_len, i;
+    unsigned char c;
+    int bits;
+
+    if (len < sizeof(uint32_t))
+        return -1;
+
+    n_len = ntohl(n->len);
+    if (n_len > len - sizeof(uint32_t))
+        return -1;
 
-    int ret, i;
+    for (i = 0; i < n_len && !n->data[i]; ++i)
+        ;
+    if (i == n_len)
+        return 0;
+
+    bits = (n_len - i) * 8;
+    for (c = n->data[i]; !(c & 0x80); c <<= 1)
+        --bits;
+
+    return bits;
+}
+
+static uint64_t benchmark(accelerator *accel, accel_rsa_size *size)
+{
+    // keep the time spent per size roughly constant, RSA cost grows with cube of the size
+    int scale = size->bits / 1024;
+    int iterations = scale > 1 ? 1000 / (scale * scale * scale) : 1000;
+
+    int ret, i, j, batch_size;
     struct timespec t1, t2, total;
-    uint64_t speed = INT_MAX;
+    uint64_t speed = UINT64_MAX;
+    accel_op batch[ACCEL_BATCH_MAX];
 
     memset(&t1, 0, sizeof(struct timespec));
     memset(&t2, 0, sizeof(struct timespec));
     memset(&total, 0, sizeof(struct timespec));
 
+    if (iterations < 10)
+        iterations = 10;
+
     unsigned char plain[] = {1,2,3,4,5};
     int plain_len = sizeof(plain);
-    const unsigned char *p = test_key_openssl_rsa1024;
-    RSA *rsa_key = d2i_RSAPrivateKey(NULL, &p, sizeof(test_key_openssl_rsa1024));
+    const unsigned char *p = size->der;
+    RSA *rsa_key = d2i_RSAPrivateKey(NULL, &p, size->der_len);
+
+    if (!rsa_key)
+    {
+        LOG_ERROR("could not load %d-bit test key", size->bits);
+        return speed;
+    }
+
     unsigned char cipher[RSA_size(rsa_key)];
     unsigned char result[RSA_size(rsa_key)];
 
@@ -74,6 +250,8 @@ static int benchmark(accelerator *accel)
 
     void *key = NULL;
     cmd_op_rsa *op = NULL;
+    unsigned char *key_data = NULL;
+    size_t key_len;
 
     if (len < 0)
     {
@@ -81,7 +259,16 @@ static int benchmark(accelerator *accel)
         goto ret;
     }
 
-    key = setup_test_key(accel);
+    key_data = serialize_rsa_key(rsa_key, &key_len);
+    if (key_data)
+        key = accelerator_add_key(accel, CMD_KEY_RSA, key_len, key_data);
+
+    if (!key)
+    {
+        LOG_INFO("%s does not support %d-bit keys", accelerator_name(accel), size->bits);
+        goto ret;
+    }
+
     op = malloc(sizeof(cmd_op_rsa) + accelerator_result_max_len(accel, key, CMD_OP_RSA_PRIV_DEC));
 
     if (!op)
@@ -93,27 +280,37 @@ static int benchmark(accelerator *accel)
     op->pad = htonl(RSA_PKCS1_PADDING);
     memcpy(&op->data[0], cipher, len);
 
-    if (!key)
+    // the whole op, header included, as it comes from a client
+    ret = accelerator_rsa_priv_dec(accel, key, sizeof(cmd_op_rsa) + len, (const unsigned char *)op, result);
+    if (ret != plain_len || memcmp(result, plain, ret) != 0)
     {
-        LOG_ERROR("%s failed in setup_test_key", accelerator_name(accel));
+        LOG_ERROR("%s failed in accelerator_rsa_priv_dec", accelerator_name(accel));
         goto ret;
     }
 
-
-    ret = accelerator_rsa_priv_dec(accel, key, len, (const unsigned char *)op, result);
-    if (ret != plain_len || memcmp(result, plain, ret) != 0)
+    // methods doing several ops at once are measured by their throughput
+    for (i = 0; i < ACCEL_BATCH_MAX; ++i)
     {
-        LOG_ERROR("%s failed in accelerator_rsa_priv_dec", accelerator_name(accel));
-        goto ret;
+        batch[i].key = key;
+        batch[i].op = CMD_OP_RSA_PRIV_DEC;
+        batch[i].len = sizeof(cmd_op_rsa) + len;
+        batch[i].data = (const unsigned char *)op;
+        batch[i].result = result;
     }
+    batch_size = accel->method->perform_batch ? ACCEL_BATCH_MAX : 1;
+    iterations = (iterations + batch_size - 1) / batch_size * batch_size;
 
     stat_store_time(&t1);
-    for (i = 0; i < iterations; ++i)
+    for (i = 0; i < iterations; i += batch_size)
     {
-        if (unlikely(accelerator_rsa_priv_dec(accel, key, len, (const unsigned char *)op, result) != plain_len))
+        accelerator_perform_batch(accel, batch, batch_size);
+        for (j = 0; j < batch_size; ++j)
         {
-            LOG_ERROR("%s failed in RSA_priv_dec", accelerator_name(accel));
-            goto ret;
+            if (unlikely(batch[j].ret != plain_len))
+            {
+                LOG_ERROR("%s failed in RSA_priv_dec", accelerator_name(accel));
+                goto ret;
+            }
         }
     }
     stat_store_time(&t2);
@@ -121,84 +318,724 @@ static int benchmark(accelerator *accel)
     stat_difftime(&t2, &t1, &total);
     speed = ((uint64_t)total.tv_sec * (uint64_t)NANOSEC_IN_SEC + (uint64_t)total.tv_nsec) / (uint64_t)iterations;
 
-    LOG_INFO("%s RSA 1024 private decrypt: %lld ns", accelerator_name(accel), speed);
+    LOG_INFO("%s RSA %d private decrypt: %lld ns", accelerator_name(accel), size->bits, (long long)speed);
 
 ret:
     RSA_free(rsa_key);
     free(op);
-    accelerator_destroy_key(accel, CMD_KEY_RSA, key);
+    free(key_data);
+    if (key)
+        accelerator_destroy_key(accel, CMD_KEY_RSA, key);
     return speed;
 }
 
-static accelerator *accel_rsa_choose_best(void)
+static void accel_rsa_size_sort(accel_rsa_size *size)
+{
+    int i, j;
+
+    for (i = 0; i < rsa_method_count; ++i)
+        size->order[i] = i;
+
+    // insertion sort, there is only a handful of methods
+    for (i = 1; i < rsa_method_count; ++i)
+    {
+        int m = size->order[i];
+
+        for (j = i; j > 0 && size->speed[size->order[j - 1]] > size->speed[m]; --j)
+            size->order[j] = size->order[j - 1];
+        size->order[j] = m;
+    }
+}
+
+// fills speeds from the profile, fails unless it has results for every method and size
+static int accel_profile_read(const char *path, const char *signature)
+{
+    accel_profile_entry entries[ACCEL_MAX_METHODS * (sizeof(rsa_sizes) / sizeof(rsa_sizes[0]) + 1)];
+    int count = accel_profile_load(path, signature, entries, (int)(sizeof(entries) / sizeof(entries[0])));
+    int found = 0;
+    int e, i, s;
+
+    for (e = 0; e < count; ++e)
+    {
+        for (i = 0; i < ed25519_method_count; ++i)
+        {
+            if (entries[e].bits == ED25519_PROFILE_BITS && !strcmp(entries[e].method, accelerator_name(ed25519_methods[i])))
+            {
+                ed25519_speed[i] = entries[e].speed;
+                ++found;
+            }
+        }
+
+        for (s = 0; s < rsa_size_count; ++s)
+        {
+            for (i = 0; i < rsa_method_count; ++i)
+            {
+                if (entries[e].bits == rsa_sizes[s].bits && !strcmp(entries[e].method, accelerator_name(rsa_methods[i])))
+                {
+                    rsa_sizes[s].speed[i] = entries[e].speed;
+                    ++found;
+                }
+            }
+        }
+    }
+
+    return found == rsa_size_count * rsa_method_count + ed25519_method_count ? 1 : -1;
+}
+
+static void accel_profile_write(const char *path, const char *signature)
+{
+    accel_profile_entry entries[ACCEL_MAX_METHODS * (sizeof(rsa_sizes) / sizeof(rsa_sizes[0]) + 1)];
+    int count = 0;
+    int i, s;
+
+    for (i = 0; i < ed25519_method_count; ++i, ++count)
+    {
+        entries[count].bits = ED25519_PROFILE_BITS;
+        snprintf(entries[count].method, sizeof(entries[count].method), "%s", accelerator_name(ed25519_methods[i]));
+        entries[count].speed = ed25519_speed[i];
+    }
+
+    for (s = 0; s < rsa_size_count; ++s)
+    {
+        for (i = 0; i < rsa_method_count; ++i, ++count)
+        {
+            entries[count].bits = rsa_sizes[s].bits;
+            snprintf(entries[count].method, sizeof(entries[count].method), "%s", accelerator_name(rsa_methods[i]));
+            entries[count].speed = rsa_sizes[s].speed[i];
+        }
+    }
+
+    if (accel_profile_save(path, signature, entries, count) < 0)
+        LOG_WARN("could not save calibration profile %s", path);
+}
+
+static accel_rsa_size *accel_rsa_size_find(int bits)
+{
+    accel_rsa_size *best = &rsa_sizes[0];
+    int s;
+
+    // sizes are ascending, a key halfway between two goes to the smaller one
+    for (s = 1; s < rsa_size_count; ++s)
+    {
+        if (abs(rsa_sizes[s].bits - bits) < abs(best->bits - bits))
+            best = &rsa_sizes[s];
+    }
+
+    return best;
+}
+
+// without calibrate only checks the test signature
+static uint64_t ed25519_benchmark(accelerator *accel, int calibrate)
+{
+    const int iterations = calibrate ? 1000 : 1;
+
+    int i, j, batch_size;
+    struct timespec t1, t2, total;
+    uint64_t speed = UINT64_MAX;
+    accel_op batch[ACCEL_BATCH_MAX];
+    unsigned char key_data[2 * (sizeof(uint32_t) + 32)];
+    unsigned char result[ACCEL_BATCH_MAX][64];
+    cmd_op_ed25519 op;
+    unsigned char *ptr = key_data;
+    void *key;
+
+    memset(&t1, 0, sizeof(struct timespec));
+    memset(&t2, 0, sizeof(struct timespec));
+    memset(&total, 0, sizeof(struct timespec));
+
+    *(uint32_t *)ptr = htonl(32);
+    memcpy(ptr + sizeof(uint32_t), ed25519_test_seed, 32);
+    ptr += sizeof(uint32_t) + 32;
+    *(uint32_t *)ptr = htonl(32);
+    memcpy(ptr + sizeof(uint32_t), ed25519_test_pub, 32);
+
+    key = accelerator_add_key(accel, CMD_KEY_ED25519, sizeof(key_data), key_data);
+    OPENSSL_cleanse(key_data, sizeof(key_data));
+
+    if (!key)
+    {
+        LOG_ERROR("%s refused Ed25519 test key", accelerator_name(accel));
+        return speed;
+    }
+
+    op.len = htonl(0);
+
+    for (i = 0; i < ACCEL_BATCH_MAX; ++i)
+    {
+        batch[i].key = key;
+        batch[i].op = CMD_OP_ED25519_SIGN;
+        batch[i].len = sizeof(op);
+        batch[i].data = (const unsigned char *)&op;
+        batch[i].result = result[i];
+    }
+    batch_size = accel->method->perform_batch ? ACCEL_BATCH_MAX : 1;
+
+    stat_store_time(&t1);
+    for (i = 0; i < iterations; i += batch_size)
+    {
+        accelerator_perform_batch(accel, batch, batch_size);
+        for (j = 0; j < batch_size; ++j)
+        {
+            if (unlikely(batch[j].ret != 64 || memcmp(result[j], ed25519_test_sig, 64)))
+            {
+                LOG_ERROR("%s failed Ed25519 test signature", accelerator_name(accel));
+                goto ret;
+            }
+        }
+    }
+    stat_store_time(&t2);
+
+    stat_difftime(&t2, &t1, &total);
+    speed = ((uint64_t)total.tv_sec * (uint64_t)NANOSEC_IN_SEC + (uint64_t)total.tv_nsec) / (uint64_t)i;
+
+    if (calibrate)
+        LOG_INFO("%s Ed25519 sign: %lld ns", accelerator_name(accel), (long long)speed);
+
+ret:
+    accelerator_destroy_key(accel, CMD_KEY_ED25519, key);
+    return speed;
+}
+
+// X25519 key shares are checked to be on curve25519 and not on its twist
+static int x25519_self_test(accelerator *accel)
+{
+    unsigned char result[CMD_KEYSHARE_X25519_LEN];
+    unsigned char u[32];
+    BN_CTX *ctx = BN_CTX_new();
+    BIGNUM *p, *e, *x, *t;
+    int ret = -1;
+    int i;
+
+    if (!ctx)
+        return -1;
+    BN_CTX_start(ctx);
+    p = BN_CTX_get(ctx);
+    e = BN_CTX_get(ctx);
+    x = BN_CTX_get(ctx);
+    t = BN_CTX_get(ctx);
+    if (!t)
+        goto end;
+
+    if (accelerator_keyshare(accel, CMD_GROUP_X25519, 1, result) != CMD_KEYSHARE_X25519_LEN)
+    {
+        LOG_ERROR("%s failed to make an X25519 key share", accelerator_name(accel));
+        goto end;
+    }
+
+    // u is little endian
+    for (i = 0; i < 32; ++i)
+        u[i] = result[CMD_KEYSHARE_X25519_LEN - 1 - i];
+
+    // p = 2^255 - 19, u^3 + 486662 u^2 + u must be a square: to the (p - 1) / 2 it is 1
+    BN_zero(p);
+    if (!BN_set_bit(p, 255) || !BN_sub_word(p, 19) || !BN_copy(e, p) || !BN_sub_word(e, 1) || !BN_rshift1(e, e) ||
+        !BN_bin2bn(u, sizeof(u), x) || !BN_copy(t, x) || !BN_add_word(t, 486662) ||
+        !BN_mod_mul(t, t, x, p, ctx) || !BN_add_word(t, 1) || !BN_mod_mul(t, t, x, p, ctx) ||
+        !BN_mod_exp(t, t, e, p, ctx))
+        goto end;
+
+    if (BN_cmp(x, p) >= 0 || !BN_is_one(t))
+    {
+        LOG_ERROR("%s made an X25519 key share off the curve", accelerator_name(accel));
+        goto end;
+    }
+
+    ret = 1;
+
+end:
+    OPENSSL_cleanse(result, sizeof(result));
+    BN_CTX_end(ctx);
+    BN_CTX_free(ctx);
+    return ret;
+}
+
+// the test key signs and OpenSSL verifies, then a fresh key share has to be d G
+static int p256_self_test(accelerator *accel)
+{
+    unsigned char key_data[4 * sizeof(uint32_t) + sizeof(p256_test_d) + sizeof(p256_test_pub)];
+    unsigned char op_data[sizeof(cmd_op_ecdsa) + sizeof(p256_test_dgst)];
+    unsigned char result[CMD_KEYSHARE_SECP256R1_LEN];
+    cmd_op_ecdsa *op = (cmd_op_ecdsa *)op_data;
+    unsigned char *ptr = key_data;
+    EC_KEY *ec = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+    ECDSA_SIG *sig = ECDSA_SIG_new();
+    BIGNUM *r = NULL, *s = NULL, *d = NULL;
+    EC_POINT *q = NULL, *chk = NULL;
+    const EC_GROUP *group;
+    void *key = NULL;
+    int ret = -1;
+
+    if (!ec || !sig)
+        goto end;
+    group = EC_KEY_get0_group(ec);
+
+    *(uint32_t *)ptr = htonl(sizeof(uint32_t));
+    *(uint32_t *)(ptr + sizeof(uint32_t)) = htonl(CMD_EC_CURVE_P256);
+    ptr += 2 * sizeof(uint32_t);
+    *(uint32_t *)ptr = htonl(sizeof(p256_test_d));
+    memcpy(ptr + sizeof(uint32_t), p256_test_d, sizeof(p256_test_d));
+    ptr += sizeof(uint32_t) + sizeof(p256_test_d);
+    *(uint32_t *)ptr = htonl(sizeof(p256_test_pub));
+    memcpy(ptr + sizeof(uint32_t), p256_test_pub, sizeof(p256_test_pub));
+
+    key = accelerator_add_key(accel, CMD_KEY_EC, sizeof(key_data), key_data);
+    if (!key)
+    {
+        LOG_ERROR("%s refused P-256 test key", accelerator_name(accel));
+        goto end;
+    }
+
+    op->len = htonl(sizeof(p256_test_dgst));
+    memcpy(op->data, p256_test_dgst, sizeof(p256_test_dgst));
+
+    q = EC_POINT_new(group);
+    chk = EC_POINT_new(group);
+    if (!q || !chk || !EC_POINT_oct2point(group, q, p256_test_pub, sizeof(p256_test_pub), NULL) ||
+        !EC_KEY_set_public_key(ec, q))
+        goto end;
+
+    if (accelerator_ecdsa_sign(accel, key, sizeof(op_data), op_data, result) != 2 * (int)sizeof(p256_test_d))
+    {
+        LOG_ERROR("%s failed to sign with P-256 test key", accelerator_name(accel));
+        goto end;
+    }
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    r = BN_bin2bn(result, sizeof(p256_test_d), NULL);
+    s = BN_bin2bn(result + sizeof(p256_test_d), sizeof(p256_test_d), NULL);
+    if (!r || !s || !ECDSA_SIG_set0(sig, r, s))
+        goto end;
+    r = s = NULL;
+#else
+    if (!BN_bin2bn(result, sizeof(p256_test_d), sig->r) ||
+        !BN_bin2bn(result + sizeof(p256_test_d), sizeof(p256_test_d), sig->s))
+        goto end;
+#endif
+
+    if (ECDSA_do_verify(p256_test_dgst, sizeof(p256_test_dgst), sig, ec) != 1)
+    {
+        LOG_ERROR("%s failed P-256 test signature", accelerator_name(accel));
+        goto end;
+    }
+
+    if (accelerator_keyshare(accel, CMD_GROUP_SECP256R1, 1, result) != CMD_KEYSHARE_SECP256R1_LEN)
+    {
+        LOG_ERROR("%s failed to make a P-256 key share", accelerator_name(accel));
+        goto end;
+    }
+
+    d = BN_bin2bn(result, sizeof(p256_test_d), NULL);
+    if (!d || !EC_POINT_oct2point(group, q, result + sizeof(p256_test_d), sizeof(p256_test_pub), NULL) ||
+        EC_POINT_is_on_curve(group, q, NULL) != 1 || !EC_POINT_mul(group, chk, d, NULL, NULL, NULL) ||
+        EC_POINT_cmp(group, q, chk, NULL) != 0)
+    {
+        LOG_ERROR("%s made a wrong P-256 key share", accelerator_name(accel));
+        goto end;
+    }
+
+    ret = 1;
+
+end:
+    OPENSSL_cleanse(result, sizeof(result));
+    if (key)
+        accelerator_destroy_key(accel, CMD_KEY_EC, key);
+    BN_clear_free(d);
+    BN_free(r);
+    BN_free(s);
+    EC_POINT_free(q);
+    EC_POINT_free(chk);
+    ECDSA_SIG_free(sig);
+    EC_KEY_free(ec);
+    return ret;
+}
+
+// candidates, ordered by ed25519_sort once their speeds are known
+static void ed25519_find_methods(void)
+{
+    accelerator *accel;
+    int i;
+
+    if ((accel = accel_ed25519_method()))
+        ed25519_methods[ed25519_method_count++] = accel;
+    for (i = 0; i < ACCEL_ED25519_MB_KERNELS && ed25519_method_count < ACCEL_MAX_METHODS; ++i)
+    {
+        if ((accel = accel_ed25519_mb_method(i)))
+            ed25519_methods[ed25519_method_count++] = accel;
+    }
+}
+
+// drops methods that failed the test signature, the rest goes from the fastest
+static void ed25519_sort(void)
+{
+    int count = ed25519_method_count;
+    int i, j;
+
+    ed25519_method_count = 0;
+    for (i = 0; i < count; ++i)
+    {
+        accelerator *accel = ed25519_methods[i];
+        uint64_t speed = ed25519_speed[i];
+
+        if (speed == UINT64_MAX)
+        {
+            accelerator_done(accel);
+            continue;
+        }
+
+        // insertion sort, there is only a handful of methods
+        for (j = ed25519_method_count; j > 0 && ed25519_speed[j - 1] > speed; --j)
+        {
+            ed25519_methods[j] = ed25519_methods[j - 1];
+            ed25519_speed[j] = ed25519_speed[j - 1];
+        }
+        ed25519_methods[j] = accel;
+        ed25519_speed[j] = speed;
+        ++ed25519_method_count;
+    }
+
+    if (ed25519_method_count)
+        LOG_INFO("Ed25519: using %s", accelerator_name(ed25519_methods[0]));
+    else
+        LOG_WARN("no method handles Ed25519 keys");
+}
+
+static int accel_choose_best(const char *profile, int recalibrate)
 {
     accelerator *methods[] = {
-        //accel_ipp_method(),
+#ifdef HAVE_IPP_CRYPTO_MB
+        accel_ipp_method(),
+#endif
         accel_mod_exp_method(accel_gmp_method()),
-        //accel_mod_exp_method(accel_tfm_method()),
+#ifdef HAVE_TFM
+        accel_mod_exp_method(accel_tfm_method()),
+#endif
         accel_mod_exp_method(accel_bn_method()),
+        accel_evp_method(),
     };
-    int method_count = (int)(sizeof(methods) / sizeof(mod_exp_method *));
-    int method_times[method_count];
-    int best_time = INT_MAX;
+    int method_count = (int)(sizeof(methods) / sizeof(methods[0]));
+    char signature[ACCEL_PROFILE_SIGNATURE_LEN];
+    int calibrate = 1;
+    int usable = 0;
+    int i, s;
 
-    int i;
-    int best = -1;
+    for (i = 0; i < method_count && rsa_method_count < ACCEL_MAX_METHODS; ++i)
+    {
+        if (methods[i])
+            rsa_methods[rsa_method_count++] = methods[i];
+    }
 
-    for (i = 0; i < method_count; ++i)
+    // set of available methods is part of what the profile was measured on
+    accel_profile_signature(signature, sizeof(signature));
+    for (i = 0; i < rsa_method_count; ++i)
     {
-        setup_test_key(methods[i]);
-        method_times[i] = benchmark(methods[i]);
+        size_t used = strlen(signature);
 
-        if (method_times[i] < best_time)
-        {
-            best_time = method_times[i];
-            best = i;
-        }
+        snprintf(signature + used, sizeof(signature) - used, "%s%s", i ? "," : ";methods=", accelerator_name(rsa_methods[i]));
     }
+    for (i = 0; i < ed25519_method_count; ++i)
+    {
+        size_t used = strlen(signature);
 
-    for (i = 0; i < method_count; ++i)
+        snprintf(signature + used, sizeof(signature) - used, "%s%s", i ? "," : ";ed25519=", accelerator_name(ed25519_methods[i]));
+    }
+
+    if (profile && !recalibrate)
     {
-        if (i != best)
-            accelerator_done(methods[i]);
+        calibrate = accel_profile_read(profile, signature) < 0;
+        if (calibrate)
+            LOG_INFO("no usable calibration profile in %s, calibrating", profile);
+        else
+            LOG_INFO("using calibration profile %s", profile);
     }
 
-    if (best == -1)
-        return NULL;
+    // the test signature and key share are checked even when the speed comes from the profile
+    for (i = 0; i < ed25519_method_count; ++i)
+    {
+        uint64_t speed = ed25519_benchmark(ed25519_methods[i], calibrate);
+
+        if (speed != UINT64_MAX && x25519_self_test(ed25519_methods[i]) < 0)
+            speed = UINT64_MAX;
+
+        if (calibrate || speed == UINT64_MAX)
+            ed25519_speed[i] = speed;
+    }
+
+    for (s = 0; s < rsa_size_count; ++s)
+    {
+        accel_rsa_size *size = &rsa_sizes[s];
+
+        if (calibrate)
+        {
+            for (i = 0; i < rsa_method_count; ++i)
+                size->speed[i] = benchmark(rsa_methods[i], size);
+        }
+
+        accel_rsa_size_sort(size);
+
+        if (size->speed[size->order[0]] == UINT64_MAX)
+        {
+            LOG_WARN("no method handles %d-bit RSA keys", size->bits);
+            continue;
+        }
 
-    return methods[best];
+        LOG_INFO("RSA %d: using %s", size->bits, accelerator_name(rsa_methods[size->order[0]]));
+        ++usable;
+    }
+
+    if (calibrate && profile)
+        accel_profile_write(profile, signature);
+
+    // after saving, so that the profile has an entry for every method
+    ed25519_sort();
+
+    return usable > 0 ? 1 : -1;
 }
 
-int accel_init()
+int accel_init(const char *profile, int recalibrate)
 {
+    accelerator *accel;
+    char isa[128];
+
     LOG_MODULE_INIT("accessl.accel");
 
-    if (accel_mod_exp_init() < 0)
+    if (urandom_fd < 0 && (urandom_fd = open("/dev/urandom", O_RDONLY)) < 0)
         return -1;
 
-    //if (accel_ipp_init() < 0)
-    //  return -1;
+    accel_cpu_init();
+    accel_cpu_describe(isa, sizeof(isa));
+    LOG_INFO("instruction set extensions: %s", isa);
+
+    // keys loaded for benchmarking already register background jobs
+    if (accel_bg_init() < 0)
+        return -1;
 
-    rsa_accel = accel_rsa_choose_best();
+    if (accel_mod_exp_init() < 0)
+        return -1;
 
-    if (!rsa_accel)
+#ifdef HAVE_IPP_CRYPTO_MB
+    if (accel_ipp_init() < 0)
         return -1;
-    return 1;
+#endif
+
+    if (accel_p256_init() < 0)
+        LOG_WARN("P-256 unavailable, EC keys will not be loaded");
+    else if ((accel = accel_p256_method()) && p256_self_test(accel) < 0)
+    {
+        LOG_WARN("P-256 failed its self-test, EC keys will not be loaded");
+        accelerator_done(accel);
+    }
+    else if (accel)
+        ec_methods[ec_method_count++] = accel;
+
+    if (accel_ticket_init() < 0)
+        LOG_WARN("session tickets unavailable, ticket keys will not be loaded");
+    else if ((ticket_methods[ticket_method_count] = accel_ticket_method()))
+        ++ticket_method_count;
+
+    if (accel_ed25519_init() < 0)
+        LOG_WARN("Ed25519 unavailable, Ed25519 keys will not be loaded");
+    else
+        ed25519_find_methods();
+
+    return accel_choose_best(profile, recalibrate);
 }
 
 void accel_destroy()
 {
-    accelerator_done(rsa_accel);
+    int i;
+
+    accel_gmp_set_parallel_crt(0);
+    accel_par_destroy();
+
+    while (keys)
+        accel_destroy_key(keys->type, keys);
+
+    for (i = 0; i < rsa_method_count; ++i)
+        accelerator_done(rsa_methods[i]);
+    rsa_method_count = 0;
 
-    //accel_ipp_destroy();
+    for (i = 0; i < ec_method_count; ++i)
+        accelerator_done(ec_methods[i]);
+    ec_method_count = 0;
+    accel_p256_destroy();
+
+    for (i = 0; i < ed25519_method_count; ++i)
+        accelerator_done(ed25519_methods[i]);
+    ed25519_method_count = 0;
+    accel_ed25519_destroy();
+
+    for (i = 0; i < ticket_method_count; ++i)
+        accelerator_done(ticket_methods[i]);
+    ticket_method_count = 0;
+    accel_ticket_destroy();
+
+#ifdef HAVE_IPP_CRYPTO_MB
+    accel_ipp_destroy();
+#endif
     accel_mod_exp_destroy();
+    accel_bg_destroy();
+
+    if (urandom_fd >= 0)
+        close(urandom_fd);
+    urandom_fd = -1;
+}
+
+static void *accel_rsa_add_key(size_t len, const unsigned char *data)
+{
+    int bits = rsa_key_bits(len, data);
+    accel_rsa_size *size;
+    accel_key *k;
+    int i;
+
+    if (bits <= 0 || rsa_method_count == 0)
+        return NULL;
+
+    k = calloc(1, sizeof(accel_key));
+    if (unlikely(!k))
+        return NULL;
+
+    k->type = CMD_KEY_RSA;
+    k->bits = bits;
+
+    // best method for this size first, others if it refuses the key; failed methods sort last
+    size = accel_rsa_size_find(bits);
+    for (i = 0; i < rsa_method_count && !k->priv; ++i)
+    {
+        accelerator *accel = rsa_methods[size->order[i]];
+
+        if (size->speed[size->order[i]] == UINT64_MAX)
+            break;
+
+        k->priv = accelerator_add_key(accel, CMD_KEY_RSA, len, data);
+        if (k->priv)
+            k->accel = accel;
+    }
+
+    if (!k->priv)
+    {
+        LOG_ERROR("no verified method accepted %d-bit RSA key", bits);
+        free(k);
+        return NULL;
+    }
+
+    LOG_INFO("RSA %d-bit key bound to %s (benchmarked at %d bits)", bits, accelerator_name(k->accel), size->bits);
+
+    k->next = keys;
+    keys = k;
+
+    return k;
+}
+
+static void *accel_ec_add_key(size_t len, const unsigned char *data)
+{
+    accel_key *k;
+    int i;
+
+    k = calloc(1, sizeof(accel_key));
+    if (unlikely(!k))
+        return NULL;
+
+    k->type = CMD_KEY_EC;
+
+    for (i = 0; i < ec_method_count && !k->priv; ++i)
+    {
+        k->priv = accelerator_add_key(ec_methods[i], CMD_KEY_EC, len, data);
+        if (k->priv)
+            k->accel = ec_methods[i];
+    }
+
+    if (!k->priv)
+    {
+        LOG_ERROR("no method accepted EC key");
+        free(k);
+        return NULL;
+    }
+
+    LOG_INFO("EC key bound to %s", accelerator_name(k->accel));
+
+    k->next = keys;
+    keys = k;
+
+    return k;
+}
+
+static void *accel_ed25519_add_key(size_t len, const unsigned char *data)
+{
+    accel_key *k;
+    int i;
+
+    k = calloc(1, sizeof(accel_key));
+    if (unlikely(!k))
+        return NULL;
+
+    k->type = CMD_KEY_ED25519;
+
+    for (i = 0; i < ed25519_method_count && !k->priv; ++i)
+    {
+        k->priv = accelerator_add_key(ed25519_methods[i], CMD_KEY_ED25519, len, data);
+        if (k->priv)
+            k->accel = ed25519_methods[i];
+    }
+
+    if (!k->priv)
+    {
+        LOG_ERROR("no method accepted Ed25519 key");
+        free(k);
+        return NULL;
+    }
+
+    LOG_INFO("Ed25519 key bound to %s", accelerator_name(k->accel));
+
+    k->next = keys;
+    keys = k;
+
+    return k;
+}
+
+static void *accel_ticket_add_key(size_t len, const unsigned char *data)
+{
+    accel_key *k;
+    int i;
+
+    k = calloc(1, sizeof(accel_key));
+    if (unlikely(!k))
+        return NULL;
+
+    k->type = CMD_KEY_TICKET;
+
+    for (i = 0; i < ticket_method_count && !k->priv; ++i)
+    {
+        k->priv = accelerator_add_key(ticket_methods[i], CMD_KEY_TICKET, len, data);
+        if (k->priv)
+            k->accel = ticket_methods[i];
+    }
+
+    if (!k->priv)
+    {
+        LOG_ERROR("no method accepted ticket key");
+        free(k);
+        return NULL;
+    }
+
+    LOG_INFO("ticket key bound to %s", accelerator_name(k->accel));
+
+    k->next = keys;
+    keys = k;
+
+    return k;
 }
 
 void *accel_add_key(int type, size_t len, const unsigned char *data)
 {
     switch (type) {
     case CMD_KEY_RSA:
-        return accelerator_add_key(rsa_accel, type, len, data);
+        return accel_rsa_add_key(len, data);
+    case CMD_KEY_EC:
+        return accel_ec_add_key(len, data);
+    case CMD_KEY_ED25519:
+        return accel_ed25519_add_key(len, data);
+    case CMD_KEY_TICKET:
+        return accel_ticket_add_key(len, data);
     default:
         return NULL;
     }
@@ -206,40 +1043,340 @@ void *accel_add_key(int type, size_t len, const unsigned char *data)
 
 void accel_destroy_key(int type, void *key)
 {
-    switch (type) {
-    case CMD_KEY_RSA:
-        accelerator_destroy_key(rsa_accel, type, key);
-    default:
+    accel_key *k = (accel_key *)key;
+    accel_key **it;
+
+    if (!k)
         return;
+
+    for (it = &keys; *it; it = &(*it)->next)
+    {
+        if (*it == k)
+        {
+            *it = k->next;
+            break;
+        }
     }
+
+    accelerator_destroy_key(k->accel, type, k->priv);
+    free(k);
 }
 
-size_t accel_result_max_len(void *key, int op)
+// key type an op needs, -1 for unknown ops
+static int accel_op_key_type(int op)
 {
     switch (op) {
     case CMD_OP_RSA_PRIV_DEC:
     case CMD_OP_RSA_PRIV_ENC:
     case CMD_OP_RSA_PUB_DEC:
     case CMD_OP_RSA_PUB_ENC:
-        return accelerator_result_max_len(rsa_accel, key, op);
+    case CMD_OP_RSA_SIGN:
+        return CMD_KEY_RSA;
+    case CMD_OP_ECDSA_SIGN:
+        return CMD_KEY_EC;
+    case CMD_OP_ED25519_SIGN:
+        return CMD_KEY_ED25519;
+    case CMD_OP_TICKET_SEAL:
+    case CMD_OP_TICKET_OPEN:
+        return CMD_KEY_TICKET;
     default:
         return -1;
     }
 }
 
-int accel_perform(void *key, int op, size_t len, const unsigned char *data, unsigned char *result)
+// CMD_OP_KEYSHARE needs no key, the fastest method knowing the group makes the pairs
+static int accel_keyshare(size_t len, const unsigned char *data, unsigned char *result)
 {
-    switch (op) {
-    case CMD_OP_RSA_PRIV_DEC:
-        return accelerator_rsa_priv_dec(rsa_accel, key, len, data, result);
-    case CMD_OP_RSA_PRIV_ENC:
-        return accelerator_rsa_priv_enc(rsa_accel, key, len, data, result);
-    case CMD_OP_RSA_PUB_DEC:
-        return accelerator_rsa_pub_dec(rsa_accel, key, len, data, result);
-    case CMD_OP_RSA_PUB_ENC:
-        return accelerator_rsa_pub_enc(rsa_accel, key, len, data, result);
+    const cmd_op_keyshare *c = (const cmd_op_keyshare *)data;
+    accelerator **methods;
+    int group, method_count, i;
+
+    if (unlikely(len < sizeof(cmd_op_keyshare)))
+        return -1;
+
+    group = ntohl(c->group);
+    switch (group) {
+    case CMD_GROUP_X25519:
+        methods = ed25519_methods;
+        method_count = ed25519_method_count;
+        break;
+    case CMD_GROUP_SECP256R1:
+        methods = ec_methods;
+        method_count = ec_method_count;
+        break;
+    default:
+        return -1;
+    }
+
+    for (i = 0; i < method_count; ++i)
+    {
+        int ret = accelerator_keyshare(methods[i], group, ntohl(c->count), result);
+
+        if (ret >= 0)
+        {
+            stat_add(&keyshare_pairs, ntohl(c->count));
+            return ret;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Ticket ops come without a key: seal uses the ticket key loaded first (the last one
+ * on the list), open the one named at the start of the ticket.
+ */
+static accel_key *accel_ticket_key(int op, size_t len, const unsigned char *data)
+{
+    const cmd_op_ticket *c = (const cmd_op_ticket *)data;
+    accel_key *k, *found = NULL;
+
+    if (op != CMD_OP_TICKET_SEAL && op != CMD_OP_TICKET_OPEN)
+        return NULL;
+
+    if (op == CMD_OP_TICKET_OPEN && (len < sizeof(cmd_op_ticket) || ntohl(c->len) > len - sizeof(cmd_op_ticket) ||
+                                     ntohl(c->len) < CMD_TICKET_NAME_LEN))
+        return NULL;
+
+    for (k = keys; k; k = k->next)
+    {
+        if (k->type != CMD_KEY_TICKET)
+            continue;
+
+        if (op == CMD_OP_TICKET_SEAL)
+            found = k;
+        else if (!memcmp(accel_ticket_key_name(k->priv), c->data, CMD_TICKET_NAME_LEN))
+            return k;
+    }
+
+    return found;
+}
+
+static int accel_random(unsigned char *buf, size_t len)
+{
+    size_t got = 0;
+
+    while (got < len)
+    {
+        ssize_t ret = read(urandom_fd, buf + got, len - got);
+
+        if (ret <= 0)
+            return -1;
+        got += ret;
+    }
+
+    return 1;
+}
+
+/*
+ * CMD_OP_RSA_SIGN is carried out as the CMD_OP_RSA_PRIV_ENC it encodes to, so all RSA
+ * methods and batching handle it unchanged. buf (CMD_MAX_LEN bytes) gets the new op data.
+ */
+static int accel_rsa_sign_encode(const accel_key *k, accel_op *op, unsigned char *buf)
+{
+    const cmd_op_rsa_sign *c = (const cmd_op_rsa_sign *)op->data;
+    cmd_op_rsa *rsa_op = (cmd_op_rsa *)buf;
+    size_t num = (k->bits + 7) / 8, max = CMD_MAX_LEN - sizeof(cmd_op_rsa);
+    int nid, pad, len;
+
+    if (unlikely(op->len < sizeof(cmd_op_rsa_sign) || ntohl(c->len) > op->len - sizeof(cmd_op_rsa_sign) || num > max))
+        return -1;
+
+    nid = ntohl(c->nid);
+    pad = ntohl(c->pad);
+    switch (pad) {
+    case RSA_PKCS1_PADDING:
+        len = accel_pad_digest_info(rsa_op->data, max, nid, c->data, ntohl(c->len));
+        break;
+    case RSA_PKCS1_PSS_PADDING:
+        {
+            unsigned char salt[EVP_MAX_MD_SIZE];
+            uint32_t saltlen = ntohl(c->saltlen);
+
+            if (saltlen == CMD_RSA_PSS_SALTLEN_DIGEST)
+                saltlen = accel_pad_md_size(nid);
+            if (saltlen > sizeof(salt) || accel_random(salt, saltlen) < 0)
+                return -1;
+
+            len = accel_pad_add_pss(rsa_op->data, num, k->bits, nid, c->data, ntohl(c->len), salt, saltlen);
+            pad = RSA_NO_PADDING;
+        }
+        break;
     default:
         return -1;
     }
+
+    if (len < 0)
+        return -1;
+
+    rsa_op->len = htonl(len);
+    rsa_op->pad = htonl(pad);
+
+    op->op = CMD_OP_RSA_PRIV_ENC;
+    op->len = sizeof(cmd_op_rsa) + len;
+    op->data = buf;
+
+    return 1;
+}
+
+size_t accel_result_max_len(void *key, int op)
+{
+    accel_key *k = (accel_key *)key;
+
+    if (op == CMD_OP_KEYSHARE || !k)
+        return CMD_MAX_LEN;
+
+    if (accel_op_key_type(op) != k->type)
+        return -1;
+
+    return accelerator_result_max_len(k->accel, k->priv, op);
+}
+
+int accel_perform(void *key, int op, size_t len, const unsigned char *data, unsigned char *result)
+{
+    accel_key *k = (accel_key *)key;
+    unsigned char buf[CMD_MAX_LEN];
+
+    if (op == CMD_OP_KEYSHARE)
+        return accel_keyshare(len, data, result);
+
+    if (!k)
+        k = accel_ticket_key(op, len, data);
+
+    if (unlikely(!k || accel_op_key_type(op) != k->type))
+        return -1;
+
+    stat_inc(&k->ops);
+
+    if (op == CMD_OP_RSA_SIGN)
+    {
+        accel_op o;
+
+        o.op = op;
+        o.len = len;
+        o.data = data;
+        if (accel_rsa_sign_encode(k, &o, buf) < 0)
+            return -1;
+
+        op = o.op;
+        len = o.len;
+        data = o.data;
+    }
+
+    return accelerator_perform(k->accel, k->priv, op, len, data, result);
+}
+
+int accel_perform_batch(accel_op *ops, int count)
+{
+    accel_op work[ACCEL_BATCH_MAX], batch[ACCEL_BATCH_MAX];
+    unsigned char sign_buf[ACCEL_BATCH_MAX][CMD_MAX_LEN];
+    int idx[ACCEL_BATCH_MAX];
+    int done[ACCEL_BATCH_MAX];
+    int i, j, n;
+
+    if (unlikely(count > ACCEL_BATCH_MAX))
+        return -1;
+
+    memset(done, 0, sizeof(done));
+
+    // work holds the ops as methods see them: keys found and signatures encoded
+    for (i = 0; i < count; ++i)
+    {
+        work[i] = ops[i];
+
+        if (work[i].op == CMD_OP_KEYSHARE)
+        {
+            ops[i].ret = accel_keyshare(work[i].len, work[i].data, work[i].result);
+            done[i] = 1;
+            continue;
+        }
+
+        if (!work[i].key)
+            work[i].key = accel_ticket_key(work[i].op, work[i].len, work[i].data);
+
+        if (likely(work[i].key && accel_op_key_type(work[i].op) == ((accel_key *)work[i].key)->type) &&
+            (work[i].op != CMD_OP_RSA_SIGN || accel_rsa_sign_encode(work[i].key, &work[i], sign_buf[i]) > 0))
+            continue;
+
+        ops[i].ret = -1;
+        done[i] = 1;
+    }
+
+    // hand all ops for keys bound to the same accelerator in one call
+    for (i = 0; i < count; ++i)
+    {
+        accelerator *accel;
+
+        if (done[i])
+            continue;
+
+        accel = ((accel_key *)work[i].key)->accel;
+        for (n = 0, j = i; j < count; ++j)
+        {
+            accel_key *k = (accel_key *)work[j].key;
+
+            if (done[j] || k->accel != accel)
+                continue;
+
+            stat_inc(&k->ops);
+            batch[n] = work[j];
+            batch[n].key = k->priv;
+            idx[n++] = j;
+            done[j] = 1;
+        }
+
+        accelerator_perform_batch(accel, batch, n);
+
+        for (j = 0; j < n; ++j)
+            ops[idx[j]].ret = batch[j].ret;
+    }
+
+    return count;
+}
+
+void accel_log_stats(void)
+{
+    accel_key *k;
+
+    for (k = keys; k; k = k->next)
+    {
+        char extra[128];
+
+        accelerator_key_stats(k->accel, k->priv, extra, sizeof(extra));
+
+        if (k->type == CMD_KEY_EC)
+            LOG_INFO("key %p: EC, %s, %lld ops%s%s", (void *)k, accelerator_name(k->accel), stat_read(&k->ops), extra[0] ? ", " : "", extra);
+        else if (k->type == CMD_KEY_TICKET)
+            LOG_INFO("key %p: ticket, %s, %lld ops%s%s", (void *)k, accelerator_name(k->accel), stat_read(&k->ops), extra[0] ? ", " : "", extra);
+        else if (k->type == CMD_KEY_ED25519)
+            LOG_INFO("key %p: Ed25519, %s, %lld ops%s%s", (void *)k, accelerator_name(k->accel), stat_read(&k->ops), extra[0] ? ", " : "", extra);
+        else
+            LOG_INFO("key %p: %d bits, %s, %lld ops%s%s", (void *)k, k->bits, accelerator_name(k->accel), stat_read(&k->ops), extra[0] ? ", " : "", extra);
+    }
+
+    if (stat_read(&keyshare_pairs))
+        LOG_INFO("key shares: %lld pairs", stat_read(&keyshare_pairs));
+}
+
+void accel_set_ecdsa_pool(int size, int rate)
+{
+    accel_p256_set_pool(size, rate);
+}
+
+int accel_set_isa(const char *isa)
+{
+    return accel_cpu_limit(isa);
+}
+
+int accel_ed25519_public_key(const unsigned char *seed, unsigned char *pub)
+{
+    return accel_ed25519_derive_public(seed, pub);
 }
 
+void accel_set_latency_mode(int enable)
+{
+    if (enable && accel_par_init() < 0)
+        enable = 0;
+
+    accel_gmp_set_parallel_crt(enable);
+}
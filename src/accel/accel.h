@@ -27,13 +27,57 @@
 extern "C" {
 #endif
 
-int accel_init(void);
+// most operations handed to accel_perform_batch at once
+#define ACCEL_BATCH_MAX  8
+
+struct accel_op_t {
+    void *key; // NULL for CMD_OP_KEYSHARE and ticket ops, accel finds the ticket key itself
+    int op;
+    size_t len;
+    const unsigned char *data;
+    unsigned char *result;
+
+    int ret; // what accel_perform would return
+};
+typedef struct accel_op_t accel_op;
+
+/*
+ * Benchmarks available methods to pick the fastest one for each key size.
+ * With a profile path, results are reused from (and saved to) that file as long as
+ * it was written on the same hardware and libraries; recalibrate forces a new run.
+ */
+int accel_init(const char *profile, int recalibrate);
 void accel_destroy(void);
 
 void *accel_add_key(int type, unsigned long len, const unsigned char *data);
 void accel_destroy_key(int type, void *key);
 size_t accel_result_max_len(void *key, int op);
 int accel_perform(void *key, int op, size_t len, const unsigned char *data, unsigned char *result);
+// perform up to ACCEL_BATCH_MAX operations, methods able to do several at once get them together
+int accel_perform_batch(accel_op *ops, int count);
+
+// log the method each key is bound to and number of operations done with it
+void accel_log_stats(void);
+
+/*
+ * ECDSA nonces (k^-1, r) are precomputed on idle cores, size pairs per key and thread,
+ * at most rate per second and key (0 for no limit). Size 0 disables it. Affects keys added later.
+ */
+#define ACCEL_ECDSA_POOL_DEFAULT  1024
+
+void accel_set_ecdsa_pool(int size, int rate);
+
+/*
+ * Highest instruction set level kernels may use: "base", "bmi2", "avx2", "avx512" or
+ * "native" (the default). Must be called before accel_init; -1 on an unknown level.
+ */
+int accel_set_isa(const char *isa);
+
+// public key of a 32-byte Ed25519 private key (seed), needed for its fingerprint
+int accel_ed25519_public_key(const unsigned char *seed, unsigned char *pub);
+
+// trade throughput for latency by using more than one core per operation
+void accel_set_latency_mode(int enable);
 
 #ifdef __cplusplus
 };
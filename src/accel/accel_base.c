@@ -18,6 +18,8 @@
     Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 */
 
+#include <accessl-common/cmd.h>
+
 #include "accel_base.h"
 
 const char *accelerator_name(accelerator *accel)
@@ -68,3 +70,90 @@ int accelerator_rsa_pub_enc(accelerator *accel, void *key, size_t len, const uns
 {
     return accel->method->rsa_pub_enc(accel->priv, key, len, data, result);
 }
+
+int accelerator_ecdsa_sign(accelerator *accel, void *key, size_t len, const unsigned char *data, unsigned char *result)
+{
+    if (!accel->method->ecdsa_sign)
+        return -1;
+
+    return accel->method->ecdsa_sign(accel->priv, key, len, data, result);
+}
+
+int accelerator_ed25519_sign(accelerator *accel, void *key, size_t len, const unsigned char *data, unsigned char *result)
+{
+    if (!accel->method->ed25519_sign)
+        return -1;
+
+    return accel->method->ed25519_sign(accel->priv, key, len, data, result);
+}
+
+int accelerator_ticket_seal(accelerator *accel, void *key, size_t len, const unsigned char *data, unsigned char *result)
+{
+    if (!accel->method->ticket_seal)
+        return -1;
+
+    return accel->method->ticket_seal(accel->priv, key, len, data, result);
+}
+
+int accelerator_ticket_open(accelerator *accel, void *key, size_t len, const unsigned char *data, unsigned char *result)
+{
+    if (!accel->method->ticket_open)
+        return -1;
+
+    return accel->method->ticket_open(accel->priv, key, len, data, result);
+}
+
+int accelerator_keyshare(accelerator *accel, int group, int count, unsigned char *result)
+{
+    if (!accel->method->keyshare)
+        return -1;
+
+    return accel->method->keyshare(accel->priv, group, count, result);
+}
+
+void accelerator_key_stats(accelerator *accel, void *key, char *buf, size_t len)
+{
+    if (len)
+        buf[0] = '\0';
+
+    if (accel->method->key_stats)
+        accel->method->key_stats(accel->priv, key, buf, len);
+}
+
+int accelerator_perform(accelerator *accel, void *key, int op, size_t len, const unsigned char *data, unsigned char *result)
+{
+    switch (op) {
+    case CMD_OP_RSA_PRIV_DEC:
+        return accelerator_rsa_priv_dec(accel, key, len, data, result);
+    case CMD_OP_RSA_PRIV_ENC:
+        return accelerator_rsa_priv_enc(accel, key, len, data, result);
+    case CMD_OP_RSA_PUB_DEC:
+        return accelerator_rsa_pub_dec(accel, key, len, data, result);
+    case CMD_OP_RSA_PUB_ENC:
+        return accelerator_rsa_pub_enc(accel, key, len, data, result);
+    case CMD_OP_ECDSA_SIGN:
+        return accelerator_ecdsa_sign(accel, key, len, data, result);
+    case CMD_OP_ED25519_SIGN:
+        return accelerator_ed25519_sign(accel, key, len, data, result);
+    case CMD_OP_TICKET_SEAL:
+        return accelerator_ticket_seal(accel, key, len, data, result);
+    case CMD_OP_TICKET_OPEN:
+        return accelerator_ticket_open(accel, key, len, data, result);
+    default:
+        return -1;
+    }
+}
+
+void accelerator_perform_batch(accelerator *accel, accel_op *ops, int count)
+{
+    int i;
+
+    if (accel->method->perform_batch)
+    {
+        accel->method->perform_batch(accel->priv, ops, count);
+        return;
+    }
+
+    for (i = 0; i < count; ++i)
+        ops[i].ret = accelerator_perform(accel, ops[i].key, ops[i].op, ops[i].len, ops[i].data, ops[i].result);
+}
@@ -23,6 +23,8 @@
 
 #include <stdlib.h>
 
+#include "accel.h"
+
 struct accel_method_t {
     const char *(*get_name)(void *accel_priv);
 
@@ -36,6 +38,21 @@ struct accel_method_t {
     int (*rsa_pub_dec)(void *accel_priv, void *key, size_t len, const unsigned char *data, unsigned char *result);
     int (*rsa_priv_enc)(void *accel_priv, void *key, size_t len, const unsigned char *data, unsigned char *result);
     int (*rsa_pub_enc)(void *accel_priv, void *key, size_t len, const unsigned char *data, unsigned char *result);
+    // optional, only for methods handling CMD_KEY_EC
+    int (*ecdsa_sign)(void *accel_priv, void *key, size_t len, const unsigned char *data, unsigned char *result);
+    // optional, only for methods handling CMD_KEY_ED25519
+    int (*ed25519_sign)(void *accel_priv, void *key, size_t len, const unsigned char *data, unsigned char *result);
+    // optional, only for methods handling CMD_KEY_TICKET
+    int (*ticket_seal)(void *accel_priv, void *key, size_t len, const unsigned char *data, unsigned char *result);
+    int (*ticket_open)(void *accel_priv, void *key, size_t len, const unsigned char *data, unsigned char *result);
+    // optional, count ephemeral key pairs of a CMD_GROUP_* laid out as CMD_OP_KEYSHARE results
+    int (*keyshare)(void *accel_priv, int group, int count, unsigned char *result);
+
+    // optional, describes method specific counters of the key
+    void (*key_stats)(void *accel_priv, void *key, char *buf, size_t len);
+
+    // optional, ops[i].key are the method's own keys
+    void (*perform_batch)(void *accel_priv, accel_op *ops, int count);
 };
 typedef struct accel_method_t accel_method;
 
@@ -54,5 +71,13 @@ int accelerator_rsa_priv_dec(accelerator *accel, void *key, size_t len, const un
 int accelerator_rsa_pub_dec(accelerator *accel, void *key, size_t len, const unsigned char *data, unsigned char *result);
 int accelerator_rsa_priv_enc(accelerator *accel, void *key, size_t len, const unsigned char *data, unsigned char *result);
 int accelerator_rsa_pub_enc(accelerator *accel, void *key, size_t len, const unsigned char *data, unsigned char *result);
+int accelerator_ecdsa_sign(accelerator *accel, void *key, size_t len, const unsigned char *data, unsigned char *result);
+int accelerator_ed25519_sign(accelerator *accel, void *key, size_t len, const unsigned char *data, unsigned char *result);
+int accelerator_ticket_seal(accelerator *accel, void *key, size_t len, const unsigned char *data, unsigned char *result);
+int accelerator_ticket_open(accelerator *accel, void *key, size_t len, const unsigned char *data, unsigned char *result);
+int accelerator_keyshare(accelerator *accel, int group, int count, unsigned char *result);
+void accelerator_key_stats(accelerator *accel, void *key, char *buf, size_t len);
+int accelerator_perform(accelerator *accel, void *key, int op, size_t len, const unsigned char *data, unsigned char *result);
+void accelerator_perform_batch(accelerator *accel, accel_op *ops, int count);
 
 #endif // _ACCELERATOR_GMP_H_
@@ -0,0 +1,195 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include <common/compiler.h>
+
+#include <accessl-common/log.h>
+
+#include "accel_bg.h"
+
+#define BG_MAX_JOBS  256
+#define BG_IDLE_WAIT_MS  100
+
+LOG_MODULE_DEFINE;
+
+struct bg_job_t {
+    accel_bg_fn fn;
+    void *arg;
+};
+typedef struct bg_job_t bg_job;
+
+static pthread_mutex_t bg_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bg_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t bg_idle = PTHREAD_COND_INITIALIZER;
+
+static pthread_t bg_thread;
+static int bg_running = 0;
+static int bg_stop = 0;
+static volatile int bg_kicked = 0;
+static int bg_current = -1; // job being run, unregister waits for it
+
+static bg_job jobs[BG_MAX_JOBS];
+
+static void accel_bg_lower_priority(void)
+{
+#ifdef SCHED_IDLE
+    struct sched_param param = { 0 };
+
+    if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) == 0)
+        return;
+#endif
+    // per-thread on Linux
+    setpriority(PRIO_PROCESS, 0, 19);
+}
+
+static void *accel_bg_main(void *arg UNUSED)
+{
+    accel_bg_lower_priority();
+
+    pthread_mutex_lock(&bg_lock);
+
+    while (!bg_stop)
+    {
+        int busy = 0;
+        int i;
+
+        bg_kicked = 0;
+
+        for (i = 0; i < BG_MAX_JOBS && !bg_stop; ++i)
+        {
+            bg_job job = jobs[i];
+
+            if (!job.fn)
+                continue;
+
+            bg_current = i;
+            pthread_mutex_unlock(&bg_lock);
+
+            busy |= job.fn(job.arg);
+
+            pthread_mutex_lock(&bg_lock);
+            bg_current = -1;
+            pthread_cond_broadcast(&bg_idle);
+        }
+
+        if (!busy && !bg_kicked && !bg_stop)
+        {
+            struct timespec deadline;
+
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += BG_IDLE_WAIT_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L)
+            {
+                deadline.tv_sec += 1;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&bg_work, &bg_lock, &deadline);
+        }
+    }
+
+    pthread_mutex_unlock(&bg_lock);
+
+    return NULL;
+}
+
+int accel_bg_init(void)
+{
+    LOG_MODULE_INIT("accessl.accel_bg");
+
+    if (bg_running)
+        return 1;
+
+    bg_stop = 0;
+    if (pthread_create(&bg_thread, NULL, accel_bg_main, NULL) != 0)
+    {
+        LOG_ERROR("could not create background thread");
+        return -1;
+    }
+    bg_running = 1;
+
+    return 1;
+}
+
+void accel_bg_destroy(void)
+{
+    if (!bg_running)
+        return;
+
+    pthread_mutex_lock(&bg_lock);
+    bg_stop = 1;
+    pthread_cond_signal(&bg_work);
+    pthread_mutex_unlock(&bg_lock);
+
+    pthread_join(bg_thread, NULL);
+    bg_running = 0;
+}
+
+int accel_bg_register(accel_bg_fn fn, void *arg)
+{
+    int i, ret = -1;
+
+    pthread_mutex_lock(&bg_lock);
+    for (i = 0; i < BG_MAX_JOBS; ++i)
+    {
+        if (!jobs[i].fn)
+        {
+            jobs[i].fn = fn;
+            jobs[i].arg = arg;
+            ret = i;
+            pthread_cond_signal(&bg_work);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&bg_lock);
+
+    if (ret < 0)
+        LOG_WARN("no room for background job");
+
+    return ret;
+}
+
+void accel_bg_unregister(int handle)
+{
+    if (handle < 0 || handle >= BG_MAX_JOBS)
+        return;
+
+    pthread_mutex_lock(&bg_lock);
+    while (bg_current == handle)
+        pthread_cond_wait(&bg_idle, &bg_lock);
+    jobs[handle].fn = NULL;
+    jobs[handle].arg = NULL;
+    pthread_mutex_unlock(&bg_lock);
+}
+
+void accel_bg_kick(void)
+{
+    // unlocked on purpose, a missed kick only delays refill until the idle timeout
+    if (!bg_kicked)
+    {
+        bg_kicked = 1;
+        pthread_cond_signal(&bg_work);
+    }
+}
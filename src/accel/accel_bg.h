@@ -0,0 +1,43 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _ACCEL_BG_H_
+#define _ACCEL_BG_H_
+
+/*
+ * Low priority background thread for work that can be done ahead of requests
+ * (e.g. precomputing blinding factors). It only gets the CPU when the machine is idle.
+ */
+
+// does a bit of work, returns 1 if there may be more to do, 0 if everything is topped up
+typedef int (*accel_bg_fn)(void *arg);
+
+int accel_bg_init(void);
+void accel_bg_destroy(void);
+
+// returns handle for accel_bg_unregister, -1 on failure
+int accel_bg_register(accel_bg_fn fn, void *arg);
+// once it returns fn is not running and won't be called again
+void accel_bg_unregister(int handle);
+
+// tell the background thread work is waiting, cheap enough for the request path
+void accel_bg_kick(void);
+
+#endif // _ACCEL_BG_H_
@@ -0,0 +1,392 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <common/compiler.h>
+
+#include "accel_bg.h"
+#include "accel_blinding.h"
+#include "accel_thread.h"
+
+// pairs precomputed per thread, power of two
+#define BLINDING_RING  16
+
+/*
+ * Single producer (background thread), single consumer (owning thread) ring.
+ * The consumer also keeps the pair it used last: it is needed for unblinding and,
+ * squared, serves as the next pair if the ring runs dry.
+ */
+struct blinding_ring_t {
+    BIGNUM *A[BLINDING_RING];
+    BIGNUM *Ai[BLINDING_RING];
+    volatile unsigned int head; // next pair to take, written by consumer
+    volatile unsigned int tail; // next pair to fill, written by producer
+
+    BIGNUM *last_A;
+    BIGNUM *last_Ai;
+    int has_last;
+};
+typedef struct blinding_ring_t blinding_ring;
+
+struct accel_blinding_t {
+    BIGNUM *n;
+    BIGNUM *e;
+    BN_MONT_CTX *mont;
+
+    blinding_ring *volatile rings[ACCEL_MAX_THREADS];
+
+    int bg_handle;
+    BN_CTX *bg_ctx; // used by the background thread only
+};
+
+static int urandom_fd = -1;
+
+static void blinding_ring_free(blinding_ring *r)
+{
+    int i;
+
+    for (i = 0; i < BLINDING_RING; ++i)
+    {
+        BN_clear_free(r->A[i]);
+        BN_clear_free(r->Ai[i]);
+    }
+    BN_clear_free(r->last_A);
+    BN_clear_free(r->last_Ai);
+    free(r);
+}
+
+static blinding_ring *blinding_ring_new(void)
+{
+    blinding_ring *r = calloc(1, sizeof(blinding_ring));
+    int i;
+
+    if (unlikely(!r))
+        return NULL;
+
+    for (i = 0; i < BLINDING_RING; ++i)
+    {
+        r->A[i] = BN_new();
+        r->Ai[i] = BN_new();
+        if (unlikely(!r->A[i] || !r->Ai[i]))
+            goto err;
+    }
+    r->last_A = BN_new();
+    r->last_Ai = BN_new();
+    if (unlikely(!r->last_A || !r->last_Ai))
+        goto err;
+
+    return r;
+
+err:
+    blinding_ring_free(r);
+    return NULL;
+}
+
+/*
+ * Random r is read from the kernel rather than OpenSSL RAND, which needs
+ * locking callbacks to be used from more than one thread.
+ */
+static int blinding_random(BIGNUM *r, const BIGNUM *n, BN_CTX *ctx)
+{
+    unsigned char buf[BN_num_bytes(n) + 8]; // extra bytes make the bias of mod n negligible
+    size_t got = 0;
+    BIGNUM *tmp;
+    int ret = -1;
+
+    while (got < sizeof(buf))
+    {
+        ssize_t len = read(urandom_fd, buf + got, sizeof(buf) - got);
+
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            return -1;
+        got += len;
+    }
+
+    BN_CTX_start(ctx);
+    tmp = BN_CTX_get(ctx);
+    if (tmp && BN_bin2bn(buf, sizeof(buf), tmp) && BN_mod(r, tmp, n, ctx))
+        ret = 1;
+    BN_CTX_end(ctx);
+
+    OPENSSL_cleanse(buf, sizeof(buf));
+
+    return ret;
+}
+
+static int blinding_pair(accel_blinding *b, BIGNUM *A, BIGNUM *Ai, BN_CTX *ctx)
+{
+    int tries;
+
+    for (tries = 0; tries < 32; ++tries)
+    {
+        if (blinding_random(A, b->n, ctx) < 0)
+            return -1;
+
+        // r without inverse shares a factor with n, practically impossible but retry
+        BN_set_flags(A, BN_FLG_CONSTTIME);
+        if (!BN_mod_inverse(Ai, A, b->n, ctx))
+            continue;
+
+        if (!BN_mod_exp_mont(A, A, b->e, b->n, ctx, b->mont))
+            return -1;
+
+        return 1;
+    }
+
+    return -1;
+}
+
+static int accel_blinding_refill(void *arg)
+{
+    accel_blinding *b = (accel_blinding *)arg;
+    int more = 0;
+    int i;
+
+    for (i = 0; i < ACCEL_MAX_THREADS; ++i)
+    {
+        blinding_ring *r = b->rings[i];
+        unsigned int tail;
+
+        if (!r)
+            continue;
+
+        tail = r->tail;
+        if (tail - r->head >= BLINDING_RING)
+            continue;
+
+        // one pair per ring per call, so other keys get their turn
+        if (blinding_pair(b, r->A[tail % BLINDING_RING], r->Ai[tail % BLINDING_RING], b->bg_ctx) < 0)
+            continue;
+
+        __sync_synchronize();
+        r->tail = tail + 1;
+
+        if (tail + 1 - r->head < BLINDING_RING)
+            more = 1;
+    }
+
+    return more;
+}
+
+accel_blinding *accel_blinding_new(const BIGNUM *n, const BIGNUM *e)
+{
+    accel_blinding *b = calloc(1, sizeof(accel_blinding));
+
+    if (unlikely(!b))
+        return NULL;
+
+    b->bg_handle = -1;
+
+    if (urandom_fd < 0)
+    {
+        int fd = open("/dev/urandom", O_RDONLY);
+
+        if (fd < 0)
+            goto err;
+        if (!__sync_bool_compare_and_swap(&urandom_fd, -1, fd))
+            close(fd);
+    }
+
+    b->n = BN_dup(n);
+    b->e = BN_dup(e);
+    b->mont = BN_MONT_CTX_new();
+    b->bg_ctx = BN_CTX_new();
+    if (unlikely(!b->n || !b->e || !b->mont || !b->bg_ctx))
+        goto err;
+
+    if (!BN_MONT_CTX_set(b->mont, b->n, b->bg_ctx))
+        goto err;
+
+    // without the background thread pairs are still derived by squaring, just never refreshed
+    b->bg_handle = accel_bg_register(accel_blinding_refill, b);
+
+    return b;
+
+err:
+    accel_blinding_free(b);
+    return NULL;
+}
+
+void accel_blinding_free(accel_blinding *b)
+{
+    int i;
+
+    if (!b)
+        return;
+
+    accel_bg_unregister(b->bg_handle);
+
+    for (i = 0; i < ACCEL_MAX_THREADS; ++i)
+    {
+        if (b->rings[i])
+            blinding_ring_free(b->rings[i]);
+    }
+
+    BN_free(b->n);
+    BN_free(b->e);
+    if (b->mont)
+        BN_MONT_CTX_free(b->mont);
+    if (b->bg_ctx)
+        BN_CTX_free(b->bg_ctx);
+    free(b);
+}
+
+// advances last_A/last_Ai of the calling thread's ring to the next pair
+static int blinding_next(accel_blinding *b, blinding_ring *r, BN_CTX *ctx)
+{
+    unsigned int head = r->head;
+
+    if (head != r->tail)
+    {
+        __sync_synchronize();
+        if (!BN_copy(r->last_A, r->A[head % BLINDING_RING]) ||
+            !BN_copy(r->last_Ai, r->Ai[head % BLINDING_RING]))
+            return -1;
+        __sync_synchronize();
+        r->head = head + 1;
+        r->has_last = 1;
+    }
+    else if (r->has_last)
+    {
+        // (r^2)^e and (r^2)^-1, what BN_BLINDING_update does in-line
+        if (!BN_mod_mul(r->last_A, r->last_A, r->last_A, b->n, ctx) ||
+            !BN_mod_mul(r->last_Ai, r->last_Ai, r->last_Ai, b->n, ctx))
+            return -1;
+    }
+    else
+    {
+        if (blinding_pair(b, r->last_A, r->last_Ai, ctx) < 0)
+            return -1;
+        r->has_last = 1;
+    }
+
+    // consumer never waits for the refill, it only asks for it
+    if (r->tail - r->head < BLINDING_RING / 2)
+        accel_bg_kick();
+
+    return 1;
+}
+
+// ring of the calling thread with its next pair in last_A/last_Ai, NULL for threads without a slot
+static blinding_ring *blinding_ring_next(accel_blinding *b, BN_CTX *ctx, int *err)
+{
+    int slot = accel_thread_slot();
+    blinding_ring *ring;
+
+    *err = 0;
+    if (unlikely(slot < 0))
+        return NULL;
+
+    ring = b->rings[slot];
+    if (unlikely(!ring))
+    {
+        ring = blinding_ring_new();
+        if (!ring)
+            goto err;
+        __sync_synchronize();
+        b->rings[slot] = ring;
+    }
+
+    if (blinding_next(b, ring, ctx) < 0)
+        goto err;
+
+    return ring;
+
+err:
+    *err = 1;
+    return NULL;
+}
+
+int accel_blinding_get(accel_blinding *b, BIGNUM *A, BIGNUM *Ai, BN_CTX *ctx)
+{
+    int err;
+    blinding_ring *ring = blinding_ring_next(b, ctx, &err);
+
+    if (unlikely(err))
+        return -1;
+
+    // threads without a slot pay for a fresh pair every time
+    if (unlikely(!ring))
+        return blinding_pair(b, A, Ai, ctx);
+
+    return BN_copy(A, ring->last_A) && BN_copy(Ai, ring->last_Ai) ? 1 : -1;
+}
+
+static int blinding_bn2limbs(uint64_t *p, size_t n, const BIGNUM *bn)
+{
+#if BN_BITS2 == 64
+    size_t top = bn->top;
+
+    if (unlikely(top > n))
+        return -1;
+    memcpy(p, bn->d, top * sizeof(uint64_t));
+    memset(p + top, 0, (n - top) * sizeof(uint64_t));
+#else
+    unsigned char buf[n * sizeof(uint64_t)];
+    size_t len = BN_num_bytes(bn), i;
+
+    if (unlikely(len > sizeof(buf)))
+        return -1;
+    memset(buf, 0, sizeof(buf) - len);
+    BN_bn2bin(bn, buf + sizeof(buf) - len);
+    for (i = 0; i < n; ++i)
+    {
+        const unsigned char *q = buf + sizeof(buf) - (i + 1) * sizeof(uint64_t);
+        int j;
+
+        p[i] = 0;
+        for (j = 0; j < 8; ++j)
+            p[i] = (p[i] << 8) | q[j];
+    }
+    OPENSSL_cleanse(buf, sizeof(buf));
+#endif
+
+    return 1;
+}
+
+int accel_blinding_get_limbs(accel_blinding *b, uint64_t *A, uint64_t *Ai, size_t n, BN_CTX *ctx)
+{
+    int err, ret = -1;
+    blinding_ring *ring = blinding_ring_next(b, ctx, &err);
+    BIGNUM *tA, *tAi;
+
+    if (unlikely(err))
+        return -1;
+
+    if (likely(ring))
+        return blinding_bn2limbs(A, n, ring->last_A) > 0 && blinding_bn2limbs(Ai, n, ring->last_Ai) > 0 ? 1 : -1;
+
+    BN_CTX_start(ctx);
+    tA = BN_CTX_get(ctx);
+    tAi = BN_CTX_get(ctx);
+    if (tAi && blinding_pair(b, tA, tAi, ctx) > 0 &&
+        blinding_bn2limbs(A, n, tA) > 0 && blinding_bn2limbs(Ai, n, tAi) > 0)
+        ret = 1;
+    BN_CTX_end(ctx);
+
+    return ret;
+}
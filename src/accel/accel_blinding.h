@@ -0,0 +1,44 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _ACCEL_BLINDING_H_
+#define _ACCEL_BLINDING_H_
+
+#include <stdint.h>
+
+#include <openssl/bn.h>
+
+/*
+ * RSA blinding pairs (A = r^e, Ai = r^-1 mod n) kept per key and thread.
+ * Every thread takes pairs from its own ring, which the background thread
+ * refills, so the request path neither locks nor computes inverses.
+ */
+struct accel_blinding_t;
+typedef struct accel_blinding_t accel_blinding;
+
+accel_blinding *accel_blinding_new(const BIGNUM *n, const BIGNUM *e);
+void accel_blinding_free(accel_blinding *b);
+
+// next pair for the calling thread, blind with I * A and unblind the result with Ai
+int accel_blinding_get(accel_blinding *b, BIGNUM *A, BIGNUM *Ai, BN_CTX *ctx);
+// the same as little endian 64-bit limbs, n of them each
+int accel_blinding_get_limbs(accel_blinding *b, uint64_t *A, uint64_t *Ai, size_t n, BN_CTX *ctx);
+
+#endif // _ACCEL_BLINDING_H_
@@ -43,9 +43,10 @@ static void *accel_bn_rsa_key_alloc(void)
     return malloc(1);
 }
 
-static int accel_bn_rsa_key_decode_elem(void *k UNUSED, int mod_exp_elem UNUSED, unsigned char *data UNUSED, size_t len UNUSED)
+static int accel_bn_rsa_key_decode_elem(void *k UNUSED, int mod_exp_elem, unsigned char *data UNUSED, size_t len UNUSED)
 {
-    return 1;
+    // OpenSSL's CRT knows just p and q, it would silently compute garbage for multi-prime keys
+    return mod_exp_elem <= ACCEL_MOD_EXP_RSA_IQMP ? 1 : -1;
 }
 
 static mod_exp_method bn = {
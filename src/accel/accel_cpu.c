@@ -0,0 +1,149 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include "accel_cpu.h"
+
+#define ACCEL_CPU_ALL  (ACCEL_CPU_BMI2 | ACCEL_CPU_ADX | ACCEL_CPU_AVX2 | ACCEL_CPU_AVX512 | ACCEL_CPU_AVX512_IFMA)
+
+static const struct {
+    const char *name;
+    unsigned int features;
+} isa_levels[] = {
+    { "base", 0 },
+    { "bmi2", ACCEL_CPU_BMI2 | ACCEL_CPU_ADX },
+    { "avx2", ACCEL_CPU_BMI2 | ACCEL_CPU_ADX | ACCEL_CPU_AVX2 },
+    { "avx512", ACCEL_CPU_BMI2 | ACCEL_CPU_ADX | ACCEL_CPU_AVX2 | ACCEL_CPU_AVX512 },
+    { "native", ACCEL_CPU_ALL },
+};
+
+static const struct {
+    const char *name;
+    unsigned int feature;
+} feature_names[] = {
+    { "bmi2", ACCEL_CPU_BMI2 },
+    { "adx", ACCEL_CPU_ADX },
+    { "avx2", ACCEL_CPU_AVX2 },
+    { "avx512", ACCEL_CPU_AVX512 },
+    { "avx512ifma", ACCEL_CPU_AVX512_IFMA },
+};
+
+static unsigned int cpu_features = 0;
+static unsigned int cpu_allowed = ACCEL_CPU_ALL;
+
+#if defined(__x86_64__) || defined(__i386__)
+// state components the OS saves on context switch
+static unsigned int xgetbv0(void)
+{
+    unsigned int eax, edx;
+
+    __asm__ volatile("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+    return eax;
+}
+
+static unsigned int cpu_detect(void)
+{
+    unsigned int eax, ebx, ecx, edx, xcr0 = 0, ret = 0;
+
+    if (__get_cpuid_max(0, NULL) < 7 || !__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return 0;
+
+    // OSXSAVE
+    if (ecx & (1 << 27))
+        xcr0 = xgetbv0();
+
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+    if (ebx & (1 << 8))
+        ret |= ACCEL_CPU_BMI2;
+    if (ebx & (1 << 19))
+        ret |= ACCEL_CPU_ADX;
+
+    // XMM and YMM state
+    if ((xcr0 & 0x06) != 0x06)
+        return ret;
+    if (ebx & (1 << 5))
+        ret |= ACCEL_CPU_AVX2;
+
+    // opmask and both halves of ZMM state
+    if ((xcr0 & 0xe6) != 0xe6)
+        return ret;
+    if ((ebx & (1u << 16)) && (ebx & (1u << 17)) && (ebx & (1u << 30)) && (ebx & (1u << 31)))
+    {
+        ret |= ACCEL_CPU_AVX512;
+        if (ebx & (1 << 21))
+            ret |= ACCEL_CPU_AVX512_IFMA;
+    }
+
+    return ret;
+}
+#else
+static unsigned int cpu_detect(void)
+{
+    return 0;
+}
+#endif
+
+void accel_cpu_init(void)
+{
+    cpu_features = cpu_detect();
+}
+
+int accel_cpu_limit(const char *isa)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(isa_levels) / sizeof(isa_levels[0]); ++i)
+    {
+        if (!strcmp(isa, isa_levels[i].name))
+        {
+            cpu_allowed = isa_levels[i].features;
+            return 1;
+        }
+    }
+
+    return -1;
+}
+
+int accel_cpu_has(unsigned int features)
+{
+    return (cpu_features & cpu_allowed & features) == features;
+}
+
+void accel_cpu_describe(char *buf, size_t len)
+{
+    size_t i, used = 0;
+
+    snprintf(buf, len, "base");
+    for (i = 0; i < sizeof(feature_names) / sizeof(feature_names[0]); ++i)
+    {
+        if (!accel_cpu_has(feature_names[i].feature) || used >= len)
+            continue;
+
+        used += snprintf(buf + used, len - used, "%s%s", used ? " " : "", feature_names[i].name);
+    }
+}
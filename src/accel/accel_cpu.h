@@ -0,0 +1,52 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef _ACCEL_CPU_H_
+#define _ACCEL_CPU_H_
+
+#include <stddef.h>
+
+/*
+ * Instruction set extensions kernels can be built for. The package is compiled for
+ * baseline x86-64, kernels needing more are compiled separately with their -m flags
+ * and only called when the running CPU (and OS, for vector state) supports them.
+ */
+#define ACCEL_CPU_BMI2         0x01 // MULX, SHLX
+#define ACCEL_CPU_ADX          0x02 // ADCX, ADOX
+#define ACCEL_CPU_AVX2         0x04
+#define ACCEL_CPU_AVX512       0x08 // F, VL, BW and DQ
+#define ACCEL_CPU_AVX512_IFMA  0x10
+
+void accel_cpu_init(void);
+
+/*
+ * Caps the extensions used to an ISA level: "base", "bmi2" (with ADX), "avx2",
+ * "avx512" or "native". Call before accel_init; -1 on an unknown name.
+ */
+int accel_cpu_limit(const char *isa);
+
+// nonzero if all features are present and allowed
+int accel_cpu_has(unsigned int features);
+
+// space separated names of usable features, "base" if none
+void accel_cpu_describe(char *buf, size_t len);
+
+#endif // _ACCEL_CPU_H_
@@ -0,0 +1,1221 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <openssl/crypto.h>
+#include <openssl/sha.h>
+
+#include <common/compiler.h>
+
+#include <accessl-common/cmd.h>
+
+#include "accel_cpu.h"
+#include "accel_ed25519.h"
+#include "accel_ed25519_mb.h"
+
+#define LANES  ACCEL_ED25519_LANES
+
+// most X25519 key pairs one request can carry
+#define X25519_BATCH_MAX  (CMD_MAX_LEN / CMD_KEYSHARE_X25519_LEN)
+
+#define FE51_MASK  ((UINT64_C(1) << 51) - 1)
+
+typedef unsigned __int128 u128;
+
+// GF(2^255 - 19) in five 51-bit limbs, kept below 2^54 between operations
+typedef uint64_t fe51[5];
+
+// scalar modulo the group order L as little endian 64-bit limbs
+typedef uint64_t sc_num[4];
+
+// extended coordinates: x = X/Z, y = Y/Z, x y = T/Z
+struct ed_p3_t {
+    fe51 x, y, z, t;
+};
+typedef struct ed_p3_t ed_p3;
+
+// completed point, x = X/Z and y = Y/T
+struct ed_p1p1_t {
+    fe51 x, y, z, t;
+};
+typedef struct ed_p1p1_t ed_p1p1;
+
+// affine point as (y + x, y - x, 2 d x y) for mixed additions
+struct ed_precomp_t {
+    fe51 ypx, ymx, xy2d;
+};
+typedef struct ed_precomp_t ed_precomp;
+
+struct ed25519_key_t {
+    sc_num s; // secret scalar reduced modulo L
+    unsigned char prefix[ED25519_BYTES]; // second half of the expanded seed, hashed into nonces
+    unsigned char pub[ED25519_BYTES];
+};
+typedef struct ed25519_key_t ed25519_key;
+
+static const unsigned char ed_2d_bytes[ED25519_BYTES] = {
+    0x59, 0xf1, 0xb2, 0x26, 0x94, 0x9b, 0xd6, 0xeb, 0x56, 0xb1, 0x83, 0x82, 0x9a, 0x14, 0xe0, 0x00,
+    0x30, 0xd1, 0xf3, 0xee, 0xf2, 0x80, 0x8e, 0x19, 0xe7, 0xfc, 0xdf, 0x56, 0xdc, 0xd9, 0x06, 0x24,
+};
+static const unsigned char ed_bx_bytes[ED25519_BYTES] = {
+    0x1a, 0xd5, 0x25, 0x8f, 0x60, 0x2d, 0x56, 0xc9, 0xb2, 0xa7, 0x25, 0x95, 0x60, 0xc7, 0x2c, 0x69,
+    0x5c, 0xdc, 0xd6, 0xfd, 0x31, 0xe2, 0xa4, 0xc0, 0xfe, 0x53, 0x6e, 0xcd, 0xd3, 0x36, 0x69, 0x21,
+};
+static const unsigned char ed_by_bytes[ED25519_BYTES] = {
+    0x58, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+    0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+};
+
+// 4 p, added before subtracting so limbs stay positive
+static const fe51 fe51_4p = {
+    0x1fffffffffffb4ULL, 0x1ffffffffffffcULL, 0x1ffffffffffffcULL, 0x1ffffffffffffcULL, 0x1ffffffffffffcULL,
+};
+
+// L = 2^252 + 27742317777372353535851937790883648493, Montgomery constants for R = 2^256
+static const sc_num sc_l = {
+    0x5812631a5cf5d3edULL, 0x14def9dea2f79cd6ULL, 0x0000000000000000ULL, 0x1000000000000000ULL,
+};
+static const sc_num sc_r2 = {
+    0xa40611e3449c0f01ULL, 0xd00e1ba768859347ULL, 0xceec73d217f5be65ULL, 0x0399411b7c309a3dULL,
+};
+static const sc_num sc_r3 = {
+    0x2a9e49687b83a2dbULL, 0x278324e6aef7f3ecULL, 0x8065dc6c04ec5b65ULL, 0x0e530b773599cec7ULL,
+};
+static const uint64_t sc_l0inv = 0xd2b51da312547e1bULL; // -L^-1 mod 2^64
+
+static fe51 ed_2d;
+
+// base[i][j] = (j + 1) 256^i B, signed 4-bit digits of the scalar index it
+static ed_precomp base[32][8];
+ed_precomp25 accel_ed25519_base25[32][8];
+
+// multi-buffer kernels built into this binary, baseline first
+struct ed_mb_kernel_t {
+    const char *name;
+    unsigned int cpu; // ACCEL_CPU_* features it needs
+    ed_mb_mul_base_fn *mul_base;
+};
+typedef struct ed_mb_kernel_t ed_mb_kernel;
+
+static const ed_mb_kernel mb_kernels[] = {
+    { "ED25519-MB", 0, accel_ed25519_mb_mul_base_base },
+#ifdef HAVE_ACCEL_AVX2
+    { "ED25519-MB-AVX2", ACCEL_CPU_AVX2, accel_ed25519_mb_mul_base_avx2 },
+#endif
+#ifdef HAVE_ACCEL_AVX512
+    { "ED25519-MB-AVX512", ACCEL_CPU_AVX2 | ACCEL_CPU_AVX512, accel_ed25519_mb_mul_base_avx512 },
+#endif
+};
+
+static int urandom_fd = -1;
+
+static inline uint64_t ct_mask(uint64_t bit)
+{
+    return 0 - bit;
+}
+
+static inline uint64_t ct_is_zero_64(uint64_t x)
+{
+    return ct_mask(((x | (0 - x)) >> 63) ^ 1);
+}
+
+static uint64_t load64_le(const unsigned char *p)
+{
+    uint64_t r = 0;
+    int i;
+
+    for (i = 7; i >= 0; --i)
+        r = (r << 8) | p[i];
+
+    return r;
+}
+
+static void store64_le(unsigned char *p, uint64_t v)
+{
+    int i;
+
+    for (i = 0; i < 8; ++i, v >>= 8)
+        p[i] = (unsigned char)v;
+}
+
+/*
+ * Radix 2^51 field arithmetic
+ */
+
+static void fe51_frombytes(fe51 h, const unsigned char *s)
+{
+    uint64_t w0 = load64_le(s), w1 = load64_le(s + 8), w2 = load64_le(s + 16), w3 = load64_le(s + 24);
+
+    h[0] = w0 & FE51_MASK;
+    h[1] = (w0 >> 51 | w1 << 13) & FE51_MASK;
+    h[2] = (w1 >> 38 | w2 << 26) & FE51_MASK;
+    h[3] = (w2 >> 25 | w3 << 39) & FE51_MASK;
+    h[4] = (w3 >> 12) & FE51_MASK;
+}
+
+static inline void fe51_carry(fe51 h)
+{
+    int i;
+
+    for (i = 0; i < 4; ++i)
+    {
+        h[i + 1] += h[i] >> 51;
+        h[i] &= FE51_MASK;
+    }
+    h[0] += 19 * (h[4] >> 51);
+    h[4] &= FE51_MASK;
+}
+
+// canonical encoding, value reduced below p
+static void fe51_tobytes(unsigned char *s, const fe51 f)
+{
+    fe51 h;
+    uint64_t q;
+    int i;
+
+    memcpy(h, f, sizeof(h));
+    fe51_carry(h);
+    fe51_carry(h);
+
+    // q = 1 iff h >= p
+    q = (h[0] + 19) >> 51;
+    for (i = 1; i < 5; ++i)
+        q = (h[i] + q) >> 51;
+
+    h[0] += 19 * q;
+    for (i = 0; i < 4; ++i)
+    {
+        h[i + 1] += h[i] >> 51;
+        h[i] &= FE51_MASK;
+    }
+    h[4] &= FE51_MASK;
+
+    store64_le(s, h[0] | h[1] << 51);
+    store64_le(s + 8, h[1] >> 13 | h[2] << 38);
+    store64_le(s + 16, h[2] >> 26 | h[3] << 25);
+    store64_le(s + 24, h[3] >> 39 | h[4] << 12);
+}
+
+static inline void fe51_add(fe51 h, const fe51 f, const fe51 g)
+{
+    int i;
+
+    for (i = 0; i < 5; ++i)
+        h[i] = f[i] + g[i];
+}
+
+static inline void fe51_sub(fe51 h, const fe51 f, const fe51 g)
+{
+    int i;
+
+    for (i = 0; i < 5; ++i)
+        h[i] = f[i] + fe51_4p[i] - g[i];
+    fe51_carry(h);
+}
+
+static inline void fe51_cmov(fe51 h, const fe51 f, uint64_t mask)
+{
+    int i;
+
+    for (i = 0; i < 5; ++i)
+        h[i] ^= (h[i] ^ f[i]) & mask;
+}
+
+// reduce products, carries stay 128-bit as limbs of sums and differences exceed 51 bits
+static inline void fe51_reduce(fe51 h, u128 r0, u128 r1, u128 r2, u128 r3, u128 r4)
+{
+    uint64_t t0, t1, t2, t3;
+
+    t0 = (uint64_t)r0 & FE51_MASK;
+    r1 += r0 >> 51;
+    t1 = (uint64_t)r1 & FE51_MASK;
+    r2 += r1 >> 51;
+    t2 = (uint64_t)r2 & FE51_MASK;
+    r3 += r2 >> 51;
+    t3 = (uint64_t)r3 & FE51_MASK;
+    r4 += r3 >> 51;
+    h[4] = (uint64_t)r4 & FE51_MASK;
+
+    r0 = (u128)t0 + 19 * (r4 >> 51);
+    h[0] = (uint64_t)r0 & FE51_MASK;
+    h[1] = t1 + (uint64_t)(r0 >> 51);
+    h[2] = t2;
+    h[3] = t3;
+}
+
+static void fe51_mul(fe51 h, const fe51 f, const fe51 g)
+{
+    uint64_t g1_19 = 19 * g[1], g2_19 = 19 * g[2], g3_19 = 19 * g[3], g4_19 = 19 * g[4];
+    u128 r0, r1, r2, r3, r4;
+
+    r0 = (u128)f[0] * g[0] + (u128)f[1] * g4_19 + (u128)f[2] * g3_19 + (u128)f[3] * g2_19 + (u128)f[4] * g1_19;
+    r1 = (u128)f[0] * g[1] + (u128)f[1] * g[0] + (u128)f[2] * g4_19 + (u128)f[3] * g3_19 + (u128)f[4] * g2_19;
+    r2 = (u128)f[0] * g[2] + (u128)f[1] * g[1] + (u128)f[2] * g[0] + (u128)f[3] * g4_19 + (u128)f[4] * g3_19;
+    r3 = (u128)f[0] * g[3] + (u128)f[1] * g[2] + (u128)f[2] * g[1] + (u128)f[3] * g[0] + (u128)f[4] * g4_19;
+    r4 = (u128)f[0] * g[4] + (u128)f[1] * g[3] + (u128)f[2] * g[2] + (u128)f[3] * g[1] + (u128)f[4] * g[0];
+
+    fe51_reduce(h, r0, r1, r2, r3, r4);
+}
+
+static void fe51_sqr(fe51 h, const fe51 f)
+{
+    uint64_t f0_2 = 2 * f[0], f1_2 = 2 * f[1];
+    uint64_t f1_38 = 38 * f[1], f2_38 = 38 * f[2], f3_38 = 38 * f[3];
+    uint64_t f3_19 = 19 * f[3], f4_19 = 19 * f[4];
+    u128 r0, r1, r2, r3, r4;
+
+    r0 = (u128)f[0] * f[0] + (u128)f1_38 * f[4] + (u128)f2_38 * f[3];
+    r1 = (u128)f0_2 * f[1] + (u128)f2_38 * f[4] + (u128)f3_19 * f[3];
+    r2 = (u128)f0_2 * f[2] + (u128)f[1] * f[1] + (u128)f3_38 * f[4];
+    r3 = (u128)f0_2 * f[3] + (u128)f1_2 * f[2] + (u128)f4_19 * f[4];
+    r4 = (u128)f0_2 * f[4] + (u128)f1_2 * f[3] + (u128)f[2] * f[2];
+
+    fe51_reduce(h, r0, r1, r2, r3, r4);
+}
+
+static void fe51_sqr_n(fe51 h, const fe51 f, int n)
+{
+    fe51_sqr(h, f);
+    while (--n > 0)
+        fe51_sqr(h, h);
+}
+
+// h = z^(p - 2), the usual chain of 254 squarings and 11 multiplications
+static void fe51_invert(fe51 h, const fe51 z)
+{
+    fe51 t0, t1, t2, t3;
+
+    fe51_sqr(t0, z);
+    fe51_sqr_n(t1, t0, 2);
+    fe51_mul(t1, z, t1);
+    fe51_mul(t0, t0, t1);
+    fe51_sqr(t2, t0);
+    fe51_mul(t1, t1, t2);
+    fe51_sqr_n(t2, t1, 5);
+    fe51_mul(t1, t2, t1);
+    fe51_sqr_n(t2, t1, 10);
+    fe51_mul(t2, t2, t1);
+    fe51_sqr_n(t3, t2, 20);
+    fe51_mul(t2, t3, t2);
+    fe51_sqr_n(t2, t2, 10);
+    fe51_mul(t1, t2, t1);
+    fe51_sqr_n(t2, t1, 50);
+    fe51_mul(t2, t2, t1);
+    fe51_sqr_n(t3, t2, 100);
+    fe51_mul(t2, t3, t2);
+    fe51_sqr_n(t2, t2, 50);
+    fe51_mul(t1, t2, t1);
+    fe51_sqr_n(t1, t1, 5);
+    fe51_mul(h, t1, t0);
+}
+
+// multi-buffer table entries are in radix 2^25.5
+static void fe25_frombytes(uint32_t *h, const unsigned char *s)
+{
+    uint64_t acc = 0;
+    int bits = 0, i, j = 0;
+
+    for (i = 0; i < 10; ++i)
+    {
+        int w = fe25_bits(i);
+
+        while (bits < w)
+        {
+            acc |= (uint64_t)s[j++] << bits;
+            bits += 8;
+        }
+        h[i] = (uint32_t)acc & ((UINT32_C(1) << w) - 1);
+        acc >>= w;
+        bits -= w;
+    }
+}
+
+/*
+ * Scalars modulo L
+ */
+
+static void sc_from_bytes(sc_num r, const unsigned char *s)
+{
+    int i;
+
+    for (i = 0; i < 4; ++i)
+        r[i] = load64_le(s + 8 * i);
+}
+
+static void sc_to_bytes(unsigned char *s, const sc_num a)
+{
+    int i;
+
+    for (i = 0; i < 4; ++i)
+        store64_le(s + 8 * i, a[i]);
+}
+
+// r = t - L if t >= L, else t
+static void sc_reduce_once(sc_num r, const sc_num t)
+{
+    sc_num u;
+    uint64_t borrow = 0, mask;
+    int i;
+
+    for (i = 0; i < 4; ++i)
+    {
+        u128 d = (u128)t[i] - sc_l[i] - borrow;
+
+        u[i] = (uint64_t)d;
+        borrow = (uint64_t)(d >> 64) & 1;
+    }
+
+    mask = ct_mask(borrow);
+    for (i = 0; i < 4; ++i)
+        r[i] = (t[i] & mask) | (u[i] & ~mask);
+}
+
+static void sc_add(sc_num r, const sc_num a, const sc_num b)
+{
+    sc_num t;
+    uint64_t carry = 0;
+    int i;
+
+    // both below L < 2^253, no carry out
+    for (i = 0; i < 4; ++i)
+    {
+        u128 s = (u128)a[i] + b[i] + carry;
+
+        t[i] = (uint64_t)s;
+        carry = (uint64_t)(s >> 64);
+    }
+
+    sc_reduce_once(r, t);
+}
+
+// r = a b / 2^256 mod L for any 256-bit a and b below L
+static void sc_mont_mul(sc_num r, const sc_num a, const sc_num b)
+{
+    uint64_t t[6] = { 0, 0, 0, 0, 0, 0 };
+    int i, j;
+
+    for (i = 0; i < 4; ++i)
+    {
+        uint64_t c = 0, mu;
+        u128 acc;
+
+        for (j = 0; j < 4; ++j)
+        {
+            acc = (u128)a[j] * b[i] + t[j] + c;
+            t[j] = (uint64_t)acc;
+            c = (uint64_t)(acc >> 64);
+        }
+        acc = (u128)t[4] + c;
+        t[4] = (uint64_t)acc;
+        t[5] = (uint64_t)(acc >> 64);
+
+        mu = t[0] * sc_l0inv;
+        acc = (u128)mu * sc_l[0] + t[0];
+        c = (uint64_t)(acc >> 64);
+        for (j = 1; j < 4; ++j)
+        {
+            acc = (u128)mu * sc_l[j] + t[j] + c;
+            t[j - 1] = (uint64_t)acc;
+            c = (uint64_t)(acc >> 64);
+        }
+        acc = (u128)t[4] + c;
+        t[3] = (uint64_t)acc;
+        t[4] = t[5] + (uint64_t)(acc >> 64);
+    }
+
+    // t < 2 L < 2^254
+    sc_reduce_once(r, t);
+}
+
+// r = 512-bit little endian h mod L
+static void sc_reduce(sc_num r, const unsigned char *h)
+{
+    static const sc_num one = { 1, 0, 0, 0 };
+    sc_num lo, hi;
+
+    sc_from_bytes(lo, h);
+    sc_from_bytes(hi, h + 32);
+
+    // (lo R + hi R^2) / R = lo + hi 2^256
+    sc_mont_mul(lo, lo, sc_r2);
+    sc_mont_mul(hi, hi, sc_r3);
+    sc_add(r, lo, hi);
+    sc_mont_mul(r, r, one);
+
+    OPENSSL_cleanse(lo, sizeof(lo));
+    OPENSSL_cleanse(hi, sizeof(hi));
+}
+
+// r = a b + c mod L, all below L
+static void sc_muladd(sc_num r, const sc_num a, const sc_num b, const sc_num c)
+{
+    sc_num t;
+
+    sc_mont_mul(t, a, b);
+    sc_mont_mul(t, t, sc_r2);
+    sc_add(r, t, c);
+
+    OPENSSL_cleanse(t, sizeof(t));
+}
+
+/*
+ * Point arithmetic on -x^2 + y^2 = 1 + d x^2 y^2, unified formulas from ref10
+ */
+
+static void ed_p3_zero(ed_p3 *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->y[0] = 1;
+    h->z[0] = 1;
+}
+
+static void ed_madd(ed_p1p1 *r, const ed_p3 *p, const ed_precomp *q)
+{
+    fe51 a, b, c, d;
+
+    fe51_add(a, p->y, p->x);
+    fe51_sub(b, p->y, p->x);
+    fe51_mul(a, a, q->ypx);
+    fe51_mul(b, b, q->ymx);
+    fe51_mul(c, q->xy2d, p->t);
+    fe51_add(d, p->z, p->z);
+
+    fe51_sub(r->x, a, b);
+    fe51_add(r->y, a, b);
+    fe51_add(r->z, d, c);
+    fe51_sub(r->t, d, c);
+}
+
+// only X, Y and Z of p are used
+static void ed_dbl(ed_p1p1 *r, const ed_p3 *p)
+{
+    fe51 xx, yy, b, aa;
+
+    fe51_sqr(xx, p->x);
+    fe51_sqr(yy, p->y);
+    fe51_sqr(b, p->z);
+    fe51_add(b, b, b);
+    fe51_add(aa, p->x, p->y);
+    fe51_sqr(aa, aa);
+
+    fe51_add(r->y, yy, xx);
+    fe51_sub(r->z, yy, xx);
+    fe51_sub(r->x, aa, r->y);
+    fe51_sub(r->t, b, r->z);
+}
+
+static void ed_p1p1_to_p3(ed_p3 *r, const ed_p1p1 *p)
+{
+    fe51_mul(r->x, p->x, p->t);
+    fe51_mul(r->y, p->y, p->z);
+    fe51_mul(r->z, p->z, p->t);
+    fe51_mul(r->t, p->x, p->y);
+}
+
+static void ed_to_precomp(ed_precomp *r, const ed_p3 *p)
+{
+    fe51 zinv, x, y;
+
+    fe51_invert(zinv, p->z);
+    fe51_mul(x, p->x, zinv);
+    fe51_mul(y, p->y, zinv);
+
+    fe51_add(r->ypx, y, x);
+    fe51_carry(r->ypx);
+    fe51_sub(r->ymx, y, x);
+    fe51_mul(r->xy2d, x, y);
+    fe51_mul(r->xy2d, r->xy2d, ed_2d);
+}
+
+// y with the sign of x in the top bit
+static void ed_encode(unsigned char *s, const fe51 x, const fe51 y)
+{
+    unsigned char xb[ED25519_BYTES];
+
+    fe51_tobytes(s, y);
+    fe51_tobytes(xb, x);
+    s[31] ^= (xb[0] & 1) << 7;
+}
+
+static void ed_p3_encode(unsigned char *s, const ed_p3 *p)
+{
+    fe51 zinv, x, y;
+
+    fe51_invert(zinv, p->z);
+    fe51_mul(x, p->x, zinv);
+    fe51_mul(y, p->y, zinv);
+    ed_encode(s, x, y);
+}
+
+// a as 64 signed digits in [-8, 8], a[31] <= 127
+static void ed_digits(signed char *e, const unsigned char *a)
+{
+    signed char carry = 0;
+    int i;
+
+    for (i = 0; i < 32; ++i)
+    {
+        e[2 * i] = a[i] & 15;
+        e[2 * i + 1] = (a[i] >> 4) & 15;
+    }
+
+    for (i = 0; i < 63; ++i)
+    {
+        e[i] += carry;
+        carry = (e[i] + 8) >> 4;
+        e[i] -= carry * 16;
+    }
+    e[63] += carry;
+}
+
+// t = b base[pos][|b| - 1], scanning the whole row
+static void ed_select(ed_precomp *t, int pos, signed char b)
+{
+    int bi = b;
+    uint64_t neg = (uint64_t)((unsigned int)bi >> 31);
+    uint64_t babs = (uint64_t)((bi ^ -(int)neg) + (int)neg);
+    ed_precomp minus;
+    uint64_t j;
+
+    memset(t, 0, sizeof(*t));
+    t->ypx[0] = 1;
+    t->ymx[0] = 1;
+
+    for (j = 1; j <= 8; ++j)
+    {
+        uint64_t mask = ct_is_zero_64(babs ^ j);
+
+        fe51_cmov(t->ypx, base[pos][j - 1].ypx, mask);
+        fe51_cmov(t->ymx, base[pos][j - 1].ymx, mask);
+        fe51_cmov(t->xy2d, base[pos][j - 1].xy2d, mask);
+    }
+
+    memcpy(minus.ypx, t->ymx, sizeof(fe51));
+    memcpy(minus.ymx, t->ypx, sizeof(fe51));
+    memset(minus.xy2d, 0, sizeof(fe51));
+    fe51_sub(minus.xy2d, minus.xy2d, t->xy2d);
+
+    fe51_cmov(t->ypx, minus.ypx, ct_mask(neg));
+    fe51_cmov(t->ymx, minus.ymx, ct_mask(neg));
+    fe51_cmov(t->xy2d, minus.xy2d, ct_mask(neg));
+}
+
+// h = a B, odd digits first, then 16 times that plus the even ones
+static void ed_mul_base(ed_p3 *h, const unsigned char *a)
+{
+    signed char e[64];
+    ed_precomp t;
+    ed_p1p1 r;
+    int i;
+
+    ed_digits(e, a);
+    ed_p3_zero(h);
+
+    for (i = 1; i < 64; i += 2)
+    {
+        ed_select(&t, i / 2, e[i]);
+        ed_madd(&r, h, &t);
+        ed_p1p1_to_p3(h, &r);
+    }
+
+    for (i = 0; i < 4; ++i)
+    {
+        ed_dbl(&r, h);
+        ed_p1p1_to_p3(h, &r);
+    }
+
+    for (i = 0; i < 64; i += 2)
+    {
+        ed_select(&t, i / 2, e[i]);
+        ed_madd(&r, h, &t);
+        ed_p1p1_to_p3(h, &r);
+    }
+
+    OPENSSL_cleanse(e, sizeof(e));
+    OPENSSL_cleanse(&t, sizeof(t));
+}
+
+static void ed_table_init(void)
+{
+    unsigned char buf[ED25519_BYTES];
+    ed_p3 q, p;
+    ed_p1p1 r;
+    int i, j, k;
+
+    fe51_frombytes(ed_2d, ed_2d_bytes);
+
+    fe51_frombytes(q.x, ed_bx_bytes);
+    fe51_frombytes(q.y, ed_by_bytes);
+    memset(q.z, 0, sizeof(q.z));
+    q.z[0] = 1;
+    fe51_mul(q.t, q.x, q.y);
+
+    for (i = 0; i < 32; ++i)
+    {
+        // q = 256^i B
+        ed_to_precomp(&base[i][0], &q);
+        p = q;
+        for (j = 1; j < 8; ++j)
+        {
+            ed_madd(&r, &p, &base[i][0]);
+            ed_p1p1_to_p3(&p, &r);
+            ed_to_precomp(&base[i][j], &p);
+        }
+
+        for (k = 0; k < 8; ++k)
+        {
+            ed_dbl(&r, &q);
+            ed_p1p1_to_p3(&q, &r);
+        }
+    }
+
+    for (i = 0; i < 32; ++i)
+    {
+        for (j = 0; j < 8; ++j)
+        {
+            fe51_tobytes(buf, base[i][j].ypx);
+            fe25_frombytes(accel_ed25519_base25[i][j].ypx, buf);
+            fe51_tobytes(buf, base[i][j].ymx);
+            fe25_frombytes(accel_ed25519_base25[i][j].ymx, buf);
+            fe51_tobytes(buf, base[i][j].xy2d);
+            fe25_frombytes(accel_ed25519_base25[i][j].xy2d, buf);
+        }
+    }
+}
+
+/*
+ * Signing (RFC 8032 5.1.6), shared by both methods up to the multiplication by B
+ */
+
+// expands seed to the secret scalar and nonce prefix, pub gets the matching public key
+static void ed25519_expand(ed25519_key *k, const unsigned char *seed)
+{
+    unsigned char h[SHA512_DIGEST_LENGTH];
+    unsigned char wide[2 * ED25519_BYTES];
+    ed_p3 a;
+
+    SHA512(seed, ED25519_BYTES, h);
+    h[0] &= 248;
+    h[31] &= 127;
+    h[31] |= 64;
+
+    memset(wide, 0, sizeof(wide));
+    memcpy(wide, h, ED25519_BYTES);
+    sc_reduce(k->s, wide);
+    memcpy(k->prefix, h + ED25519_BYTES, ED25519_BYTES);
+
+    // B has order L, s B = clamped scalar times B
+    sc_to_bytes(wide, k->s);
+    ed_mul_base(&a, wide);
+    ed_p3_encode(k->pub, &a);
+
+    OPENSSL_cleanse(h, sizeof(h));
+    OPENSSL_cleanse(wide, sizeof(wide));
+}
+
+// r = SHA-512(prefix || M) mod L
+static void ed25519_nonce(const ed25519_key *k, const unsigned char *msg, size_t len, sc_num r)
+{
+    unsigned char h[SHA512_DIGEST_LENGTH];
+    SHA512_CTX ctx;
+
+    SHA512_Init(&ctx);
+    SHA512_Update(&ctx, k->prefix, sizeof(k->prefix));
+    SHA512_Update(&ctx, msg, len);
+    SHA512_Final(h, &ctx);
+
+    sc_reduce(r, h);
+
+    OPENSSL_cleanse(h, sizeof(h));
+    OPENSSL_cleanse(&ctx, sizeof(ctx));
+}
+
+// sig = R || (r + SHA-512(R || A || M) s mod L), R already in place
+static int ed25519_finish(const ed25519_key *k, const unsigned char *msg, size_t len, const sc_num r, unsigned char *sig)
+{
+    unsigned char h[SHA512_DIGEST_LENGTH];
+    SHA512_CTX ctx;
+    sc_num e, s;
+
+    SHA512_Init(&ctx);
+    SHA512_Update(&ctx, sig, ED25519_BYTES);
+    SHA512_Update(&ctx, k->pub, sizeof(k->pub));
+    SHA512_Update(&ctx, msg, len);
+    SHA512_Final(h, &ctx);
+
+    sc_reduce(e, h);
+    sc_muladd(s, e, k->s, r);
+    sc_to_bytes(sig + ED25519_BYTES, s);
+
+    OPENSSL_cleanse(s, sizeof(s));
+
+    return 2 * ED25519_BYTES;
+}
+
+static int ed25519_sign(const ed25519_key *k, const unsigned char *msg, size_t len, unsigned char *sig)
+{
+    unsigned char rb[ED25519_BYTES];
+    sc_num r;
+    ed_p3 p;
+    int ret;
+
+    ed25519_nonce(k, msg, len, r);
+    sc_to_bytes(rb, r);
+    ed_mul_base(&p, rb);
+    ed_p3_encode(sig, &p);
+
+    ret = ed25519_finish(k, msg, len, r, sig);
+
+    OPENSSL_cleanse(rb, sizeof(rb));
+    OPENSSL_cleanse(r, sizeof(r));
+
+    return ret;
+}
+
+static int ed25519_op_msg(const accel_op *op, const unsigned char **msg, size_t *len)
+{
+    const cmd_op_ed25519 *c = (const cmd_op_ed25519 *)op->data;
+
+    if (unlikely(op->op != CMD_OP_ED25519_SIGN || op->len < sizeof(cmd_op_ed25519) ||
+                 ntohl(c->len) > op->len - sizeof(cmd_op_ed25519)))
+        return -1;
+
+    *msg = c->data;
+    *len = ntohl(c->len);
+
+    return 1;
+}
+
+// digits of LANES scalars, lane index last as the kernels take them
+static void ed_mb_digits(signed char e[64][LANES], unsigned char a[LANES][ED25519_BYTES])
+{
+    signed char d[64];
+    int i, l;
+
+    for (l = 0; l < LANES; ++l)
+    {
+        ed_digits(d, a[l]);
+        for (i = 0; i < 64; ++i)
+            e[i][l] = d[i];
+    }
+
+    OPENSSL_cleanse(d, sizeof(d));
+}
+
+// signs up to LANES ops together, idle lanes multiply by 0
+static void ed25519_sign_mb(const ed_mb_kernel *kernel, accel_op **ops, const unsigned char **msg, const size_t *len, int count)
+{
+    unsigned char rb[LANES][ED25519_BYTES], sig_r[LANES][ED25519_BYTES];
+    signed char e[64][LANES];
+    sc_num r[LANES];
+    int l;
+
+    memset(rb, 0, sizeof(rb));
+    for (l = 0; l < count; ++l)
+    {
+        ed25519_nonce((const ed25519_key *)ops[l]->key, msg[l], len[l], r[l]);
+        sc_to_bytes(rb[l], r[l]);
+    }
+
+    ed_mb_digits(e, rb);
+    kernel->mul_base((const signed char (*)[LANES])e, sig_r, NULL, NULL);
+
+    for (l = 0; l < count; ++l)
+    {
+        memcpy(ops[l]->result, sig_r[l], ED25519_BYTES);
+        ops[l]->ret = ed25519_finish((const ed25519_key *)ops[l]->key, msg[l], len[l], r[l], ops[l]->result);
+    }
+
+    OPENSSL_cleanse(rb, sizeof(rb));
+    OPENSSL_cleanse(e, sizeof(e));
+    OPENSSL_cleanse(r, sizeof(r));
+}
+
+/*
+ * X25519 key shares (RFC 7748). The birational map takes a B on the Edwards curve to
+ * a times the Montgomery base point, whose u-coordinate is (Z + Y) / (Z - Y).
+ */
+
+// count clamped private scalars
+static int x25519_random(unsigned char a[][ED25519_BYTES], int count)
+{
+    size_t len = count * ED25519_BYTES, got = 0;
+
+    while (got < len)
+    {
+        ssize_t ret = read(urandom_fd, (unsigned char *)a + got, len - got);
+
+        if (ret <= 0)
+            return -1;
+        got += ret;
+    }
+
+    while (count-- > 0)
+    {
+        a[count][0] &= 248;
+        a[count][31] &= 127;
+        a[count][31] |= 64;
+    }
+
+    return 1;
+}
+
+/*
+ * Writes private scalars and u = num / den, all denominators inverted with a single
+ * inversion: prod[i] is den[0] ... den[i], walked back from the inverse of the last one.
+ */
+static int x25519_finish(unsigned char a[][ED25519_BYTES], fe51 *num, const fe51 *den, int count, unsigned char *result)
+{
+    fe51 prod[X25519_BATCH_MAX], inv, deninv;
+    int i;
+
+    memcpy(prod[0], den[0], sizeof(fe51));
+    for (i = 1; i < count; ++i)
+        fe51_mul(prod[i], prod[i - 1], den[i]);
+
+    fe51_invert(inv, prod[count - 1]);
+
+    for (i = count - 1; i >= 0; --i)
+    {
+        unsigned char *pair = result + i * CMD_KEYSHARE_X25519_LEN;
+
+        if (i)
+        {
+            fe51_mul(deninv, inv, prod[i - 1]);
+            fe51_mul(inv, inv, den[i]);
+        }
+        else
+            memcpy(deninv, inv, sizeof(fe51));
+
+        fe51_mul(num[i], num[i], deninv);
+        memcpy(pair, a[i], ED25519_BYTES);
+        fe51_tobytes(pair + ED25519_BYTES, num[i]);
+    }
+
+    return count * CMD_KEYSHARE_X25519_LEN;
+}
+
+static int x25519_keyshare(int count, unsigned char *result)
+{
+    unsigned char a[X25519_BATCH_MAX][ED25519_BYTES];
+    fe51 num[X25519_BATCH_MAX], den[X25519_BATCH_MAX];
+    ed_p3 p;
+    int i, ret;
+
+    if (unlikely(count <= 0 || count > X25519_BATCH_MAX))
+        return -1;
+
+    if (x25519_random(a, count) < 0)
+        return -1;
+
+    for (i = 0; i < count; ++i)
+    {
+        ed_mul_base(&p, a[i]);
+        fe51_add(num[i], p.z, p.y);
+        fe51_sub(den[i], p.z, p.y);
+    }
+
+    ret = x25519_finish(a, num, den, count, result);
+
+    OPENSSL_cleanse(a, sizeof(a));
+    OPENSSL_cleanse(&p, sizeof(p));
+
+    return ret;
+}
+
+// LANES multiplications at a time, the last round multiplies the idle lanes by 0
+static int x25519_keyshare_mb(const ed_mb_kernel *kernel, int count, unsigned char *result)
+{
+    unsigned char a[X25519_BATCH_MAX + LANES][ED25519_BYTES];
+    unsigned char yb[LANES][ED25519_BYTES], zb[LANES][ED25519_BYTES];
+    signed char e[64][LANES];
+    fe51 num[X25519_BATCH_MAX], den[X25519_BATCH_MAX], y, z;
+    int i, l, ret;
+
+    if (unlikely(count <= 0 || count > X25519_BATCH_MAX))
+        return -1;
+
+    memset(a, 0, sizeof(a));
+    if (x25519_random(a, count) < 0)
+        return -1;
+
+    for (i = 0; i < count; i += LANES)
+    {
+        ed_mb_digits(e, &a[i]);
+        kernel->mul_base((const signed char (*)[LANES])e, NULL, yb, zb);
+
+        for (l = 0; l < LANES && i + l < count; ++l)
+        {
+            fe51_frombytes(y, yb[l]);
+            fe51_frombytes(z, zb[l]);
+            fe51_add(num[i + l], z, y);
+            fe51_sub(den[i + l], z, y);
+        }
+    }
+
+    ret = x25519_finish(a, num, den, count, result);
+
+    OPENSSL_cleanse(a, sizeof(a));
+    OPENSSL_cleanse(e, sizeof(e));
+
+    return ret;
+}
+
+int accel_ed25519_init(void)
+{
+    if (urandom_fd < 0)
+    {
+        urandom_fd = open("/dev/urandom", O_RDONLY);
+        if (urandom_fd < 0)
+            return -1;
+    }
+
+    ed_table_init();
+
+    return 1;
+}
+
+void accel_ed25519_destroy(void)
+{
+    if (urandom_fd >= 0)
+        close(urandom_fd);
+    urandom_fd = -1;
+}
+
+int accel_ed25519_derive_public(const unsigned char *seed, unsigned char *pub)
+{
+    ed25519_key k;
+
+    ed25519_expand(&k, seed);
+    memcpy(pub, k.pub, sizeof(k.pub));
+    OPENSSL_cleanse(&k, sizeof(k));
+
+    return 1;
+}
+
+static const vli *accel_ed25519_next_vli(const unsigned char **data, size_t *len)
+{
+    const vli *v = (const vli *)*data;
+    size_t vlen;
+
+    if (unlikely(*len < sizeof(uint32_t)))
+        return NULL;
+
+    vlen = ntohl(v->len);
+    if (unlikely(*len - sizeof(uint32_t) < vlen))
+        return NULL;
+
+    *data += sizeof(uint32_t) + vlen;
+    *len -= sizeof(uint32_t) + vlen;
+
+    return v;
+}
+
+// seed and public key, the public key must be the one the seed gives
+static int accel_ed25519_key_decode(ed25519_key *k, size_t len, const unsigned char *data)
+{
+    const vli *seed, *pub;
+
+    seed = accel_ed25519_next_vli(&data, &len);
+    pub = accel_ed25519_next_vli(&data, &len);
+
+    if (!pub || ntohl(seed->len) != ED25519_BYTES || ntohl(pub->len) != ED25519_BYTES)
+        return -1;
+
+    ed25519_expand(k, seed->data);
+
+    return memcmp(k->pub, pub->data, ED25519_BYTES) ? -1 : 1;
+}
+
+static const char *accel_ed25519_get_name(void *accel_priv UNUSED)
+{
+    return "ED25519";
+}
+
+static const char *accel_ed25519_mb_get_name(void *accel_priv)
+{
+    return ((const ed_mb_kernel *)accel_priv)->name;
+}
+
+static void accel_ed25519_free_priv(void *accel_priv UNUSED)
+{
+}
+
+static void accel_ed25519_key_destroy(ed25519_key *k)
+{
+    OPENSSL_cleanse(k, sizeof(*k));
+    free(k);
+}
+
+static void *accel_ed25519_add_key(void *accel_priv UNUSED, int type, size_t len, const unsigned char *data)
+{
+    switch (type)
+    {
+    case CMD_KEY_ED25519:
+        {
+            ed25519_key *k = calloc(1, sizeof(ed25519_key));
+
+            if (unlikely(!k))
+                return NULL;
+
+            if (accel_ed25519_key_decode(k, len, data) < 0)
+            {
+                accel_ed25519_key_destroy(k);
+                return NULL;
+            }
+
+            return k;
+        }
+    default:
+        return NULL;
+    }
+}
+
+static void accel_ed25519_destroy_key(void *accel_priv UNUSED, int type, void *key)
+{
+    switch (type)
+    {
+    case CMD_KEY_ED25519:
+        accel_ed25519_key_destroy(key);
+    default:
+        return;
+    }
+}
+
+static size_t accel_ed25519_result_max_len(void *accel_priv UNUSED, void *key UNUSED, int op)
+{
+    switch (op) {
+    case CMD_OP_ED25519_SIGN:
+        return 2 * ED25519_BYTES;
+    default:
+        return -1;
+    }
+}
+
+static int accel_ed25519_sign(void *accel_priv UNUSED, void *key, size_t len, const unsigned char *data, unsigned char *result)
+{
+    const cmd_op_ed25519 *op = (const cmd_op_ed25519 *)data;
+
+    if (unlikely(len < sizeof(cmd_op_ed25519) || ntohl(op->len) > len - sizeof(cmd_op_ed25519)))
+        return -1;
+
+    return ed25519_sign((ed25519_key *)key, op->data, ntohl(op->len), result);
+}
+
+static void accel_ed25519_mb_perform_batch(void *accel_priv, accel_op *ops, int count)
+{
+    accel_op *lanes[LANES];
+    const unsigned char *msg[LANES];
+    size_t len[LANES];
+    int i, n = 0;
+
+    for (i = 0; i < count; ++i)
+    {
+        if (ed25519_op_msg(&ops[i], &msg[n], &len[n]) < 0)
+        {
+            ops[i].ret = -1;
+            continue;
+        }
+
+        lanes[n++] = &ops[i];
+        if (n == LANES)
+        {
+            ed25519_sign_mb(accel_priv, lanes, msg, len, n);
+            n = 0;
+        }
+    }
+
+    // idle lanes cost as much as busy ones, a few leftovers are cheaper on the single path
+    if (n >= LANES / 2)
+        ed25519_sign_mb(accel_priv, lanes, msg, len, n);
+    else
+    {
+        for (i = 0; i < n; ++i)
+            lanes[i]->ret = accel_ed25519_sign(accel_priv, lanes[i]->key, lanes[i]->len, lanes[i]->data, lanes[i]->result);
+    }
+}
+
+static int accel_ed25519_keyshare(void *accel_priv UNUSED, int group, int count, unsigned char *result)
+{
+    if (group != CMD_GROUP_X25519)
+        return -1;
+
+    return x25519_keyshare(count, result);
+}
+
+static int accel_ed25519_mb_keyshare(void *accel_priv, int group, int count, unsigned char *result)
+{
+    if (group != CMD_GROUP_X25519)
+        return -1;
+
+    return x25519_keyshare_mb(accel_priv, count, result);
+}
+
+static accel_method ed25519_accel_method = {
+    .free_priv = accel_ed25519_free_priv,
+    .get_name = accel_ed25519_get_name,
+    .add_key = accel_ed25519_add_key,
+    .destroy_key = accel_ed25519_destroy_key,
+    .result_max_len = accel_ed25519_result_max_len,
+    .ed25519_sign = accel_ed25519_sign,
+    .keyshare = accel_ed25519_keyshare,
+};
+
+static accel_method ed25519_mb_accel_method = {
+    .free_priv = accel_ed25519_free_priv,
+    .get_name = accel_ed25519_mb_get_name,
+    .add_key = accel_ed25519_add_key,
+    .destroy_key = accel_ed25519_destroy_key,
+    .result_max_len = accel_ed25519_result_max_len,
+    .ed25519_sign = accel_ed25519_sign,
+    .keyshare = accel_ed25519_mb_keyshare,
+    .perform_batch = accel_ed25519_mb_perform_batch,
+};
+
+static accelerator *accel_ed25519_new(accel_method *method, const ed_mb_kernel *kernel)
+{
+    accelerator *ret = malloc(sizeof(accelerator));
+    if (!ret)
+        return ret;
+
+    ret->method = method;
+    ret->priv = (void *)kernel;
+
+    return ret;
+}
+
+accelerator *accel_ed25519_method()
+{
+    return accel_ed25519_new(&ed25519_accel_method, NULL);
+}
+
+accelerator *accel_ed25519_mb_method(int kernel)
+{
+    if (kernel < 0 || kernel >= (int)(sizeof(mb_kernels) / sizeof(mb_kernels[0])) || !accel_cpu_has(mb_kernels[kernel].cpu))
+        return NULL;
+
+    return accel_ed25519_new(&ed25519_mb_accel_method, &mb_kernels[kernel]);
+}
@@ -0,0 +1,45 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _ACCELERATOR_ED25519_H_
+#define _ACCELERATOR_ED25519_H_
+
+#include "accel_base.h"
+
+// signatures the multi-buffer method computes together
+#define ACCEL_ED25519_LANES  8
+
+int accel_ed25519_init(void);
+void accel_ed25519_destroy(void);
+
+// one signature at a time, radix 2^51 field arithmetic
+accelerator *accel_ed25519_method(void);
+/*
+ * Batches are signed ACCEL_ED25519_LANES at a time with lane sliced radix 2^25.5 arithmetic.
+ * kernel < ACCEL_ED25519_MB_KERNELS picks the instruction set it was built for (baseline,
+ * AVX2, AVX-512), NULL if that one is not built in or the CPU cannot run it.
+ */
+#define ACCEL_ED25519_MB_KERNELS  3
+accelerator *accel_ed25519_mb_method(int kernel);
+
+// public key of a 32-byte private key (seed)
+int accel_ed25519_derive_public(const unsigned char *seed, unsigned char *pub);
+
+#endif // _ACCELERATOR_ED25519_H_
@@ -0,0 +1,432 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+/*
+ * Multi-buffer scalar multiplication by B. This file is compiled once per instruction
+ * set, the build defines ACCEL_ED25519_MB_ISA and the matching -m flags for every copy
+ * but the baseline one, so the lane loops vectorise as wide as the CPU allows.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <openssl/crypto.h>
+
+#include "accel_ed25519_mb.h"
+
+#ifndef ACCEL_ED25519_MB_ISA
+#define ACCEL_ED25519_MB_ISA  base
+#endif
+
+#define MB_MUL_BASE(isa)  MB_MUL_BASE_(isa)
+#define MB_MUL_BASE_(isa)  accel_ed25519_mb_mul_base_##isa
+
+#define LANES  ACCEL_ED25519_LANES
+
+/*
+ * GF(2^255 - 19) for LANES independent signatures, radix 2^25.5 (26-bit even and 25-bit
+ * odd limbs). Limb i of lane l is v[i][l], so every step is a short loop over lanes
+ * of 32x32->64 bit products the compiler turns into vector instructions.
+ */
+struct fe_mb_t {
+    uint32_t v[10][LANES];
+};
+typedef struct fe_mb_t fe_mb;
+
+struct ed_mb_p3_t {
+    fe_mb x, y, z, t;
+};
+typedef struct ed_mb_p3_t ed_mb_p3;
+
+struct ed_mb_p1p1_t {
+    fe_mb x, y, z, t;
+};
+typedef struct ed_mb_p1p1_t ed_mb_p1p1;
+
+struct ed_mb_precomp_t {
+    fe_mb ypx, ymx, xy2d;
+};
+typedef struct ed_mb_precomp_t ed_mb_precomp;
+
+static const uint32_t fe25_4p[10] = {
+    0xfffffb4, 0x7fffffc, 0xffffffc, 0x7fffffc, 0xffffffc, 0x7fffffc, 0xffffffc, 0x7fffffc, 0xffffffc, 0x7fffffc,
+};
+
+static inline uint64_t ct_is_zero_64(uint64_t x)
+{
+    return 0 - (((x | (0 - x)) >> 63) ^ 1);
+}
+
+// canonical encoding of one lane, limbs as left by fe_mb_carry
+static void fe25_tobytes(unsigned char *s, const uint32_t *f)
+{
+    uint32_t h[10], q;
+    uint64_t acc = 0;
+    int bits = 0, i, j = 0;
+
+    memcpy(h, f, sizeof(h));
+
+    // q = 1 iff h >= p
+    q = (h[0] + 19) >> 26;
+    for (i = 1; i < 10; ++i)
+        q = (h[i] + q) >> fe25_bits(i);
+
+    h[0] += 19 * q;
+    for (i = 0; i < 9; ++i)
+    {
+        h[i + 1] += h[i] >> fe25_bits(i);
+        h[i] &= (UINT32_C(1) << fe25_bits(i)) - 1;
+    }
+    h[9] &= (UINT32_C(1) << 25) - 1;
+
+    for (i = 0; i < 10; ++i)
+    {
+        acc |= (uint64_t)h[i] << bits;
+        for (bits += fe25_bits(i); bits >= 8; bits -= 8, acc >>= 8)
+            s[j++] = (unsigned char)acc;
+    }
+    s[j] = (unsigned char)acc;
+}
+
+// h = acc with every limb back to its width, limb 1 may keep a small excess
+static void fe_mb_carry(fe_mb *h, uint64_t acc[10][LANES])
+{
+    int i, l;
+
+    for (i = 0; i < 9; ++i)
+    {
+        int w = fe25_bits(i);
+
+        for (l = 0; l < LANES; ++l)
+        {
+            acc[i + 1][l] += acc[i][l] >> w;
+            acc[i][l] &= (UINT64_C(1) << w) - 1;
+        }
+    }
+
+    for (l = 0; l < LANES; ++l)
+    {
+        acc[0][l] += 19 * (acc[9][l] >> 25);
+        acc[9][l] &= (UINT64_C(1) << 25) - 1;
+        acc[1][l] += acc[0][l] >> 26;
+        acc[0][l] &= (UINT64_C(1) << 26) - 1;
+    }
+
+    for (i = 0; i < 10; ++i)
+    {
+        for (l = 0; l < LANES; ++l)
+            h->v[i][l] = (uint32_t)acc[i][l];
+    }
+}
+
+static inline void fe_mb_add(fe_mb *h, const fe_mb *f, const fe_mb *g)
+{
+    int i, l;
+
+    for (i = 0; i < 10; ++i)
+    {
+        for (l = 0; l < LANES; ++l)
+            h->v[i][l] = f->v[i][l] + g->v[i][l];
+    }
+}
+
+static void fe_mb_sub(fe_mb *h, const fe_mb *f, const fe_mb *g)
+{
+    uint64_t acc[10][LANES];
+    int i, l;
+
+    for (i = 0; i < 10; ++i)
+    {
+        for (l = 0; l < LANES; ++l)
+            acc[i][l] = (uint64_t)f->v[i][l] + fe25_4p[i] - g->v[i][l];
+    }
+
+    fe_mb_carry(h, acc);
+}
+
+/*
+ * Schoolbook product, limbs above 2^255 fold back multiplied by 19. Odd limbs carry
+ * half a bit less, so products of two odd limbs landing in an even limb are doubled.
+ * gg[k - i + 9] is the limb of g multiplying f[i] in h[k], so the loops have no branches.
+ */
+static void fe_mb_mul(fe_mb *h, const fe_mb *f, const fe_mb *g)
+{
+    uint64_t acc[10][LANES];
+    uint32_t f2[10][LANES], gg[19][LANES];
+    int i, k, l;
+
+    for (i = 0; i < 10; ++i)
+    {
+        for (l = 0; l < LANES; ++l)
+        {
+            f2[i][l] = f->v[i][l] << (i & 1);
+            gg[i + 9][l] = g->v[i][l];
+            if (i)
+                gg[i - 1][l] = 19 * g->v[i][l];
+        }
+    }
+
+    for (k = 0; k < 10; ++k)
+    {
+        const uint32_t (*a)[LANES] = (k & 1) ? f->v : (const uint32_t (*)[LANES])f2;
+
+        for (l = 0; l < LANES; ++l)
+            acc[k][l] = 0;
+
+        for (i = 0; i < 10; ++i)
+        {
+            for (l = 0; l < LANES; ++l)
+                acc[k][l] += (uint64_t)a[i][l] * gg[k - i + 9][l];
+        }
+    }
+
+    fe_mb_carry(h, acc);
+}
+
+static void fe_mb_sqr_n(fe_mb *h, const fe_mb *f, int n)
+{
+    fe_mb_mul(h, f, f);
+    while (--n > 0)
+        fe_mb_mul(h, h, h);
+}
+
+static void fe_mb_invert(fe_mb *h, const fe_mb *z)
+{
+    fe_mb t0, t1, t2, t3;
+
+    fe_mb_mul(&t0, z, z);
+    fe_mb_sqr_n(&t1, &t0, 2);
+    fe_mb_mul(&t1, z, &t1);
+    fe_mb_mul(&t0, &t0, &t1);
+    fe_mb_mul(&t2, &t0, &t0);
+    fe_mb_mul(&t1, &t1, &t2);
+    fe_mb_sqr_n(&t2, &t1, 5);
+    fe_mb_mul(&t1, &t2, &t1);
+    fe_mb_sqr_n(&t2, &t1, 10);
+    fe_mb_mul(&t2, &t2, &t1);
+    fe_mb_sqr_n(&t3, &t2, 20);
+    fe_mb_mul(&t2, &t3, &t2);
+    fe_mb_sqr_n(&t2, &t2, 10);
+    fe_mb_mul(&t1, &t2, &t1);
+    fe_mb_sqr_n(&t2, &t1, 50);
+    fe_mb_mul(&t2, &t2, &t1);
+    fe_mb_sqr_n(&t3, &t2, 100);
+    fe_mb_mul(&t2, &t3, &t2);
+    fe_mb_sqr_n(&t2, &t2, 50);
+    fe_mb_mul(&t1, &t2, &t1);
+    fe_mb_sqr_n(&t1, &t1, 5);
+    fe_mb_mul(h, &t1, &t0);
+}
+
+static void fe_mb_set(fe_mb *h, uint32_t v)
+{
+    int l;
+
+    memset(h, 0, sizeof(*h));
+    for (l = 0; l < LANES; ++l)
+        h->v[0][l] = v;
+}
+
+/*
+ * Same point arithmetic, one lane per signature
+ */
+
+static void ed_mb_madd(ed_mb_p1p1 *r, const ed_mb_p3 *p, const ed_mb_precomp *q)
+{
+    fe_mb a, b, c, d;
+
+    fe_mb_add(&a, &p->y, &p->x);
+    fe_mb_sub(&b, &p->y, &p->x);
+    fe_mb_mul(&a, &a, &q->ypx);
+    fe_mb_mul(&b, &b, &q->ymx);
+    fe_mb_mul(&c, &q->xy2d, &p->t);
+    fe_mb_add(&d, &p->z, &p->z);
+
+    fe_mb_sub(&r->x, &a, &b);
+    fe_mb_add(&r->y, &a, &b);
+    fe_mb_add(&r->z, &d, &c);
+    fe_mb_sub(&r->t, &d, &c);
+}
+
+static void ed_mb_dbl(ed_mb_p1p1 *r, const ed_mb_p3 *p)
+{
+    fe_mb xx, yy, b, aa;
+
+    fe_mb_mul(&xx, &p->x, &p->x);
+    fe_mb_mul(&yy, &p->y, &p->y);
+    fe_mb_mul(&b, &p->z, &p->z);
+    fe_mb_add(&b, &b, &b);
+    fe_mb_add(&aa, &p->x, &p->y);
+    fe_mb_mul(&aa, &aa, &aa);
+
+    fe_mb_add(&r->y, &yy, &xx);
+    fe_mb_sub(&r->z, &yy, &xx);
+    fe_mb_sub(&r->x, &aa, &r->y);
+    fe_mb_sub(&r->t, &b, &r->z);
+}
+
+static void ed_mb_p1p1_to_p3(ed_mb_p3 *r, const ed_mb_p1p1 *p)
+{
+    fe_mb_mul(&r->x, &p->x, &p->t);
+    fe_mb_mul(&r->y, &p->y, &p->z);
+    fe_mb_mul(&r->z, &p->z, &p->t);
+    fe_mb_mul(&r->t, &p->x, &p->y);
+}
+
+static void ed_mb_select(ed_mb_precomp *t, int pos, const signed char *b)
+{
+    uint32_t babs[LANES], neg[LANES];
+    ed_mb_precomp minus;
+    fe_mb zero;
+    uint32_t j;
+    int i, l;
+
+    for (l = 0; l < LANES; ++l)
+    {
+        int bi = b[l];
+        uint32_t n = (uint32_t)bi >> 31;
+
+        babs[l] = (uint32_t)((bi ^ -(int)n) + (int)n);
+        neg[l] = 0 - n;
+    }
+
+    fe_mb_set(&t->ypx, 1);
+    fe_mb_set(&t->ymx, 1);
+    fe_mb_set(&t->xy2d, 0);
+
+    for (j = 1; j <= 8; ++j)
+    {
+        const ed_precomp25 *e = &accel_ed25519_base25[pos][j - 1];
+        uint32_t mask[LANES];
+
+        for (l = 0; l < LANES; ++l)
+            mask[l] = (uint32_t)ct_is_zero_64(babs[l] ^ j);
+
+        for (i = 0; i < 10; ++i)
+        {
+            for (l = 0; l < LANES; ++l)
+            {
+                t->ypx.v[i][l] ^= (t->ypx.v[i][l] ^ e->ypx[i]) & mask[l];
+                t->ymx.v[i][l] ^= (t->ymx.v[i][l] ^ e->ymx[i]) & mask[l];
+                t->xy2d.v[i][l] ^= (t->xy2d.v[i][l] ^ e->xy2d[i]) & mask[l];
+            }
+        }
+    }
+
+    fe_mb_set(&zero, 0);
+    fe_mb_sub(&minus.xy2d, &zero, &t->xy2d);
+
+    for (i = 0; i < 10; ++i)
+    {
+        for (l = 0; l < LANES; ++l)
+        {
+            uint32_t swap = (t->ypx.v[i][l] ^ t->ymx.v[i][l]) & neg[l];
+
+            t->ypx.v[i][l] ^= swap;
+            t->ymx.v[i][l] ^= swap;
+            t->xy2d.v[i][l] ^= (t->xy2d.v[i][l] ^ minus.xy2d.v[i][l]) & neg[l];
+        }
+    }
+}
+
+static void ed_mb_encode(unsigned char s[LANES][ED25519_BYTES], const ed_mb_p3 *p)
+{
+    fe_mb zinv, x, y;
+    uint32_t limbs[10];
+    unsigned char xb[ED25519_BYTES];
+    int i, l;
+
+    fe_mb_invert(&zinv, &p->z);
+    fe_mb_mul(&x, &p->x, &zinv);
+    fe_mb_mul(&y, &p->y, &zinv);
+
+    for (l = 0; l < LANES; ++l)
+    {
+        for (i = 0; i < 10; ++i)
+            limbs[i] = y.v[i][l];
+        fe25_tobytes(s[l], limbs);
+
+        for (i = 0; i < 10; ++i)
+            limbs[i] = x.v[i][l];
+        fe25_tobytes(xb, limbs);
+
+        s[l][31] ^= (xb[0] & 1) << 7;
+    }
+}
+
+// lane l of f, fully reduced
+static void fe_mb_lane_bytes(unsigned char *s, const fe_mb *f, int l)
+{
+    uint32_t limbs[10];
+    int i;
+
+    for (i = 0; i < 10; ++i)
+        limbs[i] = f->v[i][l];
+    fe25_tobytes(s, limbs);
+}
+
+void MB_MUL_BASE(ACCEL_ED25519_MB_ISA)(const signed char e[64][LANES], unsigned char enc[][ED25519_BYTES],
+                                       unsigned char y[][ED25519_BYTES], unsigned char z[][ED25519_BYTES])
+{
+    ed_mb_precomp t;
+    ed_mb_p1p1 r;
+    ed_mb_p3 h;
+    int i, l;
+
+    memset(&h, 0, sizeof(h));
+    fe_mb_set(&h.y, 1);
+    fe_mb_set(&h.z, 1);
+
+    for (i = 1; i < 64; i += 2)
+    {
+        ed_mb_select(&t, i / 2, e[i]);
+        ed_mb_madd(&r, &h, &t);
+        ed_mb_p1p1_to_p3(&h, &r);
+    }
+
+    for (i = 0; i < 4; ++i)
+    {
+        ed_mb_dbl(&r, &h);
+        ed_mb_p1p1_to_p3(&h, &r);
+    }
+
+    for (i = 0; i < 64; i += 2)
+    {
+        ed_mb_select(&t, i / 2, e[i]);
+        ed_mb_madd(&r, &h, &t);
+        ed_mb_p1p1_to_p3(&h, &r);
+    }
+
+    if (enc)
+        ed_mb_encode(enc, &h);
+
+    for (l = 0; l < LANES; ++l)
+    {
+        if (y)
+            fe_mb_lane_bytes(y[l], &h.y, l);
+        if (z)
+            fe_mb_lane_bytes(z[l], &h.z, l);
+    }
+
+    OPENSSL_cleanse(&t, sizeof(t));
+    OPENSSL_cleanse(&r, sizeof(r));
+    OPENSSL_cleanse(&h, sizeof(h));
+}
@@ -0,0 +1,62 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef _ACCEL_ED25519_MB_H_
+#define _ACCEL_ED25519_MB_H_
+
+#include <stdint.h>
+
+#include "accel_ed25519.h"
+
+#define ED25519_BYTES  32
+
+// table entry in the multi-buffer radix, shared by all lanes
+struct ed_precomp25_t {
+    uint32_t ypx[10], ymx[10], xy2d[10];
+};
+typedef struct ed_precomp25_t ed_precomp25;
+
+// (j + 1) 256^i B, filled by accel_ed25519_init
+extern ed_precomp25 accel_ed25519_base25[32][8];
+
+// radix 2^25.5: 26-bit even and 25-bit odd limbs
+static inline int fe25_bits(int i)
+{
+    return 26 - (i & 1);
+}
+
+/*
+ * a B for ACCEL_ED25519_LANES scalars a given as signed 4-bit digits, e[i][lane] for
+ * digit i. enc gets the encoded points, y and z the canonical Y and Z in extended
+ * coordinates; any of them may be NULL. One copy per instruction set.
+ */
+typedef void ed_mb_mul_base_fn(const signed char e[64][ACCEL_ED25519_LANES], unsigned char enc[][ED25519_BYTES],
+                               unsigned char y[][ED25519_BYTES], unsigned char z[][ED25519_BYTES]);
+
+ed_mb_mul_base_fn accel_ed25519_mb_mul_base_base;
+#ifdef HAVE_ACCEL_AVX2
+ed_mb_mul_base_fn accel_ed25519_mb_mul_base_avx2;
+#endif
+#ifdef HAVE_ACCEL_AVX512
+ed_mb_mul_base_fn accel_ed25519_mb_mul_base_avx512;
+#endif
+
+#endif // _ACCEL_ED25519_MB_H_
@@ -0,0 +1,453 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "accel_evp.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <arpa/inet.h>
+
+#include <openssl/bn.h>
+#include <openssl/evp.h>
+#include <openssl/rsa.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/param_build.h>
+#endif
+
+#include <common/compiler.h>
+
+#include <accessl-common/cmd.h>
+
+#include "accel_thread.h"
+
+#define EVP_CTX_DEC  0
+#define EVP_CTX_SIGN  1
+#define EVP_CTX_ENC  2
+#define EVP_CTX_VERIFY  3
+#define EVP_CTX_COUNT  4
+
+#define EVP_RSA_ELEMS  8
+// r_i, d_i, t_i of the additional primes follow
+#define EVP_RSA_MAX_ELEMS  (EVP_RSA_ELEMS + 3 * (CMD_RSA_MAX_PRIMES - 2))
+
+// EVP_PKEY_CTX initialized for one operation, padding is set only when it changes
+struct evp_ctx_t {
+    EVP_PKEY_CTX *ctx;
+    int pad;
+};
+typedef struct evp_ctx_t evp_ctx;
+
+struct evp_rsa_key_t {
+    EVP_PKEY *pkey;
+    size_t max_len;
+
+    evp_ctx ctx[ACCEL_MAX_THREADS][EVP_CTX_COUNT];
+};
+typedef struct evp_rsa_key_t evp_rsa_key;
+
+static const char *accel_evp_get_name(void *accel_priv UNUSED)
+{
+    return "EVP";
+}
+
+static void accel_evp_free_priv(void *accel_priv UNUSED)
+{
+}
+
+static void accel_evp_rsa_key_destroy(evp_rsa_key *k)
+{
+    int i, j;
+
+    for (i = 0; i < ACCEL_MAX_THREADS; ++i)
+    {
+        for (j = 0; j < EVP_CTX_COUNT; ++j)
+        {
+            if (k->ctx[i][j].ctx)
+                EVP_PKEY_CTX_free(k->ctx[i][j].ctx);
+        }
+    }
+
+    if (k->pkey)
+        EVP_PKEY_free(k->pkey);
+
+    free(k);
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static EVP_PKEY *accel_evp_rsa_pkey(BIGNUM **bn, int count)
+{
+    static const char *names[EVP_RSA_MAX_ELEMS] = {
+        OSSL_PKEY_PARAM_RSA_N, OSSL_PKEY_PARAM_RSA_E, OSSL_PKEY_PARAM_RSA_D,
+        OSSL_PKEY_PARAM_RSA_FACTOR1, OSSL_PKEY_PARAM_RSA_FACTOR2,
+        OSSL_PKEY_PARAM_RSA_EXPONENT1, OSSL_PKEY_PARAM_RSA_EXPONENT2,
+        OSSL_PKEY_PARAM_RSA_COEFFICIENT1,
+        OSSL_PKEY_PARAM_RSA_FACTOR3, OSSL_PKEY_PARAM_RSA_EXPONENT3, OSSL_PKEY_PARAM_RSA_COEFFICIENT2,
+        OSSL_PKEY_PARAM_RSA_FACTOR4, OSSL_PKEY_PARAM_RSA_EXPONENT4, OSSL_PKEY_PARAM_RSA_COEFFICIENT3,
+        OSSL_PKEY_PARAM_RSA_FACTOR5, OSSL_PKEY_PARAM_RSA_EXPONENT5, OSSL_PKEY_PARAM_RSA_COEFFICIENT4,
+    };
+    OSSL_PARAM_BLD *bld = OSSL_PARAM_BLD_new();
+    OSSL_PARAM *params = NULL;
+    EVP_PKEY_CTX *ctx = NULL;
+    EVP_PKEY *pkey = NULL;
+    int i;
+
+    if (unlikely(!bld))
+        return NULL;
+
+    for (i = 0; i < count; ++i)
+    {
+        if (!OSSL_PARAM_BLD_push_BN(bld, names[i], bn[i]))
+            goto end;
+    }
+
+    params = OSSL_PARAM_BLD_to_param(bld);
+    ctx = EVP_PKEY_CTX_new_from_name(NULL, "RSA", NULL);
+    if (!params || !ctx || EVP_PKEY_fromdata_init(ctx) <= 0)
+        goto end;
+
+    if (EVP_PKEY_fromdata(ctx, &pkey, EVP_PKEY_KEYPAIR, params) <= 0)
+        pkey = NULL;
+
+end:
+    EVP_PKEY_CTX_free(ctx);
+    OSSL_PARAM_free(params);
+    OSSL_PARAM_BLD_free(bld);
+    for (i = 0; i < count; ++i)
+        BN_clear_free(bn[i]);
+    return pkey;
+}
+#else
+static EVP_PKEY *accel_evp_rsa_pkey(BIGNUM **bn, int count)
+{
+    EVP_PKEY *pkey = EVP_PKEY_new();
+    RSA *rsa = RSA_new();
+    int i;
+
+    if (unlikely(!pkey || !rsa))
+        goto err;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    if (!RSA_set0_key(rsa, bn[0], bn[1], bn[2]))
+        goto err;
+    bn[0] = bn[1] = bn[2] = NULL;
+    if (!RSA_set0_factors(rsa, bn[3], bn[4]))
+        goto err;
+    bn[3] = bn[4] = NULL;
+    if (!RSA_set0_crt_params(rsa, bn[5], bn[6], bn[7]))
+        goto err;
+    bn[5] = bn[6] = bn[7] = NULL;
+#else
+    rsa->n = bn[0];
+    rsa->e = bn[1];
+    rsa->d = bn[2];
+    rsa->p = bn[3];
+    rsa->q = bn[4];
+    rsa->dmp1 = bn[5];
+    rsa->dmq1 = bn[6];
+    rsa->iqmp = bn[7];
+    memset(bn, 0, EVP_RSA_ELEMS * sizeof(BIGNUM *));
+#endif
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    // needs p and q set, products of the preceding primes are derived from them
+    if (count > EVP_RSA_ELEMS)
+    {
+        BIGNUM *primes[CMD_RSA_MAX_PRIMES], *exps[CMD_RSA_MAX_PRIMES], *coeffs[CMD_RSA_MAX_PRIMES];
+        int pnum = (count - EVP_RSA_ELEMS) / 3;
+
+        for (i = 0; i < pnum; ++i)
+        {
+            primes[i] = bn[EVP_RSA_ELEMS + 3 * i];
+            exps[i] = bn[EVP_RSA_ELEMS + 3 * i + 1];
+            coeffs[i] = bn[EVP_RSA_ELEMS + 3 * i + 2];
+        }
+        if (!RSA_set0_multi_prime_params(rsa, primes, exps, coeffs, pnum))
+            goto err;
+        for (i = EVP_RSA_ELEMS; i < count; ++i)
+            bn[i] = NULL;
+    }
+#else
+    // no multi-prime support before OpenSSL 1.1.1
+    if (count > EVP_RSA_ELEMS)
+        goto err;
+#endif
+
+    if (!EVP_PKEY_assign_RSA(pkey, rsa))
+        goto err;
+
+    return pkey;
+
+err:
+    for (i = 0; i < count; ++i)
+        BN_clear_free(bn[i]);
+    RSA_free(rsa);
+    EVP_PKEY_free(pkey);
+    return NULL;
+}
+#endif
+
+static int accel_evp_rsa_key_decode(evp_rsa_key *k, size_t len, const unsigned char *data)
+{
+    BIGNUM *bn[EVP_RSA_MAX_ELEMS];
+    int i;
+
+    memset(bn, 0, sizeof(bn));
+
+    // n, e, d, p, q, dmp1, dmq1, iqmp [, r_i, d_i, t_i]*
+    for (i = 0; i < EVP_RSA_ELEMS || (len && i < EVP_RSA_MAX_ELEMS); ++i)
+    {
+        const vli *v = (const vli *)data;
+        size_t vlen;
+
+        if (unlikely(len < sizeof(uint32_t)))
+            goto err;
+
+        vlen = ntohl(v->len);
+        if (unlikely(len - sizeof(uint32_t) < vlen))
+            goto err;
+
+        bn[i] = BN_bin2bn(v->data, vlen, NULL);
+        if (unlikely(!bn[i]))
+            goto err;
+
+        data += sizeof(uint32_t) + vlen;
+        len -= sizeof(uint32_t) + vlen;
+    }
+
+    if (unlikely(len || (i - EVP_RSA_ELEMS) % 3))
+        goto err;
+
+    k->max_len = BN_num_bytes(bn[0]);
+    k->pkey = accel_evp_rsa_pkey(bn, i);
+
+    return k->pkey ? 1 : -1;
+
+err:
+    for (i = 0; i < EVP_RSA_MAX_ELEMS; ++i)
+        BN_clear_free(bn[i]);
+    return -1;
+}
+
+static int accel_evp_ctx_init(evp_ctx *c, EVP_PKEY *pkey, int type)
+{
+    int ret;
+
+    c->ctx = EVP_PKEY_CTX_new(pkey, NULL);
+    c->pad = -1;
+    if (unlikely(!c->ctx))
+        return -1;
+
+    switch (type) {
+    case EVP_CTX_DEC:
+        ret = EVP_PKEY_decrypt_init(c->ctx);
+        break;
+    case EVP_CTX_SIGN:
+        ret = EVP_PKEY_sign_init(c->ctx);
+        break;
+    case EVP_CTX_ENC:
+        ret = EVP_PKEY_encrypt_init(c->ctx);
+        break;
+    case EVP_CTX_VERIFY:
+        ret = EVP_PKEY_verify_recover_init(c->ctx);
+        break;
+    default:
+        ret = -1;
+    }
+
+    if (ret <= 0)
+    {
+        EVP_PKEY_CTX_free(c->ctx);
+        c->ctx = NULL;
+        return -1;
+    }
+
+    return 1;
+}
+
+/*
+ * Context for the operation, cached per key and thread so the hot path doesn't
+ * allocate or re-derive key state. Threads without a slot get a temporary one.
+ */
+static evp_ctx *accel_evp_ctx_get(evp_rsa_key *k, int type, evp_ctx *tmp)
+{
+    int slot = accel_thread_slot();
+    evp_ctx *c = slot >= 0 ? &k->ctx[slot][type] : tmp;
+
+    if (unlikely(!c->ctx) && accel_evp_ctx_init(c, k->pkey, type) < 0)
+        return NULL;
+
+    return c;
+}
+
+static int accel_evp_rsa_op(void *key, int type, size_t len UNUSED, const unsigned char *data, unsigned char *result)
+{
+    evp_rsa_key *k = (evp_rsa_key *)key;
+    const cmd_op_rsa *op = (const cmd_op_rsa *)data;
+    int oppad = ntohl(op->pad);
+    size_t outlen = k->max_len;
+    evp_ctx tmp = { NULL, -1 };
+    evp_ctx *c;
+    int ret = -1;
+
+    c = accel_evp_ctx_get(k, type, &tmp);
+    if (unlikely(!c))
+        return -1;
+
+    if (c->pad != oppad)
+    {
+        // padding leaves state behind (e.g. OAEP digest on 1.0.2 rejects RSA_NO_PADDING later), start clean
+        if (c->pad != -1)
+        {
+            EVP_PKEY_CTX_free(c->ctx);
+            if (accel_evp_ctx_init(c, k->pkey, type) < 0)
+                return -1;
+        }
+
+        if (EVP_PKEY_CTX_set_rsa_padding(c->ctx, oppad) <= 0)
+            goto end;
+        c->pad = oppad;
+    }
+
+    switch (type) {
+    case EVP_CTX_DEC:
+        ret = EVP_PKEY_decrypt(c->ctx, result, &outlen, op->data, ntohl(op->len));
+        break;
+    case EVP_CTX_SIGN:
+        ret = EVP_PKEY_sign(c->ctx, result, &outlen, op->data, ntohl(op->len));
+        break;
+    case EVP_CTX_ENC:
+        ret = EVP_PKEY_encrypt(c->ctx, result, &outlen, op->data, ntohl(op->len));
+        break;
+    case EVP_CTX_VERIFY:
+        ret = EVP_PKEY_verify_recover(c->ctx, result, &outlen, op->data, ntohl(op->len));
+        break;
+    }
+
+    ret = ret > 0 ? (int)outlen : -1;
+
+end:
+    if (tmp.ctx)
+        EVP_PKEY_CTX_free(tmp.ctx);
+    return ret;
+}
+
+static int accel_evp_rsa_priv_dec(void *accel_priv UNUSED, void *key, size_t len, const unsigned char *data, unsigned char *result)
+{
+    return accel_evp_rsa_op(key, EVP_CTX_DEC, len, data, result);
+}
+
+static int accel_evp_rsa_priv_enc(void *accel_priv UNUSED, void *key, size_t len, const unsigned char *data, unsigned char *result)
+{
+    return accel_evp_rsa_op(key, EVP_CTX_SIGN, len, data, result);
+}
+
+static int accel_evp_rsa_pub_dec(void *accel_priv UNUSED, void *key, size_t len, const unsigned char *data, unsigned char *result)
+{
+    return accel_evp_rsa_op(key, EVP_CTX_VERIFY, len, data, result);
+}
+
+static int accel_evp_rsa_pub_enc(void *accel_priv UNUSED, void *key, size_t len, const unsigned char *data, unsigned char *result)
+{
+    return accel_evp_rsa_op(key, EVP_CTX_ENC, len, data, result);
+}
+
+static void accel_evp_destroy_key(void *accel_priv UNUSED, int type, void *key)
+{
+    switch (type)
+    {
+    case CMD_KEY_RSA:
+        accel_evp_rsa_key_destroy(key);
+    default:
+        return;
+    }
+}
+
+static void *accel_evp_add_key(void *accel_priv UNUSED, int type, size_t len, const unsigned char *data)
+{
+    switch (type)
+    {
+    case CMD_KEY_RSA:
+        {
+            evp_rsa_key *k = calloc(1, sizeof(evp_rsa_key));
+
+            if (unlikely(!k))
+                return NULL;
+
+            if (accel_evp_rsa_key_decode(k, len, data) < 0)
+            {
+                accel_evp_rsa_key_destroy(k);
+                return NULL;
+            }
+
+            // preload decryption context of the thread adding the key, it is the one doing most ops
+            if (accel_thread_slot() >= 0 && !accel_evp_ctx_get(k, EVP_CTX_DEC, NULL))
+            {
+                accel_evp_rsa_key_destroy(k);
+                return NULL;
+            }
+
+            return k;
+        }
+    default:
+        return NULL;
+    }
+}
+
+static size_t accel_evp_result_max_len(void *accel_priv UNUSED, void *key, int op)
+{
+    switch (op) {
+    case CMD_OP_RSA_PRIV_DEC:
+    case CMD_OP_RSA_PRIV_ENC:
+    case CMD_OP_RSA_PUB_DEC:
+    case CMD_OP_RSA_PUB_ENC:
+        {
+            evp_rsa_key *k = (evp_rsa_key *)key;
+            return k->max_len;
+        }
+    default:
+        return -1;
+    }
+}
+
+static accel_method evp_accel_method = {
+    .free_priv = accel_evp_free_priv,
+    .get_name = accel_evp_get_name,
+    .add_key = accel_evp_add_key,
+    .destroy_key = accel_evp_destroy_key,
+    .result_max_len = accel_evp_result_max_len,
+    .rsa_priv_dec = accel_evp_rsa_priv_dec,
+    .rsa_pub_dec = accel_evp_rsa_pub_dec,
+    .rsa_priv_enc = accel_evp_rsa_priv_enc,
+    .rsa_pub_enc = accel_evp_rsa_pub_enc,
+    .perform_batch = NULL,
+};
+
+accelerator *accel_evp_method()
+{
+    accelerator *ret = malloc(sizeof(accelerator));
+    if (!ret)
+        return ret;
+
+    ret->method = &evp_accel_method;
+    ret->priv = NULL;
+
+    return ret;
+}
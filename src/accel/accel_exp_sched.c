@@ -0,0 +1,170 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <common/compiler.h>
+
+#include "accel_exp_sched.h"
+
+static inline int exp_bit(const unsigned char *exp, size_t len, size_t i)
+{
+    return (exp[len - 1 - i / 8] >> (i % 8)) & 1;
+}
+
+static size_t exp_bits(const unsigned char *exp, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; ++i)
+    {
+        if (exp[i])
+        {
+            size_t bits = (len - i) * 8;
+            unsigned char c = exp[i];
+
+            while (!(c & 0x80))
+            {
+                c <<= 1;
+                --bits;
+            }
+            return bits;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Scans the exponent from the most significant bit with sliding windows of given width.
+ * Returns the number of multiplications (excluding squarings) and, if steps is not NULL,
+ * fills the schedule.
+ */
+static size_t exp_sched_scan(exp_sched *s, const unsigned char *exp, size_t len, size_t bits, int window)
+{
+    size_t mults = 0, count = 0;
+    uint32_t pending_sqr = 0;
+    int first = 1;
+    long i = (long)bits - 1;
+
+    while (i >= 0)
+    {
+        long j, b;
+        int val = 0;
+
+        if (!exp_bit(exp, len, i))
+        {
+            ++pending_sqr;
+            --i;
+            continue;
+        }
+
+        // window must end with a set bit so that it maps to an odd power
+        j = i - window + 1;
+        if (j < 0)
+            j = 0;
+        while (!exp_bit(exp, len, j))
+            ++j;
+
+        for (b = i; b >= j; --b)
+            val = (val << 1) | exp_bit(exp, len, b);
+
+        if (first)
+        {
+            if (s)
+                s->first = val >> 1;
+            first = 0;
+        }
+        else
+        {
+            pending_sqr += i - j + 1;
+            if (s)
+            {
+                s->steps[count].sqr = pending_sqr;
+                s->steps[count].mul = val >> 1;
+            }
+            ++count;
+            ++mults;
+            pending_sqr = 0;
+        }
+
+        i = j - 1;
+    }
+
+    if (pending_sqr)
+    {
+        if (s)
+        {
+            s->steps[count].sqr = pending_sqr;
+            s->steps[count].mul = -1;
+        }
+        ++count;
+    }
+
+    if (s)
+        s->count = count;
+
+    return mults;
+}
+
+int exp_sched_compile(exp_sched *s, const unsigned char *exp, size_t len)
+{
+    size_t bits = exp_bits(exp, len);
+    size_t best_cost = (size_t)-1;
+    int w, best = 1;
+
+    memset(s, 0, sizeof(*s));
+    s->window = 1;
+    s->first = -1;
+
+    if (bits == 0)
+        return 1;
+
+    // pick the window which minimizes table setup + multiplications for this very exponent
+    for (w = 1; w <= EXP_SCHED_MAX_WINDOW; ++w)
+    {
+        size_t table = (w == 1) ? 0 : (size_t)1 << (w - 1); // base^2 and 2^(w-1)-1 multiplications
+        size_t cost = table + exp_sched_scan(NULL, exp, len, bits, w);
+
+        if (cost < best_cost)
+        {
+            best_cost = cost;
+            best = w;
+        }
+    }
+
+    s->window = best;
+    s->steps = malloc(bits * sizeof(exp_sched_step));
+    if (unlikely(!s->steps))
+        return -1;
+
+    exp_sched_scan(s, exp, len, bits, best);
+
+    return 1;
+}
+
+void exp_sched_free(exp_sched *s)
+{
+    free(s->steps);
+    s->steps = NULL;
+    s->count = 0;
+    s->first = -1;
+}
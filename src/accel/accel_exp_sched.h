@@ -0,0 +1,59 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _ACCEL_EXP_SCHED_H_
+#define _ACCEL_EXP_SCHED_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// widest sliding window considered, table then holds 2^(7-1) = 64 odd powers
+#define EXP_SCHED_MAX_WINDOW  7
+
+/*
+ * Exponentiation schedule compiled once per (fixed) exponent.
+ *
+ * The accumulator starts as table[first] (base^(2*first+1)), then for every
+ * step it is squared `sqr` times and multiplied by table[mul] (unless mul is -1).
+ * Table holds odd powers base^1, base^3, ..., base^(2^window-1).
+ */
+struct exp_sched_step_t {
+    uint32_t sqr;
+    int32_t mul;
+};
+typedef struct exp_sched_step_t exp_sched_step;
+
+struct exp_sched_t {
+    int window;
+    int first; // -1 for zero exponent
+    size_t count;
+    exp_sched_step *steps;
+};
+typedef struct exp_sched_t exp_sched;
+
+int exp_sched_compile(exp_sched *s, const unsigned char *exp, size_t len);
+void exp_sched_free(exp_sched *s);
+
+static inline int exp_sched_table_size(const exp_sched *s)
+{
+    return 1 << (s->window - 1);
+}
+
+#endif // _ACCEL_EXP_SCHED_H_
@@ -28,6 +28,37 @@
 #include <accessl-common/cmd.h>
 
 #include "accel_gmp.h"
+#include "accel_exp_sched.h"
+#include "accel_par.h"
+
+// below that the helper thread wake-up eats most of the gain
+#define ACCEL_GMP_PARALLEL_MIN_BITS  2048
+
+struct gmp_mont_t {
+    mp_size_t n;
+    mp_limb_t *m;
+    mp_limb_t *rr; // R^2 mod m
+    mp_limb_t *rrr; // R^3 mod m, brings I / R straight into Montgomery form
+    mp_limb_t minv; // -m^-1 mod B
+};
+typedef struct gmp_mont_t gmp_mont;
+
+#ifdef HAVE_GMPN_REDC_1
+// not a documented GMP function, but exported since 5.1 and much faster than the generic loop
+mp_limb_t __gmpn_redc_1(mp_ptr rp, mp_ptr up, mp_srcptr mp, mp_size_t n, mp_limb_t invm);
+#endif
+
+// additional prime of a multi-prime key
+struct gmp_rsa_prime_t {
+    mpz_t r;
+    mpz_t d;
+    mpz_t t;
+    mpz_t R; // product of all preceding primes
+
+    gmp_mont mont;
+    exp_sched sched;
+};
+typedef struct gmp_rsa_prime_t gmp_rsa_prime;
 
 struct gmp_rsa_key_t {
     mpz_t n;
@@ -38,21 +69,101 @@ struct gmp_rsa_key_t {
     mpz_t dmp1;
     mpz_t dmq1;
     mpz_t iqmp;
+
+    // precomputed at key load, CRT exponents never change
+    gmp_mont mont_p;
+    gmp_mont mont_q;
+    mp_limb_t *iqmp_mont; // iqmp R mod p, Garner's multiplier in Montgomery form
+    exp_sched dmp1_sched;
+    exp_sched dmq1_sched;
+
+    int other_primes;
+    gmp_rsa_prime other[CMD_RSA_MAX_PRIMES - 2];
 };
 typedef struct gmp_rsa_key_t gmp_rsa_key;
 
+struct gmp_crt_half_t {
+    mpz_ptr r;
+    mpz_srcptr I; // not reduced modulo prime yet
+    mpz_srcptr prime;
+    mpz_srcptr exp;
+    const exp_sched *sched;
+    const gmp_mont *mont;
+};
+typedef struct gmp_crt_half_t gmp_crt_half;
+
+// per-thread temporaries, mpz keep their storage so steady state does not allocate
+struct gmp_scratch_t {
+    int init;
+    mpz_t I;
+    mpz_t r;
+    mpz_t a;
+    mpz_t t;
+    mpz_t m1;
+    mpz_t mi;
+    mpz_t half;
+};
+typedef struct gmp_scratch_t gmp_scratch;
+
+// scratch of mod_exp_limbs, mpz are preallocated for the largest modulus it was made for
+struct gmp_limb_scratch_t {
+    gmp_scratch mpz;
+    mp_size_t n;
+    mp_limb_t *t; // 2n limbs, products of the blinding
+    mp_limb_t *q; // n + 1 limbs, their quotients
+};
+typedef struct gmp_limb_scratch_t gmp_limb_scratch;
+
+static __thread gmp_scratch scratch;
+
+static int gmp_parallel_crt = 0;
+
 static const char *accel_gmp_get_name(void)
 {
     return "GMP";
 }
 
+static void accel_gmp_scratch_init(gmp_scratch *s, mp_bitcnt_t bits)
+{
+    mpz_init2(s->I, bits);
+    mpz_init2(s->r, bits);
+    mpz_init2(s->a, bits);
+    mpz_init2(s->t, bits);
+    mpz_init2(s->m1, bits);
+    mpz_init2(s->mi, bits);
+    mpz_init2(s->half, bits);
+    s->init = 1;
+}
+
+static void accel_gmp_scratch_clear(gmp_scratch *s)
+{
+    mpz_clear(s->I);
+    mpz_clear(s->r);
+    mpz_clear(s->a);
+    mpz_clear(s->t);
+    mpz_clear(s->m1);
+    mpz_clear(s->mi);
+    mpz_clear(s->half);
+    s->init = 0;
+}
+
+static gmp_scratch *accel_gmp_scratch(void)
+{
+    gmp_scratch *s = &scratch;
+
+    if (unlikely(!s->init))
+        accel_gmp_scratch_init(s, 0);
+
+    return s;
+}
+
 static void bn2gmp(const BIGNUM *bn, mpz_t g)
 {
     bn_check_top(bn);
     if(((sizeof(bn->d[0]) * 8) == GMP_NUMB_BITS) && (BN_BITS2 == GMP_NUMB_BITS)) 
     {
-        /* The common case */
-        if(!_mpz_realloc (g, bn->top))
+        /* The common case, only grows so that the scratch keeps its size */
+        if(g->_mp_alloc < bn->top && !_mpz_realloc (g, bn->top))
             return;
         memcpy(&g->_mp_d[0], &bn->d[0], bn->top * sizeof(bn->d[0]));
         g->_mp_size = bn->top;
@@ -93,11 +204,281 @@ static void gmp2bn(mpz_t g, BIGNUM *bn)
     }
 }
 
+// read-only mpz over n limbs at p, what mpz_roinit_n does from GMP 6 on
+static mpz_srcptr limbs_view(mpz_t g, const mp_limb_t *p, mp_size_t n)
+{
+    while (n > 0 && p[n - 1] == 0)
+        --n;
+
+    g->_mp_alloc = n;
+    g->_mp_size = n;
+    g->_mp_d = (mp_limb_t *)p;
+
+    return g;
+}
+
+static void gmp2limbs(const mpz_t g, mp_limb_t *p, mp_size_t n)
+{
+    mp_size_t s = mpz_size(g);
+
+    memcpy(p, g->_mp_d, s * sizeof(mp_limb_t));
+    memset(p + s, 0, (n - s) * sizeof(mp_limb_t));
+}
+
+static void limbs2gmp(const mp_limb_t *p, mp_size_t n, mpz_t g)
+{
+    while (n > 0 && p[n - 1] == 0)
+        --n;
+
+    // _mpz_realloc would also shrink the scratch sized at start
+    if(g->_mp_alloc < n && !_mpz_realloc(g, n))
+        return;
+    memcpy(g->_mp_d, p, n * sizeof(mp_limb_t));
+    g->_mp_size = n;
+}
+
+static void accel_gmp_mont_free(gmp_mont *mont)
+{
+    free(mont->m);
+    free(mont->rr);
+    free(mont->rrr);
+    memset(mont, 0, sizeof(*mont));
+}
+
+static int accel_gmp_mont_init(gmp_mont *mont, const mpz_t m)
+{
+    mpz_t rr;
+    mp_limb_t inv;
+    int i;
+
+    accel_gmp_mont_free(mont);
+
+    if (mpz_sgn(m) <= 0 || mpz_even_p(m))
+        return -1;
+
+    mont->n = mpz_size(m);
+    mont->m = malloc(mont->n * sizeof(mp_limb_t));
+    mont->rr = malloc(mont->n * sizeof(mp_limb_t));
+    mont->rrr = malloc(mont->n * sizeof(mp_limb_t));
+    if (unlikely(!mont->m || !mont->rr || !mont->rrr))
+    {
+        accel_gmp_mont_free(mont);
+        return -1;
+    }
+
+    gmp2limbs(m, mont->m, mont->n);
+
+    // Newton iteration, each step doubles the number of correct low bits (3 to start with)
+    inv = mont->m[0];
+    for (i = 0; i < 5; ++i)
+        inv *= 2 - mont->m[0] * inv;
+    mont->minv = -inv;
+
+    mpz_init(rr);
+    mpz_setbit(rr, 2 * mont->n * GMP_NUMB_BITS);
+    mpz_mod(rr, rr, m);
+    gmp2limbs(rr, mont->rr, mont->n);
+    mpz_mul_2exp(rr, rr, mont->n * GMP_NUMB_BITS);
+    mpz_mod(rr, rr, m);
+    gmp2limbs(rr, mont->rrr, mont->n);
+    mpz_clear(rr);
+
+    return 1;
+}
+
+// rp = tp / R mod m, tp has 2n limbs and is destroyed
+static void accel_gmp_redc(mp_limb_t *rp, mp_limb_t *tp, const gmp_mont *mont)
+{
+    mp_size_t n = mont->n;
+    mp_limb_t cy;
+
+#ifdef HAVE_GMPN_REDC_1
+    cy = __gmpn_redc_1(rp, tp, mont->m, n, mont->minv);
+#else
+    mp_size_t i;
+
+    for (i = 0; i < n; ++i)
+    {
+        // tp[i] becomes 0, its slot keeps the carry which belongs to tp[i+n]
+        tp[i] = mpn_addmul_1(tp + i, mont->m, n, tp[i] * mont->minv);
+    }
+
+    cy = mpn_add_n(rp, tp + n, tp, n);
+#endif
+    if (cy || mpn_cmp(rp, mont->m, n) >= 0)
+        mpn_sub_n(rp, rp, mont->m, n);
+}
+
+static inline void accel_gmp_mont_mul(mp_limb_t *rp, const mp_limb_t *ap, const mp_limb_t *bp, const gmp_mont *mont, mp_limb_t *tp)
+{
+    mpn_mul_n(tp, ap, bp, mont->n);
+    accel_gmp_redc(rp, tp, mont);
+}
+
+static inline void accel_gmp_mont_sqr(mp_limb_t *rp, const mp_limb_t *ap, const gmp_mont *mont, mp_limb_t *tp)
+{
+    mpn_sqr(tp, ap, mont->n);
+    accel_gmp_redc(rp, tp, mont);
+}
+
+/*
+ * bp = I / R mod m with one REDC instead of a division. Works for any I below m R, which
+ * covers the CRT split of I < p q unless q has more limbs than p; 0 if I is too large.
+ */
+static int accel_gmp_mont_split(mp_limb_t *bp, const mpz_t I, const gmp_mont *mont)
+{
+    mp_size_t n = mont->n, size = mpz_size(I);
+    mp_limb_t tp[2 * n];
+
+    if (unlikely(size > 2 * n || (size == 2 * n && mpn_cmp(I->_mp_d + n, mont->m, n) >= 0)))
+        return 0;
+
+    gmp2limbs(I, tp, 2 * n);
+    accel_gmp_redc(bp, tp, mont);
+
+    return 1;
+}
+
+// rp = b^e mod m, where bp = b R^k, to_mont = R^(2-k) mod m and the exponent e was compiled into sched, bp < m
+static void accel_gmp_powm_sched(mp_limb_t *rp, const mp_limb_t *bp, const mp_limb_t *to_mont, const exp_sched *sched, const gmp_mont *mont)
+{
+    mp_size_t n = mont->n;
+    int table_size = exp_sched_table_size(sched);
+    mp_limb_t table[table_size * n];
+    mp_limb_t tp[2 * n];
+    mp_limb_t x2[n];
+    size_t i;
+    uint32_t j;
+    int k;
+
+    if (unlikely(sched->first < 0))
+    {
+        memset(rp, 0, n * sizeof(mp_limb_t));
+        rp[0] = 1;
+        return;
+    }
+
+    // table[k] = b^(2k+1) * R mod m
+    accel_gmp_mont_mul(table, bp, to_mont, mont, tp);
+    if (table_size > 1)
+    {
+        accel_gmp_mont_sqr(x2, table, mont, tp);
+        for (k = 1; k < table_size; ++k)
+            accel_gmp_mont_mul(table + k * n, table + (k - 1) * n, x2, mont, tp);
+    }
+
+    memcpy(rp, table + sched->first * n, n * sizeof(mp_limb_t));
+
+    for (i = 0; i < sched->count; ++i)
+    {
+        const exp_sched_step *step = &sched->steps[i];
+
+        for (j = 0; j < step->sqr; ++j)
+            accel_gmp_mont_sqr(rp, rp, mont, tp);
+        if (step->mul >= 0)
+            accel_gmp_mont_mul(rp, rp, table + step->mul * n, mont, tp);
+    }
+
+    // leave Montgomery domain
+    memcpy(tp, rp, n * sizeof(mp_limb_t));
+    memset(tp + n, 0, n * sizeof(mp_limb_t));
+    accel_gmp_redc(rp, tp, mont);
+}
+
+// r = (I mod m)^e mod m, half is a temporary
+static void accel_gmp_powm(mpz_t r, const mpz_t I, const mpz_t e, const mpz_t m, const exp_sched *sched, const gmp_mont *mont, mpz_t half)
+{
+    if (likely(sched->steps && mont->n))
+    {
+        mp_size_t n = mont->n;
+        mp_limb_t bp[n], rp[n];
+
+        if (likely(accel_gmp_mont_split(bp, I, mont)))
+            accel_gmp_powm_sched(rp, bp, mont->rrr, sched, mont);
+        else
+        {
+            mpz_mod(half, I, m);
+            gmp2limbs(half, bp, n);
+            accel_gmp_powm_sched(rp, bp, mont->rr, sched, mont);
+        }
+        limbs2gmp(rp, n, r);
+    }
+    else
+    {
+        mpz_mod(half, I, m);
+        mpz_powm(r, half, e, m);
+    }
+}
+
+/*
+ * r = m_q + q ((m_p - m_q) iqmp mod p), m_p < p, r may alias m_p. The product by iqmp is
+ * one Montgomery multiplication with iqmp R mod p; only keys with q much larger than p
+ * need a division.
+ */
+static void accel_gmp_garner(const gmp_rsa_key *key, mpz_t r, mpz_srcptr m_p, mpz_srcptr m_q, mpz_t t)
+{
+    const gmp_mont *mont = &key->mont_p;
+    mp_size_t n = mont->n;
+    mp_limb_t dp[n], hp[n], tp[2 * n];
+
+    mpz_sub(t, m_p, m_q);
+    if (mpz_sgn(t) < 0)
+        mpz_add(t, t, key->p);
+    if (unlikely(mpz_sgn(t) < 0))
+        mpz_mod(t, t, key->p);
+
+    gmp2limbs(t, dp, n);
+    accel_gmp_mont_mul(hp, dp, key->iqmp_mont, mont, tp);
+    limbs2gmp(hp, n, t);
+
+    mpz_mul(r, t, key->q);
+    mpz_add(r, r, m_q);
+}
+
+static int accel_gmp_rsa_key_decode_other(gmp_rsa_key *key, int mod_exp_elem, unsigned char *data, size_t len)
+{
+    int i = (mod_exp_elem - ACCEL_MOD_EXP_RSA_OTHER) / 3;
+    gmp_rsa_prime *o;
+
+    if (unlikely(i >= CMD_RSA_MAX_PRIMES - 2))
+        return -1;
+
+    o = &key->other[i];
+
+    switch ((mod_exp_elem - ACCEL_MOD_EXP_RSA_OTHER) % 3) {
+    case 0:
+        mpz_import(o->r, len, 1, 1, 0, 0, data);
+        if (i == 0)
+            mpz_mul(o->R, key->p, key->q);
+        else
+            mpz_mul(o->R, key->other[i - 1].R, key->other[i - 1].r);
+        if (accel_gmp_mont_init(&o->mont, o->r) < 0)
+            return -1;
+        if (key->other_primes < i + 1)
+            key->other_primes = i + 1;
+        break;
+    case 1:
+        mpz_import(o->d, len, 1, 1, 0, 0, data);
+        exp_sched_free(&o->sched);
+        if (exp_sched_compile(&o->sched, data, len) < 0)
+            return -1;
+        break;
+    default:
+        mpz_import(o->t, len, 1, 1, 0, 0, data);
+        break;
+    }
+
+    return 1;
+}
+
 static int accel_gmp_rsa_key_decode_elem(void *k, int mod_exp_elem, unsigned char *data, size_t len)
 {
     gmp_rsa_key *key = (gmp_rsa_key *)k;
     mpz_t *g;
 
+    if (mod_exp_elem >= ACCEL_MOD_EXP_RSA_OTHER)
+        return accel_gmp_rsa_key_decode_other(key, mod_exp_elem, data, len);
+
     switch (mod_exp_elem) {
     case ACCEL_MOD_EXP_RSA_N:
         g = &key->n;
@@ -129,12 +510,54 @@ static int accel_gmp_rsa_key_decode_elem(void *k, int mod_exp_elem, unsigned cha
 
     mpz_import(*g, len, 1, 1, 0, 0, data);
 
+    switch (mod_exp_elem) {
+    case ACCEL_MOD_EXP_RSA_P:
+        if (accel_gmp_mont_init(&key->mont_p, key->p) < 0)
+            return -1;
+        break;
+    case ACCEL_MOD_EXP_RSA_Q:
+        if (accel_gmp_mont_init(&key->mont_q, key->q) < 0)
+            return -1;
+        break;
+    case ACCEL_MOD_EXP_RSA_DMP1:
+        exp_sched_free(&key->dmp1_sched);
+        if (exp_sched_compile(&key->dmp1_sched, data, len) < 0)
+            return -1;
+        break;
+    case ACCEL_MOD_EXP_RSA_DMQ1:
+        exp_sched_free(&key->dmq1_sched);
+        if (exp_sched_compile(&key->dmq1_sched, data, len) < 0)
+            return -1;
+        break;
+    case ACCEL_MOD_EXP_RSA_IQMP:
+        // p comes first
+        if (unlikely(!key->mont_p.n))
+            return -1;
+        free(key->iqmp_mont);
+        key->iqmp_mont = malloc(key->mont_p.n * sizeof(mp_limb_t));
+        if (unlikely(!key->iqmp_mont))
+            return -1;
+        {
+            mpz_t t;
+
+            mpz_init(t);
+            mpz_mul_2exp(t, key->iqmp, key->mont_p.n * GMP_NUMB_BITS);
+            mpz_mod(t, t, key->p);
+            gmp2limbs(t, key->iqmp_mont, key->mont_p.n);
+            mpz_clear(t);
+        }
+        break;
+    default:
+        break;
+    }
+
     return 1;
 }
 
 static void accel_gmp_rsa_key_destroy(void *k)
 {
     gmp_rsa_key *key = (gmp_rsa_key *)k;
+    int i;
 
     mpz_clear(key->n);
     mpz_clear(key->e);
@@ -145,6 +568,24 @@ static void accel_gmp_rsa_key_destroy(void *k)
     mpz_clear(key->dmq1);
     mpz_clear(key->iqmp);
 
+    accel_gmp_mont_free(&key->mont_p);
+    accel_gmp_mont_free(&key->mont_q);
+    free(key->iqmp_mont);
+    exp_sched_free(&key->dmp1_sched);
+    exp_sched_free(&key->dmq1_sched);
+
+    for (i = 0; i < CMD_RSA_MAX_PRIMES - 2; ++i)
+    {
+        gmp_rsa_prime *o = &key->other[i];
+
+        mpz_clear(o->r);
+        mpz_clear(o->d);
+        mpz_clear(o->t);
+        mpz_clear(o->R);
+        accel_gmp_mont_free(&o->mont);
+        exp_sched_free(&o->sched);
+    }
+
     free(k);
 }
 
@@ -157,50 +598,192 @@ static void *accel_gmp_rsa_key_alloc(void)
     return k;
 }
 
-static void accel_gmp_mod_exp(gmp_rsa_key *key, mpz_t r0, mpz_t I0)
+static void accel_gmp_crt_half(void *arg)
+{
+    gmp_crt_half *h = (gmp_crt_half *)arg;
+    gmp_scratch *s = accel_gmp_scratch(); // of the thread running this half
+
+    accel_gmp_powm(h->r, h->I, h->exp, h->prime, h->sched, h->mont, s->half);
+}
+
+static void accel_gmp_mod_exp(gmp_rsa_key *key, mpz_t r0, mpz_srcptr I0, gmp_scratch *s)
+{
+    mpz_ptr r1 = s->t, m1 = s->m1;
+    gmp_crt_half half_p, half_q, half_r;
+    accel_par_task task;
+    int i;
+
+    half_q.r = m1;
+    half_q.I = I0;
+    half_q.prime = key->q;
+    half_q.exp = key->dmq1;
+    half_q.sched = &key->dmq1_sched;
+    half_q.mont = &key->mont_q;
+
+    half_p.r = r0;
+    half_p.I = I0;
+    half_p.prime = key->p;
+    half_p.exp = key->dmp1;
+    half_p.sched = &key->dmp1_sched;
+    half_p.mont = &key->mont_p;
+
+    if (gmp_parallel_crt &&
+        mpz_size(key->n) * GMP_NUMB_BITS >= ACCEL_GMP_PARALLEL_MIN_BITS &&
+        accel_par_fork(&task, accel_gmp_crt_half, &half_q))
+    {
+        accel_gmp_crt_half(&half_p);
+        accel_par_join(&task);
+    }
+    else
+    {
+        accel_gmp_crt_half(&half_q);
+        accel_gmp_crt_half(&half_p);
+    }
+
+    accel_gmp_garner(key, r0, r0, m1, r1);
+
+    // multi-prime keys, RFC 8017 5.1.2 step 2.b.(v): r0 += R_i * ((m_i - r0) * t_i mod r_i)
+    for (i = 0; i < key->other_primes; ++i)
+    {
+        const gmp_rsa_prime *o = &key->other[i];
+
+        half_r.r = s->mi;
+        half_r.I = I0;
+        half_r.prime = o->r;
+        half_r.exp = o->d;
+        half_r.sched = &o->sched;
+        half_r.mont = &o->mont;
+        accel_gmp_crt_half(&half_r);
+
+        mpz_sub(s->mi, s->mi, r0);
+        mpz_mul(r1, s->mi, o->t);
+        mpz_mod(s->mi, r1, o->r);
+        mpz_mul(r1, s->mi, o->R);
+        mpz_add(r0, r0, r1);
+    }
+}
+
+static int accel_gmp_rsa_mod_exp(void *k, BIGNUM *r0, const BIGNUM *I0)
 {
-    mpz_t r1, m1;
+    gmp_scratch *s = accel_gmp_scratch();
+    gmp_rsa_key *key = (gmp_rsa_key *)k;
 
-    mpz_init(r1);
-    mpz_init(m1);
+    bn2gmp(I0, s->I);
+    accel_gmp_mod_exp(key, s->r, s->I, s);
+    gmp2bn(s->r, r0);
 
-    mpz_mod(r1, I0, key->q);
-    mpz_powm(m1, r1, key->dmq1, key->q);
+    return 1;
+}
 
-    mpz_mod(r1, I0, key->p);
-    mpz_powm(r0, r1, key->dmp1, key->p);
+static int accel_gmp_rsa_mod_exp_bin(void *k, unsigned char *r, const unsigned char *I, size_t len, const BIGNUM *A, const BIGNUM *Ai)
+{
+    gmp_scratch *s = accel_gmp_scratch();
+    gmp_rsa_key *key = (gmp_rsa_key *)k;
+    size_t rlen;
 
-    mpz_sub(r0, r0, m1);
+    mpz_import(s->I, len, 1, 1, 0, 0, I);
 
-    if(mpz_sgn(r0) < 0)
-        mpz_add(r0, r0, key->p);
-    mpz_mul(r1, r0, key->iqmp);
-    mpz_mod(r0, r1, key->p);
+    if (A)
+    {
+        bn2gmp(A, s->a);
+        mpz_mul(s->t, s->I, s->a);
+        mpz_mod(s->I, s->t, key->n);
+    }
+
+    accel_gmp_mod_exp(key, s->r, s->I, s);
+
+    if (Ai)
+    {
+        bn2gmp(Ai, s->a);
+        mpz_mul(s->t, s->r, s->a);
+        mpz_mod(s->r, s->t, key->n);
+    }
+
+    memset(r, 0, len);
+    if (mpz_sgn(s->r) == 0)
+        return 1;
 
-    if(mpz_sgn(r0) < 0)
-        mpz_add(r0, r0, key->p);
-    mpz_mul(r1, r0, key->q);
-    mpz_add(r0, r1, m1);
+    rlen = (mpz_sizeinbase(s->r, 2) + 7) / 8;
+    if (unlikely(rlen > len))
+        return 0;
 
-    mpz_clear(r1);
-    mpz_clear(m1);
+    mpz_export(r + len - rlen, NULL, 1, 1, 0, 0, s->r);
+
+    return 1;
 }
 
-static int accel_gmp_rsa_mod_exp(void *k, BIGNUM *r0, const BIGNUM *I0)
+#if GMP_NUMB_BITS == 64 && GMP_NAIL_BITS == 0
+static void accel_gmp_free_scratch(void *p)
+{
+    gmp_limb_scratch *ls = (gmp_limb_scratch *)p;
+
+    if (!ls)
+        return;
+
+    if (ls->mpz.init)
+        accel_gmp_scratch_clear(&ls->mpz);
+    free(ls->t);
+    free(ls);
+}
+
+static void *accel_gmp_alloc_scratch(size_t nlimbs)
+{
+    gmp_limb_scratch *ls = calloc(1, sizeof(gmp_limb_scratch));
+
+    if (unlikely(!ls))
+        return NULL;
+
+    ls->n = nlimbs;
+    ls->t = malloc((3 * nlimbs + 1) * sizeof(mp_limb_t));
+    if (unlikely(!ls->t))
+    {
+        accel_gmp_free_scratch(ls);
+        return NULL;
+    }
+    ls->q = ls->t + 2 * nlimbs;
+
+    // room for the double size products of the CRT, so steady state never reallocates
+    accel_gmp_scratch_init(&ls->mpz, (2 * nlimbs + 2) * GMP_NUMB_BITS);
+
+    return ls;
+}
+
+// the CRT itself still works on mpz, but on views of the caller's limbs and preallocated temporaries
+static int accel_gmp_rsa_mod_exp_limbs(void *k, uint64_t *r, const uint64_t *I, size_t nlimbs,
+                                       const uint64_t *A, const uint64_t *Ai, void *scratch)
 {
-    mpz_t gmp_r0, gmp_I0;
     gmp_rsa_key *key = (gmp_rsa_key *)k;
+    gmp_limb_scratch *ls = (gmp_limb_scratch *)scratch;
+    gmp_scratch *s = &ls->mpz;
+    mp_size_t n = nlimbs;
+    mp_limb_t *rp = (mp_limb_t *)r;
+    mpz_t in;
+
+    if (unlikely(n != (mp_size_t)mpz_size(key->n) || n > ls->n))
+        return 0;
+
+    if (A)
+    {
+        // rp holds the blinded input until the result overwrites it
+        mpn_mul_n(ls->t, (const mp_limb_t *)I, (const mp_limb_t *)A, n);
+        mpn_tdiv_qr(ls->q, rp, 0, ls->t, 2 * n, key->n->_mp_d, n);
+        limbs_view(in, rp, n);
+    }
+    else
+        limbs_view(in, (const mp_limb_t *)I, n);
 
-    mpz_init(gmp_r0);
-    mpz_init(gmp_I0);
-    bn2gmp(I0, gmp_I0);
-    accel_gmp_mod_exp(key, gmp_r0, gmp_I0);
-    gmp2bn(gmp_r0, r0);
-    mpz_clear(gmp_r0);
-    mpz_clear(gmp_I0);
+    accel_gmp_mod_exp(key, s->r, in, s);
+    gmp2limbs(s->r, rp, n);
+
+    if (Ai)
+    {
+        mpn_mul_n(ls->t, rp, (const mp_limb_t *)Ai, n);
+        mpn_tdiv_qr(ls->q, rp, 0, ls->t, 2 * n, key->n->_mp_d, n);
+    }
 
     return 1;
 }
+#endif
 
 static mod_exp_method gmp = {
     .get_name = accel_gmp_get_name,
@@ -208,8 +791,19 @@ static mod_exp_method gmp = {
     .free_priv = accel_gmp_rsa_key_destroy,
     .decode_elem = accel_gmp_rsa_key_decode_elem,
     .mod_exp = accel_gmp_rsa_mod_exp,
+    .mod_exp_bin = accel_gmp_rsa_mod_exp_bin,
+#if GMP_NUMB_BITS == 64 && GMP_NAIL_BITS == 0
+    .mod_exp_limbs = accel_gmp_rsa_mod_exp_limbs,
+    .alloc_scratch = accel_gmp_alloc_scratch,
+    .free_scratch = accel_gmp_free_scratch,
+#endif
 };
 
+void accel_gmp_set_parallel_crt(int enable)
+{
+    gmp_parallel_crt = enable;
+}
+
 mod_exp_method *accel_gmp_method()
 {
     return &gmp;
@@ -25,4 +25,7 @@
 
 mod_exp_method *accel_gmp_method(void);
 
+// run mod p and mod q exponentiations on two cores (needs accel_par_init)
+void accel_gmp_set_parallel_crt(int enable);
+
 #endif // _ACCELERATOR_GMP_H_
@@ -0,0 +1,203 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#define BOOST_TEST_MODULE accel_gmp
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include <vector>
+
+#include <boost/test/included/unit_test.hpp>
+
+#include <gmp.h>
+#include <openssl/rsa.h>
+
+extern "C" {
+#include "accel_base.h"
+#include "accel_gmp.h"
+#include "accel_mod_exp.h"
+}
+
+#include <accessl-common/cmd.h>
+#include <accessl-common/testrsa.h>
+
+using namespace std;
+
+// GMP allocations, counted once the keys are loaded and the first operations are done
+static int gmp_allocs = 0;
+
+static void *count_alloc(size_t size)
+{
+    ++gmp_allocs;
+    return malloc(size);
+}
+
+static void *count_realloc(void *p, size_t old_size, size_t new_size)
+{
+    (void)old_size;
+    ++gmp_allocs;
+    return realloc(p, new_size);
+}
+
+static void count_free(void *p, size_t size)
+{
+    (void)size;
+    free(p);
+}
+
+static void serialize_bn(const BIGNUM *bn, vector<unsigned char>& out)
+{
+    uint32_t len = htonl(BN_num_bytes(bn));
+    size_t pos = out.size();
+
+    out.resize(pos + sizeof(len) + BN_num_bytes(bn));
+    memcpy(&out[pos], &len, sizeof(len));
+    BN_bn2bin(bn, &out[pos + sizeof(len)]);
+}
+
+static RSA *load_rsa(const unsigned char *der, size_t der_len, vector<const BIGNUM *>& elems)
+{
+    const unsigned char *p = der;
+    RSA *rsa = d2i_RSAPrivateKey(NULL, &p, der_len);
+    BOOST_REQUIRE( rsa );
+
+    const BIGNUM *e[] = {
+        rsa->n, rsa->e, rsa->d, rsa->p, rsa->q, rsa->dmp1, rsa->dmq1, rsa->iqmp
+    };
+    elems.assign(e, e + sizeof(e) / sizeof(e[0]));
+
+    return rsa;
+}
+
+// through accel_mod_exp, which hands GMP limbs when it can
+static void check_steady_state(accelerator *accel, const unsigned char *der, size_t der_len)
+{
+    vector<const BIGNUM *> elems;
+    RSA *rsa = load_rsa(der, der_len, elems);
+
+    vector<unsigned char> key_data;
+    for (size_t i = 0; i < elems.size(); ++i)
+        serialize_bn(elems[i], key_data);
+
+    void *key = accelerator_add_key(accel, CMD_KEY_RSA, key_data.size(), &key_data[0]);
+    BOOST_REQUIRE( key );
+
+    unsigned char plain[] = {1, 2, 3, 4, 5};
+    vector<unsigned char> op(sizeof(cmd_op_rsa) + RSA_size(rsa));
+    vector<unsigned char> result(accelerator_result_max_len(accel, key, CMD_OP_RSA_PRIV_DEC));
+    cmd_op_rsa *o = reinterpret_cast<cmd_op_rsa *>(&op[0]);
+    int len = RSA_public_encrypt(sizeof(plain), plain, o->data, rsa, RSA_PKCS1_PADDING);
+    BOOST_REQUIRE( len > 0 );
+    o->len = htonl(len);
+    o->pad = htonl(RSA_PKCS1_PADDING);
+
+    // the first operations size the per-thread scratch
+    for (int i = 0; i < 10; ++i)
+        accelerator_rsa_priv_dec(accel, key, sizeof(cmd_op_rsa) + len, &op[0], &result[0]);
+
+    gmp_allocs = 0;
+    for (int i = 0; i < 100; ++i)
+    {
+        int ret = accelerator_rsa_priv_dec(accel, key, sizeof(cmd_op_rsa) + len, &op[0], &result[0]);
+        BOOST_REQUIRE( ret == (int)sizeof(plain) && !memcmp(&result[0], plain, sizeof(plain)) );
+    }
+    BOOST_CHECK_EQUAL( gmp_allocs, 0 );
+
+    accelerator_destroy_key(accel, CMD_KEY_RSA, key);
+    RSA_free(rsa);
+}
+
+// the big endian entry point with a BIGNUM blinding pair, used where GMP limbs are not 64-bit
+static void check_mod_exp_bin(mod_exp_method *method, const unsigned char *der, size_t der_len)
+{
+    vector<const BIGNUM *> elems;
+    RSA *rsa = load_rsa(der, der_len, elems);
+
+    void *priv = method->alloc_priv();
+    BOOST_REQUIRE( priv );
+    for (size_t i = 0; i < elems.size(); ++i)
+    {
+        vector<unsigned char> bin(BN_num_bytes(elems[i]));
+        BN_bn2bin(elems[i], &bin[0]);
+        BOOST_REQUIRE( method->decode_elem(priv, ACCEL_MOD_EXP_RSA_N + i, &bin[0], bin.size()) >= 0 );
+    }
+
+    // A = r^e and Ai = r^-1, so the result is the plain text
+    BN_CTX *ctx = BN_CTX_new();
+    BIGNUM *r = BN_new(), *A = BN_new(), *Ai = BN_new();
+    BOOST_REQUIRE( BN_rand_range(r, rsa->n) );
+    BOOST_REQUIRE( BN_mod_exp(A, r, rsa->e, rsa->n, ctx) );
+    BOOST_REQUIRE( BN_mod_inverse(Ai, r, rsa->n, ctx) );
+
+    size_t len = RSA_size(rsa);
+    vector<unsigned char> plain(len, 0x5a), in(len), out(len);
+    plain[0] = 0;
+    BOOST_REQUIRE( RSA_public_encrypt(len, &plain[0], &in[0], rsa, RSA_NO_PADDING) == (int)len );
+
+    for (int i = 0; i < 10; ++i)
+        method->mod_exp_bin(priv, &out[0], &in[0], len, A, Ai);
+
+    gmp_allocs = 0;
+    for (int i = 0; i < 100; ++i)
+    {
+        BOOST_REQUIRE( method->mod_exp_bin(priv, &out[0], &in[0], len, A, Ai) > 0 );
+        BOOST_REQUIRE( out == plain );
+    }
+    BOOST_CHECK_EQUAL( gmp_allocs, 0 );
+
+    BN_free(Ai);
+    BN_free(A);
+    BN_free(r);
+    BN_CTX_free(ctx);
+    method->free_priv(priv);
+    RSA_free(rsa);
+}
+
+BOOST_AUTO_TEST_CASE( steady_state_does_not_allocate )
+{
+    mp_set_memory_functions(count_alloc, count_realloc, count_free);
+
+    BOOST_REQUIRE( accel_mod_exp_init() >= 0 );
+    accelerator *accel = accel_mod_exp_method(accel_gmp_method());
+    BOOST_REQUIRE( accel );
+
+    check_steady_state(accel, test1024, sizeof(test1024));
+    check_steady_state(accel, test2048, sizeof(test2048));
+    check_steady_state(accel, test3072, sizeof(test3072));
+    check_steady_state(accel, test4096, sizeof(test4096));
+
+    accelerator_done(accel);
+}
+
+BOOST_AUTO_TEST_CASE( blinded_mod_exp_bin_does_not_allocate )
+{
+    mp_set_memory_functions(count_alloc, count_realloc, count_free);
+
+    mod_exp_method *method = accel_gmp_method();
+    BOOST_REQUIRE( method && method->mod_exp_bin );
+
+    check_mod_exp_bin(method, test1024, sizeof(test1024));
+    check_mod_exp_bin(method, test2048, sizeof(test2048));
+    check_mod_exp_bin(method, test3072, sizeof(test3072));
+    check_mod_exp_bin(method, test4096, sizeof(test4096));
+}
@@ -27,44 +27,54 @@
 #include <openssl/bn.h>
 #include <openssl/rsa.h>
 
-#include <ippcore.h>
-#include <ippcp.h>
+#include <crypto_mb/cpu_features.h>
+#include <crypto_mb/rsa.h>
+#include <crypto_mb/status.h>
+
+#include <common/compiler.h>
 
 #include <accessl-common/cmd.h>
-#include <accessl-common/compiler.h>
 #include <accessl-common/log.h>
 
-#define MAX(a,b)  (((a)>(b))?(a):(b))
-#define IPP_BN_LEN(bn)  (((bn)->top)*BN_BYTES/sizeof(Ipp32u))
+#include "accel_cpu.h"
 
-#define ACCEL_IPP_RSA_N    1
-#define ACCEL_IPP_RSA_E    2
-#define ACCEL_IPP_RSA_D    3
-#define ACCEL_IPP_RSA_P    4
-#define ACCEL_IPP_RSA_Q    5
+#define IPP_LANES  8
+#define IPP_MAX_BITS  4096
+#define IPP_SIZES  4 // 1024, 2048, 3072 and 4096 bits
 
 LOG_MODULE_DEFINE;
 
 struct ipp_rsa_key_t {
+    int bits;
     int max_len;
-    int ipp_bn_len;
 
-    IppsBigNumState *n;
-    IppsBigNumState *d;
-    IppsBigNumState *e;
-    IppsBigNumState *p;
-    IppsBigNumState *q;
+    // CRT parameters as little endian 64-bit limbs, bits / 2 wide each
+    int64u *p;
+    int64u *q;
+    int64u *dmp1;
+    int64u *dmq1;
+    int64u *iqmp;
 
-    IppsRSAState *rsa;
+    RSA *pub; // public operations are cheap, leave them to OpenSSL
 };
 typedef struct ipp_rsa_key_t ipp_rsa_key;
 
+// crypto_mb method and its scratch buffer for every supported modulus size
+struct ipp_priv_t {
+    const mbx_RSA_Method *method[IPP_SIZES];
+    int8u *buffer[IPP_SIZES];
+};
+typedef struct ipp_priv_t ipp_priv;
+
+static inline int ipp_size_idx(int bits)
+{
+    return bits / 1024 - 1;
+}
+
 int accel_ipp_init()
 {
     LOG_MODULE_INIT("accessl.accel_ipp");
 
-    ippSetNumThreads(1);
-
     return 1;
 }
 
@@ -72,148 +82,160 @@ void accel_ipp_destroy()
 {
 }
 
-static const char *accel_ipp_get_name()
+static const char *accel_ipp_get_name(void *accel_priv UNUSED)
 {
-    return "IPP";
+    return "IPP crypto_mb";
 }
 
-static void accel_ipp_free_priv(void *priv)
+static void accel_ipp_free_priv(void *accel_priv)
 {
+    ipp_priv *priv = (ipp_priv *)accel_priv;
+    int i;
+
+    if (!priv)
+        return;
+
+    for (i = 0; i < IPP_SIZES; ++i)
+        free(priv->buffer[i]);
+    free(priv);
 }
 
-static int accel_rsa_key_decode_elem(ipp_rsa_key *k, int key_elem, BIGNUM *bn)
+static ipp_priv *accel_ipp_alloc_priv(void)
 {
-    IppsBigNumState **ipp_bn;
-    IppRSAKeyTag tag;
-    int len, size;
-
-    switch (key_elem) {
-    case ACCEL_IPP_RSA_N:
-        ipp_bn = &k->n;
-        tag = IppRSAkeyN;
-        break;
-    case ACCEL_IPP_RSA_E:
-        ipp_bn = &k->e;
-        tag = IppRSAkeyE;
-        break;
-    case ACCEL_IPP_RSA_D:
-        ipp_bn = &k->d;
-        tag = IppRSAkeyD;
-        break;
-    case ACCEL_IPP_RSA_P:
-        ipp_bn = &k->p;
-        tag = IppRSAkeyP;
-        break;
-    case ACCEL_IPP_RSA_Q:
-        ipp_bn = &k->q;
-        tag = IppRSAkeyQ;
-        break;
-    default:
-        return -1;
-    }
+    ipp_priv *priv = calloc(1, sizeof(ipp_priv));
+    int i;
 
-    len = IPP_BN_LEN(bn);
-    if (ippsBigNumGetSize(len, &size) != ippStsNoErr)
-        return -1;
+    if (unlikely(!priv))
+        return NULL;
 
-    *ipp_bn = malloc(size);
-    if (! (*ipp_bn))
-        return -1;
+    for (i = 0; i < IPP_SIZES; ++i)
+    {
+        priv->method[i] = mbx_RSA_private_crt_Method((i + 1) * 1024);
+        if (unlikely(!priv->method[i]))
+            goto err;
 
-    if (ippsBigNumInit(len, *ipp_bn) != ippStsNoErr)
-        return -1;
+        priv->buffer[i] = malloc(mbx_RSA_Method_BufSize(priv->method[i]));
+        if (unlikely(!priv->buffer[i]))
+            goto err;
+    }
 
-    if (ippsSet_BN(IppsBigNumPOS, len, (const Ipp32u *)bn->d, *ipp_bn) != ippStsNoErr)
-        return -1;
-    if (ippsRSASetKey(*ipp_bn, tag, k->rsa) != ippStsNoErr)
-        return -1;
+    return priv;
 
-    return 1;
+err:
+    accel_ipp_free_priv(priv);
+    return NULL;
 }
 
-static int accel_rsa_key_bn(BIGNUM **bn, const unsigned char **data, size_t *len)
+static const vli *accel_ipp_next_vli(const unsigned char **data, size_t *len)
 {
-    vli *v = (vli *)*data;
-    size_t vlen = ntohl(v->len);
+    const vli *v = (const vli *)*data;
+    size_t vlen;
 
-    if (unlikely(*len < vlen))
-        return -1;
+    if (unlikely(*len < sizeof(uint32_t)))
+        return NULL;
 
-    *bn = BN_bin2bn(v->data, vlen, *bn);
+    vlen = ntohl(v->len);
+    if (unlikely(*len - sizeof(uint32_t) < vlen))
+        return NULL;
 
-    *data += vlen + sizeof(unsigned int);
-    *len -= vlen + sizeof(unsigned int);
+    *data += sizeof(uint32_t) + vlen;
+    *len -= sizeof(uint32_t) + vlen;
 
-    return 1;
+    return v;
 }
 
-static int accel_rsa_key_decode(ipp_rsa_key *k, size_t len, const unsigned char *data)
+// big endian bytes to zero padded little endian limbs
+static int bin2limbs(const vli *v, int64u *limbs, int nlimbs)
 {
-    int ret = 1;
-    BIGNUM *n = NULL, *e = NULL, *d = NULL, *p = NULL, *q = NULL;
-    int n_bit_size, p_bit_size, q_bit_size, p_bit_max, size;
+    size_t vlen = ntohl(v->len);
+    size_t i;
 
-    // TODO handle public only key
+    memset(limbs, 0, nlimbs * sizeof(int64u));
 
-    if (ret > 0) ret = accel_rsa_key_bn(&n, &data, &len);
-    if (ret > 0) ret = accel_rsa_key_bn(&e, &data, &len);
-    if (ret > 0) ret = accel_rsa_key_bn(&d, &data, &len);
-    if (ret > 0) ret = accel_rsa_key_bn(&p, &data, &len);
-    if (ret > 0) ret = accel_rsa_key_bn(&q, &data, &len);
+    for (i = 0; i < vlen; ++i)
+    {
+        size_t pos = vlen - 1 - i;
 
-    if (ret > 0) {
-        k->max_len = BN_num_bytes(n);
-        k->ipp_bn_len = IPP_BN_LEN(n);
+        if (i / 8 >= (size_t)nlimbs)
+        {
+            if (v->data[pos])
+                return -1;
+            continue;
+        }
+        limbs[i / 8] |= (int64u)v->data[pos] << (8 * (i % 8));
+    }
 
-        n_bit_size = BN_num_bits(n);
-        p_bit_size = BN_num_bits(p);
-        q_bit_size = BN_num_bits(q);
-        p_bit_max = MAX((n_bit_size + 1) / 2, MAX(p_bit_size, q_bit_size));
+    return 1;
+}
 
-        if (ippsRSAGetSize(n_bit_size, 0, IppRSAprivate, &size) != ippStsNoErr)
-            ret = -1;
+static void accel_ipp_rsa_key_destroy(ipp_rsa_key *k)
+{
+    if (k->p)
+    {
+        OPENSSL_cleanse(k->p, 5 * (k->bits / 128) * sizeof(int64u));
+        free(k->p);
+    }
+    if (k->pub)
+        RSA_free(k->pub);
 
-        if (ret > 0) 
-            k->rsa = malloc(size);
+    free(k);
+}
 
-        if (!k->rsa)
-            ret = -1;
+static int accel_ipp_rsa_key_decode(ipp_rsa_key *k, size_t len, const unsigned char *data)
+{
+    const vli *n, *e, *p, *q, *dmp1, *dmq1, *iqmp;
+    int nlimbs;
 
-        if (ret > 0 && ippsRSAInit(n_bit_size, p_bit_max, IppRSAprivate, k->rsa) != ippStsNoErr)
-            ret = -1;
-    }
+    n = accel_ipp_next_vli(&data, &len);
+    e = accel_ipp_next_vli(&data, &len);
+    if (!accel_ipp_next_vli(&data, &len)) // d is not needed with CRT
+        return -1;
+    p = accel_ipp_next_vli(&data, &len);
+    q = accel_ipp_next_vli(&data, &len);
+    dmp1 = accel_ipp_next_vli(&data, &len);
+    dmq1 = accel_ipp_next_vli(&data, &len);
+    iqmp = accel_ipp_next_vli(&data, &len);
+
+    // crypto_mb CRT is two-prime only, multi-prime keys go to other accelerators
+    if (!iqmp || len)
+        return -1;
 
-    if (ret > 0) ret = accel_rsa_key_decode_elem(k, ACCEL_IPP_RSA_N, n);
-    if (ret > 0) ret = accel_rsa_key_decode_elem(k, ACCEL_IPP_RSA_E, e);
-    if (ret > 0) ret = accel_rsa_key_decode_elem(k, ACCEL_IPP_RSA_D, d);
-    if (ret > 0) ret = accel_rsa_key_decode_elem(k, ACCEL_IPP_RSA_P, p);
-    if (ret > 0) ret = accel_rsa_key_decode_elem(k, ACCEL_IPP_RSA_Q, q);
+    k->pub = RSA_new();
+    if (unlikely(!k->pub))
+        return -1;
 
-    if (n) BN_clear_free(n);
-    if (e) BN_clear_free(e);
-    if (d) BN_clear_free(d);
-    if (p) BN_clear_free(p);
-    if (q) BN_clear_free(q);
+    k->pub->n = BN_bin2bn(n->data, ntohl(n->len), NULL);
+    k->pub->e = BN_bin2bn(e->data, ntohl(e->len), NULL);
+    if (unlikely(!k->pub->n || !k->pub->e))
+        return -1;
 
-    return ret;
-}
+    // crypto_mb handles only moduli of exactly 1024, 2048, 3072 or 4096 bits
+    k->bits = BN_num_bits(k->pub->n);
+    k->max_len = BN_num_bytes(k->pub->n);
+    if (k->bits % 1024 || k->bits < 1024 || k->bits > IPP_MAX_BITS)
+        return -1;
 
-static void accel_ipp_rsa_key_destroy(void *key)
-{
-    ipp_rsa_key *k = (ipp_rsa_key *)key;
+    nlimbs = k->bits / 128;
+    k->p = malloc(5 * nlimbs * sizeof(int64u));
+    if (unlikely(!k->p))
+        return -1;
 
-    free(k->n);
-    free(k->d);
-    free(k->e);
-    free(k->p);
-    free(k->q);
+    k->q = k->p + nlimbs;
+    k->dmp1 = k->q + nlimbs;
+    k->dmq1 = k->dmp1 + nlimbs;
+    k->iqmp = k->dmq1 + nlimbs;
 
-    free(k->rsa);
+    if (bin2limbs(p, k->p, nlimbs) < 0 ||
+        bin2limbs(q, k->q, nlimbs) < 0 ||
+        bin2limbs(dmp1, k->dmp1, nlimbs) < 0 ||
+        bin2limbs(dmq1, k->dmq1, nlimbs) < 0 ||
+        bin2limbs(iqmp, k->iqmp, nlimbs) < 0)
+        return -1;
 
-    free(k);
+    return 1;
 }
 
-static void accel_ipp_destroy_key(void *accel_priv, int type, void *key)
+static void accel_ipp_destroy_key(void *accel_priv UNUSED, int type, void *key)
 {
     switch (type)
     {
@@ -224,32 +246,22 @@ static void accel_ipp_destroy_key(void *accel_priv, int type, void *key)
     }
 }
 
-static ipp_rsa_key *accel_ipp_rsa_key_alloc(void *priv, size_t len, const unsigned char *data)
-{
-    ipp_rsa_key *k = calloc(1, sizeof(ipp_rsa_key));
-    if (unlikely(!k))
-        return NULL;
-
-    if (accel_rsa_key_decode(k, len, data) < 0)
-    {
-        accel_ipp_rsa_key_destroy(k);
-        return NULL;
-    }
-
-    return k;
-}
-
-static void *accel_ipp_add_key(void *priv, int type, size_t len, const unsigned char *data)
+static void *accel_ipp_add_key(void *accel_priv UNUSED, int type, size_t len, const unsigned char *data)
 {
     switch (type)
     {
     case CMD_KEY_RSA:
         {
-            ipp_rsa_key *k = accel_ipp_rsa_key_alloc(priv, len, data);
-
+            ipp_rsa_key *k = calloc(1, sizeof(ipp_rsa_key));
             if (unlikely(!k))
                 return NULL;
 
+            if (accel_ipp_rsa_key_decode(k, len, data) < 0)
+            {
+                accel_ipp_rsa_key_destroy(k);
+                return NULL;
+            }
+
             return k;
         }
     default:
@@ -257,7 +269,7 @@ static void *accel_ipp_add_key(void *priv, int type, size_t len, const unsigned
     }
 }
 
-static size_t accel_ipp_result_max_len(void *accel_priv, void *key, int op)
+static size_t accel_ipp_result_max_len(void *accel_priv UNUSED, void *key, int op)
 {
     switch (op) {
     case CMD_OP_RSA_PRIV_DEC:
@@ -265,279 +277,222 @@ static size_t accel_ipp_result_max_len(void *accel_priv, void *key, int op)
     case CMD_OP_RSA_PUB_DEC:
     case CMD_OP_RSA_PUB_ENC:
         {
-            ipp_rsa_key *gkey = (ipp_rsa_key *)key;
-            return gkey->max_len;
+            ipp_rsa_key *k = (ipp_rsa_key *)key;
+            return k->max_len;
         }
     default:
         return -1;
     }
 }
 
-static int accel_ipp_rsa_priv_dec(void *accel_priv, void *key, size_t len, const unsigned char *data, unsigned char *result)
+/*
+ * Turns the request into the exponentiation input, returns -1 if the op can't be done.
+ * Input must be below the modulus, both are max_len bytes big endian.
+ */
+static int accel_ipp_rsa_priv_prepare(ipp_rsa_key *k, const accel_op *o, unsigned char *in)
 {
-    ipp_rsa_key *k = (ipp_rsa_key *)key;
-    cmd_op_rsa *op = (cmd_op_rsa *)data;
-    long oplen = ntohl(op->len);
-    long oppad = ntohl(op->pad);
-    int ret = -1;
-    int size;
-    IppsBigNumState *tmp, *output;
-    Ipp8u *buf;
-
-    buf = malloc(k->max_len);
+    const cmd_op_rsa *op = (const cmd_op_rsa *)o->data;
+    unsigned char n[IPP_MAX_BITS / 8];
+    size_t oplen = ntohl(op->len);
+    int oppad = ntohl(op->pad);
+    int ret;
 
-    ippsBigNumGetSize(k->ipp_bn_len, &size);
-    tmp = malloc(size);
-    output = malloc(size);
+    if (unlikely(o->len < sizeof(cmd_op_rsa) || o->len - sizeof(cmd_op_rsa) < oplen))
+        return -1;
 
-    if (unlikely(!buf || !tmp || !output))
-        goto end;
+    if (o->op == CMD_OP_RSA_PRIV_DEC)
+    {
+        if (unlikely(oplen > (size_t)k->max_len))
+            return -1;
+        memset(in, 0, k->max_len - oplen);
+        memcpy(in + k->max_len - oplen, op->data, oplen);
+    }
+    else
+    {
+        switch (oppad) {
+        case RSA_PKCS1_PADDING:
+            ret = RSA_padding_add_PKCS1_type_1(in, k->max_len, op->data, oplen);
+            break;
+        case RSA_X931_PADDING:
+            ret = RSA_padding_add_X931(in, k->max_len, op->data, oplen);
+            break;
+        case RSA_NO_PADDING:
+            ret = RSA_padding_add_none(in, k->max_len, op->data, oplen);
+            break;
+        default:
+            return -1;
+        }
+        if (ret <= 0)
+            return -1;
+    }
 
-    if (unlikely(ippsBigNumInit(k->ipp_bn_len, tmp) != ippStsNoErr))
-        goto end;
+    BN_bn2bin(k->pub->n, n);
+    if (memcmp(in, n, k->max_len) >= 0)
+        return -1;
 
-    if (unlikely(ippsBigNumInit(k->ipp_bn_len, output) != ippStsNoErr))
-        goto end;
+    return 1;
+}
 
-    if (unlikely(ippsSetOctString_BN(op->data, oplen, tmp) != ippStsNoErr))
-        goto end;
+static int accel_ipp_rsa_priv_finish(ipp_rsa_key *k, const accel_op *o, const unsigned char *out)
+{
+    const cmd_op_rsa *op = (const cmd_op_rsa *)o->data;
 
-    ippsCmp_BN(tmp, k->n, (Ipp32u*)&size);
-    if (unlikely(IS_ZERO == size || GREATER_THAN_ZERO == size))
-        goto end;
+    int oppad = ntohl(op->pad);
 
-    if (unlikely(ippsRSADecrypt(tmp, output, k->rsa) != ippStsNoErr))
-        goto end;
+    if (o->op == CMD_OP_RSA_PRIV_ENC)
+    {
+        memcpy(o->result, out, k->max_len);
+        return k->max_len;
+    }
 
-    ippsExtGet_BN(0, &size, 0, output);
-    size = (size+7)/8;
-    ippsGetOctString_BN(buf, size, output);
+    // padding checks take the encoded message without its leading zero
+    if (oppad != RSA_NO_PADDING && out[0] != 0)
+        return -1;
 
     switch (oppad) {
     case RSA_PKCS1_PADDING:
-        ret = RSA_padding_check_PKCS1_type_2(result, k->max_len, buf,size, k->max_len);
-        break;
+        return RSA_padding_check_PKCS1_type_2(o->result, k->max_len, out + 1, k->max_len - 1, k->max_len);
     case RSA_PKCS1_OAEP_PADDING:
-        ret = RSA_padding_check_PKCS1_OAEP(result,k->max_len, buf,size, k->max_len,NULL,0);
-        break;
+        return RSA_padding_check_PKCS1_OAEP(o->result, k->max_len, out + 1, k->max_len - 1, k->max_len, NULL, 0);
     case RSA_SSLV23_PADDING:
-        ret = RSA_padding_check_SSLv23(result,k->max_len, buf,size, k->max_len);
-        break;
+        return RSA_padding_check_SSLv23(o->result, k->max_len, out + 1, k->max_len - 1, k->max_len);
     case RSA_NO_PADDING:
-        ret = RSA_padding_check_none(result,k->max_len, buf,size, k->max_len);
-        break;
+        return RSA_padding_check_none(o->result, k->max_len, out, k->max_len, k->max_len);
     default:
-        goto end;
+        return -1;
     }
-
-end:
-    free(buf);
-    free(tmp);
-    free(output);
-    return ret;
 }
 
-static int accel_ipp_rsa_pub_dec(void *accel_priv, void *key, size_t len, const unsigned char *data, unsigned char *result)
+/*
+ * Runs up to 8 private key ops with keys of the same size in one mb8 call.
+ * Lanes not in use repeat the first op, their results are thrown away.
+ */
+static void accel_ipp_rsa_priv_mb8(ipp_priv *priv, accel_op **ops, int count)
 {
-    ipp_rsa_key *k = (ipp_rsa_key *)key;
-    cmd_op_rsa *op = (cmd_op_rsa *)data;
-    long oplen = ntohl(op->len);
-    long oppad = ntohl(op->pad);
-    int ret = -1;
-    int size;
-    IppsBigNumState *tmp, *output;
-    Ipp8u *buf;
-
-    buf = malloc(k->max_len);
-
-    ippsBigNumGetSize(k->ipp_bn_len, &size);
-    tmp = malloc(size);
-    output = malloc(size);
-
-    if (unlikely(!buf || !tmp || !output))
-        goto end;
-
-    if (unlikely(ippsBigNumInit(k->ipp_bn_len, tmp) != ippStsNoErr))
-        goto end;
-
-    if (unlikely(ippsBigNumInit(k->ipp_bn_len, output) != ippStsNoErr))
-        goto end;
-
-    if (unlikely(ippsSetOctString_BN(op->data, oplen, tmp) != ippStsNoErr))
-        goto end;
-
-    ippsCmp_BN(tmp, k->n, (Ipp32u*)&size);
-    if (unlikely(IS_ZERO == size || GREATER_THAN_ZERO == size))
-        goto end;
-
-    if (unlikely(ippsRSAEncrypt(tmp, output, k->rsa) != ippStsNoErr))
-        goto end;
+    unsigned char in[IPP_LANES][IPP_MAX_BITS / 8];
+    unsigned char out[IPP_LANES][IPP_MAX_BITS / 8];
+    const int8u *from[IPP_LANES];
+    int8u *to[IPP_LANES];
+    const int64u *p[IPP_LANES], *q[IPP_LANES], *dmp1[IPP_LANES], *dmq1[IPP_LANES], *iqmp[IPP_LANES];
+    int ok[IPP_LANES];
+    ipp_rsa_key *first = (ipp_rsa_key *)ops[0]->key;
+    int idx = ipp_size_idx(first->bits);
+    mbx_status status;
+    int i, lane;
+
+    for (i = 0; i < IPP_LANES; ++i)
+    {
+        ipp_rsa_key *k;
 
-    ippsExtGet_BN(0, &size, (Ipp32u *)buf, output);
-    if ((oppad == RSA_X931_PADDING) && ((((Ipp32u*)buf)[0] & 0xf) != 12))
-        ippsSub_BN(k->n, output, output);
+        lane = 0;
+        ok[i] = 0;
+        if (i < count)
+        {
+            ok[i] = accel_ipp_rsa_priv_prepare((ipp_rsa_key *)ops[i]->key, ops[i], in[i]) > 0;
+            lane = ok[i] ? i : 0;
+        }
+        // lane 0 may have failed too, it still has to carry a valid key
+        k = (ipp_rsa_key *)ops[lane]->key;
+        if (lane == 0 && !ok[0])
+            memset(in[0], 0, first->max_len);
+
+        from[i] = in[lane];
+        to[i] = out[i];
+        p[i] = k->p;
+        q[i] = k->q;
+        dmp1[i] = k->dmp1;
+        dmq1[i] = k->dmq1;
+        iqmp[i] = k->iqmp;
+    }
 
-    ippsExtGet_BN(0, &size, 0, output);
-    size = (size+7)/8;
-    ippsGetOctString_BN(buf, size, output);
+    status = mbx_rsa_private_crt_mb8(from, to, p, q, dmp1, dmq1, iqmp, first->bits,
+                                     priv->method[idx], priv->buffer[idx]);
 
-    switch (oppad) {
-    case RSA_PKCS1_PADDING:
-        ret = RSA_padding_check_PKCS1_type_1(result, k->max_len, buf, size, k->max_len);
-        break;
-    case RSA_X931_PADDING:
-        ret = RSA_padding_check_X931(result, k->max_len, buf,size, k->max_len);
-        break;
-    case RSA_NO_PADDING:
-        ret = RSA_padding_check_none(result, k->max_len, buf,size, k->max_len);
-        break;
-    default:
-        ret = -1;
-        goto end;
+    for (i = 0; i < count; ++i)
+    {
+        if (ok[i] && MBX_GET_STS(status, i) == MBX_STATUS_OK)
+            ops[i]->ret = accel_ipp_rsa_priv_finish((ipp_rsa_key *)ops[i]->key, ops[i], out[i]);
+        else
+            ops[i]->ret = -1;
     }
-
-end:
-    free(buf);
-    free(tmp);
-    free(output);
-    return ret;
 }
 
-static int accel_ipp_rsa_priv_enc(void *accel_priv, void *key, size_t len, const unsigned char *data, unsigned char *result)
+static int accel_ipp_rsa_priv(void *accel_priv, void *key, int opcode, size_t len, const unsigned char *data, unsigned char *result)
 {
-    ipp_rsa_key *k = (ipp_rsa_key *)key;
-    cmd_op_rsa *op = (cmd_op_rsa *)data;
-    long oplen = ntohl(op->len);
-    long oppad = ntohl(op->pad);
-    int ret = -1;
-    int size;
-    IppsBigNumState *tmp, *output;
-    Ipp8u *buf;
-
-    buf = malloc(k->max_len);
-
-    ippsBigNumGetSize(k->ipp_bn_len, &size);
-    tmp = malloc(size);
-    output = malloc(size);
-
-    if (unlikely(!buf || !tmp || !output))
-        goto end;
-
-    if (unlikely(ippsBigNumInit(k->ipp_bn_len, tmp) != ippStsNoErr))
-        goto end;
-
-    if (unlikely(ippsBigNumInit(k->ipp_bn_len, output) != ippStsNoErr))
-        goto end;
-
-    switch (oppad) {
-    case RSA_PKCS1_PADDING:
-        ret = RSA_padding_add_PKCS1_type_1(buf, k->max_len, op->data, oplen);
-        break;
-    case RSA_X931_PADDING:
-        ret = RSA_padding_add_X931(buf, k->max_len, op->data, oplen);
-        break;
-    case RSA_NO_PADDING:
-        ret = RSA_padding_add_none(buf, k->max_len, op->data, oplen);
-        break;
-    default:
-        ret = -1;
-        goto end;
-    }
+    accel_op op = { key, opcode, len, data, result, -1 };
+    accel_op *ops[1] = { &op };
 
-    if (unlikely(ret < 0))
-        goto end;
+    accel_ipp_rsa_priv_mb8((ipp_priv *)accel_priv, ops, 1);
 
-    if (unlikely(ippsSetOctString_BN(buf, k->max_len, tmp) != ippStsNoErr))
-        goto end;
-
-    ippsCmp_BN(tmp, k->n, (Ipp32u*)&size);
-    if (unlikely(IS_ZERO == size || GREATER_THAN_ZERO == size))
-        goto end;
-
-    if (unlikely(ippsRSADecrypt(tmp, output, k->rsa) != ippStsNoErr))
-        goto end;
-
-    if (unlikely(ippsGetOctString_BN(result, k->max_len, output) != ippStsNoErr))
-        goto end;
+    return op.ret;
+}
 
-    ret = k->max_len;
+static int accel_ipp_rsa_priv_dec(void *accel_priv, void *key, size_t len, const unsigned char *data, unsigned char *result)
+{
+    return accel_ipp_rsa_priv(accel_priv, key, CMD_OP_RSA_PRIV_DEC, len, data, result);
+}
 
-end:
-    free(buf);
-    free(tmp);
-    free(output);
-    return ret;
+static int accel_ipp_rsa_priv_enc(void *accel_priv, void *key, size_t len, const unsigned char *data, unsigned char *result)
+{
+    return accel_ipp_rsa_priv(accel_priv, key, CMD_OP_RSA_PRIV_ENC, len, data, result);
 }
 
-static int accel_ipp_rsa_pub_enc(void *accel_priv, void *key, size_t len, const unsigned char *data, unsigned char *result)
+static int accel_ipp_rsa_pub_dec(void *accel_priv UNUSED, void *key, size_t len UNUSED, const unsigned char *data, unsigned char *result)
 {
     ipp_rsa_key *k = (ipp_rsa_key *)key;
-    cmd_op_rsa *op = (cmd_op_rsa *)data;
-    long oplen = ntohl(op->len);
-    long oppad = ntohl(op->pad);
-    int ret = -1;
-    int size;
-    IppsBigNumState *tmp, *output;
-    Ipp8u *buf;
+    const cmd_op_rsa *op = (const cmd_op_rsa *)data;
 
-    buf = malloc(k->max_len);
-
-    ippsBigNumGetSize(k->ipp_bn_len, &size);
-    tmp = malloc(size);
-    output = malloc(size);
-
-    if (unlikely(!buf || !tmp || !output))
-        goto end;
+    return RSA_public_decrypt(ntohl(op->len), op->data, result, k->pub, ntohl(op->pad));
+}
 
-    if (unlikely(ippsBigNumInit(k->ipp_bn_len, tmp) != ippStsNoErr))
-        goto end;
+static int accel_ipp_rsa_pub_enc(void *accel_priv UNUSED, void *key, size_t len UNUSED, const unsigned char *data, unsigned char *result)
+{
+    ipp_rsa_key *k = (ipp_rsa_key *)key;
+    const cmd_op_rsa *op = (const cmd_op_rsa *)data;
 
-    if (unlikely(ippsBigNumInit(k->ipp_bn_len, output) != ippStsNoErr))
-        goto end;
+    return RSA_public_encrypt(ntohl(op->len), op->data, result, k->pub, ntohl(op->pad));
+}
 
-    switch (oppad) {
-    case RSA_PKCS1_PADDING:
-        ret = RSA_padding_add_PKCS1_type_2(buf, k->max_len, op->data, oplen);
-        break;
-    case RSA_PKCS1_OAEP_PADDING:
-        ret = RSA_padding_add_PKCS1_OAEP(buf, k->max_len, op->data, oplen, NULL, 0);
-        break;
-    case RSA_SSLV23_PADDING:
-        ret = RSA_padding_add_SSLv23(buf, k->max_len, op->data, oplen);
-        break;
-    case RSA_NO_PADDING:
-        ret = RSA_padding_add_none(buf, k->max_len, op->data, oplen);
-        break;
-    default:
-        ret = -1;
-        goto end;
-    }
+static void accel_ipp_perform_batch(void *accel_priv, accel_op *ops, int count)
+{
+    accel_op *lanes[IPP_LANES];
+    int done[ACCEL_BATCH_MAX];
+    int i, j, n;
 
-    if (unlikely(ret < 0))
-        goto end;
+    memset(done, 0, sizeof(done));
 
-    ret = -1;
+    // private ops with keys of the same size share one mb8 call
+    for (i = 0; i < count; ++i)
+    {
+        ipp_rsa_key *k = (ipp_rsa_key *)ops[i].key;
 
-    if (unlikely(ippsSetOctString_BN(buf, k->max_len, tmp) != ippStsNoErr))
-        goto end;
+        if (done[i])
+            continue;
 
-    ippsCmp_BN(tmp, k->n, (Ipp32u*)&size);
-    if (unlikely(IS_ZERO == size || GREATER_THAN_ZERO == size))
-        goto end;
+        if (ops[i].op != CMD_OP_RSA_PRIV_DEC && ops[i].op != CMD_OP_RSA_PRIV_ENC)
+        {
+            ops[i].ret = ops[i].op == CMD_OP_RSA_PUB_DEC ?
+                accel_ipp_rsa_pub_dec(accel_priv, k, ops[i].len, ops[i].data, ops[i].result) :
+                ops[i].op == CMD_OP_RSA_PUB_ENC ?
+                accel_ipp_rsa_pub_enc(accel_priv, k, ops[i].len, ops[i].data, ops[i].result) : -1;
+            done[i] = 1;
+            continue;
+        }
 
-    if (unlikely(ippsRSAEncrypt(tmp, output, k->rsa) != ippStsNoErr))
-        goto end;
+        for (n = 0, j = i; j < count && n < IPP_LANES; ++j)
+        {
+            ipp_rsa_key *kj = (ipp_rsa_key *)ops[j].key;
 
-    if (unlikely(ippsGetOctString_BN(result, k->max_len, output) != ippStsNoErr))
-        goto end;
+            if (done[j] || kj->bits != k->bits ||
+                (ops[j].op != CMD_OP_RSA_PRIV_DEC && ops[j].op != CMD_OP_RSA_PRIV_ENC))
+                continue;
 
-    ret = k->max_len;
+            lanes[n++] = &ops[j];
+            done[j] = 1;
+        }
 
-end:
-    free(buf);
-    free(tmp);
-    free(output);
-    return ret;
+        accel_ipp_rsa_priv_mb8((ipp_priv *)accel_priv, lanes, n);
+    }
 }
 
 static accel_method ipp_accel_method = {
@@ -549,17 +504,33 @@ static accel_method ipp_accel_method = {
     .rsa_priv_dec = accel_ipp_rsa_priv_dec,
     .rsa_pub_dec = accel_ipp_rsa_pub_dec,
     .rsa_priv_enc = accel_ipp_rsa_priv_enc,
-    .rsa_pub_enc = accel_ipp_rsa_pub_enc
+    .rsa_pub_enc = accel_ipp_rsa_pub_enc,
+    .perform_batch = accel_ipp_perform_batch,
 };
 
 accelerator *accel_ipp_method()
 {
-    accelerator *ret = malloc(sizeof(accelerator));
+    accelerator *ret;
+
+    // crypto_mb needs AVX-512 IFMA, --isa may rule it out too
+    if (!accel_cpu_has(ACCEL_CPU_AVX512_IFMA) || !mbx_is_crypto_mb_applicable(0))
+    {
+        LOG_INFO("crypto_mb not usable on this CPU");
+        return NULL;
+    }
+
+    ret = malloc(sizeof(accelerator));
     if (!ret)
         return ret;
 
     ret->method = &ipp_accel_method;
-    ret->priv = NULL;
+    ret->priv = accel_ipp_alloc_priv();
+
+    if (!ret->priv)
+    {
+        free(ret);
+        return NULL;
+    }
 
     return ret;
 }
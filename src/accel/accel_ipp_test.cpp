@@ -0,0 +1,102 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#define BOOST_TEST_MODULE accel_ipp
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <boost/test/included/unit_test.hpp>
+
+#include "accel.h"
+
+extern "C" {
+#include "accel_base.h"
+#include "accel_ipp.h"
+#include "accel_profile.h"
+}
+
+using namespace std;
+
+// the profile written by a calibration run, read back with its own signature
+static int read_profile(const char *path, accel_profile_entry *entries, int max)
+{
+    char line[ACCEL_PROFILE_SIGNATURE_LEN + 16];
+    FILE *f = fopen(path, "r");
+
+    if (!f)
+        return -1;
+
+    if (!fgets(line, sizeof(line), f) || strncmp(line, "signature ", 10))
+    {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    line[strcspn(line, "\n")] = '\0';
+
+    return accel_profile_load(path, line + 10, entries, max);
+}
+
+// every size crypto_mb handles has to pass the correctness check and get a real speed
+BOOST_AUTO_TEST_CASE( ipp_calibrates_to_finite_speed )
+{
+    BOOST_REQUIRE( accel_ipp_init() >= 0 );
+
+    accelerator *ipp = accel_ipp_method();
+    if (!ipp)
+    {
+        BOOST_TEST_MESSAGE( "crypto_mb not usable on this CPU, skipping" );
+        return;
+    }
+    string name = accelerator_name(ipp);
+    accelerator_done(ipp);
+
+    char path[] = "/tmp/accel_ipp_test.XXXXXX";
+    int fd = mkstemp(path);
+    BOOST_REQUIRE( fd >= 0 );
+    close(fd);
+
+    BOOST_REQUIRE( accel_init(path, 1) > 0 );
+
+    accel_profile_entry entries[64];
+    int count = read_profile(path, entries, (int)(sizeof(entries) / sizeof(entries[0])));
+    BOOST_REQUIRE( count > 0 );
+
+    int checked = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        if (name != entries[i].method || entries[i].bits < 1024)
+            continue;
+
+        BOOST_CHECK_MESSAGE( entries[i].speed != UINT64_MAX, name << " failed calibration at " << entries[i].bits << " bits" );
+        ++checked;
+    }
+    BOOST_CHECK_EQUAL( checked, 4 );
+
+    accel_destroy();
+    unlink(path);
+}
@@ -35,19 +35,56 @@
 #include <accessl-common/cmd.h>
 #include <accessl-common/log.h>
 
+#include "accel_blinding.h"
 #include "accel_mod_exp.h"
+#include "accel_pad.h"
 
 LOG_MODULE_DEFINE;
 
+// largest modulus (bytes) handled by the native padding path, bigger keys go through OpenSSL
+#define ACCEL_MOD_EXP_NATIVE_MAX_LEN  1024
+#define ACCEL_MOD_EXP_NATIVE_MAX_LIMBS  (ACCEL_MOD_EXP_NATIVE_MAX_LEN / sizeof(uint64_t))
+
 struct mod_exp_rsa_key_t {
     RSA *rsa_key;
 
     mod_exp_method *method;
 
     void *priv;
+
+    accel_blinding *blinding; // replaces OpenSSL's shared, locked BN_BLINDING
+
+    size_t n_len;
+    size_t n_limbs;
+    unsigned char *n_bin; // modulus for the native path range check
 };
 typedef struct mod_exp_rsa_key_t mod_exp_rsa_key;
 
+/*
+ * Per-thread buffers of the native path, allocated on first use and kept for the
+ * life of the thread, so requests create no OpenSSL objects.
+ */
+struct mod_exp_native_t {
+    BN_CTX *ctx;
+    BIGNUM *A;
+    BIGNUM *Ai;
+    unsigned char in[ACCEL_MOD_EXP_NATIVE_MAX_LEN];
+    unsigned char em[ACCEL_MOD_EXP_NATIVE_MAX_LEN];
+    unsigned char db[ACCEL_MOD_EXP_NATIVE_MAX_LEN];
+
+    // operands of mod_exp_limbs and the scratch of the method that last used them
+    uint64_t I[ACCEL_MOD_EXP_NATIVE_MAX_LIMBS] ALIGNED(ACCEL_MOD_EXP_LIMB_ALIGN);
+    uint64_t r[ACCEL_MOD_EXP_NATIVE_MAX_LIMBS] ALIGNED(ACCEL_MOD_EXP_LIMB_ALIGN);
+    uint64_t A_limbs[ACCEL_MOD_EXP_NATIVE_MAX_LIMBS] ALIGNED(ACCEL_MOD_EXP_LIMB_ALIGN);
+    uint64_t Ai_limbs[ACCEL_MOD_EXP_NATIVE_MAX_LIMBS] ALIGNED(ACCEL_MOD_EXP_LIMB_ALIGN);
+    mod_exp_method *scratch_method;
+    size_t scratch_limbs;
+    void *scratch;
+};
+typedef struct mod_exp_native_t mod_exp_native;
+
+static __thread mod_exp_native native;
+
 struct mod_exp_priv_t {
     mod_exp_method *method;
 };
@@ -119,10 +156,14 @@ static const char *accel_mod_exp_get_name(void *accel_priv)
 static int accel_rsa_key_decode_elem(mod_exp_rsa_key *k, int mod_exp_elem, const unsigned char **data, size_t *len)
 {
     vli *v = (vli *)*data;
-    size_t vlen = ntohl(v->len);
+    size_t vlen;
     BIGNUM **bn;
 
-    if (unlikely(*len < vlen))
+    if (unlikely(*len < sizeof(unsigned int)))
+        return -1;
+
+    vlen = ntohl(v->len);
+    if (unlikely(*len - sizeof(unsigned int) < vlen))
         return -1;
 
     switch (mod_exp_elem) {
@@ -151,10 +192,14 @@ static int accel_rsa_key_decode_elem(mod_exp_rsa_key *k, int mod_exp_elem, const
         bn = &k->rsa_key->iqmp;
         break;
     default:
-        return -1;
+        // other primes are only known to the backend, OpenSSL 1.0 RSA has no place for them
+        if (mod_exp_elem < ACCEL_MOD_EXP_RSA_OTHER)
+            return -1;
+        bn = NULL;
     }
 
-    *bn = BN_bin2bn(v->data, vlen, *bn);
+    if (bn)
+        *bn = BN_bin2bn(v->data, vlen, *bn);
 
     if (k->method->decode_elem(k->priv, mod_exp_elem, v->data, vlen) < 0)
         return -1;
@@ -167,7 +212,7 @@ static int accel_rsa_key_decode_elem(mod_exp_rsa_key *k, int mod_exp_elem, const
 
 static int accel_rsa_key_decode(mod_exp_rsa_key *k, size_t len, const unsigned char *data)
 {
-    int ret = 1;
+    int ret = 1, i;
 
     // TODO handle public only key
 
@@ -180,6 +225,16 @@ static int accel_rsa_key_decode(mod_exp_rsa_key *k, size_t len, const unsigned c
     if (likely(ret > 0)) ret = accel_rsa_key_decode_elem(k, ACCEL_MOD_EXP_RSA_DMQ1, &data, &len);
     if (likely(ret > 0)) ret = accel_rsa_key_decode_elem(k, ACCEL_MOD_EXP_RSA_IQMP, &data, &len);
 
+    for (i = 0; likely(ret > 0) && len; ++i)
+    {
+        if (unlikely(i >= CMD_RSA_MAX_PRIMES - 2))
+            return -1;
+
+        ret = accel_rsa_key_decode_elem(k, ACCEL_MOD_EXP_RSA_R(i), &data, &len);
+        if (likely(ret > 0)) ret = accel_rsa_key_decode_elem(k, ACCEL_MOD_EXP_RSA_D_R(i), &data, &len);
+        if (likely(ret > 0)) ret = accel_rsa_key_decode_elem(k, ACCEL_MOD_EXP_RSA_T(i), &data, &len);
+    }
+
     return ret;
 }
 
@@ -187,6 +242,8 @@ static void accel_mod_exp_rsa_key_destroy(void *key)
 {
     mod_exp_rsa_key *k = (mod_exp_rsa_key *)key;
 
+    accel_blinding_free(k->blinding);
+    free(k->n_bin);
     k->method->free_priv(k->priv);
     RSA_free(k->rsa_key);
     free(k);
@@ -223,6 +280,25 @@ static mod_exp_rsa_key *accel_mod_exp_rsa_key_alloc(mod_exp_priv *priv, size_t l
         return NULL;
     }
 
+    // blinding is done in accel_rsa_mod_exp with per-thread pairs
+    k->blinding = accel_blinding_new(k->rsa_key->n, k->rsa_key->e);
+    if (unlikely(!k->blinding))
+    {
+        accel_mod_exp_rsa_key_destroy(k);
+        return NULL;
+    }
+    k->rsa_key->flags |= RSA_FLAG_NO_BLINDING;
+
+    k->n_len = BN_num_bytes(k->rsa_key->n);
+    k->n_limbs = (k->n_len + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    k->n_bin = malloc(k->n_len);
+    if (unlikely(!k->n_bin))
+    {
+        accel_mod_exp_rsa_key_destroy(k);
+        return NULL;
+    }
+    BN_bn2bin(k->rsa_key->n, k->n_bin);
+
     return k;
 }
 
@@ -273,11 +349,195 @@ static size_t accel_mod_exp_result_max_len(void *accel_priv UNUSED, void *key, i
     }
 }
 
+static mod_exp_native *accel_mod_exp_native_get(void)
+{
+    mod_exp_native *nt = &native;
+
+    if (unlikely(!nt->ctx))
+    {
+        nt->A = BN_new();
+        nt->Ai = BN_new();
+        nt->ctx = BN_CTX_new();
+        if (unlikely(!nt->A || !nt->Ai || !nt->ctx))
+        {
+            BN_free(nt->A);
+            BN_free(nt->Ai);
+            BN_CTX_free(nt->ctx);
+            memset(nt, 0, sizeof(*nt));
+            return NULL;
+        }
+    }
+
+    return nt;
+}
+
+static inline int accel_mod_exp_native_usable(mod_exp_rsa_key *key, int pad, int dec)
+{
+    if ((!key->method->mod_exp_bin && !key->method->mod_exp_limbs) || !key->blinding || key->n_len > ACCEL_MOD_EXP_NATIVE_MAX_LEN)
+        return 0;
+
+    switch (pad)
+    {
+    case RSA_PKCS1_PADDING:
+    case RSA_NO_PADDING:
+        return 1;
+    case RSA_PKCS1_OAEP_PADDING:
+        return dec;
+    default:
+        return 0;
+    }
+}
+
+// big endian len bytes into n little endian limbs, len <= 8 n
+static void accel_mod_exp_bin2limbs(uint64_t *p, size_t n, const unsigned char *bin, size_t len)
+{
+    size_t i;
+
+    memset(p, 0, n * sizeof(uint64_t));
+    for (i = 0; i < len; ++i)
+        p[i / 8] |= (uint64_t)bin[len - 1 - i] << (8 * (i % 8));
+}
+
+static void accel_mod_exp_limbs2bin(unsigned char *bin, size_t len, const uint64_t *p)
+{
+    size_t i;
+
+    for (i = 0; i < len; ++i)
+        bin[len - 1 - i] = p[i / 8] >> (8 * (i % 8));
+}
+
+static void *accel_mod_exp_native_scratch(mod_exp_native *nt, mod_exp_method *method, size_t n)
+{
+    if (likely(nt->scratch && nt->scratch_method == method && nt->scratch_limbs >= n))
+        return nt->scratch;
+
+    if (nt->scratch)
+        nt->scratch_method->free_scratch(nt->scratch);
+
+    // largest size up front, so keys of mixed sizes on a thread do not keep reallocating
+    nt->scratch = method->alloc_scratch(ACCEL_MOD_EXP_NATIVE_MAX_LIMBS);
+    nt->scratch_method = nt->scratch ? method : NULL;
+    nt->scratch_limbs = nt->scratch ? ACCEL_MOD_EXP_NATIVE_MAX_LIMBS : 0;
+
+    return nt->scratch;
+}
+
+static int accel_mod_exp_native_exp_limbs(mod_exp_rsa_key *key, mod_exp_native *nt, unsigned char *out)
+{
+    size_t n = key->n_limbs;
+    void *scratch = accel_mod_exp_native_scratch(nt, key->method, n);
+    int ret;
+
+    if (unlikely(!scratch))
+        return -1;
+
+    if (unlikely(accel_blinding_get_limbs(key->blinding, nt->A_limbs, nt->Ai_limbs, n, nt->ctx) <= 0))
+        return -1;
+
+    accel_mod_exp_bin2limbs(nt->I, n, nt->in, key->n_len);
+    ret = key->method->mod_exp_limbs(key->priv, nt->r, nt->I, n, nt->A_limbs, nt->Ai_limbs, scratch);
+    if (likely(ret > 0))
+        accel_mod_exp_limbs2bin(out, key->n_len, nt->r);
+
+    OPENSSL_cleanse(nt->I, n * sizeof(uint64_t));
+    OPENSSL_cleanse(nt->r, n * sizeof(uint64_t));
+
+    return ret > 0 ? 1 : -1;
+}
+
+// blinded nt->in^d into out, nt->in holds n_len bytes
+static int accel_mod_exp_native_exp(mod_exp_rsa_key *key, mod_exp_native *nt, unsigned char *out)
+{
+    // input is public, no need for a constant time compare
+    if (unlikely(memcmp(nt->in, key->n_bin, key->n_len) >= 0))
+        return -1;
+
+    if (key->method->mod_exp_limbs)
+        return accel_mod_exp_native_exp_limbs(key, nt, out);
+
+    if (unlikely(accel_blinding_get(key->blinding, nt->A, nt->Ai, nt->ctx) <= 0))
+        return -1;
+
+    if (unlikely(key->method->mod_exp_bin(key->priv, out, nt->in, key->n_len, nt->A, nt->Ai) <= 0))
+        return -1;
+
+    return 1;
+}
+
+static int accel_mod_exp_native_priv_dec(mod_exp_rsa_key *key, size_t flen, const unsigned char *from, unsigned char *to, int pad)
+{
+    mod_exp_native *nt = accel_mod_exp_native_get();
+    size_t num = key->n_len;
+    int ret = -1;
+
+    if (unlikely(!nt || flen > num))
+        return -1;
+
+    memset(nt->in, 0, num - flen);
+    memcpy(nt->in + num - flen, from, flen);
+
+    if (accel_mod_exp_native_exp(key, nt, nt->em) < 0)
+        return -1;
+
+    switch (pad)
+    {
+    case RSA_PKCS1_PADDING:
+        ret = accel_pad_check_pkcs1_type2(to, num, nt->em, num);
+        break;
+    case RSA_PKCS1_OAEP_PADDING:
+        ret = accel_pad_check_oaep_sha1(to, num, nt->em, num, nt->db);
+        OPENSSL_cleanse(nt->db, num);
+        break;
+    case RSA_NO_PADDING:
+        memcpy(to, nt->em, num);
+        ret = num;
+        break;
+    }
+
+    OPENSSL_cleanse(nt->em, num);
+
+    return ret;
+}
+
+static int accel_mod_exp_native_priv_enc(mod_exp_rsa_key *key, size_t flen, const unsigned char *from, unsigned char *to, int pad)
+{
+    mod_exp_native *nt = accel_mod_exp_native_get();
+    size_t num = key->n_len;
+
+    if (unlikely(!nt))
+        return -1;
+
+    switch (pad)
+    {
+    case RSA_PKCS1_PADDING:
+        if (accel_pad_add_pkcs1_type1(nt->in, num, from, flen) < 0)
+            return -1;
+        break;
+    case RSA_NO_PADDING:
+        if (flen != num)
+            return -1;
+        memcpy(nt->in, from, num);
+        break;
+    default:
+        return -1;
+    }
+
+    if (accel_mod_exp_native_exp(key, nt, to) < 0)
+        return -1;
+
+    return num;
+}
+
 static int accel_mod_exp_rsa_priv_dec(void *accel_priv UNUSED, void *key, size_t len UNUSED, const unsigned char *data, unsigned char *result)
 {
     cmd_op_rsa *op = (cmd_op_rsa *)data;
     mod_exp_rsa_key *mod_exp_key = (mod_exp_rsa_key *)key;
-    return RSA_private_decrypt(ntohl(op->len), op->data, result, mod_exp_key->rsa_key, ntohl(op->pad));
+    int pad = ntohl(op->pad);
+
+    if (likely(accel_mod_exp_native_usable(mod_exp_key, pad, 1)))
+        return accel_mod_exp_native_priv_dec(mod_exp_key, ntohl(op->len), op->data, result, pad);
+
+    return RSA_private_decrypt(ntohl(op->len), op->data, result, mod_exp_key->rsa_key, pad);
 }
 
 static int accel_mod_exp_rsa_pub_dec(void *accel_priv UNUSED, void *key, size_t len UNUSED, const unsigned char *data, unsigned char *result)
@@ -291,7 +551,12 @@ static int accel_mod_exp_rsa_priv_enc(void *accel_priv UNUSED, void *key, size_t
 {
     cmd_op_rsa *op = (cmd_op_rsa *)data;
     mod_exp_rsa_key *mod_exp_key = (mod_exp_rsa_key *)key;
-    return RSA_private_encrypt(ntohl(op->len), op->data, result, mod_exp_key->rsa_key, ntohl(op->pad));
+    int pad = ntohl(op->pad);
+
+    if (likely(accel_mod_exp_native_usable(mod_exp_key, pad, 0)))
+        return accel_mod_exp_native_priv_enc(mod_exp_key, ntohl(op->len), op->data, result, pad);
+
+    return RSA_private_encrypt(ntohl(op->len), op->data, result, mod_exp_key->rsa_key, pad);
 }
 
 static int accel_mod_exp_rsa_pub_enc(void *accel_priv UNUSED, void *key, size_t len UNUSED, const unsigned char *data, unsigned char *result)
@@ -301,16 +566,41 @@ static int accel_mod_exp_rsa_pub_enc(void *accel_priv UNUSED, void *key, size_t
     return RSA_public_encrypt(ntohl(op->len), op->data, result, mod_exp_key->rsa_key, ntohl(op->pad));
 }
 
-static int accel_rsa_mod_exp(BIGNUM *r0, const BIGNUM *I, RSA *rsa, BN_CTX *ctx)
+static int accel_rsa_mod_exp_raw(mod_exp_rsa_key *key, BIGNUM *r0, const BIGNUM *I, RSA *rsa, BN_CTX *ctx)
 {
-    mod_exp_rsa_key *key = (mod_exp_rsa_key *)RSA_get_ex_data(rsa, data_idx);
-
     if (likely(key && key->method->mod_exp))
         return key->method->mod_exp(key->priv, r0, I);
     else
         return RSA_PKCS1_SSLeay()->rsa_mod_exp(r0, I, rsa, ctx);
 }
 
+static int accel_rsa_mod_exp(BIGNUM *r0, const BIGNUM *I, RSA *rsa, BN_CTX *ctx)
+{
+    mod_exp_rsa_key *key = (mod_exp_rsa_key *)RSA_get_ex_data(rsa, data_idx);
+    BIGNUM *A, *Ai, *f;
+    int ret = 0;
+
+    if (unlikely(!key || !key->blinding))
+        return accel_rsa_mod_exp_raw(key, r0, I, rsa, ctx);
+
+    BN_CTX_start(ctx);
+    A = BN_CTX_get(ctx);
+    Ai = BN_CTX_get(ctx);
+    f = BN_CTX_get(ctx);
+
+    // r0 = (I * r^e)^d * r^-1 = I^d
+    if (likely(f) &&
+        accel_blinding_get(key->blinding, A, Ai, ctx) > 0 &&
+        BN_mod_mul(f, I, A, rsa->n, ctx) &&
+        accel_rsa_mod_exp_raw(key, r0, f, rsa, ctx) &&
+        BN_mod_mul(r0, r0, Ai, rsa->n, ctx))
+        ret = 1;
+
+    BN_CTX_end(ctx);
+
+    return ret;
+}
+
 static accel_method mod_exp_accel_method = {
     .free_priv = accel_mod_exp_free_priv,
     .get_name = accel_mod_exp_get_name,
@@ -21,6 +21,8 @@
 #ifndef _ACCEL_MOD_EXP_H_
 #define _ACCEL_MOD_EXP_H_
 
+#include <stdint.h>
+
 #include <openssl/bn.h>
 
 #include "accel_base.h"
@@ -34,6 +36,15 @@
 #define ACCEL_MOD_EXP_RSA_DMQ1  7
 #define ACCEL_MOD_EXP_RSA_IQMP  8
 
+// additional primes of multi-prime keys, i = 0 for the third prime
+#define ACCEL_MOD_EXP_RSA_OTHER  16
+#define ACCEL_MOD_EXP_RSA_R(i)  (ACCEL_MOD_EXP_RSA_OTHER + 3 * (i))
+#define ACCEL_MOD_EXP_RSA_D_R(i)  (ACCEL_MOD_EXP_RSA_OTHER + 3 * (i) + 1)
+#define ACCEL_MOD_EXP_RSA_T(i)  (ACCEL_MOD_EXP_RSA_OTHER + 3 * (i) + 2)
+
+// limb spans of mod_exp_limbs are aligned to this many bytes
+#define ACCEL_MOD_EXP_LIMB_ALIGN  64
+
 struct mod_exp_method_t {
     const char *(*get_name)(void);
 
@@ -42,6 +53,24 @@ struct mod_exp_method_t {
 
     int (*decode_elem)(void *mod_exp_priv, int mod_exp_elem, unsigned char *data, size_t len);
     int (*mod_exp)(void *mod_exp_priv, BIGNUM *r0, const BIGNUM *I0);
+
+    /*
+     * Optional, r = ((I * A)^d * Ai) mod n on big endian strings of len (modulus size) bytes.
+     * A and Ai is the blinding pair or NULL. Lets padding skip OpenSSL's RSA_private_* and BIGNUMs.
+     */
+    int (*mod_exp_bin)(void *mod_exp_priv, unsigned char *r, const unsigned char *I, size_t len,
+                       const BIGNUM *A, const BIGNUM *Ai);
+
+    /*
+     * Optional and preferred over the above, the same on little endian 64-bit limbs, nlimbs being
+     * the modulus size in limbs. Every span is nlimbs long and aligned to ACCEL_MOD_EXP_LIMB_ALIGN.
+     * scratch is what alloc_scratch returned for at least nlimbs and is used by one thread at a time,
+     * so the backend neither converts nor allocates per call.
+     */
+    int (*mod_exp_limbs)(void *mod_exp_priv, uint64_t *r, const uint64_t *I, size_t nlimbs,
+                         const uint64_t *A, const uint64_t *Ai, void *scratch);
+    void *(*alloc_scratch)(size_t nlimbs);
+    void (*free_scratch)(void *scratch);
 };
 typedef struct mod_exp_method_t mod_exp_method;
 
@@ -0,0 +1,1113 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <openssl/crypto.h>
+
+#include <common/compiler.h>
+
+#include <accessl-common/cmd.h>
+#include <accessl-common/stat.h>
+
+#include "accel_bg.h"
+#include "accel_p256.h"
+#include "accel_thread.h"
+
+#define P256_BYTES  32
+
+// comb teeth, columns are P256_COMB_SPACING bits apart
+#define P256_COMB_TEETH  8
+#define P256_COMB_SPACING  32
+#define P256_COMB_SIZE  (1 << P256_COMB_TEETH)
+
+// most key pairs one request can carry
+#define P256_KEYSHARE_MAX  (CMD_MAX_LEN / CMD_KEYSHARE_SECP256R1_LEN)
+
+typedef unsigned __int128 u128;
+
+// 256-bit number as little endian 64-bit limbs
+typedef uint64_t p256_num[4];
+
+// Montgomery arithmetic modulo m, R = 2^256
+struct p256_mod_t {
+    p256_num m;
+    p256_num m_minus_2; // inversion exponent
+    p256_num one; // R mod m
+    p256_num rr; // R^2 mod m
+    uint64_t m0inv; // -m^-1 mod 2^64
+};
+typedef struct p256_mod_t p256_mod;
+
+// field elements are kept in Montgomery form
+struct p256_affine_t {
+    p256_num x;
+    p256_num y;
+};
+typedef struct p256_affine_t p256_affine;
+
+// Jacobian coordinates, Z = 0 is the point at infinity
+struct p256_jac_t {
+    p256_num x;
+    p256_num y;
+    p256_num z;
+};
+typedef struct p256_jac_t p256_jac;
+
+// precomputed nonce, k^-1 in Montgomery form and r = x(k G) mod n
+struct p256_pair_t {
+    p256_num kinv;
+    p256_num r;
+};
+typedef struct p256_pair_t p256_pair;
+
+/*
+ * Single producer (background thread), single consumer (owning thread) ring,
+ * same scheme as the RSA blinding rings. Every pair is handed out once and wiped.
+ */
+struct p256_ring_t {
+    volatile unsigned int head; // next pair to take, written by consumer
+    volatile unsigned int tail; // next pair to fill, written by producer
+
+    struct stat_t hits;
+    struct stat_t misses;
+
+    p256_pair pairs[0];
+};
+typedef struct p256_ring_t p256_ring;
+
+struct p256_pool_t {
+    unsigned int size; // pairs per ring, power of two
+    int rate; // pairs per second the background thread may compute, 0 for no limit
+    uint64_t budget_ns; // time the pairs computed so far used up at the rate, lags by a second at most
+
+    p256_ring *volatile rings[ACCEL_MAX_THREADS];
+    int bg_handle;
+};
+typedef struct p256_pool_t p256_pool;
+
+struct p256_key_t {
+    p256_num d; // Montgomery form modulo n
+    p256_pool *pool; // NULL if pools are off
+};
+typedef struct p256_key_t p256_key;
+
+static const p256_num p256_b = {
+    0x3bce3c3e27d2604bULL, 0x651d06b0cc53b0f6ULL, 0xb3ebbd55769886bcULL, 0x5ac635d8aa3a93e7ULL,
+};
+static const p256_num p256_gx = {
+    0xf4a13945d898c296ULL, 0x77037d812deb33a0ULL, 0xf8bce6e563a440f2ULL, 0x6b17d1f2e12c4247ULL,
+};
+static const p256_num p256_gy = {
+    0xcbb6406837bf51f5ULL, 0x2bce33576b315eceULL, 0x8ee7eb4a7c0f9e16ULL, 0x4fe342e2fe1a7f9bULL,
+};
+
+static const p256_mod fp = {
+    { 0xffffffffffffffffULL, 0x00000000ffffffffULL, 0x0000000000000000ULL, 0xffffffff00000001ULL },
+    { 0xfffffffffffffffdULL, 0x00000000ffffffffULL, 0x0000000000000000ULL, 0xffffffff00000001ULL },
+    { 0x0000000000000001ULL, 0xffffffff00000000ULL, 0xffffffffffffffffULL, 0x00000000fffffffeULL },
+    { 0x0000000000000003ULL, 0xfffffffbffffffffULL, 0xfffffffffffffffeULL, 0x00000004fffffffdULL },
+    0x0000000000000001ULL,
+};
+
+static const p256_mod fn = {
+    { 0xf3b9cac2fc632551ULL, 0xbce6faada7179e84ULL, 0xffffffffffffffffULL, 0xffffffff00000000ULL },
+    { 0xf3b9cac2fc63254fULL, 0xbce6faada7179e84ULL, 0xffffffffffffffffULL, 0xffffffff00000000ULL },
+    { 0x0c46353d039cdaafULL, 0x4319055258e8617bULL, 0x0000000000000000ULL, 0x00000000ffffffffULL },
+    { 0x83244c95be79eea2ULL, 0x4699799c49bd6fa6ULL, 0x2845b2392b6bec59ULL, 0x66e12d94f3d95620ULL },
+    0xccd1c8aaee00bc4fULL,
+};
+
+static p256_num b_mont;
+
+// comb[j] = sum of 2^(P256_COMB_SPACING * i) * G over set bits i of j, comb[0] is unused
+static p256_affine comb[P256_COMB_SIZE];
+
+static int urandom_fd = -1;
+
+// applies to keys added afterwards
+static unsigned int pool_size = ACCEL_ECDSA_POOL_DEFAULT;
+static int pool_rate = 0;
+
+static inline uint64_t ct_mask(uint64_t bit)
+{
+    return 0 - bit;
+}
+
+static inline uint64_t ct_is_zero_64(uint64_t x)
+{
+    return ct_mask(((x | (0 - x)) >> 63) ^ 1);
+}
+
+static inline uint64_t num_is_zero(const p256_num a)
+{
+    return ct_is_zero_64(a[0] | a[1] | a[2] | a[3]);
+}
+
+static inline void num_select(p256_num r, uint64_t mask, const p256_num a, const p256_num b)
+{
+    int i;
+
+    for (i = 0; i < 4; ++i)
+        r[i] = (a[i] & mask) | (b[i] & ~mask);
+}
+
+// r = t - m if t (with hi above 256 bits) >= m, else t
+static void mod_reduce_once(p256_num r, const p256_num t, uint64_t hi, const p256_mod *m)
+{
+    p256_num u;
+    uint64_t borrow = 0;
+    int i;
+
+    for (i = 0; i < 4; ++i)
+    {
+        u128 d = (u128)t[i] - m->m[i] - borrow;
+
+        u[i] = (uint64_t)d;
+        borrow = (uint64_t)(d >> 64) & 1;
+    }
+
+    num_select(r, ct_mask(borrow & ~hi & 1), t, u);
+}
+
+static void mod_add(p256_num r, const p256_num a, const p256_num b, const p256_mod *m)
+{
+    p256_num t;
+    uint64_t carry = 0;
+    int i;
+
+    for (i = 0; i < 4; ++i)
+    {
+        u128 s = (u128)a[i] + b[i] + carry;
+
+        t[i] = (uint64_t)s;
+        carry = (uint64_t)(s >> 64);
+    }
+
+    mod_reduce_once(r, t, carry, m);
+}
+
+static void mod_sub(p256_num r, const p256_num a, const p256_num b, const p256_mod *m)
+{
+    p256_num t;
+    uint64_t borrow = 0, carry = 0, mask;
+    int i;
+
+    for (i = 0; i < 4; ++i)
+    {
+        u128 d = (u128)a[i] - b[i] - borrow;
+
+        t[i] = (uint64_t)d;
+        borrow = (uint64_t)(d >> 64) & 1;
+    }
+
+    // add m back if it went negative
+    mask = ct_mask(borrow);
+    for (i = 0; i < 4; ++i)
+    {
+        u128 s = (u128)t[i] + (m->m[i] & mask) + carry;
+
+        r[i] = (uint64_t)s;
+        carry = (uint64_t)(s >> 64);
+    }
+}
+
+// r = a * b / R mod m, operands below m, r may alias them
+static inline __attribute__((always_inline)) void mont_mul(p256_num r, const p256_num a, const p256_num b, const p256_mod *m)
+{
+    uint64_t t[6] = { 0, 0, 0, 0, 0, 0 };
+    int i, j;
+
+    for (i = 0; i < 4; ++i)
+    {
+        uint64_t c = 0, mu;
+        u128 acc;
+
+        for (j = 0; j < 4; ++j)
+        {
+            acc = (u128)a[j] * b[i] + t[j] + c;
+            t[j] = (uint64_t)acc;
+            c = (uint64_t)(acc >> 64);
+        }
+        acc = (u128)t[4] + c;
+        t[4] = (uint64_t)acc;
+        t[5] = (uint64_t)(acc >> 64);
+
+        // add mu * m to clear the lowest limb and shift down
+        mu = t[0] * m->m0inv;
+        acc = (u128)mu * m->m[0] + t[0];
+        c = (uint64_t)(acc >> 64);
+        for (j = 1; j < 4; ++j)
+        {
+            acc = (u128)mu * m->m[j] + t[j] + c;
+            t[j - 1] = (uint64_t)acc;
+            c = (uint64_t)(acc >> 64);
+        }
+        acc = (u128)t[4] + c;
+        t[3] = (uint64_t)acc;
+        t[4] = t[5] + (uint64_t)(acc >> 64);
+    }
+
+    mod_reduce_once(r, t, t[4], m);
+}
+
+// separate copies for both moduli let the compiler fold their limbs (mostly 0 and ~0 for p)
+static void mod_mul(p256_num r, const p256_num a, const p256_num b, const p256_mod *m)
+{
+    if (m == &fp)
+        mont_mul(r, a, b, &fp);
+    else
+        mont_mul(r, a, b, &fn);
+}
+
+static inline void mod_sqr(p256_num r, const p256_num a, const p256_mod *m)
+{
+    mod_mul(r, a, a, m);
+}
+
+static inline void mod_to_mont(p256_num r, const p256_num a, const p256_mod *m)
+{
+    mod_mul(r, a, m->rr, m);
+}
+
+static inline void mod_from_mont(p256_num r, const p256_num a, const p256_mod *m)
+{
+    static const p256_num one = { 1, 0, 0, 0 };
+
+    mod_mul(r, a, one, m);
+}
+
+// r = a^(m-2) = a^-1 in Montgomery form, the exponent is public so branching on it is fine
+static void mod_inv(p256_num r, const p256_num a, const p256_mod *m)
+{
+    p256_num pow[16], x;
+    int i;
+
+    memcpy(pow[0], m->one, sizeof(x));
+    for (i = 1; i < 16; ++i)
+        mod_mul(pow[i], pow[i - 1], a, m);
+
+    // fixed 4-bit windows from the top
+    memcpy(x, m->one, sizeof(x));
+    for (i = 252; i >= 0; i -= 4)
+    {
+        int w = (m->m_minus_2[i / 64] >> (i % 64)) & 0xf;
+
+        mod_sqr(x, x, m);
+        mod_sqr(x, x, m);
+        mod_sqr(x, x, m);
+        mod_sqr(x, x, m);
+        if (w)
+            mod_mul(x, x, pow[w], m);
+    }
+
+    memcpy(r, x, sizeof(x));
+}
+
+static void num_from_bin(p256_num r, const unsigned char *bin, size_t len)
+{
+    size_t i;
+
+    memset(r, 0, sizeof(p256_num));
+    for (i = 0; i < len && i < P256_BYTES; ++i)
+        r[i / 8] |= (uint64_t)bin[len - 1 - i] << (8 * (i % 8));
+}
+
+static void num_to_bin(unsigned char *bin, const p256_num a)
+{
+    int i;
+
+    for (i = 0; i < P256_BYTES; ++i)
+        bin[P256_BYTES - 1 - i] = (unsigned char)(a[i / 8] >> (8 * (i % 8)));
+}
+
+// a < m, not constant time
+static int num_lt(const p256_num a, const p256_num m)
+{
+    int i;
+
+    for (i = 3; i >= 0; --i)
+    {
+        if (a[i] != m[i])
+            return a[i] < m[i];
+    }
+
+    return 0;
+}
+
+/*
+ * Doubling for a = -3 (dbl-2001-b), r may alias a:
+ * alpha = 3 (X - Z^2)(X + Z^2), X3 = alpha^2 - 8 X Y^2, Z3 = (Y + Z)^2 - Y^2 - Z^2,
+ * Y3 = alpha (4 X Y^2 - X3) - 8 Y^4.
+ */
+static void p256_dbl(p256_jac *r, const p256_jac *a)
+{
+    p256_num delta, gamma, beta, alpha, t1, t2, x3, z3;
+
+    mod_sqr(delta, a->z, &fp);
+    mod_sqr(gamma, a->y, &fp);
+    mod_mul(beta, a->x, gamma, &fp);
+
+    mod_sub(t1, a->x, delta, &fp);
+    mod_add(t2, a->x, delta, &fp);
+    mod_mul(alpha, t1, t2, &fp);
+    mod_add(t1, alpha, alpha, &fp);
+    mod_add(alpha, t1, alpha, &fp);
+
+    mod_add(t1, a->y, a->z, &fp);
+    mod_sqr(t1, t1, &fp);
+    mod_sub(t1, t1, gamma, &fp);
+    mod_sub(z3, t1, delta, &fp);
+
+    mod_add(t2, beta, beta, &fp);
+    mod_add(t2, t2, t2, &fp);
+    mod_sqr(x3, alpha, &fp);
+    mod_sub(x3, x3, t2, &fp);
+    mod_sub(x3, x3, t2, &fp);
+
+    mod_sub(t2, t2, x3, &fp);
+    mod_mul(t2, alpha, t2, &fp);
+    mod_sqr(gamma, gamma, &fp);
+    mod_add(gamma, gamma, gamma, &fp);
+    mod_add(gamma, gamma, gamma, &fp);
+    mod_add(gamma, gamma, gamma, &fp);
+    mod_sub(r->y, t2, gamma, &fp);
+
+    memcpy(r->x, x3, sizeof(x3));
+    memcpy(r->z, z3, sizeof(z3));
+}
+
+/*
+ * r = a + b with b affine (madd-2007-bl), constant time also when a is at infinity.
+ * a == b gives a wrong result, returns all ones mask then. r may alias a.
+ */
+static uint64_t p256_add_affine(p256_jac *r, const p256_jac *a, const p256_affine *b)
+{
+    p256_num z1z1, u2, s2, h, hh, i, j, rr, v, t;
+    p256_jac res;
+    uint64_t a_inf, same;
+
+    mod_sqr(z1z1, a->z, &fp);
+    mod_mul(u2, b->x, z1z1, &fp);
+    mod_mul(s2, b->y, a->z, &fp);
+    mod_mul(s2, s2, z1z1, &fp);
+    mod_sub(h, u2, a->x, &fp);
+    mod_sub(rr, s2, a->y, &fp);
+
+    a_inf = num_is_zero(a->z);
+    same = num_is_zero(h) & num_is_zero(rr) & ~a_inf;
+
+    mod_add(rr, rr, rr, &fp);
+    mod_sqr(hh, h, &fp);
+    mod_add(i, hh, hh, &fp);
+    mod_add(i, i, i, &fp);
+    mod_mul(j, h, i, &fp);
+    mod_mul(v, a->x, i, &fp);
+
+    mod_sqr(res.x, rr, &fp);
+    mod_sub(res.x, res.x, j, &fp);
+    mod_sub(res.x, res.x, v, &fp);
+    mod_sub(res.x, res.x, v, &fp);
+
+    mod_sub(t, v, res.x, &fp);
+    mod_mul(res.y, rr, t, &fp);
+    mod_mul(t, a->y, j, &fp);
+    mod_add(t, t, t, &fp);
+    mod_sub(res.y, res.y, t, &fp);
+
+    mod_add(t, a->z, h, &fp);
+    mod_sqr(t, t, &fp);
+    mod_sub(t, t, z1z1, &fp);
+    mod_sub(res.z, t, hh, &fp);
+
+    num_select(r->x, a_inf, b->x, res.x);
+    num_select(r->y, a_inf, b->y, res.y);
+    num_select(r->z, a_inf, fp.one, res.z);
+
+    return same;
+}
+
+// x (and y if not NULL) of a, in Montgomery form
+static void p256_to_affine(p256_num x, p256_num y, const p256_jac *a)
+{
+    p256_num zinv, zinv2;
+
+    mod_inv(zinv, a->z, &fp);
+    mod_sqr(zinv2, zinv, &fp);
+    mod_mul(x, a->x, zinv2, &fp);
+    if (y)
+    {
+        mod_mul(zinv2, zinv2, zinv, &fp);
+        mod_mul(y, a->y, zinv2, &fp);
+    }
+}
+
+// reads every entry so the access pattern does not depend on idx, zero point for idx 0
+static void p256_comb_lookup(p256_affine *r, uint64_t idx)
+{
+    uint64_t j;
+    int k;
+
+    memset(r, 0, sizeof(*r));
+    for (j = 1; j < P256_COMB_SIZE; ++j)
+    {
+        uint64_t mask = ct_is_zero_64(j ^ idx);
+
+        for (k = 0; k < 4; ++k)
+        {
+            r->x[k] |= comb[j].x[k] & mask;
+            r->y[k] |= comb[j].y[k] & mask;
+        }
+    }
+}
+
+/*
+ * r = k * G, k below the group order. The accumulator hits the table point being added
+ * only for a handful of k (it is then a multiple of n away), returns -1 for those.
+ */
+static int p256_mul_base(p256_jac *r, const p256_num k)
+{
+    p256_jac acc, sum;
+    p256_affine t;
+    uint64_t same = 0;
+    int c, b;
+
+    memset(&acc, 0, sizeof(acc));
+
+    for (c = P256_COMB_SPACING - 1; c >= 0; --c)
+    {
+        uint64_t idx = 0, skip;
+
+        p256_dbl(&acc, &acc);
+
+        for (b = 0; b < P256_COMB_TEETH; ++b)
+        {
+            int bit = P256_COMB_SPACING * b + c;
+
+            idx |= ((k[bit / 64] >> (bit % 64)) & 1) << b;
+        }
+
+        p256_comb_lookup(&t, idx);
+        skip = ct_is_zero_64(idx);
+        same |= p256_add_affine(&sum, &acc, &t) & ~skip;
+
+        num_select(acc.x, skip, acc.x, sum.x);
+        num_select(acc.y, skip, acc.y, sum.y);
+        num_select(acc.z, skip, acc.z, sum.z);
+    }
+
+    *r = acc;
+
+    return same ? -1 : 1;
+}
+
+static void p256_comb_init(void)
+{
+    p256_affine base[P256_COMB_TEETH];
+    p256_jac p;
+    int b, i, j;
+
+    // base[b] = 2^(P256_COMB_SPACING * b) * G
+    mod_to_mont(p.x, p256_gx, &fp);
+    mod_to_mont(p.y, p256_gy, &fp);
+    memcpy(p.z, fp.one, sizeof(p.z));
+    for (b = 0; b < P256_COMB_TEETH; ++b)
+    {
+        p256_to_affine(base[b].x, base[b].y, &p);
+        for (i = 0; i < P256_COMB_SPACING; ++i)
+            p256_dbl(&p, &p);
+    }
+
+    memset(comb, 0, sizeof(comb));
+    for (j = 1; j < P256_COMB_SIZE; ++j)
+    {
+        int rest = j & (j - 1);
+
+        b = __builtin_ctz(j);
+        if (!rest)
+        {
+            comb[j] = base[b];
+            continue;
+        }
+
+        memcpy(p.x, comb[rest].x, sizeof(p.x));
+        memcpy(p.y, comb[rest].y, sizeof(p.y));
+        memcpy(p.z, fp.one, sizeof(p.z));
+        p256_add_affine(&p, &p, &base[b]);
+        p256_to_affine(comb[j].x, comb[j].y, &p);
+    }
+}
+
+static int p256_random(unsigned char *buf, size_t len)
+{
+    size_t got = 0;
+
+    while (got < len)
+    {
+        ssize_t ret = read(urandom_fd, buf + got, len - got);
+
+        if (ret <= 0)
+            return -1;
+        got += ret;
+    }
+
+    return 1;
+}
+
+/*
+ * Fresh nonce k, returns r = x(k G) mod n and k^-1 (Montgomery form modulo n).
+ * Rejected candidates say nothing about the k finally used.
+ */
+static int p256_sign_setup(p256_num kinv, p256_num r)
+{
+    unsigned char buf[P256_BYTES];
+    p256_num k, x;
+    p256_jac p;
+
+    for (;;)
+    {
+        if (p256_random(buf, sizeof(buf)) < 0)
+            return -1;
+        num_from_bin(k, buf, sizeof(buf));
+        if (num_is_zero(k) || !num_lt(k, fn.m) || p256_mul_base(&p, k) < 0)
+            continue;
+
+        p256_to_affine(x, NULL, &p);
+        mod_from_mont(x, x, &fp);
+        mod_reduce_once(r, x, 0, &fn);
+        if (!num_is_zero(r))
+            break;
+    }
+
+    mod_to_mont(k, k, &fn);
+    mod_inv(kinv, k, &fn);
+
+    OPENSSL_cleanse(buf, sizeof(buf));
+    OPENSSL_cleanse(k, sizeof(k));
+
+    return 1;
+}
+
+static int p256_pool_refill(void *arg)
+{
+    p256_pool *pool = (p256_pool *)arg;
+    int more = 0;
+    int i;
+
+    for (i = 0; i < ACCEL_MAX_THREADS; ++i)
+    {
+        p256_ring *ring = pool->rings[i];
+        unsigned int tail;
+
+        if (!ring)
+            continue;
+
+        tail = ring->tail;
+        if (tail - ring->head >= pool->size)
+            continue;
+
+        if (pool->rate > 0)
+        {
+            struct timespec ts;
+            uint64_t now;
+
+            // over the budget, the idle timeout of the background thread brings us back
+            stat_store_time(&ts);
+            now = (uint64_t)ts.tv_sec * NANOSEC_IN_SEC + ts.tv_nsec;
+            if (pool->budget_ns > now)
+                return 0;
+
+            // idle time accrues up to a second worth of pairs, taken in bursts between timeouts
+            if (pool->budget_ns + NANOSEC_IN_SEC < now)
+                pool->budget_ns = now - NANOSEC_IN_SEC;
+            pool->budget_ns += NANOSEC_IN_SEC / pool->rate;
+        }
+
+        // one pair per ring per call, so other keys get their turn
+        if (p256_sign_setup(ring->pairs[tail & (pool->size - 1)].kinv, ring->pairs[tail & (pool->size - 1)].r) < 0)
+            continue;
+
+        __sync_synchronize();
+        ring->tail = tail + 1;
+
+        if (tail + 1 - ring->head < pool->size)
+            more = 1;
+    }
+
+    return more;
+}
+
+static p256_pool *p256_pool_new(void)
+{
+    p256_pool *pool;
+
+    if (!pool_size)
+        return NULL;
+
+    pool = calloc(1, sizeof(p256_pool));
+    if (unlikely(!pool))
+        return NULL;
+
+    pool->size = pool_size;
+    pool->rate = pool_rate;
+
+    // without the background thread every signature computes its own nonce
+    pool->bg_handle = accel_bg_register(p256_pool_refill, pool);
+
+    return pool;
+}
+
+static void p256_pool_free(p256_pool *pool)
+{
+    int i;
+
+    if (!pool)
+        return;
+
+    accel_bg_unregister(pool->bg_handle);
+
+    for (i = 0; i < ACCEL_MAX_THREADS; ++i)
+    {
+        p256_ring *ring = pool->rings[i];
+
+        if (ring)
+        {
+            OPENSSL_cleanse(ring, sizeof(p256_ring) + pool->size * sizeof(p256_pair));
+            free(ring);
+        }
+    }
+
+    free(pool);
+}
+
+static p256_ring *p256_pool_ring(p256_pool *pool)
+{
+    int slot = accel_thread_slot();
+    p256_ring *ring;
+
+    // threads without a slot compute nonces themselves
+    if (!pool || unlikely(slot < 0))
+        return NULL;
+
+    ring = pool->rings[slot];
+    if (unlikely(!ring))
+    {
+        ring = calloc(1, sizeof(p256_ring) + pool->size * sizeof(p256_pair));
+        if (!ring)
+            return NULL;
+        __sync_synchronize();
+        pool->rings[slot] = ring;
+    }
+
+    return ring;
+}
+
+// takes a precomputed pair if the calling thread has one ready, computes it otherwise
+static int p256_pool_take(p256_pool *pool, p256_num kinv, p256_num r)
+{
+    p256_ring *ring = p256_pool_ring(pool);
+    unsigned int head;
+    p256_pair *pair;
+
+    if (!ring)
+        return p256_sign_setup(kinv, r);
+
+    head = ring->head;
+    if (head == ring->tail)
+    {
+        stat_inc(&ring->misses);
+        accel_bg_kick();
+        return p256_sign_setup(kinv, r);
+    }
+
+    __sync_synchronize();
+    pair = &ring->pairs[head & (pool->size - 1)];
+    memcpy(kinv, pair->kinv, sizeof(p256_num));
+    memcpy(r, pair->r, sizeof(p256_num));
+    OPENSSL_cleanse(pair, sizeof(p256_pair));
+    __sync_synchronize();
+    ring->head = head + 1;
+
+    stat_inc(&ring->hits);
+
+    // consumer never waits for the refill, it only asks for it
+    if (ring->tail - ring->head < pool->size / 2)
+        accel_bg_kick();
+
+    return 1;
+}
+
+static void p256_pool_stats(p256_pool *pool, stat_val_t *hits, stat_val_t *misses, stat_val_t *ready)
+{
+    int i;
+
+    *hits = *misses = *ready = 0;
+    if (!pool)
+        return;
+
+    for (i = 0; i < ACCEL_MAX_THREADS; ++i)
+    {
+        p256_ring *ring = pool->rings[i];
+
+        if (ring)
+        {
+            *hits += stat_read(&ring->hits);
+            *misses += stat_read(&ring->misses);
+            *ready += ring->tail - ring->head;
+        }
+    }
+}
+
+void accel_p256_set_pool(int size, int rate)
+{
+    unsigned int pow2 = 1;
+
+    if (size <= 0)
+    {
+        pool_size = 0;
+        return;
+    }
+
+    while (pow2 < (unsigned int)size && pow2 < ACCEL_P256_POOL_MAX)
+        pow2 <<= 1;
+
+    pool_size = pow2;
+    pool_rate = rate > 0 ? rate : 0;
+}
+
+// s = k^-1 (e + r d) mod n, leftmost 256 bits of the digest make e
+static int p256_sign(const p256_key *key, const unsigned char *dgst, size_t dlen, unsigned char *sig)
+{
+    p256_num e, r, kinv, s, t;
+
+    num_from_bin(e, dgst, dlen < P256_BYTES ? dlen : P256_BYTES);
+    mod_reduce_once(e, e, 0, &fn);
+    mod_to_mont(e, e, &fn);
+
+    do {
+        if (p256_pool_take(key->pool, kinv, r) < 0)
+            return -1;
+
+        mod_to_mont(t, r, &fn);
+        mod_mul(s, t, key->d, &fn);
+        mod_add(s, s, e, &fn);
+        mod_mul(s, kinv, s, &fn);
+        mod_from_mont(s, s, &fn);
+    } while (num_is_zero(s));
+
+    num_to_bin(sig, r);
+    num_to_bin(sig + P256_BYTES, s);
+
+    OPENSSL_cleanse(kinv, sizeof(kinv));
+
+    return 2 * P256_BYTES;
+}
+
+/*
+ * count ephemeral ECDH key pairs as private scalar and uncompressed point. Every Z is
+ * made affine with one inversion: zz[i] = z[0] ... z[i] is walked back from the last one.
+ */
+static int p256_keyshare(int count, unsigned char *result)
+{
+    unsigned char buf[P256_BYTES];
+    p256_num d[P256_KEYSHARE_MAX], zz[P256_KEYSHARE_MAX], inv, zinv, zinv2, t;
+    p256_jac p[P256_KEYSHARE_MAX];
+    int i;
+
+    if (unlikely(count <= 0 || count > P256_KEYSHARE_MAX))
+        return -1;
+
+    for (i = 0; i < count; ++i)
+    {
+        do {
+            if (p256_random(buf, sizeof(buf)) < 0)
+            {
+                OPENSSL_cleanse(d, sizeof(d));
+                return -1;
+            }
+            num_from_bin(d[i], buf, sizeof(buf));
+        } while (num_is_zero(d[i]) || !num_lt(d[i], fn.m) || p256_mul_base(&p[i], d[i]) < 0);
+
+        if (i)
+            mod_mul(zz[i], zz[i - 1], p[i].z, &fp);
+        else
+            memcpy(zz[0], p[0].z, sizeof(zz[0]));
+    }
+
+    mod_inv(inv, zz[count - 1], &fp);
+
+    for (i = count - 1; i >= 0; --i)
+    {
+        unsigned char *pair = result + i * CMD_KEYSHARE_SECP256R1_LEN;
+
+        if (i)
+        {
+            mod_mul(zinv, inv, zz[i - 1], &fp);
+            mod_mul(inv, inv, p[i].z, &fp);
+        }
+        else
+            memcpy(zinv, inv, sizeof(zinv));
+
+        mod_sqr(zinv2, zinv, &fp);
+        mod_mul(t, p[i].x, zinv2, &fp);
+        mod_from_mont(t, t, &fp);
+        num_to_bin(pair + P256_BYTES + 1, t);
+
+        mod_mul(zinv2, zinv2, zinv, &fp);
+        mod_mul(t, p[i].y, zinv2, &fp);
+        mod_from_mont(t, t, &fp);
+        num_to_bin(pair + 2 * P256_BYTES + 1, t);
+
+        num_to_bin(pair, d[i]);
+        pair[P256_BYTES] = 0x04;
+    }
+
+    OPENSSL_cleanse(buf, sizeof(buf));
+    OPENSSL_cleanse(d, sizeof(d));
+
+    return count * CMD_KEYSHARE_SECP256R1_LEN;
+}
+
+int accel_p256_init(void)
+{
+    if (urandom_fd < 0)
+    {
+        urandom_fd = open("/dev/urandom", O_RDONLY);
+        if (urandom_fd < 0)
+            return -1;
+    }
+
+    mod_to_mont(b_mont, p256_b, &fp);
+
+    p256_comb_init();
+
+    return 1;
+}
+
+void accel_p256_destroy(void)
+{
+    if (urandom_fd >= 0)
+        close(urandom_fd);
+    urandom_fd = -1;
+}
+
+static const vli *accel_p256_next_vli(const unsigned char **data, size_t *len)
+{
+    const vli *v = (const vli *)*data;
+    size_t vlen;
+
+    if (unlikely(*len < sizeof(uint32_t)))
+        return NULL;
+
+    vlen = ntohl(v->len);
+    if (unlikely(*len - sizeof(uint32_t) < vlen))
+        return NULL;
+
+    *data += sizeof(uint32_t) + vlen;
+    *len -= sizeof(uint32_t) + vlen;
+
+    return v;
+}
+
+// y^2 = x^3 - 3x + b, coordinates in Montgomery form
+static int p256_on_curve(const p256_affine *a)
+{
+    p256_num l, r, t;
+
+    mod_sqr(l, a->y, &fp);
+    mod_sqr(r, a->x, &fp);
+    mod_mul(r, r, a->x, &fp);
+    mod_add(t, a->x, a->x, &fp);
+    mod_add(t, t, a->x, &fp);
+    mod_sub(r, r, t, &fp);
+    mod_add(r, r, b_mont, &fp);
+
+    return !memcmp(l, r, sizeof(l));
+}
+
+// the public point must be d G, so a key with mixed up halves is refused at load
+static int accel_p256_key_decode(p256_key *k, size_t len, const unsigned char *data)
+{
+    const vli *curve, *d, *pub;
+    p256_affine q, chk;
+    p256_num priv;
+    p256_jac p;
+    int ret = -1;
+
+    curve = accel_p256_next_vli(&data, &len);
+    d = accel_p256_next_vli(&data, &len);
+    pub = accel_p256_next_vli(&data, &len);
+
+    if (!pub || ntohl(curve->len) != sizeof(uint32_t) || ntohl(*(const uint32_t *)curve->data) != CMD_EC_CURVE_P256)
+        return -1;
+
+    if (ntohl(d->len) > P256_BYTES || ntohl(pub->len) != 1 + 2 * P256_BYTES || pub->data[0] != 4)
+        return -1;
+
+    num_from_bin(priv, d->data, ntohl(d->len));
+    num_from_bin(q.x, pub->data + 1, P256_BYTES);
+    num_from_bin(q.y, pub->data + 1 + P256_BYTES, P256_BYTES);
+
+    if (num_is_zero(priv) || !num_lt(priv, fn.m) || !num_lt(q.x, fp.m) || !num_lt(q.y, fp.m))
+        goto end;
+
+    mod_to_mont(q.x, q.x, &fp);
+    mod_to_mont(q.y, q.y, &fp);
+    if (!p256_on_curve(&q))
+        goto end;
+
+    if (p256_mul_base(&p, priv) < 0)
+        goto end;
+    p256_to_affine(chk.x, chk.y, &p);
+    if (memcmp(&chk, &q, sizeof(q)))
+        goto end;
+
+    mod_to_mont(k->d, priv, &fn);
+    ret = 1;
+
+end:
+    OPENSSL_cleanse(priv, sizeof(priv));
+    return ret;
+}
+
+static const char *accel_p256_get_name(void *accel_priv UNUSED)
+{
+    return "P256";
+}
+
+static void accel_p256_free_priv(void *accel_priv UNUSED)
+{
+}
+
+static void accel_p256_key_destroy(p256_key *k)
+{
+    p256_pool_free(k->pool);
+    OPENSSL_cleanse(k, sizeof(*k));
+    free(k);
+}
+
+static void *accel_p256_add_key(void *accel_priv UNUSED, int type, size_t len, const unsigned char *data)
+{
+    switch (type)
+    {
+    case CMD_KEY_EC:
+        {
+            p256_key *k = calloc(1, sizeof(p256_key));
+
+            if (unlikely(!k))
+                return NULL;
+
+            if (accel_p256_key_decode(k, len, data) < 0)
+            {
+                accel_p256_key_destroy(k);
+                return NULL;
+            }
+
+            k->pool = p256_pool_new();
+
+            return k;
+        }
+    default:
+        return NULL;
+    }
+}
+
+static void accel_p256_destroy_key(void *accel_priv UNUSED, int type, void *key)
+{
+    switch (type)
+    {
+    case CMD_KEY_EC:
+        accel_p256_key_destroy(key);
+    default:
+        return;
+    }
+}
+
+static size_t accel_p256_result_max_len(void *accel_priv UNUSED, void *key UNUSED, int op)
+{
+    switch (op) {
+    case CMD_OP_ECDSA_SIGN:
+        return 2 * P256_BYTES;
+    default:
+        return -1;
+    }
+}
+
+static int accel_p256_ecdsa_sign(void *accel_priv UNUSED, void *key, size_t len, const unsigned char *data, unsigned char *result)
+{
+    const cmd_op_ecdsa *op = (const cmd_op_ecdsa *)data;
+
+    if (unlikely(len < sizeof(cmd_op_ecdsa) || ntohl(op->len) > len - sizeof(cmd_op_ecdsa)))
+        return -1;
+
+    return p256_sign((p256_key *)key, op->data, ntohl(op->len), result);
+}
+
+static void accel_p256_key_stats(void *accel_priv UNUSED, void *key, char *buf, size_t len)
+{
+    p256_key *k = (p256_key *)key;
+    stat_val_t hits, misses, ready;
+
+    if (!k->pool)
+    {
+        snprintf(buf, len, "no nonce pool");
+        return;
+    }
+
+    p256_pool_stats(k->pool, &hits, &misses, &ready);
+    snprintf(buf, len, "nonce pool %lld hits, %lld misses, %lld ready", hits, misses, ready);
+}
+
+static int accel_p256_keyshare(void *accel_priv UNUSED, int group, int count, unsigned char *result)
+{
+    if (group != CMD_GROUP_SECP256R1)
+        return -1;
+
+    return p256_keyshare(count, result);
+}
+
+static accel_method p256_accel_method = {
+    .free_priv = accel_p256_free_priv,
+    .get_name = accel_p256_get_name,
+    .add_key = accel_p256_add_key,
+    .destroy_key = accel_p256_destroy_key,
+    .result_max_len = accel_p256_result_max_len,
+    .ecdsa_sign = accel_p256_ecdsa_sign,
+    .keyshare = accel_p256_keyshare,
+    .key_stats = accel_p256_key_stats,
+};
+
+accelerator *accel_p256_method()
+{
+    accelerator *ret = malloc(sizeof(accelerator));
+    if (!ret)
+        return ret;
+
+    ret->method = &p256_accel_method;
+    ret->priv = NULL;
+
+    return ret;
+}
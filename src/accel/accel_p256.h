@@ -0,0 +1,38 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _ACCELERATOR_P256_H_
+#define _ACCELERATOR_P256_H_
+
+#include "accel_base.h"
+
+// constant time ECDSA over NIST P-256, 64-bit Montgomery field arithmetic and a fixed-base comb
+// largest nonce pool per key and thread, sizes are rounded up to a power of two
+#define ACCEL_P256_POOL_MAX  65536
+
+int accel_p256_init(void);
+void accel_p256_destroy(void);
+
+accelerator *accel_p256_method(void);
+
+// size 0 turns pools off, rate limits pairs computed per second and key (0 for no limit)
+void accel_p256_set_pool(int size, int rate);
+
+#endif // _ACCELERATOR_P256_H_
@@ -0,0 +1,376 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/obj_mac.h>
+#include <openssl/sha.h>
+
+#include "accel_pad.h"
+
+#define PKCS1_PADDING_SIZE  11
+
+/*
+ * Constant time helpers: masks are all ones for true and all zeros for false.
+ */
+static inline unsigned int ct_msb(unsigned int a)
+{
+    return 0 - (a >> (sizeof(a) * 8 - 1));
+}
+
+static inline unsigned int ct_lt(unsigned int a, unsigned int b)
+{
+    return ct_msb(a ^ ((a ^ b) | ((a - b) ^ b)));
+}
+
+static inline unsigned int ct_ge(unsigned int a, unsigned int b)
+{
+    return ~ct_lt(a, b);
+}
+
+static inline unsigned int ct_is_zero(unsigned int a)
+{
+    return ct_msb(~a & (a - 1));
+}
+
+static inline unsigned int ct_eq(unsigned int a, unsigned int b)
+{
+    return ct_is_zero(a ^ b);
+}
+
+static inline unsigned int ct_select(unsigned int mask, unsigned int a, unsigned int b)
+{
+    return (mask & a) | (~mask & b);
+}
+
+static inline unsigned char ct_select_8(unsigned int mask, unsigned char a, unsigned char b)
+{
+    return (unsigned char)ct_select(mask, a, b);
+}
+
+static inline int ct_select_int(unsigned int mask, int a, int b)
+{
+    return (int)ct_select(mask, (unsigned int)a, (unsigned int)b);
+}
+
+/*
+ * Moves msg_len bytes found at em[start + (max_len - msg_len)] to em[start] without
+ * revealing msg_len, then copies up to tlen of them into to if good.
+ */
+static void ct_copy_msg(unsigned char *to, size_t tlen, unsigned char *em, size_t start, size_t end,
+                        size_t max_len, unsigned int msg_len, unsigned int good)
+{
+    size_t shift, i;
+
+    for (shift = 1; shift < max_len; shift <<= 1)
+    {
+        unsigned int mask = ~ct_eq(shift & (max_len - msg_len), 0);
+
+        for (i = start; i < end - shift; i++)
+            em[i] = ct_select_8(mask, em[i + shift], em[i]);
+    }
+
+    for (i = 0; i < tlen; i++)
+    {
+        unsigned int mask = good & ct_lt(i, msg_len);
+
+        to[i] = ct_select_8(mask, em[i + start], to[i]);
+    }
+}
+
+int accel_pad_check_pkcs1_type2(unsigned char *to, size_t tlen, unsigned char *em, size_t num)
+{
+    unsigned int good, found_zero_byte = 0, zero_index = 0, mlen;
+    size_t i, max_len;
+
+    if (num < PKCS1_PADDING_SIZE)
+        return -1;
+
+    good = ct_is_zero(em[0]);
+    good &= ct_eq(em[1], 2);
+
+    for (i = 2; i < num; i++)
+    {
+        unsigned int equals0 = ct_is_zero(em[i]);
+
+        zero_index = ct_select(~found_zero_byte & equals0, i, zero_index);
+        found_zero_byte |= equals0;
+    }
+
+    // at least 8 bytes of non-zero padding
+    good &= ct_ge(zero_index, 2 + 8);
+
+    mlen = num - (zero_index + 1);
+    good &= ct_ge(tlen, mlen);
+
+    max_len = num - PKCS1_PADDING_SIZE;
+    if (tlen > max_len)
+        tlen = max_len;
+
+    ct_copy_msg(to, tlen, em, PKCS1_PADDING_SIZE, num, max_len, mlen, good);
+
+    return ct_select_int(good, mlen, -1);
+}
+
+static int mgf1_sha1_xor(unsigned char *out, size_t len, const unsigned char *seed, size_t seed_len)
+{
+    unsigned char md[SHA_DIGEST_LENGTH];
+    unsigned char cnt[4];
+    size_t done, i;
+    uint32_t c;
+
+    for (c = 0, done = 0; done < len; ++c)
+    {
+        SHA_CTX sha;
+
+        cnt[0] = (c >> 24) & 0xff;
+        cnt[1] = (c >> 16) & 0xff;
+        cnt[2] = (c >> 8) & 0xff;
+        cnt[3] = c & 0xff;
+
+        if (!SHA1_Init(&sha) ||
+            !SHA1_Update(&sha, seed, seed_len) ||
+            !SHA1_Update(&sha, cnt, sizeof(cnt)) ||
+            !SHA1_Final(md, &sha))
+            return -1;
+
+        for (i = 0; i < SHA_DIGEST_LENGTH && done < len; ++i, ++done)
+            out[done] ^= md[i];
+    }
+
+    OPENSSL_cleanse(md, sizeof(md));
+
+    return 1;
+}
+
+int accel_pad_check_oaep_sha1(unsigned char *to, size_t tlen, unsigned char *em, size_t num, unsigned char *db)
+{
+    static const unsigned char empty_hash[SHA_DIGEST_LENGTH] = {
+        0xda, 0x39, 0xa3, 0xee, 0x5e, 0x6b, 0x4b, 0x0d, 0x32, 0x55,
+        0xbf, 0xef, 0x95, 0x60, 0x18, 0x90, 0xaf, 0xd8, 0x07, 0x09,
+    };
+    const size_t mdlen = SHA_DIGEST_LENGTH;
+    unsigned char seed[SHA_DIGEST_LENGTH];
+    unsigned int good, found_one_byte = 0, one_index = 0, mlen;
+    size_t dblen, max_len, i;
+
+    if (num < 2 * mdlen + 2)
+        return -1;
+
+    dblen = num - mdlen - 1;
+
+    good = ct_is_zero(em[0]);
+
+    // seed = maskedSeed ^ MGF(maskedDB), DB = maskedDB ^ MGF(seed)
+    memcpy(seed, em + 1, mdlen);
+    memcpy(db, em + 1 + mdlen, dblen);
+    if (mgf1_sha1_xor(seed, mdlen, db, dblen) < 0 ||
+        mgf1_sha1_xor(db, dblen, seed, mdlen) < 0)
+        return -1;
+
+    good &= ct_is_zero(CRYPTO_memcmp(db, empty_hash, mdlen));
+
+    // DB = lHash || PS (zeros) || 0x01 || M
+    for (i = mdlen; i < dblen; i++)
+    {
+        unsigned int equals1 = ct_eq(db[i], 1);
+        unsigned int equals0 = ct_is_zero(db[i]);
+
+        one_index = ct_select(~found_one_byte & equals1, i, one_index);
+        found_one_byte |= equals1;
+        good &= (found_one_byte | equals0);
+    }
+    good &= found_one_byte;
+
+    mlen = dblen - (one_index + 1);
+    good &= ct_ge(tlen, mlen);
+
+    max_len = dblen - mdlen - 1;
+    if (tlen > max_len)
+        tlen = max_len;
+
+    ct_copy_msg(to, tlen, db, mdlen + 1, dblen, max_len, mlen, good);
+
+    OPENSSL_cleanse(seed, sizeof(seed));
+
+    return ct_select_int(good, mlen, -1);
+}
+
+int accel_pad_add_pkcs1_type1(unsigned char *em, size_t num, const unsigned char *from, size_t flen)
+{
+    if (flen > num - PKCS1_PADDING_SIZE || num < PKCS1_PADDING_SIZE)
+        return -1;
+
+    // 00 01 FF .. FF 00 message
+    em[0] = 0;
+    em[1] = 1;
+    memset(em + 2, 0xff, num - 3 - flen);
+    em[num - flen - 1] = 0;
+    memcpy(em + num - flen, from, flen);
+
+    return num;
+}
+
+// DER of DigestInfo up to the digest itself (RFC 8017 9.2, note 1)
+struct digest_info_t {
+    int nid;
+    size_t hlen;
+    unsigned char prefix[19];
+    size_t prefix_len;
+};
+typedef struct digest_info_t digest_info;
+
+static const digest_info digest_infos[] = {
+    { NID_md5, 16, { 0x30, 0x20, 0x30, 0x0c, 0x06, 0x08, 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x02, 0x05,
+                     0x05, 0x00, 0x04, 0x10 }, 18 },
+    { NID_sha1, 20, { 0x30, 0x21, 0x30, 0x09, 0x06, 0x05, 0x2b, 0x0e, 0x03, 0x02, 0x1a, 0x05, 0x00, 0x04,
+                      0x14 }, 15 },
+    { NID_sha224, 28, { 0x30, 0x2d, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02,
+                        0x04, 0x05, 0x00, 0x04, 0x1c }, 19 },
+    { NID_sha256, 32, { 0x30, 0x31, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02,
+                        0x01, 0x05, 0x00, 0x04, 0x20 }, 19 },
+    { NID_sha384, 48, { 0x30, 0x41, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02,
+                        0x02, 0x05, 0x00, 0x04, 0x30 }, 19 },
+    { NID_sha512, 64, { 0x30, 0x51, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02,
+                        0x03, 0x05, 0x00, 0x04, 0x40 }, 19 },
+    // TLS before 1.2 signs the bare MD5 || SHA-1 concatenation
+    { NID_md5_sha1, 36, { 0 }, 0 },
+};
+
+int accel_pad_digest_info(unsigned char *to, size_t tlen, int nid, const unsigned char *hash, size_t hlen)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(digest_infos) / sizeof(digest_infos[0]); ++i)
+    {
+        const digest_info *di = &digest_infos[i];
+
+        if (di->nid != nid)
+            continue;
+
+        if (hlen != di->hlen || tlen < di->prefix_len + hlen)
+            return -1;
+
+        memcpy(to, di->prefix, di->prefix_len);
+        memcpy(to + di->prefix_len, hash, hlen);
+
+        return di->prefix_len + hlen;
+    }
+
+    return -1;
+}
+
+static const EVP_MD *pad_md(int nid)
+{
+    switch (nid) {
+    case NID_sha1:
+        return EVP_sha1();
+    case NID_sha224:
+        return EVP_sha224();
+    case NID_sha256:
+        return EVP_sha256();
+    case NID_sha384:
+        return EVP_sha384();
+    case NID_sha512:
+        return EVP_sha512();
+    default:
+        return NULL;
+    }
+}
+
+int accel_pad_md_size(int nid)
+{
+    const EVP_MD *md = pad_md(nid);
+
+    return md ? EVP_MD_size(md) : -1;
+}
+
+static int mgf1_xor(unsigned char *out, size_t len, const unsigned char *seed, size_t seed_len, const EVP_MD *md)
+{
+    unsigned char in[EVP_MAX_MD_SIZE + 4], mask[EVP_MAX_MD_SIZE];
+    unsigned int mdlen;
+    size_t done, i;
+    uint32_t c;
+
+    if (seed_len > EVP_MAX_MD_SIZE)
+        return -1;
+
+    memcpy(in, seed, seed_len);
+    for (c = 0, done = 0; done < len; ++c)
+    {
+        in[seed_len] = (c >> 24) & 0xff;
+        in[seed_len + 1] = (c >> 16) & 0xff;
+        in[seed_len + 2] = (c >> 8) & 0xff;
+        in[seed_len + 3] = c & 0xff;
+
+        if (!EVP_Digest(in, seed_len + 4, mask, &mdlen, md, NULL))
+            return -1;
+
+        for (i = 0; i < mdlen && done < len; ++i, ++done)
+            out[done] ^= mask[i];
+    }
+
+    return 1;
+}
+
+int accel_pad_add_pss(unsigned char *em, size_t num, int bits, int nid, const unsigned char *mhash, size_t hlen,
+                      const unsigned char *salt, size_t slen)
+{
+    static const unsigned char zeros[8] = { 0 };
+    const EVP_MD *md = pad_md(nid);
+    unsigned char mprime[sizeof(zeros) + 2 * EVP_MAX_MD_SIZE];
+    unsigned char *db, *h;
+    size_t em_bits = bits - 1, em_len = (em_bits + 7) / 8, db_len;
+    unsigned int mdlen;
+
+    if (!md || hlen != (size_t)EVP_MD_size(md) || slen > EVP_MAX_MD_SIZE ||
+        bits < 2 || num < em_len || em_len < hlen + slen + 2)
+        return -1;
+
+    // the modulus may take a byte more than emBits do
+    memset(em, 0, num - em_len);
+    db = em + num - em_len;
+    db_len = em_len - hlen - 1;
+    h = db + db_len;
+
+    // H = Hash(0x00 * 8 || mHash || salt)
+    memcpy(mprime, zeros, sizeof(zeros));
+    memcpy(mprime + sizeof(zeros), mhash, hlen);
+    memcpy(mprime + sizeof(zeros) + hlen, salt, slen);
+    if (!EVP_Digest(mprime, sizeof(zeros) + hlen + slen, h, &mdlen, md, NULL))
+        return -1;
+
+    // DB = PS || 0x01 || salt, masked with MGF1(H)
+    memset(db, 0, db_len - slen - 1);
+    db[db_len - slen - 1] = 1;
+    memcpy(db + db_len - slen, salt, slen);
+    if (mgf1_xor(db, db_len, h, hlen, md) < 0)
+        return -1;
+
+    db[0] &= 0xff >> (8 * em_len - em_bits);
+    em[num - 1] = 0xbc;
+
+    OPENSSL_cleanse(mprime, sizeof(mprime));
+
+    return num;
+}
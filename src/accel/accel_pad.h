@@ -0,0 +1,47 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _ACCEL_PAD_H_
+#define _ACCEL_PAD_H_
+
+#include <stddef.h>
+
+/*
+ * RSA padding working on caller supplied buffers, no allocations.
+ * Checks run in time independent of the decrypted message: em is the whole
+ * num byte encoded message (leading zero included) and is scratched over.
+ * They return message length or -1, like their OpenSSL counterparts.
+ */
+int accel_pad_check_pkcs1_type2(unsigned char *to, size_t tlen, unsigned char *em, size_t num);
+// OAEP with SHA-1 and empty label, db is num bytes of scratch
+int accel_pad_check_oaep_sha1(unsigned char *to, size_t tlen, unsigned char *em, size_t num, unsigned char *db);
+
+int accel_pad_add_pkcs1_type1(unsigned char *em, size_t num, const unsigned char *from, size_t flen);
+
+// DigestInfo of hash for PKCS#1 v1.5 signatures, NID_md5_sha1 gets none as in TLS before 1.2
+int accel_pad_digest_info(unsigned char *to, size_t tlen, int nid, const unsigned char *hash, size_t hlen);
+
+// digest length for the hashes PSS supports, -1 for others
+int accel_pad_md_size(int nid);
+// EMSA-PSS (RFC 8017 9.1.1) with MGF1 over the same hash, for a bits long modulus of num bytes
+int accel_pad_add_pss(unsigned char *em, size_t num, int bits, int nid, const unsigned char *mhash, size_t hlen,
+                      const unsigned char *salt, size_t slen);
+
+#endif // _ACCEL_PAD_H_
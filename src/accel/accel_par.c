@@ -0,0 +1,132 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <pthread.h>
+
+#include <common/compiler.h>
+
+#include <accessl-common/log.h>
+
+#include "accel_par.h"
+
+LOG_MODULE_DEFINE;
+
+static pthread_mutex_t par_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t par_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t par_done = PTHREAD_COND_INITIALIZER;
+
+static pthread_t par_thread;
+static int par_running = 0;
+static int par_stop = 0;
+static accel_par_task *par_pending = NULL;
+
+static void *accel_par_helper(void *arg UNUSED)
+{
+    pthread_mutex_lock(&par_lock);
+
+    while (1)
+    {
+        accel_par_task *task;
+
+        while (!par_pending && !par_stop)
+            pthread_cond_wait(&par_work, &par_lock);
+
+        if (par_stop)
+            break;
+
+        task = par_pending;
+        pthread_mutex_unlock(&par_lock);
+
+        task->fn(task->arg);
+
+        pthread_mutex_lock(&par_lock);
+        task->done = 1;
+        par_pending = NULL;
+        pthread_cond_broadcast(&par_done);
+    }
+
+    pthread_mutex_unlock(&par_lock);
+
+    return NULL;
+}
+
+int accel_par_init(void)
+{
+    LOG_MODULE_INIT("accessl.accel_par");
+
+    if (par_running)
+        return 1;
+
+    par_stop = 0;
+    if (pthread_create(&par_thread, NULL, accel_par_helper, NULL) != 0)
+    {
+        LOG_ERROR("could not create helper thread");
+        return -1;
+    }
+    par_running = 1;
+
+    return 1;
+}
+
+void accel_par_destroy(void)
+{
+    if (!par_running)
+        return;
+
+    pthread_mutex_lock(&par_lock);
+    par_stop = 1;
+    pthread_cond_signal(&par_work);
+    pthread_mutex_unlock(&par_lock);
+
+    pthread_join(par_thread, NULL);
+    par_running = 0;
+}
+
+int accel_par_fork(accel_par_task *task, void (*fn)(void *), void *arg)
+{
+    int ret = 0;
+
+    task->fn = fn;
+    task->arg = arg;
+    task->done = 0;
+
+    if (unlikely(!par_running))
+        return 0;
+
+    pthread_mutex_lock(&par_lock);
+    // helper busy with someone else's task - do not queue behind it
+    if (!par_pending && !par_stop)
+    {
+        par_pending = task;
+        pthread_cond_signal(&par_work);
+        ret = 1;
+    }
+    pthread_mutex_unlock(&par_lock);
+
+    return ret;
+}
+
+void accel_par_join(accel_par_task *task)
+{
+    pthread_mutex_lock(&par_lock);
+    while (!task->done)
+        pthread_cond_wait(&par_done, &par_lock);
+    pthread_mutex_unlock(&par_lock);
+}
@@ -0,0 +1,43 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _ACCEL_PAR_H_
+#define _ACCEL_PAR_H_
+
+/*
+ * Minimal fork/join onto a single helper thread.
+ * Used to run independent halves of an operation (e.g. CRT exponentiations) on two cores.
+ */
+
+struct accel_par_task_t {
+    void (*fn)(void *arg);
+    void *arg;
+    volatile int done;
+};
+typedef struct accel_par_task_t accel_par_task;
+
+int accel_par_init(void);
+void accel_par_destroy(void);
+
+// returns 1 if task was handed to the helper, 0 if the caller has to run it itself
+int accel_par_fork(accel_par_task *task, void (*fn)(void *), void *arg);
+void accel_par_join(accel_par_task *task);
+
+#endif // _ACCEL_PAR_H_
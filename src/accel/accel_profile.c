@@ -0,0 +1,162 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include <gmp.h>
+#include <openssl/crypto.h>
+
+#ifdef HAVE_TFM
+#include <tfm.h>
+#endif
+#ifdef HAVE_IPP_CRYPTO_MB
+#include <crypto_mb/version.h>
+#endif
+
+#include <common/compiler.h>
+
+#include "accel_cpu.h"
+#include "accel_profile.h"
+
+#define PROFILE_LINE_LEN  (ACCEL_PROFILE_SIGNATURE_LEN + 64)
+
+static void cpuinfo_field(const char *field, char *value, size_t len)
+{
+    char line[256];
+    size_t field_len = strlen(field);
+    FILE *f = fopen("/proc/cpuinfo", "r");
+
+    snprintf(value, len, "unknown");
+    if (!f)
+        return;
+
+    while (fgets(line, sizeof(line), f))
+    {
+        char *v;
+
+        if (strncmp(line, field, field_len) || !(v = strchr(line, ':')))
+            continue;
+
+        for (++v; *v == ' ' || *v == '\t'; ++v)
+            ;
+        v[strcspn(v, "\n")] = '\0';
+        snprintf(value, len, "%s", v);
+        break;
+    }
+
+    fclose(f);
+}
+
+void accel_profile_signature(char *signature, size_t len)
+{
+    char model[128], microcode[32], isa[128];
+    size_t used UNUSED;
+
+    cpuinfo_field("model name", model, sizeof(model));
+    cpuinfo_field("microcode", microcode, sizeof(microcode));
+    accel_cpu_describe(isa, sizeof(isa));
+
+    snprintf(signature, len, "cpu=%s;microcode=%s;isa=%s;cpus=%ld;openssl=%s;gmp=%s",
+             model, microcode, isa, sysconf(_SC_NPROCESSORS_ONLN),
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+             OpenSSL_version(OPENSSL_VERSION),
+#else
+             SSLeay_version(SSLEAY_VERSION),
+#endif
+             gmp_version);
+
+#ifdef HAVE_TFM
+    // fp_ident() spans several lines, the first one has the version
+    used = strlen(signature);
+    snprintf(signature + used, len - used, ";tfm=%.*s FP_MAX_SIZE=%d",
+             (int)strcspn(fp_ident(), "\n"), fp_ident(), FP_MAX_SIZE);
+#endif
+#ifdef HAVE_IPP_CRYPTO_MB
+    used = strlen(signature);
+    snprintf(signature + used, len - used, ";crypto_mb=%s", mbx_getversion()->strVersion);
+#endif
+}
+
+int accel_profile_load(const char *path, const char *signature, accel_profile_entry *entries, int max)
+{
+    char line[PROFILE_LINE_LEN];
+    int count = 0;
+    FILE *f = fopen(path, "r");
+
+    if (!f)
+        return -1;
+
+    // first line is the signature, then "<bits> <ns> <method name>" per line
+    if (!fgets(line, sizeof(line), f) ||
+        strncmp(line, "signature ", 10) ||
+        (line[strcspn(line, "\n")] = '\0', strcmp(line + 10, signature)))
+    {
+        fclose(f);
+        return -1;
+    }
+
+    while (count < max && fgets(line, sizeof(line), f))
+    {
+        accel_profile_entry *e = &entries[count];
+        int name_pos;
+
+        line[strcspn(line, "\n")] = '\0';
+        if (sscanf(line, "%d %" SCNu64 " %n", &e->bits, &e->speed, &name_pos) < 2)
+            continue;
+
+        snprintf(e->method, sizeof(e->method), "%s", line + name_pos);
+        ++count;
+    }
+
+    fclose(f);
+
+    return count;
+}
+
+int accel_profile_save(const char *path, const char *signature, const accel_profile_entry *entries, int count)
+{
+    char tmp[PATH_MAX];
+    FILE *f;
+    int i;
+
+    // write aside and rename, so concurrently starting workers never read a partial profile
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+
+    f = fopen(tmp, "w");
+    if (!f)
+        return -1;
+
+    fprintf(f, "signature %s\n", signature);
+    for (i = 0; i < count; ++i)
+        fprintf(f, "%d %" PRIu64 " %s\n", entries[i].bits, entries[i].speed, entries[i].method);
+
+    if (fclose(f) != 0 || rename(tmp, path) < 0)
+    {
+        unlink(tmp);
+        return -1;
+    }
+
+    return 1;
+}
@@ -0,0 +1,48 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _ACCEL_PROFILE_H_
+#define _ACCEL_PROFILE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ACCEL_PROFILE_NAME_LEN  64
+#define ACCEL_PROFILE_SIGNATURE_LEN  512
+
+/*
+ * Calibration results kept between runs. Profile is only valid for the
+ * signature it was saved with: CPU model, microcode, usable instruction set
+ * extensions and library versions.
+ */
+struct accel_profile_entry_t {
+    int bits;
+    char method[ACCEL_PROFILE_NAME_LEN];
+    uint64_t speed; // ns per private key operation
+};
+typedef struct accel_profile_entry_t accel_profile_entry;
+
+void accel_profile_signature(char *signature, size_t len);
+
+// returns number of entries read, -1 if there is no profile or it was saved with another signature
+int accel_profile_load(const char *path, const char *signature, accel_profile_entry *entries, int max);
+int accel_profile_save(const char *path, const char *signature, const accel_profile_entry *entries, int count);
+
+#endif // _ACCEL_PROFILE_H_
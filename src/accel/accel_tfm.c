@@ -60,27 +60,37 @@ static void *accel_tfm_rsa_key_alloc(void)
     return k;
 }
 
-static void bn2fp(const BIGNUM *bn, fp_int *fp)
+static int bn2fp(const BIGNUM *bn, fp_int *fp)
 {
     bn_check_top(bn);
+    if (unlikely(bn->top > FP_SIZE))
+        return -1;
+
+    fp_zero(fp);
     memcpy(&fp->dp[0], &bn->d[0], bn->top * sizeof(bn->d[0]));
     fp->used = bn->top;
     fp->sign = bn->neg;
+
+    return 1;
 }
 
-static void fp2bn(fp_int *fp, BIGNUM *bn)
+static int fp2bn(fp_int *fp, BIGNUM *bn)
 {
     BN_zero(bn);
-    bn_expand2(bn, fp->used);
+    if (unlikely(!bn_expand2(bn, fp->used)))
+        return -1;
     bn->top = fp->used;
     memcpy(&bn->d[0], &fp->dp[0], fp->used * sizeof(bn->d[0]));
     bn_correct_top(bn);
     bn->neg = fp->sign;
+
+    return 1;
 }
 
 static int accel_tfm_rsa_key_decode_elem(void *k, int mod_exp_elem, unsigned char *data, size_t len)
 {
     tfm_rsa_key *key = (tfm_rsa_key *)k;
+    size_t max_len = FP_SIZE * sizeof(fp_digit);
     fp_int *g;
 
     switch (mod_exp_elem) {
@@ -95,9 +105,11 @@ static int accel_tfm_rsa_key_decode_elem(void *k, int mod_exp_elem, unsigned cha
             break;
         case ACCEL_MOD_EXP_RSA_P:
             g = &key->p;
+            max_len /= 2; // exptmod works on double-sized products
             break;
         case ACCEL_MOD_EXP_RSA_Q:
             g = &key->q;
+            max_len /= 2;
             break;
         case ACCEL_MOD_EXP_RSA_DMP1:
             g = &key->dmp1;
@@ -112,6 +124,10 @@ static int accel_tfm_rsa_key_decode_elem(void *k, int mod_exp_elem, unsigned cha
             return -1;
     }
 
+    // fp_read_unsigned_bin silently truncates, refuse keys not fitting in FP_MAX_SIZE
+    if (len > max_len)
+        return -1;
+
     fp_read_unsigned_bin(g, data, len);
 
     return 1;
@@ -150,12 +166,13 @@ static int accel_tfm_rsa_mod_exp(void *k, BIGNUM *r0, const BIGNUM *I0)
     fp_int fp_r0, fp_I0;
     tfm_rsa_key *key = (tfm_rsa_key *)k;
 
-    bn2fp(I0, &fp_I0);
+    // OpenSSL treats 0 as failure of rsa_mod_exp
+    if (unlikely(bn2fp(I0, &fp_I0) < 0))
+        return 0;
     fp_init(&fp_r0);
     accel_tfm_mod_exp(key, &fp_r0, &fp_I0);
-    fp2bn(&fp_r0, r0);
 
-    return 1;
+    return fp2bn(&fp_r0, r0) > 0;
 }
 
 static mod_exp_method tfm = {
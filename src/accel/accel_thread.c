@@ -0,0 +1,36 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "accel_thread.h"
+
+static int next_slot = 0;
+static __thread int thread_slot = -1;
+
+int accel_thread_slot(void)
+{
+    if (thread_slot < 0)
+    {
+        int slot = __sync_fetch_and_add(&next_slot, 1);
+
+        thread_slot = slot < ACCEL_MAX_THREADS ? slot : ACCEL_MAX_THREADS;
+    }
+
+    return thread_slot < ACCEL_MAX_THREADS ? thread_slot : -1;
+}
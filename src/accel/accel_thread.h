@@ -0,0 +1,34 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _ACCEL_THREAD_H_
+#define _ACCEL_THREAD_H_
+
+// threads beyond this have no slot and backends fall back to uncached state
+#define ACCEL_MAX_THREADS  64
+
+/*
+ * Small dense per-thread index, so backends can keep per-thread state in plain arrays.
+ * Slots are handed out on first use and never reclaimed.
+ * Returns -1 if all slots are taken.
+ */
+int accel_thread_slot(void);
+
+#endif // _ACCEL_THREAD_H_
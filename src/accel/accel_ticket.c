@@ -0,0 +1,403 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "accel_ticket.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+
+#include <common/compiler.h>
+
+#include <accessl-common/cmd.h>
+
+#include "accel_thread.h"
+
+#define TICKET_CTX_SEAL  0
+#define TICKET_CTX_OPEN  1
+#define TICKET_CTX_COUNT  2
+
+#define TICKET_MAX_KEY_LEN  32
+
+struct ticket_key_t {
+    unsigned char name[CMD_TICKET_NAME_LEN];
+    unsigned char key[TICKET_MAX_KEY_LEN];
+    const EVP_CIPHER *cipher;
+
+    // contexts with the key schedule already expanded, only the IV changes per ticket
+    EVP_CIPHER_CTX *ctx[ACCEL_MAX_THREADS][TICKET_CTX_COUNT];
+};
+typedef struct ticket_key_t ticket_key;
+
+static int urandom_fd = -1;
+
+static int ticket_random(unsigned char *buf, size_t len)
+{
+    size_t got = 0;
+
+    while (got < len)
+    {
+        ssize_t ret = read(urandom_fd, buf + got, len - got);
+
+        if (ret <= 0)
+            return -1;
+        got += ret;
+    }
+
+    return 1;
+}
+
+static EVP_CIPHER_CTX *ticket_ctx_new(const ticket_key *k, int type)
+{
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+
+    if (unlikely(!ctx))
+        return NULL;
+
+    if (EVP_CipherInit_ex(ctx, k->cipher, NULL, k->key, NULL, type == TICKET_CTX_SEAL) != 1)
+    {
+        EVP_CIPHER_CTX_free(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+// cached per key and thread, threads without a slot get a temporary one they have to free
+static EVP_CIPHER_CTX *ticket_ctx_get(ticket_key *k, int type, int *tmp)
+{
+    int slot = accel_thread_slot();
+
+    *tmp = slot < 0;
+    if (*tmp)
+        return ticket_ctx_new(k, type);
+
+    if (unlikely(!k->ctx[slot][type]))
+        k->ctx[slot][type] = ticket_ctx_new(k, type);
+
+    return k->ctx[slot][type];
+}
+
+// ticket = name || iv || ciphertext || tag, the name is authenticated as well
+static int ticket_seal(ticket_key *k, const unsigned char *iv, const unsigned char *state, size_t len, unsigned char *ticket)
+{
+    unsigned char *iv_out = ticket + CMD_TICKET_NAME_LEN;
+    unsigned char *ct = iv_out + CMD_TICKET_IV_LEN;
+    EVP_CIPHER_CTX *ctx;
+    int outl, tmp, ret = -1;
+
+    if (unlikely(len > CMD_MAX_LEN - CMD_TICKET_OVERHEAD))
+        return -1;
+
+    ctx = ticket_ctx_get(k, TICKET_CTX_SEAL, &tmp);
+    if (unlikely(!ctx))
+        return -1;
+
+    if (EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, iv) == 1 &&
+        EVP_EncryptUpdate(ctx, NULL, &outl, k->name, CMD_TICKET_NAME_LEN) == 1 &&
+        EVP_EncryptUpdate(ctx, ct, &outl, state, len) == 1 &&
+        EVP_EncryptFinal_ex(ctx, ct + outl, &outl) == 1 &&
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, CMD_TICKET_TAG_LEN, ct + len) == 1)
+    {
+        memcpy(ticket, k->name, CMD_TICKET_NAME_LEN);
+        memcpy(iv_out, iv, CMD_TICKET_IV_LEN);
+        ret = len + CMD_TICKET_OVERHEAD;
+    }
+
+    if (tmp)
+        EVP_CIPHER_CTX_free(ctx);
+
+    return ret;
+}
+
+static int ticket_open(ticket_key *k, const unsigned char *ticket, size_t len, unsigned char *state)
+{
+    const unsigned char *iv = ticket + CMD_TICKET_NAME_LEN;
+    const unsigned char *ct = iv + CMD_TICKET_IV_LEN;
+    size_t ct_len;
+    EVP_CIPHER_CTX *ctx;
+    int outl, tmp, ret = -1;
+
+    if (unlikely(len < CMD_TICKET_OVERHEAD || CRYPTO_memcmp(ticket, k->name, CMD_TICKET_NAME_LEN)))
+        return -1;
+    ct_len = len - CMD_TICKET_OVERHEAD;
+
+    ctx = ticket_ctx_get(k, TICKET_CTX_OPEN, &tmp);
+    if (unlikely(!ctx))
+        return -1;
+
+    // the tag is only known to be good after the final call, nothing decrypted leaks before that
+    if (EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, iv) == 1 &&
+        EVP_DecryptUpdate(ctx, NULL, &outl, ticket, CMD_TICKET_NAME_LEN) == 1 &&
+        EVP_DecryptUpdate(ctx, state, &outl, ct, ct_len) == 1 &&
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, CMD_TICKET_TAG_LEN, (void *)(ct + ct_len)) == 1 &&
+        EVP_DecryptFinal_ex(ctx, state + outl, &outl) == 1)
+        ret = ct_len;
+    else
+        OPENSSL_cleanse(state, ct_len);
+
+    if (tmp)
+        EVP_CIPHER_CTX_free(ctx);
+
+    return ret;
+}
+
+int accel_ticket_init(void)
+{
+    if (urandom_fd < 0)
+    {
+        urandom_fd = open("/dev/urandom", O_RDONLY);
+        if (urandom_fd < 0)
+            return -1;
+    }
+
+    return 1;
+}
+
+void accel_ticket_destroy(void)
+{
+    if (urandom_fd >= 0)
+        close(urandom_fd);
+    urandom_fd = -1;
+}
+
+const unsigned char *accel_ticket_key_name(void *key)
+{
+    return ((ticket_key *)key)->name;
+}
+
+static const vli *accel_ticket_next_vli(const unsigned char **data, size_t *len)
+{
+    const vli *v = (const vli *)*data;
+    size_t vlen;
+
+    if (unlikely(*len < sizeof(uint32_t)))
+        return NULL;
+
+    vlen = ntohl(v->len);
+    if (unlikely(*len - sizeof(uint32_t) < vlen))
+        return NULL;
+
+    *data += sizeof(uint32_t) + vlen;
+    *len -= sizeof(uint32_t) + vlen;
+
+    return v;
+}
+
+static int accel_ticket_key_decode(ticket_key *k, size_t len, const unsigned char *data)
+{
+    const vli *name, *key;
+
+    name = accel_ticket_next_vli(&data, &len);
+    key = accel_ticket_next_vli(&data, &len);
+
+    if (!key || ntohl(name->len) != CMD_TICKET_NAME_LEN)
+        return -1;
+
+    switch (ntohl(key->len)) {
+    case 16:
+        k->cipher = EVP_aes_128_gcm();
+        break;
+    case 32:
+        k->cipher = EVP_aes_256_gcm();
+        break;
+    default:
+        return -1;
+    }
+
+    memcpy(k->name, name->data, CMD_TICKET_NAME_LEN);
+    memcpy(k->key, key->data, ntohl(key->len));
+
+    return 1;
+}
+
+static const char *accel_ticket_get_name(void *accel_priv UNUSED)
+{
+    return "AES-GCM";
+}
+
+static void accel_ticket_free_priv(void *accel_priv UNUSED)
+{
+}
+
+static void accel_ticket_key_destroy(ticket_key *k)
+{
+    int i, j;
+
+    for (i = 0; i < ACCEL_MAX_THREADS; ++i)
+    {
+        for (j = 0; j < TICKET_CTX_COUNT; ++j)
+        {
+            if (k->ctx[i][j])
+                EVP_CIPHER_CTX_free(k->ctx[i][j]);
+        }
+    }
+
+    OPENSSL_cleanse(k, sizeof(*k));
+    free(k);
+}
+
+static void *accel_ticket_add_key(void *accel_priv UNUSED, int type, size_t len, const unsigned char *data)
+{
+    switch (type)
+    {
+    case CMD_KEY_TICKET:
+        {
+            ticket_key *k = calloc(1, sizeof(ticket_key));
+
+            if (unlikely(!k))
+                return NULL;
+
+            if (accel_ticket_key_decode(k, len, data) < 0)
+            {
+                accel_ticket_key_destroy(k);
+                return NULL;
+            }
+
+            return k;
+        }
+    default:
+        return NULL;
+    }
+}
+
+static void accel_ticket_destroy_key(void *accel_priv UNUSED, int type, void *key)
+{
+    switch (type)
+    {
+    case CMD_KEY_TICKET:
+        accel_ticket_key_destroy(key);
+    default:
+        return;
+    }
+}
+
+static size_t accel_ticket_result_max_len(void *accel_priv UNUSED, void *key UNUSED, int op)
+{
+    switch (op) {
+    case CMD_OP_TICKET_SEAL:
+    case CMD_OP_TICKET_OPEN:
+        return CMD_MAX_LEN;
+    default:
+        return -1;
+    }
+}
+
+static int accel_ticket_op_data(const accel_op *op, const unsigned char **data, size_t *len)
+{
+    const cmd_op_ticket *c = (const cmd_op_ticket *)op->data;
+
+    if (unlikely(op->len < sizeof(cmd_op_ticket) || ntohl(c->len) > op->len - sizeof(cmd_op_ticket)))
+        return -1;
+
+    *data = c->data;
+    *len = ntohl(c->len);
+
+    return 1;
+}
+
+/*
+ * IVs of all seals in the batch come from a single read, the rest goes through EVP,
+ * whose GCM uses AES-NI and PCLMULQDQ where the CPU has them.
+ */
+static void accel_ticket_perform_batch(void *accel_priv UNUSED, accel_op *ops, int count)
+{
+    unsigned char iv[ACCEL_BATCH_MAX][CMD_TICKET_IV_LEN];
+    int i, seals = 0;
+
+    for (i = 0; i < count; ++i)
+        seals += ops[i].op == CMD_OP_TICKET_SEAL;
+
+    if (seals && ticket_random(iv[0], seals * CMD_TICKET_IV_LEN) < 0)
+        seals = -1;
+
+    for (i = 0; i < count; ++i)
+    {
+        const unsigned char *data;
+        size_t len;
+
+        ops[i].ret = -1;
+        if (accel_ticket_op_data(&ops[i], &data, &len) < 0)
+            continue;
+
+        switch (ops[i].op) {
+        case CMD_OP_TICKET_SEAL:
+            if (seals > 0)
+                ops[i].ret = ticket_seal((ticket_key *)ops[i].key, iv[--seals], data, len, ops[i].result);
+            break;
+        case CMD_OP_TICKET_OPEN:
+            ops[i].ret = ticket_open((ticket_key *)ops[i].key, data, len, ops[i].result);
+            break;
+        }
+    }
+}
+
+static int accel_ticket_perform_one(void *accel_priv, void *key, int op, size_t len, const unsigned char *data, unsigned char *result)
+{
+    accel_op o;
+
+    o.key = key;
+    o.op = op;
+    o.len = len;
+    o.data = data;
+    o.result = result;
+
+    accel_ticket_perform_batch(accel_priv, &o, 1);
+
+    return o.ret;
+}
+
+static int accel_ticket_seal(void *accel_priv, void *key, size_t len, const unsigned char *data, unsigned char *result)
+{
+    return accel_ticket_perform_one(accel_priv, key, CMD_OP_TICKET_SEAL, len, data, result);
+}
+
+static int accel_ticket_open(void *accel_priv, void *key, size_t len, const unsigned char *data, unsigned char *result)
+{
+    return accel_ticket_perform_one(accel_priv, key, CMD_OP_TICKET_OPEN, len, data, result);
+}
+
+static accel_method ticket_accel_method = {
+    .free_priv = accel_ticket_free_priv,
+    .get_name = accel_ticket_get_name,
+    .add_key = accel_ticket_add_key,
+    .destroy_key = accel_ticket_destroy_key,
+    .result_max_len = accel_ticket_result_max_len,
+    .ticket_seal = accel_ticket_seal,
+    .ticket_open = accel_ticket_open,
+    .perform_batch = accel_ticket_perform_batch,
+};
+
+accelerator *accel_ticket_method()
+{
+    accelerator *ret = malloc(sizeof(accelerator));
+    if (!ret)
+        return ret;
+
+    ret->method = &ticket_accel_method;
+    ret->priv = NULL;
+
+    return ret;
+}
@@ -0,0 +1,35 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _ACCELERATOR_TICKET_H_
+#define _ACCELERATOR_TICKET_H_
+
+#include "accel_base.h"
+
+int accel_ticket_init(void);
+void accel_ticket_destroy(void);
+
+// session tickets sealed with AES-GCM through EVP, the key schedule is expanded once per key and thread
+accelerator *accel_ticket_method(void);
+
+// name of a CMD_KEY_TICKET key, tickets carry it in front
+const unsigned char *accel_ticket_key_name(void *key);
+
+#endif // _ACCELERATOR_TICKET_H_
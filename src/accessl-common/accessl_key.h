@@ -29,7 +29,7 @@ extern "C" {
 #define KEY_FINGERPRINT_SIZE 16
 
 struct accessl_key_t {
-    int type; // for now only RSA_KEY == 1
+    int type; // CMD_KEY_RSA or CMD_KEY_EC
     int key_converted;
     unsigned char fingerprint[KEY_FINGERPRINT_SIZE];
 };
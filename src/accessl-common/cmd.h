@@ -31,13 +31,80 @@
 #define CMD_MAX_LEN  2048
 
 #define CMD_OP    2
+/*
+ * CMD_OP whose response starts with the tag of the request as it was sent, so one socket can
+ * have many requests in flight. Plain CMD_OP responses are just the result.
+ */
+#define CMD_OP_TAGGED  3
 
 #define CMD_KEY_RSA  1
 
+/*
+ * CMD_KEY_RSA data is a sequence of vli: n, e, d, p, q, dmp1, dmq1, iqmp, followed
+ * for multi-prime keys (RFC 8017) by r_i, d_i, t_i of every additional prime.
+ */
+#define CMD_RSA_MAX_PRIMES  5
+
+/*
+ * CMD_KEY_EC data is a sequence of vli: curve (4 byte CMD_EC_CURVE_*), private scalar d
+ * and the uncompressed public point, whose MD5 is the key fingerprint.
+ */
+#define CMD_KEY_EC  2
+
+#define CMD_EC_CURVE_P256  1
+
+// CMD_KEY_ED25519 data is a sequence of vli: 32-byte seed and public key, whose MD5 is the key fingerprint
+#define CMD_KEY_ED25519  3
+
+/*
+ * CMD_KEY_TICKET data is a sequence of vli: 16-byte key name and a 16 or 32-byte AES key.
+ * Tickets are name || 12-byte IV || AES-GCM ciphertext || 16-byte tag, authenticating the name.
+ */
+#define CMD_KEY_TICKET  4
+
+#define CMD_TICKET_NAME_LEN  16
+#define CMD_TICKET_IV_LEN  12
+#define CMD_TICKET_TAG_LEN  16
+#define CMD_TICKET_OVERHEAD  (CMD_TICKET_NAME_LEN + CMD_TICKET_IV_LEN + CMD_TICKET_TAG_LEN)
+
 #define CMD_OP_RSA_PRIV_DEC  1
 #define CMD_OP_RSA_PRIV_ENC  2
 #define CMD_OP_RSA_PUB_DEC  3
 #define CMD_OP_RSA_PUB_ENC  4
+// data is cmd_op_ecdsa with the digest, result is r || s, each as long as the group order
+#define CMD_OP_ECDSA_SIGN  5
+// data is cmd_op_ed25519 with the whole message (RFC 8032 Ed25519), result is R || S
+#define CMD_OP_ED25519_SIGN  6
+/*
+ * Needs no key, the fingerprint is ignored. Data is cmd_op_keyshare, result is count fresh
+ * ephemeral key pairs, each the private key followed by the public one as sent in a TLS key share.
+ */
+#define CMD_OP_KEYSHARE  7
+
+// TLS NamedGroup ids of groups CMD_OP_KEYSHARE knows
+#define CMD_GROUP_SECP256R1  0x0017
+#define CMD_GROUP_X25519  0x001d
+
+// X25519 pairs are private scalar and u-coordinate, P-256 ones private scalar and uncompressed point
+#define CMD_KEYSHARE_X25519_LEN  (32 + 32)
+#define CMD_KEYSHARE_SECP256R1_LEN  (32 + 65)
+
+/*
+ * Ticket ops need no key either. Data is cmd_op_ticket, seal encrypts the session state with the
+ * first ticket key the worker loaded and returns the ticket, open finds the key by the name in
+ * the ticket and returns the state, -1 for unknown names and tickets failing authentication.
+ */
+#define CMD_OP_TICKET_SEAL  8
+#define CMD_OP_TICKET_OPEN  9
+/*
+ * Data is cmd_op_rsa_sign with the digest only, the worker encodes it as the padding asks:
+ * RSA_PKCS1_PADDING adds DigestInfo of nid (OpenSSL NID), RSA_PKCS1_PSS_PADDING uses
+ * MGF1 with the same hash and a fresh salt of saltlen bytes (CMD_RSA_PSS_SALTLEN_DIGEST for
+ * the digest length). Result is the signature, as long as the modulus.
+ */
+#define CMD_OP_RSA_SIGN  10
+
+#define CMD_RSA_PSS_SALTLEN_DIGEST  0xffffffff
 
 struct cmd_op_t {
     uint32_t op;
@@ -67,4 +134,37 @@ struct cmd_op_rsa_t {
 };
 typedef struct cmd_op_rsa_t cmd_op_rsa;
 
+struct cmd_op_rsa_sign_t {
+    uint32_t nid;
+    uint32_t pad;
+    uint32_t saltlen;
+    uint32_t len;
+    unsigned char data[0];
+};
+typedef struct cmd_op_rsa_sign_t cmd_op_rsa_sign;
+
+struct cmd_op_ecdsa_t {
+    uint32_t len;
+    unsigned char data[0];
+};
+typedef struct cmd_op_ecdsa_t cmd_op_ecdsa;
+
+struct cmd_op_ed25519_t {
+    uint32_t len;
+    unsigned char data[0];
+};
+typedef struct cmd_op_ed25519_t cmd_op_ed25519;
+
+struct cmd_op_keyshare_t {
+    uint32_t group;
+    uint32_t count;
+};
+typedef struct cmd_op_keyshare_t cmd_op_keyshare;
+
+struct cmd_op_ticket_t {
+    uint32_t len;
+    unsigned char data[0];
+};
+typedef struct cmd_op_ticket_t cmd_op_ticket;
+
 #endif // _CMD_H_
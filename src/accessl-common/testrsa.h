@@ -227,6 +227,186 @@ static unsigned char test2048[]={
   0x95,
   };
 
+static unsigned char test3072[]={
+  0x30,0x82,0x06,0xe4,0x02,0x01,0x00,0x02,0x82,0x01,
+  0x81,0x00,0xa7,0x33,0x23,0xf1,0x84,0xec,0xc2,0x52,
+  0x1e,0xcb,0x2b,0x35,0x34,0x2b,0x11,0x2a,0x83,0x71,
+  0xe3,0xd8,0x7e,0xaa,0x45,0xe9,0xf4,0x3b,0x32,0x19,
+  0xc3,0x18,0xec,0xd9,0x20,0xc4,0xd6,0x53,0xd8,0x82,
+  0xfb,0x3b,0x2c,0x64,0x7d,0xfb,0x0c,0x4e,0x42,0xe8,
+  0x03,0x06,0x58,0xda,0x43,0x1b,0x45,0x3e,0x9b,0x59,
+  0x59,0x0d,0xfc,0x83,0xbc,0x1c,0xd0,0xad,0x5b,0x58,
+  0xdb,0x42,0xaf,0x53,0xfe,0x00,0xde,0xaa,0x21,0x6e,
+  0x38,0x52,0x0e,0xab,0x37,0x96,0xec,0x5a,0xb0,0x4e,
+  0xe9,0x35,0x7d,0x54,0xdd,0x45,0xba,0xd1,0xbc,0xbf,
+  0x51,0xbf,0xfa,0x25,0x64,0xfa,0x46,0xf2,0xed,0x70,
+  0x93,0x45,0x2a,0xa9,0x7e,0xdb,0x85,0x55,0x38,0x5e,
+  0xe0,0x80,0x67,0xa0,0x28,0x9e,0x3b,0x87,0xe6,0xe4,
+  0xaa,0x03,0xcb,0x68,0xb7,0x13,0x82,0x9a,0x99,0xf0,
+  0x79,0x77,0x11,0x33,0xe2,0x86,0xb5,0x5f,0x3b,0x2b,
+  0x5d,0xfa,0x2c,0xf5,0x71,0x7a,0xba,0xe4,0x52,0xfc,
+  0xe0,0x2a,0xff,0xdc,0x4d,0xbc,0x22,0xeb,0x2f,0x96,
+  0x34,0x52,0x40,0x5d,0x7c,0xe0,0x1e,0x6d,0x90,0xa4,
+  0xbc,0x4f,0x71,0xce,0x70,0xf6,0xe4,0xde,0x5b,0x40,
+  0x85,0xcf,0x62,0x62,0x9e,0x8f,0xb4,0x44,0x4f,0x1b,
+  0x18,0x99,0xbf,0x72,0x5e,0xc2,0xd9,0x0a,0x21,0xac,
+  0xc1,0xd5,0x0b,0x86,0xa5,0xf5,0x54,0x23,0xd6,0x9e,
+  0xaa,0x52,0xed,0x7d,0xfc,0xf5,0x35,0xa6,0x3b,0xc7,
+  0x47,0x1d,0x92,0x4e,0xd8,0xe8,0x87,0x91,0x0a,0xc6,
+  0xc9,0x4d,0x37,0x5d,0xf3,0xb2,0xc3,0xa8,0xb1,0x9f,
+  0x30,0x3c,0xe7,0x37,0x79,0x8d,0xbb,0x88,0xb9,0xea,
+  0x28,0xfc,0x10,0xe2,0xcc,0x25,0x7f,0xe4,0x9e,0x1d,
+  0xbc,0x33,0x7f,0xae,0xa1,0x84,0x4f,0x8b,0xc7,0x9f,
+  0x31,0x2c,0x7a,0x17,0x61,0x5b,0x68,0xdf,0xe6,0xdb,
+  0xf8,0x36,0x9e,0x41,0x11,0x2d,0x91,0x13,0x3a,0x90,
+  0xbf,0x7e,0xb9,0x0d,0xd0,0x5b,0x4d,0x50,0x6b,0x3a,
+  0x6e,0xea,0x55,0x61,0x00,0x40,0x87,0xe6,0x02,0x8c,
+  0xac,0x11,0xce,0x47,0xc5,0x54,0x57,0x3f,0xfb,0xd8,
+  0xa3,0xa2,0xb4,0xf3,0x32,0x9f,0x01,0x8f,0x59,0xf0,
+  0xe5,0x79,0xf4,0x78,0x78,0x93,0xe1,0x50,0x2c,0xf2,
+  0x41,0xd8,0x7a,0xed,0x13,0x20,0x4c,0x1b,0xd5,0x5e,
+  0x64,0x06,0x52,0x8e,0x15,0x0c,0x01,0x6d,0x34,0x7e,
+  0x34,0x57,0x17,0xa6,0xd7,0xda,0xf9,0xc6,0x77,0xf0,
+  0x80,0x16,0xcc,0xd4,0xac,0x17,0x02,0x03,0x01,0x00,
+  0x01,0x02,0x82,0x01,0x80,0x2f,0x71,0xf6,0xa0,0x21,
+  0x6d,0x21,0xd3,0x35,0xc3,0xc7,0x56,0x08,0xa0,0xb3,
+  0xf5,0x51,0x69,0x6f,0x13,0x4f,0x16,0x38,0x52,0xa4,
+  0x28,0x6c,0x16,0x1d,0x63,0xa4,0x4a,0x14,0xdf,0x66,
+  0x46,0x52,0xa9,0x10,0x6b,0x81,0x34,0x5e,0xff,0x6f,
+  0x45,0x81,0xfc,0xde,0x66,0xdd,0xad,0xc9,0xdf,0x22,
+  0x2e,0x1a,0xdd,0x26,0xc5,0x2e,0x43,0x9f,0x8c,0xb9,
+  0xb6,0x87,0xb6,0x56,0x39,0xbd,0x10,0xe3,0x82,0x11,
+  0xad,0x4b,0x61,0x40,0x80,0x20,0x83,0x7b,0x79,0xcb,
+  0x46,0x0c,0xc3,0xc7,0xaf,0x93,0x0a,0x12,0xe4,0x27,
+  0x98,0x3e,0xac,0x37,0xa1,0x77,0x75,0x47,0x0b,0x32,
+  0x38,0xdb,0x21,0xd7,0xd8,0x87,0xbb,0xa3,0x30,0xdd,
+  0xcc,0x09,0xfb,0xfa,0x4e,0xd5,0x99,0x00,0x0d,0xae,
+  0xac,0xe8,0xdb,0x38,0x57,0x6d,0x50,0x20,0xab,0x5b,
+  0xa3,0x4d,0x4d,0x8c,0xda,0x39,0xba,0x74,0x6c,0x6f,
+  0x69,0x3f,0x9c,0x15,0xc5,0xd9,0x1e,0x28,0xfe,0x7f,
+  0xac,0x2c,0xd4,0x6f,0x34,0x24,0x78,0xba,0x62,0x49,
+  0xb2,0x5d,0x45,0x8d,0x41,0x4d,0xdc,0x79,0x84,0x0b,
+  0x7e,0x61,0xce,0x2d,0x55,0x89,0xe0,0xdf,0xf3,0x5f,
+  0x8c,0xad,0x6e,0x48,0xca,0x49,0x8b,0x67,0x24,0x2b,
+  0xa5,0x88,0x9a,0x87,0x58,0x2d,0x1e,0x51,0xe0,0xfd,
+  0x76,0xe7,0x86,0xab,0x72,0xbd,0x58,0xe9,0x3e,0xf9,
+  0x1b,0xc7,0xb6,0x37,0x18,0xd7,0x1c,0x4e,0xe6,0xd9,
+  0x3d,0xd0,0x1f,0xa2,0x9d,0x76,0xe9,0x11,0xf3,0xbe,
+  0x49,0x8d,0x14,0x96,0xd1,0xe9,0x29,0x3d,0x27,0x02,
+  0x36,0x14,0x8a,0xfd,0x38,0xdf,0x42,0x5b,0xe3,0xea,
+  0x62,0x68,0x7f,0x9f,0xf2,0x71,0x4a,0x4a,0xe3,0xa4,
+  0x46,0x11,0xf4,0x08,0x48,0xa7,0x90,0x90,0x00,0x2a,
+  0x88,0x0e,0x2c,0x9e,0xe3,0x85,0x9c,0x1c,0x91,0x20,
+  0x96,0x9d,0x25,0x90,0x59,0xd7,0x52,0xbe,0x97,0x8e,
+  0x63,0xde,0x8c,0x4b,0x51,0xaa,0xc7,0x6b,0x02,0x62,
+  0x67,0x5f,0x61,0x62,0x94,0x2b,0x13,0x95,0x00,0xb4,
+  0xf5,0xfe,0x7f,0x5e,0x69,0x75,0xb2,0x16,0x32,0x94,
+  0x52,0x8b,0x28,0x8b,0x53,0xbc,0x72,0xf5,0xe7,0xda,
+  0xb0,0x0d,0x29,0xb4,0x30,0x1c,0x2d,0x90,0xde,0xf6,
+  0x76,0xe7,0x7e,0x9a,0x26,0xed,0xdb,0xb9,0x0f,0xda,
+  0x87,0xe2,0x30,0x53,0x56,0xd0,0x85,0xb7,0xa1,0x02,
+  0xa7,0xeb,0x4c,0x0d,0xc3,0x15,0xef,0x27,0xff,0x5a,
+  0x83,0x7f,0x16,0x21,0x75,0x13,0x43,0x21,0xf1,0x02,
+  0x81,0xc1,0x00,0xd5,0x5e,0xf1,0x32,0x0d,0xb8,0x5e,
+  0x74,0x3e,0xa1,0x04,0xb1,0xec,0xf8,0xbb,0xa0,0xdf,
+  0x19,0xd7,0x78,0x71,0x72,0x0f,0xa4,0x66,0x9b,0x58,
+  0x29,0x55,0x31,0x42,0xd3,0x67,0xfe,0xcc,0xf8,0xe2,
+  0x1a,0x62,0x32,0xf1,0xc4,0x9c,0x1d,0xd1,0x28,0xc6,
+  0xad,0x19,0x18,0xc1,0x04,0x69,0x7c,0x92,0x3f,0x49,
+  0x88,0xf9,0xf9,0x58,0x29,0xf5,0x9c,0x35,0x25,0xa5,
+  0xe5,0xc1,0x81,0x4f,0x34,0x26,0xac,0x8f,0x1c,0x48,
+  0x53,0x87,0x45,0xcd,0x0a,0x31,0xa3,0x50,0x4c,0xf9,
+  0x52,0xe3,0xa1,0x62,0x4e,0x6c,0x76,0x50,0xe9,0x9c,
+  0x74,0x50,0x27,0x21,0x3a,0x80,0x67,0x8c,0x2a,0x7b,
+  0xf3,0x39,0x37,0xfa,0x0a,0x6a,0x36,0x61,0xf3,0x12,
+  0xb7,0x0a,0xa1,0x6d,0x7c,0x3c,0x56,0xfa,0x66,0xa1,
+  0x88,0xbc,0x74,0x77,0x8f,0x33,0x39,0x15,0xcf,0xfc,
+  0x77,0x39,0x88,0x02,0x4f,0x39,0x0e,0xb2,0xca,0x18,
+  0xe6,0xb8,0xb3,0x18,0xcc,0x66,0x5b,0x62,0x67,0xfa,
+  0xc2,0xfb,0x4f,0xe3,0x46,0xd6,0xad,0x43,0x60,0x4c,
+  0x9f,0x05,0x58,0x8f,0x5a,0x6e,0x51,0x3c,0x48,0xec,
+  0x57,0x1d,0xa4,0xfc,0x0c,0xdb,0xea,0x7c,0xc4,0x1f,
+  0xeb,0x6a,0xeb,0x96,0x7f,0x02,0x81,0xc1,0x00,0xc8,
+  0x9a,0xbb,0xa4,0x55,0x4a,0x39,0x97,0xd2,0x15,0x5a,
+  0xae,0x69,0x0c,0x40,0x19,0xb1,0x67,0x3c,0x51,0xd7,
+  0x67,0x46,0xf0,0x0e,0x90,0xe0,0x39,0x2c,0xbf,0x1e,
+  0x9a,0xfe,0x86,0xdb,0xb6,0xc6,0xbb,0xc7,0x38,0x97,
+  0xa8,0xf2,0xa1,0xb8,0x6c,0xb0,0x73,0x8b,0x98,0x5a,
+  0x1d,0xc4,0x38,0xc6,0xce,0x2e,0x5e,0x68,0x66,0xa0,
+  0x7f,0x81,0xd5,0xa0,0xc0,0xb4,0xe3,0xf0,0x31,0xe5,
+  0xcf,0x7b,0x95,0x00,0x50,0xf9,0x3d,0xac,0xdf,0xd3,
+  0x8b,0x70,0xc2,0xb2,0x7a,0x07,0x0f,0xff,0x1c,0xce,
+  0x5f,0x3f,0x58,0x3b,0x1a,0xcb,0x8b,0x5b,0x67,0x97,
+  0x2f,0x31,0x9b,0x22,0xc2,0x23,0x40,0x4f,0x59,0xfa,
+  0x06,0xdd,0x0c,0x54,0x20,0x40,0xa2,0x46,0x86,0x95,
+  0x16,0xd5,0xa5,0x6c,0x18,0x97,0xe5,0xb9,0x8d,0x6e,
+  0x46,0x80,0xd5,0x55,0xe7,0xf7,0x76,0x0a,0x3d,0xda,
+  0x7f,0xc3,0x1b,0x92,0xe0,0xcb,0xc0,0x72,0xda,0x13,
+  0xb7,0x77,0x59,0xf8,0x27,0x0f,0x45,0x4a,0xf0,0x07,
+  0x9e,0x45,0xa0,0x9c,0xc1,0x21,0x3a,0xf3,0x56,0xea,
+  0x68,0x2f,0x9c,0xad,0xdc,0x33,0xed,0x7a,0xcf,0x29,
+  0x1e,0xae,0x15,0x8d,0xfd,0x3f,0x91,0xcd,0x87,0x0e,
+  0x69,0x02,0x81,0xc1,0x00,0x81,0x5b,0x51,0xf6,0xfa,
+  0x82,0x70,0x21,0x21,0x67,0x15,0x25,0x99,0x79,0x22,
+  0xa7,0x61,0x1a,0x95,0x9b,0x1b,0x8b,0xff,0x17,0xb8,
+  0x6d,0x2d,0x81,0xc1,0x78,0x5f,0xff,0x32,0xe9,0x32,
+  0xf3,0x20,0x80,0xc6,0x50,0x04,0x6b,0x22,0x0a,0xa1,
+  0xa7,0x8a,0xeb,0x9e,0x6f,0x77,0x75,0x69,0x4e,0x70,
+  0x8b,0x95,0xd5,0x49,0x57,0x75,0xaf,0xda,0x8b,0x9d,
+  0x5c,0xf9,0xba,0xd5,0x19,0xc4,0x1e,0xe5,0xe3,0x6f,
+  0xcf,0xc1,0xb9,0x82,0x25,0x3b,0x2d,0x96,0xf2,0x5f,
+  0xd8,0x8a,0xbf,0x49,0xe9,0xa9,0x63,0xca,0x35,0xe0,
+  0xd0,0x00,0x5e,0x33,0xc9,0xc5,0x47,0x66,0x59,0x60,
+  0x8c,0xd1,0x20,0x9f,0xeb,0xe3,0xd7,0x34,0x95,0x4b,
+  0xc4,0xc5,0xef,0xda,0xae,0x0b,0x66,0x6a,0x5e,0x80,
+  0xe8,0x7f,0xbe,0x1a,0x22,0xb1,0xe9,0x4b,0x30,0xac,
+  0x9c,0xaf,0x7e,0xc8,0x8e,0x40,0x78,0x2f,0x2b,0x4e,
+  0x11,0x60,0x0f,0x60,0xa2,0x93,0xc2,0x37,0xbb,0xe7,
+  0x69,0x0a,0x89,0xf3,0x3a,0x77,0x9b,0x96,0xc2,0xec,
+  0x3a,0x11,0xb9,0xc6,0xcf,0xed,0xf8,0xf1,0x30,0xa6,
+  0xcf,0xbf,0x19,0x01,0x8b,0xe8,0x93,0x13,0x30,0x91,
+  0xfb,0x85,0x2e,0x80,0x5f,0xdb,0x99,0x02,0x81,0xc0,
+  0x4b,0x0d,0x10,0xdc,0xc7,0x88,0x10,0x8a,0x0b,0x70,
+  0x2f,0xd0,0x06,0xbf,0x2d,0x90,0x2f,0x3e,0x07,0x64,
+  0x3b,0x29,0x89,0x71,0xb0,0x91,0x65,0x42,0x1e,0xca,
+  0x96,0x21,0xb8,0xce,0x2d,0x8f,0x71,0x44,0xb9,0xa1,
+  0x23,0xa4,0x72,0xba,0x2c,0x6c,0x85,0x8b,0x85,0x13,
+  0x87,0xcb,0x91,0x29,0x08,0xc0,0x04,0xbb,0x0f,0x66,
+  0x2d,0xef,0xe6,0x5c,0x4d,0x5b,0x2b,0x92,0x07,0xc0,
+  0x33,0x51,0x6f,0xd3,0xec,0x1d,0x5f,0x52,0x42,0xc6,
+  0x2e,0xb8,0x01,0x84,0xe6,0x0f,0x1f,0x6b,0x4d,0xaf,
+  0xb2,0x4a,0x12,0x41,0xe9,0x42,0xfa,0x19,0xf6,0x25,
+  0x88,0x7b,0x80,0x9c,0xa0,0xe1,0x6f,0x1c,0xd5,0x53,
+  0x3d,0x66,0xa9,0xf6,0xbd,0xd6,0x9f,0x37,0xd7,0x18,
+  0xec,0xd8,0x71,0x30,0x05,0x84,0x21,0xf8,0x31,0x76,
+  0x87,0x66,0x5b,0x36,0xf5,0x7f,0xe6,0xa6,0x43,0xe8,
+  0xa6,0x41,0x9c,0x76,0x49,0x7a,0x4e,0xe0,0x7e,0x57,
+  0xb6,0x7e,0xb2,0x69,0x77,0x9c,0xed,0x6a,0xa8,0x41,
+  0xab,0x27,0xfc,0xb6,0xbd,0x4e,0xc8,0x26,0xec,0xf9,
+  0x7c,0x93,0x64,0x14,0xc3,0x3b,0x1a,0x36,0x63,0xf6,
+  0xf3,0x54,0x66,0x1e,0xec,0x53,0x6e,0x20,0x17,0x7b,
+  0xca,0xd9,0x02,0x81,0xc1,0x00,0xbf,0xed,0x58,0x08,
+  0xb1,0x68,0xf6,0x4d,0xe9,0xb9,0xd1,0x25,0x20,0x1e,
+  0x51,0xae,0x7e,0xf2,0xa3,0x31,0x18,0x52,0x30,0x61,
+  0x7a,0x94,0xf4,0xa9,0xa6,0x35,0xab,0x41,0x35,0xe6,
+  0x6b,0x14,0x77,0x24,0xdc,0xda,0xdc,0xff,0x75,0x31,
+  0xea,0xc5,0xf3,0x05,0x5f,0xb9,0xa5,0xaa,0xbc,0xff,
+  0x3e,0xcf,0x66,0xf6,0xbf,0x3d,0x6e,0x5d,0xc4,0x39,
+  0xbf,0xd9,0x83,0x84,0xaa,0x0f,0x61,0x29,0x4a,0x59,
+  0xdd,0x23,0xe1,0x94,0x52,0xeb,0xe5,0x5e,0x24,0x43,
+  0xa1,0x69,0xf2,0xd7,0xdc,0x93,0x32,0x66,0xe1,0x23,
+  0x26,0x50,0x85,0xa0,0xee,0x68,0x45,0x18,0x4b,0x41,
+  0xc4,0x37,0x70,0x7f,0xf8,0x75,0x7e,0x78,0xb8,0xa7,
+  0xd6,0xbc,0x2d,0xc7,0x7d,0x64,0x2f,0xa6,0xa2,0xd5,
+  0xcc,0xf9,0x49,0xa4,0xfd,0x43,0xf1,0xa9,0xcf,0x34,
+  0xb3,0x2c,0xdc,0x32,0xa1,0xab,0x65,0x79,0xa3,0xcc,
+  0xf4,0x6a,0xf8,0xbc,0x77,0xb0,0x92,0x1b,0x4e,0x5e,
+  0x56,0x61,0x87,0xf4,0x75,0xb3,0x4a,0xe5,0xc3,0x15,
+  0x6e,0x82,0xa3,0xca,0x98,0xd2,0xd2,0xec,0x7c,0xe3,
+  0xb9,0x21,0xa3,0xde,0xa5,0x0a,0xf8,0x72,0xe2,0xf4,
+  0x65,0x9d,0x66,0x00,0xa0,0x46,0xac,0x5f,
+  };
+
 static unsigned char test4096[]={
   0x30,0x82,0x09,0x29,0x02,0x01,0x00,0x02,0x82,0x02,
   0x01,0x00,0xc0,0x71,0xac,0x1a,0x13,0x88,0x82,0x43,
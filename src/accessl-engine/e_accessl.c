@@ -32,12 +32,15 @@
  * ====================================================================
  */
 
+/* the ENGINE and low level key APIs this is built on are deprecated in 3.0 */
+#define OPENSSL_SUPPRESS_DEPRECATED
+
 #include <stdio.h>
 #include <string.h>
+#include <dlfcn.h>
 #include <openssl/crypto.h>
 #include <openssl/rand.h>
 #include <openssl/buffer.h>
-#include <openssl/dso.h>
 #include <openssl/engine.h>
 #include <openssl/md5.h>
 #ifndef OPENSSL_NO_RSA
@@ -45,9 +48,36 @@
 #endif
 #include <openssl/bn.h>
 
+/* RSA_METHOD and the key structures are opaque since 1.1.0, EC_KEY_METHOD replaced ECDSA_METHOD */
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+#define E_ACCESSL_OPAQUE
+#endif
+
+/* ECDSA_METHOD can be built outside of OpenSSL since 1.0.2 */
+#if defined(E_ACCESSL_OPAQUE) && !defined(OPENSSL_NO_EC)
+#define E_ACCESSL_ECDSA
+#elif !defined(E_ACCESSL_OPAQUE) && !defined(OPENSSL_NO_ECDSA) && OPENSSL_VERSION_NUMBER >= 0x10002000L
+#define E_ACCESSL_ECDSA
+#endif
+
+#ifdef E_ACCESSL_ECDSA
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
+#include <openssl/obj_mac.h>
+#endif
+
+/* async jobs, which nginx ssl_async runs handshakes in, came with 1.1.0 */
+#if !defined(OPENSSL_NO_ASYNC) && OPENSSL_VERSION_NUMBER >= 0x10100000L && defined(__linux__)
+#define E_ACCESSL_ASYNC
+#include <openssl/async.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
 #include <arpa/inet.h>
 
 #include <accessl-common/accessl_key.h>
+#include <accessl-common/cmd.h>
 
 #define UNUSED __attribute__((unused))
 
@@ -69,22 +99,47 @@ static int e_accessl_rsa_priv_dec(int flen, const unsigned char *from, unsigned
 static int e_accessl_rsa_pub_enc(int flen, const unsigned char *from, unsigned char *to, RSA *rsa, int padding);
 static int e_accessl_rsa_pub_dec(int flen, const unsigned char *from, unsigned char *to, RSA *rsa, int padding);
 static int e_accessl_rsa_sign(int type, const unsigned char *m, unsigned int m_len, unsigned char *sigret, unsigned int *siglen, const RSA *rsa);
-static int e_accessl_rsa_verify(int dtype, const unsigned char *m, unsigned int m_length, unsigned char *sigbuf, unsigned int siglen, const RSA *rsa);
+static int e_accessl_rsa_verify(int dtype, const unsigned char *m, unsigned int m_length, unsigned char *sigbuf, unsigned int siglen, const RSA *rsa) UNUSED;
 static int e_accessl_rsa_init(RSA *r);
 static int e_accessl_rsa_finish(RSA *r);
 #endif
 
+#ifdef E_ACCESSL_ECDSA
+static ECDSA_SIG *e_accessl_ecdsa_sign(const unsigned char *dgst, int dgst_len, const BIGNUM *inv, const BIGNUM *rp, EC_KEY *eckey);
+#endif
+
 #define ACCESSL_CMD_SO_PATH    ENGINE_CMD_BASE
+#define ACCESSL_CMD_DEADLINE   (ENGINE_CMD_BASE + 1)
+#define ACCESSL_CMD_TRIES      (ENGINE_CMD_BASE + 2)
 
 static const ENGINE_CMD_DEFN e_accessl_cmd_defns[] = {
     {ACCESSL_CMD_SO_PATH,
         "SO_PATH",
         "Specifies the path to the 'accessl-engine' shared library",
         ENGINE_CMD_FLAG_STRING},
+    {ACCESSL_CMD_DEADLINE,
+        "DEADLINE",
+        "Milliseconds an operation may take with all its retries, 0 for no limit",
+        ENGINE_CMD_FLAG_NUMERIC},
+    {ACCESSL_CMD_TRIES,
+        "TRIES",
+        "Number of workers an operation is sent to before it fails, 0 for no limit",
+        ENGINE_CMD_FLAG_NUMERIC},
     {0, NULL, NULL, 0}
 };
 
 #ifndef OPENSSL_NO_RSA
+/* 1.1.0 uses rsa_sign whenever it is set */
+#ifndef RSA_FLAG_SIGN_VER
+#define RSA_FLAG_SIGN_VER 0
+#endif
+
+#define E_ACCESSL_RSA_FLAGS (RSA_FLAG_CACHE_PUBLIC|RSA_FLAG_CACHE_PRIVATE|RSA_FLAG_SIGN_VER|RSA_METHOD_FLAG_NO_CHECK|RSA_FLAG_EXT_PKEY)
+
+#ifdef E_ACCESSL_OPAQUE
+/* Built in bind_helper, bn_mod_exp is taken from the OpenSSL method */
+static RSA_METHOD *e_accessl_rsa = NULL;
+#else
 /* Our internal RSA_METHOD that we provide pointers to */
 static RSA_METHOD e_accessl_rsa =
 {
@@ -97,10 +152,10 @@ static RSA_METHOD e_accessl_rsa =
     NULL,
     e_accessl_rsa_init,
     e_accessl_rsa_finish,
-    RSA_FLAG_CACHE_PUBLIC|RSA_FLAG_CACHE_PRIVATE|RSA_METHOD_FLAG_NO_CHECK|RSA_FLAG_EXT_PKEY,
+    E_ACCESSL_RSA_FLAGS,
     NULL,
-    NULL, //e_accessl_rsa_sign,
-    NULL, //e_accessl_rsa_verify,
+    e_accessl_rsa_sign, /* worker pads the digest, saves a DigestInfo copy per signature */
+    NULL, /* verify locally through pub_dec */
     NULL
 };
 
@@ -115,12 +170,13 @@ static RSA_METHOD e_accessl_rsa_sign_verify UNUSED =
     NULL,
     e_accessl_rsa_init,
     e_accessl_rsa_finish,
-    RSA_FLAG_CACHE_PUBLIC|RSA_FLAG_CACHE_PRIVATE|RSA_FLAG_SIGN_VER|RSA_METHOD_FLAG_NO_CHECK|RSA_FLAG_EXT_PKEY,
+    E_ACCESSL_RSA_FLAGS,
     NULL,
     e_accessl_rsa_sign,
     e_accessl_rsa_verify,
     NULL
 };
+#endif
 
 #endif
 
@@ -148,23 +204,161 @@ static AcceSSL_RSA_Priv_Dec_t *accessl_rsa_priv_dec = NULL;
 
 #endif
 
-static DSO *accessl_dso = NULL;
+#ifdef E_ACCESSL_ECDSA
+/* P-256 is the only curve workers can handle */
+#define E_ACCESSL_EC_BYTES 32
+
+/* Copy of the OpenSSL method with signing replaced */
+#ifdef E_ACCESSL_OPAQUE
+static EC_KEY_METHOD *e_accessl_ecdsa = NULL;
+
+/* OpenSSL's own signing, for keys on other curves */
+static ECDSA_SIG *(*e_accessl_ecdsa_sign_default)(const unsigned char *, int, const BIGNUM *, const BIGNUM *, EC_KEY *) = NULL;
+
+/* CRYPTO_LOCK_ECDSA is gone, guards attaching the fingerprint */
+static CRYPTO_RWLOCK *e_accessl_ecdsa_lock = NULL;
+#else
+static ECDSA_METHOD *e_accessl_ecdsa = NULL;
+#endif
+
+/* Used to attach key fingerprint to an EC_KEY */
+static int accessl_ecdsa_idx = -1;
+
+typedef int AcceSSL_ECDSA_Sign_t(accessl_key *, const unsigned char *, int, int, unsigned char *);
+
+static AcceSSL_ECDSA_Sign_t *accessl_ecdsa_sign = NULL;
+#endif
+
+typedef void AcceSSL_Set_Budget_t(long, long);
+
+static AcceSSL_Set_Budget_t *accessl_set_budget = NULL;
+
+/* Operation budget from ctrls, -1 keeps the library default; passed on at init */
+static long e_accessl_deadline = -1;
+static long e_accessl_tries = -1;
+
+static void *accessl_dso = NULL;
 
 /* Constants used when creating the ENGINE */
 static const char *engine_e_accessl_id = "accessl";
 static const char *engine_e_accessl_name = "AcceSSL engine support";
 
+#ifdef E_ACCESSL_ASYNC
+typedef int AcceSSL_Async_Wait_Fd_t(void);
+typedef int AcceSSL_Async_Pause_t(void);
+typedef void AcceSSL_Set_Async_t(AcceSSL_Async_Wait_Fd_t *, AcceSSL_Async_Pause_t *);
+
+static void e_accessl_async_fd_cleanup(ASYNC_WAIT_CTX *ctx UNUSED, const void *key UNUSED, OSSL_ASYNC_FD fd, void *custom UNUSED)
+{
+    close(fd);
+}
+
+/*
+ * The library makes this fd readable when the job may go on. One per job, made on its first
+ * operation and closed with the wait context, the application polls it while the job is paused.
+ */
+static int e_accessl_async_wait_fd(void)
+{
+    ASYNC_JOB *job = ASYNC_get_current_job();
+    ASYNC_WAIT_CTX *ctx;
+    OSSL_ASYNC_FD fd;
+    void *custom;
+
+    if (!job || !(ctx = ASYNC_get_wait_ctx(job)))
+        return -1;
+
+    if (ASYNC_WAIT_CTX_get_fd(ctx, engine_e_accessl_id, &fd, &custom))
+        return fd;
+
+    fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd == -1)
+        return -1;
+
+    if (!ASYNC_WAIT_CTX_set_wait_fd(ctx, engine_e_accessl_id, fd, NULL, e_accessl_async_fd_cleanup))
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static int e_accessl_async_pause(void)
+{
+    return ASYNC_pause_job();
+}
+#endif
+
+#if defined(E_ACCESSL_OPAQUE) && !defined(OPENSSL_NO_RSA)
+static RSA_METHOD *e_accessl_rsa_new(void)
+{
+    RSA_METHOD *meth = RSA_meth_new("AcceSSL", E_ACCESSL_RSA_FLAGS);
+
+    if (!meth)
+        return NULL;
+
+    if (!RSA_meth_set_pub_enc(meth, e_accessl_rsa_pub_enc) ||
+            !RSA_meth_set_pub_dec(meth, e_accessl_rsa_pub_dec) ||
+            !RSA_meth_set_priv_enc(meth, e_accessl_rsa_priv_enc) ||
+            !RSA_meth_set_priv_dec(meth, e_accessl_rsa_priv_dec) ||
+            !RSA_meth_set_bn_mod_exp(meth, RSA_meth_get_bn_mod_exp(RSA_PKCS1_OpenSSL())) ||
+            !RSA_meth_set_init(meth, e_accessl_rsa_init) ||
+            !RSA_meth_set_finish(meth, e_accessl_rsa_finish) ||
+            /* worker pads the digest, saves a DigestInfo copy per signature */
+            !RSA_meth_set_sign(meth, e_accessl_rsa_sign))
+    {
+        RSA_meth_free(meth);
+        return NULL;
+    }
+
+    return meth;
+}
+#endif
+
+#if defined(E_ACCESSL_OPAQUE) && defined(E_ACCESSL_ECDSA)
+static EC_KEY_METHOD *e_accessl_ecdsa_new(void)
+{
+    EC_KEY_METHOD *meth = EC_KEY_METHOD_new(EC_KEY_OpenSSL());
+    int (*sign)(int, const unsigned char *, int, unsigned char *, unsigned int *, const BIGNUM *, const BIGNUM *, EC_KEY *);
+    int (*sign_setup)(EC_KEY *, BN_CTX *, BIGNUM **, BIGNUM **);
+
+    if (!meth)
+        return NULL;
+
+    /* DER signing goes through sign_sig, verification and sign setup stay with OpenSSL */
+    EC_KEY_METHOD_get_sign(meth, &sign, &sign_setup, &e_accessl_ecdsa_sign_default);
+    EC_KEY_METHOD_set_sign(meth, sign, sign_setup, e_accessl_ecdsa_sign);
+
+    return meth;
+}
+#endif
+
 /* This internal function is used by ENGINE_accessl() and possibly by the
  * "dynamic" ENGINE support too */
 static int bind_helper(ENGINE *e)
 {
-#ifndef OPENSSL_NO_RSA
+#if !defined(OPENSSL_NO_RSA) && !defined(E_ACCESSL_OPAQUE)
     const RSA_METHOD *meth1;
 #endif
     if(!ENGINE_set_id(e, engine_e_accessl_id) ||
             !ENGINE_set_name(e, engine_e_accessl_name) ||
 #ifndef OPENSSL_NO_RSA
+#ifdef E_ACCESSL_OPAQUE
+            !(e_accessl_rsa || (e_accessl_rsa = e_accessl_rsa_new())) ||
+            !ENGINE_set_RSA(e, e_accessl_rsa) ||
+#else
             !ENGINE_set_RSA(e, &e_accessl_rsa) ||
+#endif
+#endif
+#ifdef E_ACCESSL_ECDSA
+#ifdef E_ACCESSL_OPAQUE
+            !(e_accessl_ecdsa_lock || (e_accessl_ecdsa_lock = CRYPTO_THREAD_lock_new())) ||
+            !(e_accessl_ecdsa || (e_accessl_ecdsa = e_accessl_ecdsa_new())) ||
+            !ENGINE_set_EC(e, e_accessl_ecdsa) ||
+#else
+            !(e_accessl_ecdsa || (e_accessl_ecdsa = ECDSA_METHOD_new(ECDSA_OpenSSL()))) ||
+            !ENGINE_set_ECDSA(e, e_accessl_ecdsa) ||
+#endif
 #endif
             !ENGINE_set_destroy_function(e, e_accessl_destroy) ||
             !ENGINE_set_init_function(e, e_accessl_init) ||
@@ -173,11 +367,17 @@ static int bind_helper(ENGINE *e)
             !ENGINE_set_cmd_defns(e, e_accessl_cmd_defns))
         return 0;
 
-#ifndef OPENSSL_NO_RSA
+#if !defined(OPENSSL_NO_RSA) && !defined(E_ACCESSL_OPAQUE)
     meth1 = RSA_PKCS1_SSLeay();
     e_accessl_rsa.bn_mod_exp = meth1->bn_mod_exp;
 #endif
 
+#if defined(E_ACCESSL_ECDSA) && !defined(E_ACCESSL_OPAQUE)
+    /* verification and sign setup stay with OpenSSL */
+    ECDSA_METHOD_set_name(e_accessl_ecdsa, "AcceSSL");
+    ECDSA_METHOD_set_sign(e_accessl_ecdsa, e_accessl_ecdsa_sign);
+#endif
+
     /* Ensure the e_accessl error handling is set up */
     ERR_load_accessl_strings();
     return 1;
@@ -226,6 +426,24 @@ void ENGINE_load_accessl(void)
 
 static int e_accessl_destroy(ENGINE *e UNUSED)
 {
+#if !defined(OPENSSL_NO_RSA) && defined(E_ACCESSL_OPAQUE)
+    if (e_accessl_rsa)
+        RSA_meth_free(e_accessl_rsa);
+    e_accessl_rsa = NULL;
+#endif
+#ifdef E_ACCESSL_ECDSA
+#ifdef E_ACCESSL_OPAQUE
+    if (e_accessl_ecdsa)
+        EC_KEY_METHOD_free(e_accessl_ecdsa);
+    if (e_accessl_ecdsa_lock)
+        CRYPTO_THREAD_lock_free(e_accessl_ecdsa_lock);
+    e_accessl_ecdsa_lock = NULL;
+#else
+    if (e_accessl_ecdsa)
+        ECDSA_METHOD_free(e_accessl_ecdsa);
+#endif
+    e_accessl_ecdsa = NULL;
+#endif
     ERR_unload_accessl_strings();
     return 1;
 }
@@ -252,6 +470,33 @@ static int set_AcceSSL_libname(const char *name)
     return (((AcceSSL_libname = BUF_strdup(name)) != NULL) ? 1 : 0);
 }
 
+/* As DSO_load did, a name without a path is looked up as lib<name>.so */
+static void *e_accessl_dlopen(const char *name)
+{
+    char *path;
+    void *ret;
+
+    if (strchr(name, '/'))
+        return dlopen(name, RTLD_NOW);
+
+    path = OPENSSL_malloc(strlen(name) + sizeof("lib.so"));
+    if (!path)
+        return NULL;
+    sprintf(path, "lib%s.so", name);
+    ret = dlopen(path, RTLD_NOW);
+    OPENSSL_free(path);
+
+    return ret;
+}
+
+#ifdef E_ACCESSL_ECDSA
+static void e_accessl_ecdsa_free_data(void *parent UNUSED, void *ptr, CRYPTO_EX_DATA *ad UNUSED, int idx UNUSED, long argl UNUSED, void *argp UNUSED)
+{
+    if (ptr)
+        OPENSSL_free(ptr);
+}
+#endif
+
 /* (de)initialisation functions. */
 static int e_accessl_init(ENGINE *e UNUSED)
 {
@@ -263,13 +508,20 @@ static int e_accessl_init(ENGINE *e UNUSED)
     AcceSSL_RSA_Pub_Enc_t *p12 = NULL;
     AcceSSL_RSA_Priv_Dec_t *p13 = NULL;
     AcceSSL_RSA_Priv_Enc_t *p14 = NULL;
+#ifdef E_ACCESSL_ECDSA
+    AcceSSL_ECDSA_Sign_t *p15 = NULL;
+#endif
+#ifdef E_ACCESSL_ASYNC
+    AcceSSL_Set_Async_t *p16 = NULL;
+#endif
+    AcceSSL_Set_Budget_t *p17 = NULL;
 
     if(accessl_dso != NULL)
     {
         ACCESSLerr(ACCESSL_F_E_ACCESSL_INIT, ACCESSL_R_ALREADY_LOADED);
         return 0;
     }
-    accessl_dso = DSO_load(NULL, get_AcceSSL_libname(), NULL, 0);
+    accessl_dso = e_accessl_dlopen(get_AcceSSL_libname());
 
     if (accessl_dso == NULL)
     {
@@ -289,16 +541,43 @@ static int e_accessl_init(ENGINE *e UNUSED)
     }
 #endif
 
-    p1 = (AcceSSL_Init_t *)DSO_bind_func(accessl_dso, "accessl_init");
-    p2 = (AcceSSL_Finish_t *)DSO_bind_func(accessl_dso, "accessl_finish");
-    p9 = (AcceSSL_RSA_Verify_t *)DSO_bind_func(accessl_dso, "accessl_rsa_verify");
-    p10 = (AcceSSL_RSA_Sign_t *)DSO_bind_func(accessl_dso, "accessl_rsa_sign");
-    p11 = (AcceSSL_RSA_Pub_Dec_t *)DSO_bind_func(accessl_dso, "accessl_rsa_pub_dec");
-    p12 = (AcceSSL_RSA_Pub_Enc_t *)DSO_bind_func(accessl_dso, "accessl_rsa_pub_enc");
-    p13 = (AcceSSL_RSA_Priv_Dec_t *)DSO_bind_func(accessl_dso, "accessl_rsa_priv_dec");
-    p14 = (AcceSSL_RSA_Priv_Enc_t *)DSO_bind_func(accessl_dso, "accessl_rsa_priv_enc");
+#ifdef E_ACCESSL_ECDSA
+    if (accessl_ecdsa_idx == -1)
+#ifdef E_ACCESSL_OPAQUE
+        accessl_ecdsa_idx = EC_KEY_get_ex_new_index(0,
+                "AcceSSL private data handle",
+                NULL, NULL, e_accessl_ecdsa_free_data);
+#else
+        accessl_ecdsa_idx = ECDSA_get_ex_new_index(0,
+                "AcceSSL private data handle",
+                NULL, NULL, e_accessl_ecdsa_free_data);
+#endif
+    if (accessl_ecdsa_idx == -1)
+    {
+        ACCESSLerr(ACCESSL_F_E_ACCESSL_INIT, ACCESSL_R_ECDSA_GET_NEW_INDEX_FAILURE);
+        return 0;
+    }
 
-    if (!p1 || !p2 || !p9 || !p10 || !p11 || !p12 || !p13 || !p14)
+    p15 = (AcceSSL_ECDSA_Sign_t *)dlsym(accessl_dso, "accessl_ecdsa_sign");
+    if (!p15)
+    {
+        ACCESSLerr(ACCESSL_F_E_ACCESSL_INIT, ACCESSL_R_DSO_FAILURE);
+        return 0;
+    }
+    accessl_ecdsa_sign = p15;
+#endif
+
+    p1 = (AcceSSL_Init_t *)dlsym(accessl_dso, "accessl_init");
+    p2 = (AcceSSL_Finish_t *)dlsym(accessl_dso, "accessl_finish");
+    p9 = (AcceSSL_RSA_Verify_t *)dlsym(accessl_dso, "accessl_rsa_verify");
+    p10 = (AcceSSL_RSA_Sign_t *)dlsym(accessl_dso, "accessl_rsa_sign");
+    p11 = (AcceSSL_RSA_Pub_Dec_t *)dlsym(accessl_dso, "accessl_rsa_pub_dec");
+    p12 = (AcceSSL_RSA_Pub_Enc_t *)dlsym(accessl_dso, "accessl_rsa_pub_enc");
+    p13 = (AcceSSL_RSA_Priv_Dec_t *)dlsym(accessl_dso, "accessl_rsa_priv_dec");
+    p14 = (AcceSSL_RSA_Priv_Enc_t *)dlsym(accessl_dso, "accessl_rsa_priv_enc");
+    p17 = (AcceSSL_Set_Budget_t *)dlsym(accessl_dso, "accessl_set_budget");
+
+    if (!p1 || !p2 || !p9 || !p10 || !p11 || !p12 || !p13 || !p14 || !p17)
     {
         ACCESSLerr(ACCESSL_F_E_ACCESSL_INIT, ACCESSL_R_DSO_FAILURE);
         return 0;
@@ -312,6 +591,19 @@ static int e_accessl_init(ENGINE *e UNUSED)
     accessl_rsa_pub_enc = p12;
     accessl_rsa_priv_dec = p13;
     accessl_rsa_priv_enc = p14;
+    accessl_set_budget = p17;
+
+    accessl_set_budget(e_accessl_deadline, e_accessl_tries);
+
+#ifdef E_ACCESSL_ASYNC
+    p16 = (AcceSSL_Set_Async_t *)dlsym(accessl_dso, "accessl_set_async");
+    if (!p16)
+    {
+        ACCESSLerr(ACCESSL_F_E_ACCESSL_INIT, ACCESSL_R_DSO_FAILURE);
+        return 0;
+    }
+    p16(e_accessl_async_wait_fd, e_accessl_async_pause);
+#endif
 
     return accessl_init();
 }
@@ -322,7 +614,7 @@ static int e_accessl_finish(ENGINE *e UNUSED)
     return 1;
 }
 
-static int e_accessl_ctrl(ENGINE *e UNUSED, int cmd, long i UNUSED, void *p, void (*f)(void) UNUSED)
+static int e_accessl_ctrl(ENGINE *e UNUSED, int cmd, long i, void *p, void (*f)(void) UNUSED)
 {
     int to_return = 1;
     int initialised = ((accessl_dso == NULL) ? 0 : 1);
@@ -342,6 +634,20 @@ static int e_accessl_ctrl(ENGINE *e UNUSED, int cmd, long i UNUSED, void *p, voi
         }
         to_return = set_AcceSSL_libname((const char *)p);
         break;
+    case ACCESSL_CMD_DEADLINE:
+    case ACCESSL_CMD_TRIES:
+        if (i < 0)
+        {
+            ACCESSLerr(ACCESSL_F_E_ACCESSL_CTRL, ACCESSL_R_INVALID_VALUE);
+            return 0;
+        }
+        if (cmd == ACCESSL_CMD_DEADLINE)
+            e_accessl_deadline = i;
+        else
+            e_accessl_tries = i;
+        if (initialised)
+            accessl_set_budget(e_accessl_deadline, e_accessl_tries);
+        break;
     default:
         ACCESSLerr(ACCESSL_F_E_ACCESSL_CTRL, ACCESSL_R_CTRL_COMMAND_NOT_IMPLEMENTED);
         to_return = 0;
@@ -362,6 +668,7 @@ static int e_accessl_convert_rsa_key(const RSA *rsa, accessl_key *a_key)
     MD5_CTX md5_ctx;
     unsigned char *n_bin = NULL; int n_len;
     unsigned char *e_bin = NULL; int e_len;
+    const BIGNUM *n, *e;
 
     if (!a_key)
     {
@@ -369,8 +676,15 @@ static int e_accessl_convert_rsa_key(const RSA *rsa, accessl_key *a_key)
         return 0;
     }
 
-    n_len = BN_num_bytes(rsa->n); n_bin = OPENSSL_malloc(n_len);
-    e_len = BN_num_bytes(rsa->e); e_bin = OPENSSL_malloc(e_len);
+#ifdef E_ACCESSL_OPAQUE
+    RSA_get0_key(rsa, &n, &e, NULL);
+#else
+    n = rsa->n;
+    e = rsa->e;
+#endif
+
+    n_len = BN_num_bytes(n); n_bin = OPENSSL_malloc(n_len);
+    e_len = BN_num_bytes(e); e_bin = OPENSSL_malloc(e_len);
 
     if (!n_bin || !e_bin)
     {
@@ -379,9 +693,9 @@ static int e_accessl_convert_rsa_key(const RSA *rsa, accessl_key *a_key)
     }
 
     memset(n_bin, 0, n_len);
-    BN_bn2bin(rsa->n, n_bin);
+    BN_bn2bin(n, n_bin);
     memset(e_bin, 0, e_len);
-    BN_bn2bin(rsa->e, e_bin);
+    BN_bn2bin(e, e_bin);
 
     if (!MD5_Init(&md5_ctx) ||
         !MD5_Update(&md5_ctx, n_bin, n_len) ||
@@ -392,7 +706,7 @@ static int e_accessl_convert_rsa_key(const RSA *rsa, accessl_key *a_key)
         goto err;
     }
 
-    a_key->type = 1;
+    a_key->type = CMD_KEY_RSA;
     a_key->key_converted = 1;
 
     ret = 1;
@@ -594,6 +908,171 @@ static int e_accessl_rsa_finish(RSA *rsa)
     return 1;
 }
 
+#ifdef E_ACCESSL_ECDSA
+#ifdef E_ACCESSL_OPAQUE
+#define E_ACCESSL_EC_get_ex_data EC_KEY_get_ex_data
+#define E_ACCESSL_EC_set_ex_data EC_KEY_set_ex_data
+#define E_ACCESSL_EC_lock() CRYPTO_THREAD_write_lock(e_accessl_ecdsa_lock)
+#define E_ACCESSL_EC_unlock() CRYPTO_THREAD_unlock(e_accessl_ecdsa_lock)
+#else
+#define E_ACCESSL_EC_get_ex_data ECDSA_get_ex_data
+#define E_ACCESSL_EC_set_ex_data ECDSA_set_ex_data
+#define E_ACCESSL_EC_lock() CRYPTO_w_lock(CRYPTO_LOCK_ECDSA)
+#define E_ACCESSL_EC_unlock() CRYPTO_w_unlock(CRYPTO_LOCK_ECDSA)
+#endif
+
+static int e_accessl_convert_ec_key(const EC_KEY *ec, accessl_key *a_key)
+{
+    const EC_GROUP *group = EC_KEY_get0_group(ec);
+    const EC_POINT *pub = EC_KEY_get0_public_key(ec);
+    unsigned char point[1 + 2 * E_ACCESSL_EC_BYTES];
+
+    if (!group || EC_GROUP_get_curve_name(group) != NID_X9_62_prime256v1)
+    {
+        ACCESSLerr(ACCESSL_F_E_ACCESSL_CONVERT_EC_KEY, ACCESSL_R_UNSUPPORTED_CURVE);
+        return 0;
+    }
+
+    if (!pub || EC_POINT_point2oct(group, pub, POINT_CONVERSION_UNCOMPRESSED, point, sizeof(point), NULL) != sizeof(point))
+    {
+        ACCESSLerr(ACCESSL_F_E_ACCESSL_CONVERT_EC_KEY, ACCESSL_R_MISSING_KEY_COMPONENTS);
+        return 0;
+    }
+
+    if (!MD5(point, sizeof(point), a_key->fingerprint))
+    {
+        ACCESSLerr(ACCESSL_F_E_ACCESSL_CONVERT_EC_KEY, ACCESSL_R_MD5_FAILURE);
+        return 0;
+    }
+
+    a_key->type = CMD_KEY_EC;
+    a_key->key_converted = 1;
+
+    return 1;
+}
+
+/* There are no init/finish hooks for EC keys, the fingerprint is attached on first use */
+static accessl_key *e_accessl_ec_key(EC_KEY *eckey)
+{
+    accessl_key *a_key = E_ACCESSL_EC_get_ex_data(eckey, accessl_ecdsa_idx);
+    accessl_key *other;
+
+    if (a_key)
+        return a_key;
+
+    a_key = OPENSSL_malloc(sizeof(accessl_key));
+    if (!a_key)
+    {
+        ACCESSLerr(ACCESSL_F_E_ACCESSL_ECDSA_SIGN, ACCESSL_R_MEMORY_ALLOC);
+        return NULL;
+    }
+    memset(a_key, 0, sizeof(accessl_key));
+
+    if (!e_accessl_convert_ec_key(eckey, a_key))
+    {
+        OPENSSL_free(a_key);
+        return NULL;
+    }
+
+    /* another thread may have got there first */
+    E_ACCESSL_EC_lock();
+    other = E_ACCESSL_EC_get_ex_data(eckey, accessl_ecdsa_idx);
+    if (!other && E_ACCESSL_EC_set_ex_data(eckey, accessl_ecdsa_idx, a_key))
+    {
+        other = a_key;
+        a_key = NULL;
+    }
+    E_ACCESSL_EC_unlock();
+
+    if (a_key)
+        OPENSSL_free(a_key);
+
+    if (!other)
+        ACCESSLerr(ACCESSL_F_E_ACCESSL_ECDSA_SIGN, ACCESSL_R_NO_KEY_CONTEXT);
+
+    return other;
+}
+
+/* Keys on curves workers can't handle are signed by OpenSSL, as if the engine wasn't there */
+static ECDSA_SIG *e_accessl_ecdsa_sign_locally(const unsigned char *dgst, int dgst_len, const BIGNUM *inv, const BIGNUM *rp, EC_KEY *eckey)
+{
+#ifdef E_ACCESSL_OPAQUE
+    return e_accessl_ecdsa_sign_default(dgst, dgst_len, inv, rp, eckey);
+#else
+    /* the OpenSSL method can't be called directly before 1.1.0, sign with a copy using it */
+    EC_KEY *tmp = EC_KEY_new();
+    ECDSA_SIG *ret = NULL;
+
+    if (tmp &&
+            EC_KEY_set_group(tmp, EC_KEY_get0_group(eckey)) &&
+            EC_KEY_set_private_key(tmp, EC_KEY_get0_private_key(eckey)) &&
+            ECDSA_set_method(tmp, ECDSA_OpenSSL()))
+        ret = ECDSA_do_sign_ex(dgst, dgst_len, inv, rp, tmp);
+
+    if (tmp)
+        EC_KEY_free(tmp);
+
+    return ret;
+#endif
+}
+
+/* precomputed kinv and rp are ignored, workers pick their own nonce */
+static ECDSA_SIG *e_accessl_ecdsa_sign(const unsigned char *dgst, int dgst_len, const BIGNUM *inv, const BIGNUM *rp, EC_KEY *eckey)
+{
+    const EC_GROUP *group = EC_KEY_get0_group(eckey);
+    unsigned char sig[2 * E_ACCESSL_EC_BYTES];
+    ECDSA_SIG *ret;
+    accessl_key *a_key;
+    int len;
+#ifdef E_ACCESSL_OPAQUE
+    BIGNUM *r, *s;
+#endif
+
+    if (group && EC_GROUP_get_curve_name(group) != NID_X9_62_prime256v1)
+        return e_accessl_ecdsa_sign_locally(dgst, dgst_len, inv, rp, eckey);
+
+    a_key = e_accessl_ec_key(eckey);
+    if (!a_key)
+        return NULL;
+
+    len = accessl_ecdsa_sign(a_key, dgst, dgst_len, sizeof(sig), sig);
+    if (len != sizeof(sig))
+    {
+        ACCESSLerr(ACCESSL_F_E_ACCESSL_ECDSA_SIGN, ACCESSL_R_ACCESSL_FAILURE);
+        return NULL;
+    }
+
+    ret = ECDSA_SIG_new();
+    if (!ret)
+    {
+        ACCESSLerr(ACCESSL_F_E_ACCESSL_ECDSA_SIGN, ACCESSL_R_MEMORY_ALLOC);
+        return NULL;
+    }
+
+#ifdef E_ACCESSL_OPAQUE
+    r = BN_bin2bn(sig, E_ACCESSL_EC_BYTES, NULL);
+    s = BN_bin2bn(sig + E_ACCESSL_EC_BYTES, E_ACCESSL_EC_BYTES, NULL);
+    if (!r || !s || !ECDSA_SIG_set0(ret, r, s))
+    {
+        ACCESSLerr(ACCESSL_F_E_ACCESSL_ECDSA_SIGN, ACCESSL_R_MEMORY_ALLOC);
+        BN_free(r);
+        BN_free(s);
+        ECDSA_SIG_free(ret);
+        return NULL;
+    }
+#else
+    if (!BN_bin2bn(sig, E_ACCESSL_EC_BYTES, ret->r) || !BN_bin2bn(sig + E_ACCESSL_EC_BYTES, E_ACCESSL_EC_BYTES, ret->s))
+    {
+        ACCESSLerr(ACCESSL_F_E_ACCESSL_ECDSA_SIGN, ACCESSL_R_MEMORY_ALLOC);
+        ECDSA_SIG_free(ret);
+        return NULL;
+    }
+#endif
+
+    return ret;
+}
+#endif
+
 #endif /* !OPENSSL_NO_HW_ACCESSL */
 // #endif /* !OPENSSL_NO_HW */
 
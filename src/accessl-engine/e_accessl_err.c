@@ -90,10 +90,12 @@
 
 static ERR_STRING_DATA ACCESSL_str_functs[]=
 {
+    {ERR_FUNC(ACCESSL_F_E_ACCESSL_CONVERT_EC_KEY),  "E_ACCESSL_CONVERT_EC_KEY"},
     {ERR_FUNC(ACCESSL_F_E_ACCESSL_CONVERT_RSA_KEY),  "E_ACCESSL_CONVERT_RSA_KEY"},
     {ERR_FUNC(ACCESSL_F_E_ACCESSL_CREATE_RSA_KEY_POST),  "E_ACCESSL_CREATE_RSA_KEY_POST"},
     {ERR_FUNC(ACCESSL_F_E_ACCESSL_CREATE_SERVER),  "E_ACCESSL_CREATE_SERVER"},
     {ERR_FUNC(ACCESSL_F_E_ACCESSL_CTRL),  "E_ACCESSL_CTRL"},
+    {ERR_FUNC(ACCESSL_F_E_ACCESSL_ECDSA_SIGN),  "E_ACCESSL_ECDSA_SIGN"},
     {ERR_FUNC(ACCESSL_F_E_ACCESSL_GET_MODEXP_URL),  "E_ACCESSL_GET_MODEXP_URL"},
     {ERR_FUNC(ACCESSL_F_E_ACCESSL_GET_RSA_FINGERPRINT),  "E_ACCESSL_GET_RSA_FINGERPRINT"},
     {ERR_FUNC(ACCESSL_F_E_ACCESSL_INIT),  "E_ACCESSL_INIT"},
@@ -122,9 +124,11 @@ static ERR_STRING_DATA ACCESSL_str_reasons[]=
     {ERR_REASON(ACCESSL_R_CTRL_COMMAND_NOT_IMPLEMENTED),"ctrl command not implemented"},
     {ERR_REASON(ACCESSL_R_CURL_INIT_FAILURE)  ,"curl init failure"},
     {ERR_REASON(ACCESSL_R_DSO_FAILURE)        ,"dso failure"},
+    {ERR_REASON(ACCESSL_R_ECDSA_GET_NEW_INDEX_FAILURE),"ecdsa get new index failure"},
     {ERR_REASON(ACCESSL_R_INET_NTOP_FAILUR)   ,"inet ntop failur"},
     {ERR_REASON(ACCESSL_R_INVALID_RESPONSE)   ,"invalid response"},
     {ERR_REASON(ACCESSL_R_INVALID_SYNTAX)     ,"invalid syntax"},
+    {ERR_REASON(ACCESSL_R_INVALID_VALUE)      ,"invalid value"},
     {ERR_REASON(ACCESSL_R_KEY_CONTEXT)        ,"key context"},
     {ERR_REASON(ACCESSL_R_MD5_FAILURE)        ,"md5 failure"},
     {ERR_REASON(ACCESSL_R_MDNS_INIT_FAILURE)  ,"mdns init failure"},
@@ -135,6 +139,7 @@ static ERR_STRING_DATA ACCESSL_str_reasons[]=
     {ERR_REASON(ACCESSL_R_PASSED_NULL_PARAM)  ,"passed null param"},
     {ERR_REASON(ACCESSL_R_RSA_GET_NEW_INDEX_FAILURE),"rsa get new index failure"},
     {ERR_REASON(ACCESSL_R_UNEXPECTED_HTTP_CODE),"unexpected http code"},
+    {ERR_REASON(ACCESSL_R_UNSUPPORTED_CURVE)  ,"unsupported curve"},
     {ERR_REASON(ACCESSL_R_WORKER_FAILURE)     ,"worker failure"},
     {0,NULL}
 };
@@ -42,10 +42,12 @@ static void ERR_accessl_error(int function, int reason, char *file, int line);
 /* Error codes for the ACCESSL functions. */
 
 /* Function codes. */
+#define ACCESSL_F_E_ACCESSL_CONVERT_EC_KEY     120
 #define ACCESSL_F_E_ACCESSL_CONVERT_RSA_KEY     103
 #define ACCESSL_F_E_ACCESSL_CREATE_RSA_KEY_POST     105
 #define ACCESSL_F_E_ACCESSL_CREATE_SERVER       112
 #define ACCESSL_F_E_ACCESSL_CTRL         101
+#define ACCESSL_F_E_ACCESSL_ECDSA_SIGN       121
 #define ACCESSL_F_E_ACCESSL_GET_MODEXP_URL     109
 #define ACCESSL_F_E_ACCESSL_GET_RSA_FINGERPRINT     104
 #define ACCESSL_F_E_ACCESSL_INIT         100
@@ -71,9 +73,11 @@ static void ERR_accessl_error(int function, int reason, char *file, int line);
 #define ACCESSL_R_CTRL_COMMAND_NOT_IMPLEMENTED     100
 #define ACCESSL_R_CURL_INIT_FAILURE       103
 #define ACCESSL_R_DSO_FAILURE         120
+#define ACCESSL_R_ECDSA_GET_NEW_INDEX_FAILURE     123
 #define ACCESSL_R_INET_NTOP_FAILUR       115
 #define ACCESSL_R_INVALID_RESPONSE       113
 #define ACCESSL_R_INVALID_SYNTAX         116
+#define ACCESSL_R_INVALID_VALUE          124
 #define ACCESSL_R_KEY_CONTEXT         109
 #define ACCESSL_R_MD5_FAILURE         107
 #define ACCESSL_R_MDNS_INIT_FAILURE       104
@@ -84,6 +88,7 @@ static void ERR_accessl_error(int function, int reason, char *file, int line);
 #define ACCESSL_R_PASSED_NULL_PARAM       121
 #define ACCESSL_R_RSA_GET_NEW_INDEX_FAILURE     102
 #define ACCESSL_R_UNEXPECTED_HTTP_CODE       112
+#define ACCESSL_R_UNSUPPORTED_CURVE       122
 #define ACCESSL_R_WORKER_FAILURE         111
 
 #ifdef  __cplusplus
@@ -30,6 +30,7 @@
 #define likely(x) __builtin_expect(!!(x), 1)
 #define unlikely(x) __builtin_expect(!!(x), 0)
 #define UNUSED __attribute__((unused))
+#define ALIGNED(n) __attribute__((aligned(n)))
 
 #endif // __GNUC__
 
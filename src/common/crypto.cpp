@@ -272,13 +272,162 @@ string crypto_t::extract_errors()
     return ret;
 }
 
-RSA *crypto_t::rsa_private_key_from_pem(const std::string& filename)
+static void asn1_seq_free(STACK_OF(ASN1_TYPE) *seq)
+{
+    if (seq)
+        sk_ASN1_TYPE_pop_free(seq, ASN1_TYPE_free);
+}
+
+static BIGNUM *asn1_seq_bn(STACK_OF(ASN1_TYPE) *seq, int i)
+{
+    ASN1_TYPE *t = sk_ASN1_TYPE_value(seq, i);
+
+    if (!t || t->type != V_ASN1_INTEGER)
+        return NULL;
+
+    return ASN1_INTEGER_to_BN(t->value.integer, NULL);
+}
+
+static STACK_OF(ASN1_TYPE) *asn1_seq_seq(STACK_OF(ASN1_TYPE) *seq, int i)
+{
+    ASN1_TYPE *t = sk_ASN1_TYPE_value(seq, i);
+
+    if (!t || t->type != V_ASN1_SEQUENCE)
+        return NULL;
+
+    const unsigned char *p = t->value.sequence->data;
+    return d2i_ASN1_SEQUENCE_ANY(NULL, &p, t->value.sequence->length);
+}
+
+// OtherPrimeInfos ::= SEQUENCE OF SEQUENCE { prime, exponent, coefficient }
+static bool rsa_other_primes_from_asn1(STACK_OF(ASN1_TYPE) *infos, vector<BIGNUM *>& other_primes)
+{
+    for (int i = 0; i < sk_ASN1_TYPE_num(infos); ++i)
+    {
+        STACK_OF(ASN1_TYPE) *info = asn1_seq_seq(infos, i);
+        bool ok = info && sk_ASN1_TYPE_num(info) == 3;
+
+        for (int j = 0; ok && j < 3; ++j)
+        {
+            BIGNUM *bn = asn1_seq_bn(info, j);
+
+            ok = bn != NULL;
+            if (ok)
+                other_primes.push_back(bn);
+        }
+
+        asn1_seq_free(info);
+        if (!ok)
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * OpenSSL 1.0 can't parse multi-prime keys (RSAPrivateKey version 1), take them apart here.
+ * Returns NULL for anything else, two-prime keys are left to OpenSSL.
+ */
+static RSA *rsa_multi_prime_from_der(const vector<unsigned char>& der, vector<BIGNUM *>& other_primes)
+{
+    const unsigned char *p = &der[0];
+    STACK_OF(ASN1_TYPE) *seq = d2i_ASN1_SEQUENCE_ANY(NULL, &p, der.size());
+    STACK_OF(ASN1_TYPE) *infos = NULL;
+    size_t first = other_primes.size();
+    RSA *rsa = NULL;
+
+    if (seq && sk_ASN1_TYPE_num(seq) == 10 && (infos = asn1_seq_seq(seq, 9)) && (rsa = RSA_new()))
+    {
+        rsa->n = asn1_seq_bn(seq, 1);
+        rsa->e = asn1_seq_bn(seq, 2);
+        rsa->d = asn1_seq_bn(seq, 3);
+        rsa->p = asn1_seq_bn(seq, 4);
+        rsa->q = asn1_seq_bn(seq, 5);
+        rsa->dmp1 = asn1_seq_bn(seq, 6);
+        rsa->dmq1 = asn1_seq_bn(seq, 7);
+        rsa->iqmp = asn1_seq_bn(seq, 8);
+
+        if (!rsa->n || !rsa->e || !rsa->d || !rsa->p || !rsa->q || !rsa->dmp1 || !rsa->dmq1 || !rsa->iqmp ||
+            !rsa_other_primes_from_asn1(infos, other_primes))
+        {
+            RSA_free(rsa);
+            rsa = NULL;
+            for (size_t i = first; i < other_primes.size(); ++i)
+                BN_clear_free(other_primes[i]);
+            other_primes.resize(first);
+        }
+    }
+
+    asn1_seq_free(infos);
+    asn1_seq_free(seq);
+
+    return rsa;
+}
+
+// DER of the first unencrypted PKCS#1 or PKCS#8 RSA private key in the PEM file
+static bool pem_rsa_der(FILE *fp, vector<unsigned char>& der)
+{
+    BIO *bio = BIO_new_fp(fp, BIO_NOCLOSE);
+    char *name = NULL, *header = NULL;
+    unsigned char *data = NULL;
+    long len = 0;
+    bool ret = false;
+
+    if (!bio)
+        return false;
+
+    while (!ret && PEM_read_bio(bio, &name, &header, &data, &len))
+    {
+        if (!strcmp(name, PEM_STRING_RSA) && !header[0])
+        {
+            der.assign(data, data + len);
+            ret = true;
+        }
+        else if (!strcmp(name, PEM_STRING_PKCS8INF))
+        {
+            const unsigned char *p = data;
+            PKCS8_PRIV_KEY_INFO *p8 = d2i_PKCS8_PRIV_KEY_INFO(NULL, &p, len);
+
+            if (p8 && OBJ_obj2nid(p8->pkeyalg->algorithm) == NID_rsaEncryption &&
+                p8->pkey->type == V_ASN1_OCTET_STRING)
+            {
+                ASN1_OCTET_STRING *key = p8->pkey->value.octet_string;
+
+                der.assign(key->data, key->data + key->length);
+                ret = true;
+            }
+            PKCS8_PRIV_KEY_INFO_free(p8);
+        }
+
+        OPENSSL_free(name);
+        OPENSSL_free(header);
+        OPENSSL_free(data);
+    }
+
+    BIO_free(bio);
+    ERR_clear_error();
+
+    return ret;
+}
+
+RSA *crypto_t::rsa_private_key_from_pem(const std::string& filename, vector<BIGNUM *> *other_primes)
 {
     RSA *rsa = NULL;
     FILE *fp = fopen(filename.c_str(), "rb");
     if (!fp)
         throw crypto_error("could not open " + filename + ": " + strerror(errno));
-    rsa = PEM_read_RSAPrivateKey(fp, &rsa, NULL, NULL);
+
+    if (other_primes)
+    {
+        vector<unsigned char> der;
+
+        if (pem_rsa_der(fp, der))
+            rsa = rsa_multi_prime_from_der(der, *other_primes);
+        rewind(fp);
+    }
+
+    if (!rsa)
+        rsa = PEM_read_RSAPrivateKey(fp, &rsa, NULL, NULL);
     fclose(fp);
 
     if (!rsa) {
@@ -292,5 +441,79 @@ RSA *crypto_t::rsa_private_key_from_pem(const std::string& filename)
     return rsa;
 }
 
+EC_KEY *crypto_t::ec_private_key_from_pem(const std::string& filename)
+{
+    EC_KEY *ec = NULL;
+    FILE *fp = fopen(filename.c_str(), "rb");
+    if (!fp)
+        throw crypto_error("could not open " + filename + ": " + strerror(errno));
+
+    EVP_PKEY *pkey = PEM_read_PrivateKey(fp, NULL, NULL, NULL);
+    fclose(fp);
+
+    if (pkey && EVP_PKEY_type(pkey->type) == EVP_PKEY_EC)
+        ec = EVP_PKEY_get1_EC_KEY(pkey);
+
+    EVP_PKEY_free(pkey);
+    ERR_clear_error();
+
+    return ec;
+}
+
+/*
+ * OpenSSL before 1.1.1 does not know Ed25519 (RFC 8410), the PKCS#8 private key is an
+ * OCTET STRING wrapping the 32-byte seed.
+ */
+bool crypto_t::ed25519_private_key_from_pem(const std::string& filename, unsigned char *seed)
+{
+    FILE *fp = fopen(filename.c_str(), "rb");
+    if (!fp)
+        throw crypto_error("could not open " + filename + ": " + strerror(errno));
+
+    BIO *bio = BIO_new_fp(fp, BIO_NOCLOSE);
+    char *name = NULL, *header = NULL;
+    unsigned char *data = NULL;
+    long len = 0;
+    bool ret = false;
+
+    while (bio && !ret && PEM_read_bio(bio, &name, &header, &data, &len))
+    {
+        if (!strcmp(name, PEM_STRING_PKCS8INF))
+        {
+            const unsigned char *p = data;
+            PKCS8_PRIV_KEY_INFO *p8 = d2i_PKCS8_PRIV_KEY_INFO(NULL, &p, len);
+            char oid[32];
+
+            if (p8 && OBJ_obj2txt(oid, sizeof(oid), p8->pkeyalg->algorithm, 1) > 0 &&
+                !strcmp(oid, "1.3.101.112") && p8->pkey->type == V_ASN1_OCTET_STRING)
+            {
+                const unsigned char *q = p8->pkey->value.octet_string->data;
+                ASN1_OCTET_STRING *key = d2i_ASN1_OCTET_STRING(NULL, &q, p8->pkey->value.octet_string->length);
+
+                if (key && key->length == 32)
+                {
+                    memcpy(seed, key->data, 32);
+                    ret = true;
+                }
+                if (key)
+                    OPENSSL_cleanse(key->data, key->length);
+                ASN1_OCTET_STRING_free(key);
+            }
+            PKCS8_PRIV_KEY_INFO_free(p8);
+        }
+
+        OPENSSL_cleanse(data, len);
+        OPENSSL_free(name);
+        OPENSSL_free(header);
+        OPENSSL_free(data);
+    }
+
+    BIO_free(bio);
+    fclose(fp);
+    ERR_clear_error();
+
+    return ret;
+}
+
 } // namespace openssl
 } // namespace accessl
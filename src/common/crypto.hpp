@@ -26,6 +26,7 @@
 
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 namespace accessl {
 namespace openssl {
@@ -65,7 +66,12 @@ public:
     static size_t MAX_ERROR_LEN;
 
     static std::string extract_errors();
-    static RSA *rsa_private_key_from_pem(const std::string& filename);
+    // for multi-prime keys other_primes (if given) gets r_i, d_i, t_i of every additional prime
+    static RSA *rsa_private_key_from_pem(const std::string& filename, std::vector<BIGNUM *> *other_primes = NULL);
+    // NULL if the file holds no EC private key
+    static EC_KEY *ec_private_key_from_pem(const std::string& filename);
+    // false if the file holds no Ed25519 private key, seed gets its 32 bytes otherwise
+    static bool ed25519_private_key_from_pem(const std::string& filename, unsigned char *seed);
 
 private:
     bool setup_locking;
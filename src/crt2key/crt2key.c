@@ -23,13 +23,50 @@
 #include <openssl/pem.h>
 #include <openssl/err.h>
 #include <openssl/bn.h>
+#include <openssl/ec.h>
+
+/*
+ * EC stub keeps the real public point so it matches the certificate,
+ * the private scalar is a dummy, signing happens on the workers.
+ */
+static int write_ec_stub(EVP_PKEY *pkey, FILE *f)
+{
+    EC_KEY *ec = EVP_PKEY_get1_EC_KEY(pkey);
+    BIGNUM *d = NULL;
+    int ret = 0;
+
+    if (ec && BN_dec2bn(&d, "1") && EC_KEY_set_private_key(ec, d))
+        ret = PEM_write_ECPrivateKey(f, ec, NULL, NULL, 0, NULL, NULL);
+
+    BN_free(d);
+    EC_KEY_free(ec);
+    return ret;
+}
+
+static int write_rsa_stub(EVP_PKEY *pkey, FILE *f)
+{
+    RSA *rsa = EVP_PKEY_get1_RSA(pkey);
+    int ret;
+
+    BN_dec2bn(&rsa->d, "0");
+    BN_dec2bn(&rsa->p, "0");
+    BN_dec2bn(&rsa->q, "0");
+    BN_dec2bn(&rsa->dmp1, "0");
+    BN_dec2bn(&rsa->dmq1, "0");
+    BN_dec2bn(&rsa->iqmp, "0");
+
+    ret = PEM_write_RSAPrivateKey(f, rsa, NULL, NULL, 0, NULL, NULL);
+
+    RSA_free(rsa);
+    return ret;
+}
 
 int main(int argc, char **argv)
 {
     X509 *x509 = X509_new();
     EVP_PKEY *pkey;
-    RSA *rsa;
     FILE *f;
+    int ret;
 
     if (argc < 3)
     {
@@ -44,25 +81,20 @@ int main(int argc, char **argv)
         return 1;
     }
     pkey = X509_get_pubkey(x509);
-    if (pkey->type != EVP_PKEY_RSA) {
-        printf("Not an RSA key\n");
+    fclose(f);
+    if (pkey->type != EVP_PKEY_RSA && pkey->type != EVP_PKEY_EC) {
+        printf("Not an RSA or EC key\n");
         return 1;
     }
-    rsa = EVP_PKEY_get1_RSA(pkey);
-    fclose(f);
-
-    BN_dec2bn(&rsa->d, "0");
-    BN_dec2bn(&rsa->p, "0");
-    BN_dec2bn(&rsa->q, "0");
-    BN_dec2bn(&rsa->dmp1, "0");
-    BN_dec2bn(&rsa->dmq1, "0");
-    BN_dec2bn(&rsa->iqmp, "0");
 
     f = fopen(argv[2], "wb");
-    int ret = PEM_write_RSAPrivateKey(f, rsa, NULL, NULL, 0, NULL, NULL);
+    if (pkey->type == EVP_PKEY_EC)
+        ret = write_ec_stub(pkey, f);
+    else
+        ret = write_rsa_stub(pkey, f);
     fclose(f);
 
-    if (ret) {
+    if (!ret) {
         ERR_print_errors_fp(stderr);
         return 1;
     }
@@ -251,3 +251,22 @@ BOOST_AUTO_TEST_CASE( push_elems_total_count )
 
     BOOST_CHECK( tree.total_count() == 0 );
 }
+
+BOOST_AUTO_TEST_CASE( get_count )
+{
+    counted_tree<int> tree;
+    size_t n = 9;
+
+    for (size_t i = 0; i < n; i++)
+        tree.push_back(123+i, 10*(i+1));
+
+    for (size_t i = 0; i < n; i++)
+        BOOST_CHECK( tree.get_count(tree.begin()+i) == 10*(i+1) );
+
+    tree.change_count(tree.begin()+4, 0);
+    BOOST_CHECK( tree.get_count(tree.begin()+4) == 0 );
+    BOOST_CHECK( tree.get_count(tree.begin()+5) == 60 );
+
+    tree.change_count(tree.begin()+4, 7);
+    BOOST_CHECK( tree.get_count(tree.begin()+4) == 7 );
+}
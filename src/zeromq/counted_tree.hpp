@@ -268,6 +268,14 @@ public:
         return elems.begin() + (i - partial_sums_size);
     }
 
+    size_t get_count(const_iterator iter) const
+    {
+        size_t leaf_index = std::distance(begin(), iter);
+        size_t partial_sums_size = sums.size() / 2;
+
+        return sums[partial_sums_size + leaf_index];
+    }
+
     void change_count(const_iterator iter, size_t count)
     {
         size_t leaf_index = std::distance(begin(), iter);
@@ -20,6 +20,8 @@
 
 #include <pthread.h>
 
+#include <openssl/rsa.h>
+
 #include <common/compiler.h>
 
 #include <accessl-common/accessl_key.h>
@@ -31,16 +33,28 @@
 
 extern "C" int accessl_init(void);
 extern "C" void accessl_finish(void);
+extern "C" void accessl_set_budget(long deadline_ms, long tries);
+extern "C" void accessl_set_async(accessl::udp_mux::async_wait_fd_t *wait_fd, accessl::udp_mux::async_pause_t *pause);
 
 extern "C" int accessl_rsa_sign(accessl_key *key, int type, const unsigned char *m, unsigned int m_len, int retlen, unsigned char *sigret, unsigned int *siglen);
+extern "C" int accessl_rsa_sign_pss(accessl_key *key, int nid, int saltlen, const unsigned char *m, unsigned int m_len, int retlen, unsigned char *sigret, unsigned int *siglen);
 extern "C" int accessl_rsa_verify(accessl_key *key, int type, const unsigned char *m, unsigned int m_len, unsigned char *sigret, unsigned int siglen);
 extern "C" int accessl_rsa_pub_enc(accessl_key *key, int flen, const unsigned char *from, int tlen, unsigned char *to, int padding);
 extern "C" int accessl_rsa_pub_dec(accessl_key *key, int flen, const unsigned char *from, int tlen, unsigned char *to, int padding);
 extern "C" int accessl_rsa_priv_enc(accessl_key *key, int flen, const unsigned char *from, int tlen, unsigned char *to, int padding);
 extern "C" int accessl_rsa_priv_dec(accessl_key *key, int flen, const unsigned char *from, int tlen, unsigned char *to, int padding);
+extern "C" int accessl_ecdsa_sign(accessl_key *key, const unsigned char *dgst, int dlen, int tlen, unsigned char *sig);
+extern "C" int accessl_ed25519_sign(accessl_key *key, const unsigned char *msg, int mlen, int tlen, unsigned char *sig);
+extern "C" int accessl_keyshare(int group, unsigned char *priv, unsigned char *pub);
+extern "C" int accessl_ticket_seal(const unsigned char *state, int len, int tlen, unsigned char *ticket);
+extern "C" int accessl_ticket_open(const unsigned char *ticket, int len, int tlen, unsigned char *state);
 
 namespace accessl {
 
+    // TODO
+    // how to pass the socket name?
+    static const char *accessld_socket = "ipc:///tmp/accessld.0mq";
+
     struct rsa_ctx
     {
         boost::scoped_ptr<engine> e;
@@ -64,9 +78,13 @@ namespace accessl {
 
         if (unlikely(!ret))
         {
-            // TODO
-            // how to pass the socket name?
-            ret = new rsa_ctx("ipc:///tmp/accessld.0mq");
+            // the first engine of a process fetches the workers, the operation fails if that does
+            try {
+                ret = new rsa_ctx(accessld_socket);
+            } catch (std::exception& e) {
+                LOG(ERROR) << "could not set up engine: " << e.what();
+                return NULL;
+            }
             if (!ret)
                 return NULL;
 
@@ -88,6 +106,18 @@ namespace accessl {
         return ret;
     }
 
+    // servers that fork after init hand the list down, their processes never wait for accessld
+    static void prefetch_workers(void)
+    {
+        unsigned version;
+
+        try {
+            membership::get(accessld_socket).workers(version);
+        } catch (std::exception& e) {
+            LOG(WARNING) << "could not fetch workers, will try on first operation: " << e.what();
+        }
+    }
+
     void rsa_finish(void)
     {
     }
@@ -99,6 +129,7 @@ int accessl_init(void)
     int ret = 1;
 
     if (ret > 0) ret = accessl::rsa_init();
+    if (ret > 0) accessl::prefetch_workers();
 
     return ret;
 }
@@ -112,18 +143,68 @@ void accessl_finish(void)
     delete ctx;
 }
 
-int accessl_rsa_sign(accessl_key *key UNUSED, int type UNUSED,
-    const unsigned char *m UNUSED, unsigned int m_len UNUSED,
-    int retlen UNUSED, unsigned char *sigret UNUSED, unsigned int *siglen UNUSED)
+/*
+ * Bounds each operation with all its retries to deadline_ms milliseconds and tries workers,
+ * 0 for no limit and negative to keep the current value. Applies to all threads.
+ */
+void accessl_set_budget(long deadline_ms, long tries)
+{
+    accessl::engine::set_budget(deadline_ms, tries);
+}
+
+/*
+ * Operations started inside an OpenSSL async job pause it while waiting for workers,
+ * wait_fd gives the job's eventfd (-1 outside of jobs) and pause is ASYNC_pause_job.
+ * A paused job has to be resumed on the thread that started it.
+ */
+void accessl_set_async(accessl::udp_mux::async_wait_fd_t *wait_fd, accessl::udp_mux::async_pause_t *pause)
+{
+    accessl::udp_mux::set_async(wait_fd, pause);
+}
+
+// digest in, signature out; OpenSSL treats 0 as failure here
+int accessl_rsa_sign(accessl_key *key, int type, const unsigned char *m, unsigned int m_len,
+    int retlen, unsigned char *sigret, unsigned int *siglen)
+{
+    accessl::rsa_ctx *ctx = accessl::get_rsa_ctx();
+    int ret;
+
+    if (unlikely(!ctx))
+        return 0;
+    ret = ctx->e->rsa_sign(key, type, RSA_PKCS1_PADDING, 0, m, m_len, retlen, sigret);
+    if (ret <= 0)
+        return 0;
+    *siglen = ret;
+    return 1;
+}
+
+/*
+ * RSASSA-PSS with MGF1 on the same digest. saltlen -1 means digest length,
+ * other negative values are not supported. Not reachable through RSA_METHOD in
+ * OpenSSL 1.0.x, applications call it directly.
+ */
+int accessl_rsa_sign_pss(accessl_key *key, int nid, int saltlen, const unsigned char *m, unsigned int m_len,
+    int retlen, unsigned char *sigret, unsigned int *siglen)
 {
-    return -1;
+    accessl::rsa_ctx *ctx = accessl::get_rsa_ctx();
+    int ret;
+
+    if (unlikely(!ctx) || saltlen < -1)
+        return 0;
+    ret = ctx->e->rsa_sign(key, nid, RSA_PKCS1_PSS_PADDING,
+        saltlen == -1 ? CMD_RSA_PSS_SALTLEN_DIGEST : (uint32_t)saltlen, m, m_len, retlen, sigret);
+    if (ret <= 0)
+        return 0;
+    *siglen = ret;
+    return 1;
 }
 
+// verification only needs the public key, done locally through pub_dec
 int accessl_rsa_verify(accessl_key *key UNUSED, int type UNUSED,
     const unsigned char *m UNUSED, unsigned int m_len UNUSED,
     unsigned char *sigret UNUSED, unsigned int siglen UNUSED)
 {
-    return -1;
+    return 0;
 }
 
 int accessl_rsa_pub_enc(accessl_key *key, int flen, const unsigned char *from, int tlen, unsigned char *to, int padding)
@@ -165,3 +246,53 @@ int accessl_rsa_priv_dec(accessl_key *key, int flen, const unsigned char *from,
     else
         return -1;
 }
+
+int accessl_ecdsa_sign(accessl_key *key, const unsigned char *dgst, int dlen, int tlen, unsigned char *sig)
+{
+    accessl::rsa_ctx *ctx = accessl::get_rsa_ctx();
+
+    if (likely(ctx))
+        return ctx->e->ecdsa_sign(key, dgst, dlen, tlen, sig);
+    else
+        return -1;
+}
+
+int accessl_ed25519_sign(accessl_key *key, const unsigned char *msg, int mlen, int tlen, unsigned char *sig)
+{
+    accessl::rsa_ctx *ctx = accessl::get_rsa_ctx();
+
+    if (likely(ctx))
+        return ctx->e->ed25519_sign(key, msg, mlen, tlen, sig);
+    else
+        return -1;
+}
+
+int accessl_keyshare(int group, unsigned char *priv, unsigned char *pub)
+{
+    accessl::rsa_ctx *ctx = accessl::get_rsa_ctx();
+
+    if (likely(ctx))
+        return ctx->e->keyshare(group, priv, pub);
+    else
+        return -1;
+}
+
+int accessl_ticket_seal(const unsigned char *state, int len, int tlen, unsigned char *ticket)
+{
+    accessl::rsa_ctx *ctx = accessl::get_rsa_ctx();
+
+    if (likely(ctx))
+        return ctx->e->ticket_op(CMD_OP_TICKET_SEAL, state, len, tlen, ticket);
+    else
+        return -1;
+}
+
+int accessl_ticket_open(const unsigned char *ticket, int len, int tlen, unsigned char *state)
+{
+    accessl::rsa_ctx *ctx = accessl::get_rsa_ctx();
+
+    if (likely(ctx))
+        return ctx->e->ticket_op(CMD_OP_TICKET_OPEN, ticket, len, tlen, state);
+    else
+        return -1;
+}
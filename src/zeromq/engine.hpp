@@ -25,17 +25,15 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <netdb.h>
 #include <poll.h>
 
 #include <string>
 #include <vector>
 
-#include <boost/tokenizer.hpp>
 #include <boost/optional.hpp>
 #include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
 
-#include <common/zmq.hpp>
 #include <common/compiler.h>
 
 // TODO
@@ -45,6 +43,8 @@
 #include <accessl-common/accessl_key.h>
 #include <accessl-common/cmd.h>
 
+#include "membership.hpp"
+#include "mux.hpp"
 #include "servers.hpp"
 
 namespace accessl {
@@ -54,142 +54,151 @@ using namespace boost;
 
 class engine {
 private:
-    zmq::context_t zmq_ctx;
+    membership& membership_;
+    unsigned workers_version_;
 
-    int sock;
-
-    servers_chooser chooser_;
+    scoped_ptr<servers_chooser> chooser_;
     id_generator<id_t> generator_;
 
-    posix_time::ptime req_time;
-
-    vector<string> get_initial_servers(const string & socket)
-    {
-        zmq::socket_t zmq_sock(zmq_ctx, ZMQ_REQ);
-        zmq_sock.connect(socket.c_str());
-        string getmsg("GET");
-
-        zmq::message_t req(getmsg.size());
-        memcpy(req.data(), getmsg.data(), getmsg.size());
-        if (!zmq_sock.send(req))
-            throw runtime_error(string("zmq::socket_t.send: ") + strerror(errno));
-
-        zmq::message_t resp;
-        if (!zmq_sock.recv(&resp))
-            throw runtime_error(string("zmq::socket_t.recv: ") + strerror(errno));
+    // hedged requests add at most 5% of load, up to 10 can be saved up for a burst
+    hedge_budget hedge_budget_;
 
-        string respstr(reinterpret_cast<const char *>(resp.data()), resp.size());
-        typedef tokenizer<char_separator<char> > tok_t;
-        char_separator<char> sep(",");
-        tok_t tok(respstr, sep);
+    // ephemeral key pairs fetched from workers a request full at a time, used up from the end
+    struct keyshare_pool {
+        unsigned char pairs[CMD_MAX_LEN];
+        int left;
+    };
+    keyshare_pool x25519_pool_, secp256r1_pool_;
 
-        vector<string> ret;
+    // (re)builds the chooser, estimates of workers that stay are kept in the shared estimators
+    void setup_servers(const membership::worker_list& workers)
+    {
+        chooser_.reset(new servers_chooser());
 
-        for(tok_t::iterator i = tok.begin(); i != tok.end(); ++i){
-            ret.push_back(*i);
+        for (membership::worker_list::const_iterator i = workers.begin(); i != workers.end(); ++i)
+        {
+            DLOG(INFO) << "setup_server: " << inet_ntoa(i->addr) << ":" << i->port;
+            // 1000 should be good enough as a ballpark for start - it will be updated after first request
+            chooser_->push_back(server(i->addr, i->port, generator_()), 1000);
         }
-
-        return ret;
     }
 
-    void setup_servers(vector<string> server_addrs)
+    // picks up a list of workers refreshed in the meantime
+    void refresh_servers()
     {
-        vector<string>::iterator i;
-        struct addrinfo hints;
-        struct addrinfo *result;
-
-        memset(&hints, 0, sizeof(struct addrinfo));
-        hints.ai_family = AF_INET;
-        hints.ai_socktype = SOCK_DGRAM;
-        hints.ai_flags = 0;
-        hints.ai_protocol = 0;
-        hints.ai_canonname = NULL;
-        hints.ai_addr = NULL;
-        hints.ai_next = NULL;
-
-#ifndef NDEBUG
-        DLOG(INFO) << "setup_servers: ";
-        std::copy(server_addrs.begin(), server_addrs.end(), ostream_iterator<string>(DLOG(INFO), ","));
-#endif
-
-        for (i = server_addrs.begin(); i != server_addrs.end(); i++)
-        {
-            DLOG(INFO) << "setup_server: " << *i;
+        membership_.poll();
 
-            string::size_type colon = i->find(':');
-            if (colon == string::npos)
-            {
-                LOG(WARNING) << "worker " << *i << " skipped - not in fomat host:port";
-                continue;
-            }
-
-            string host(*i, 0, colon), port(*i, colon+1);
+        if (unlikely(membership_.version() != workers_version_))
+            setup_servers(*membership_.workers(workers_version_));
+    }
 
-            int ret = getaddrinfo(host.c_str(), port.c_str(), &hints, &result);
-            if (ret != 0) {
-                LOG(WARNING) << "could not resolve " << *i << ": " << gai_strerror(ret);
-                continue;
-            }
+public:
+    engine(const string & _socket) :
+        membership_(membership::get(_socket)),
+        generator_(),
+        hedge_budget_(5, 10)
+    {
+        x25519_pool_.left = 0;
+        secp256r1_pool_.left = 0;
 
-            struct sockaddr_in *addr_in = (struct sockaddr_in *)result->ai_addr;
-            DLOG(INFO) << "setup_server: resolved " << *i << " to " << inet_ntoa(addr_in->sin_addr) << ":" << ntohs(addr_in->sin_port);
-            // 1000 should be good enough as a ballpark for start - it will be updated after first request
-            chooser_.push_back(server(addr_in->sin_addr, ntohs(addr_in->sin_port), generator_()), 1000);
+        setup_servers(*membership_.workers(workers_version_));
+    }
 
-            freeaddrinfo(result);
-        }
+    virtual ~engine()
+    {
+        wipe(x25519_pool_.pairs, sizeof(x25519_pool_.pairs));
+        wipe(secp256r1_pool_.pairs, sizeof(secp256r1_pool_.pairs));
     }
 
-    bool create_socket() {
-        sock = socket(AF_INET, SOCK_DGRAM, 0);
+    // what a single operation may cost before it fails, 0 for no limit; shared by the whole process
+    struct op_budget {
+        long deadline_ms;
+        long tries;
+    };
 
-        return (sock != -1);
+    static op_budget& budget()
+    {
+        static op_budget b = { 2000, 4 };
+        return b;
     }
 
-    void create_socket_throw() {
-        if (!create_socket())
-            throw runtime_error(string("could not create UDP socket: ") + strerror(errno));
+    // negative values keep the current setting
+    static void set_budget(long deadline_ms, long tries)
+    {
+        if (deadline_ms >= 0)
+            budget().deadline_ms = deadline_ms;
+        if (tries >= 0)
+            budget().tries = tries;
     }
 
-public:
-    engine(const string & _socket) :
-        zmq_ctx(1),
-        generator_()
+private:
+    static struct sockaddr_in server_addr(const server& s)
     {
-        create_socket_throw();
+        struct sockaddr_in addr;
 
-        vector<string> server_addrs = get_initial_servers(_socket);
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(s.get_port());
+        addr.sin_addr = s.get_addr();
 
-        setup_servers(server_addrs);
+        return addr;
     }
 
-    virtual ~engine()
+    // sends the request, already out to s, to another worker as well
+    optional<server> hedge(udp_mux& mux, udp_mux::request& r, const server& s, const unsigned char *req, size_t req_len)
     {
-        close(sock);
+        optional<server> backup = chooser_->choose_other(s);
+
+        if (!backup)
+            return backup;
+
+        struct sockaddr_in addr = server_addr(backup.get());
+
+        if (!r.add_addr(addr) || !mux.send(req, req_len, addr))
+        {
+            LOG(WARNING) << "could not send request to " << inet_ntoa(addr.sin_addr) << ":" << backup->get_port();
+            return optional<server>();
+        }
+
+        hedge_budget_.spend();
+        DLOG(INFO) << "server " << inet_ntoa(s.get_addr()) << ":" << s.get_port() <<
+            " slow, hedged to " << inet_ntoa(addr.sin_addr) << ":" << backup->get_port();
+
+        return backup;
     }
 
-    int rsa_op(accessl_key *key, int op, int flen, const unsigned char *from, int tlen, unsigned char *to, int padding)
+    /*
+     * Sends the request to a worker, retrying with others until one answers or the budget is
+     * spent; every try gets a new tag and at most what is left of the deadline. A worker slower
+     * than its usual percentile gets a backup request to another one.
+     * Waits may pause an async job and let other jobs of the thread run perform in the meantime,
+     * so no state of a single request lives in the engine.
+     */
+    int perform(unsigned char *req, size_t req_len, int tlen, unsigned char *to)
     {
-        size_t req_len = 2*sizeof(uint32_t) + sizeof(cmd_op) + sizeof(cmd_op_rsa) + flen;
-        unsigned char req[req_len];
         cmd *c = reinterpret_cast<cmd *>(req);
-        cmd_op *cop = reinterpret_cast<cmd_op *>(&c->op);
-        cmd_op_rsa *rsa_op = reinterpret_cast<cmd_op_rsa *>(&cop->data);
-
-        c->tag = 0;
-        c->cmd = htonl(CMD_OP);
 
-        memcpy(cop->key_fingerprint, key->fingerprint, KEY_FINGERPRINT_SIZE);
-        cop->op = htonl(op);
-        cop->len = htonl(sizeof(cmd_op_rsa) + flen);
+        try {
+            udp_mux& mux = udp_mux::get();
+            op_budget b = budget();
 
-        rsa_op->len = htonl(flen);
-        rsa_op->pad = htonl(padding);
-        memcpy(rsa_op->data, from, flen);
+            refresh_servers();
+            posix_time::ptime start = posix_time::microsec_clock::local_time();
+            long tries = 0;
 
-        try {
             do {
-                optional<server> os = chooser_.choose();
+                posix_time::time_duration left = posix_time::milliseconds(b.deadline_ms) -
+                    (posix_time::microsec_clock::local_time() - start);
+
+                if ((b.tries && tries >= b.tries) || (b.deadline_ms && left <= posix_time::time_duration()))
+                {
+                    LOG(WARNING) << "giving up after " << tries << " tries, " <<
+                        (posix_time::microsec_clock::local_time() - start).total_milliseconds() << "ms";
+                    return -1;
+                }
+                ++tries;
+
+                optional<server> os = chooser_->choose();
 
                 if (!os)
                 {
@@ -198,108 +207,255 @@ public:
                 }
                 server s = os.get();
 
-                posix_time::time_duration timeout = chooser_.get_timeout(s);
+                posix_time::time_duration timeout = chooser_->get_timeout(s);
+                posix_time::time_duration hedge_delay = chooser_->get_hedge_delay(s);
 
-                struct sockaddr_in addr;
+                // a wait cut short by the deadline says nothing about the worker
+                bool cut = b.deadline_ms && left < timeout;
+                if (cut)
+                    timeout = left;
 
-                memset(&addr, 0, sizeof(addr));
-                addr.sin_family = AF_INET;
-                addr.sin_port = htons(s.get_port());
-                addr.sin_addr = s.get_addr();
+                struct sockaddr_in addr = server_addr(s);
 
-                req_time = posix_time::microsec_clock::local_time();
+                // responses to earlier tries no longer match a tag and are dropped by the mux
+                udp_mux::request r(mux, addr, tlen, to);
 
-                size_t sent = sendto(sock, req, req_len, 0, (const sockaddr *)&addr, sizeof(addr));
+                c->tag = htonl(r.tag());
 
-                /*
-                 * After each failed server/request we recreate local socket.
-                 * Thus if any response returns, it returns to the old socket and is silently 
-                 * discarded by the kernel.
-                 */
+                posix_time::ptime req_time = posix_time::microsec_clock::local_time();
 
-                if (sent != req_len)
+                if (!mux.send(req, req_len, addr))
                 {
                     LOG(WARNING) << "could not send request to " << inet_ntoa(addr.sin_addr) << ":" << s.get_port();
-                    create_socket_throw();
                     continue;
                 }
 
-                struct pollfd fds;
-
-                fds.fd = sock;
-                fds.events = POLLIN | POLLERR;
-
-                long poll_timeout = timeout.total_milliseconds();;
-
-                do {
-                    DLOG(INFO) << "waiting for server " <<
-                        inet_ntoa(s.get_addr()) << ":" << s.get_port() <<
-                        ", timeout " << poll_timeout << "ms";
-
-                    // TODO
-                    // record time and retry with decreased timeout if the do {} while loop is continued
-                    int ret = poll(&fds, 1, poll_timeout);
-
-                    if (likely(ret == 1)) {
-                        if (unlikely(fds.revents & POLLERR)) {
-                            // unfortunately there is no errno available here - we only get POLLERR flag and no details
-                            LOG(WARNING) << "server " << inet_ntoa(s.get_addr()) << ":" << s.get_port() << " error";
-                            create_socket_throw();
-                            break;
-                        }
-
-                        struct sockaddr_in src_addr;
-                        socklen_t src_addrlen = sizeof(src_addr);
-
-                        ssize_t ret = recvfrom(sock, to, tlen, 0, (struct sockaddr *)&src_addr, &src_addrlen);
-
-                        in_addr serv_addr_in = s.get_addr();
-
-                        if (unlikely(ntohs(src_addr.sin_port) != s.get_port() ||
-                                src_addr.sin_addr.s_addr != serv_addr_in.s_addr))
-                        {
-                            LOG(WARNING) << "received packet from strange source " <<
-                                inet_ntoa(src_addr.sin_addr) << ":" << ntohs(src_addr.sin_port) <<
-                                ", expected " <<
-                                inet_ntoa(serv_addr_in) << ":" << s.get_port() << endl;
-                            create_socket_throw();
-                            continue;
-                        }
-
-                        if (likely(ret > 0)) {
-                            posix_time::time_duration elapsed = posix_time::microsec_clock::local_time() - req_time;
-                            DLOG(INFO) << "elapsed " << elapsed;
-                            chooser_.report_time(s, elapsed);
-                            return ret;
-                        }
-
-                        PLOG(WARNING) << "server " << inet_ntoa(s.get_addr()) << ":" << s.get_port() << " error";
-                        chooser_.report_timeout(s);
-                        create_socket_throw();
-                        break;
-
-                    } else if (ret == 0) {
-                        LOG(WARNING) << "server " << inet_ntoa(s.get_addr()) << ":" << s.get_port() << " timeout";
-                        chooser_.report_timeout(s);
-                        create_socket_throw();
-                        break;
-                    } else { // ret < 0
-                        if (errno == EINTR) {
-                            DLOG(INFO) << "poll was interrupted by signal, restarting";
-                            continue;
-                        }
-                        PLOG(WARNING) << "server " << inet_ntoa(s.get_addr()) << ":" << s.get_port() << " poll error";
-                        create_socket_throw();
-                        break;
+                hedge_budget_.earn();
+
+                DLOG(INFO) << "waiting for server " <<
+                    inet_ntoa(s.get_addr()) << ":" << s.get_port() <<
+                    ", timeout " << timeout.total_milliseconds() << "ms";
+
+                optional<server> backup;
+                posix_time::ptime backup_time;
+                int ret = -1;
+
+                if (!hedge_delay.is_zero() && hedge_delay < timeout && hedge_budget_.available())
+                {
+                    ret = r.wait(hedge_delay);
+                    if (ret < 0)
+                    {
+                        backup_time = posix_time::microsec_clock::local_time();
+                        backup = hedge(mux, r, s, req, req_len);
                     }
-                } while (1);
+                }
+
+                // whichever of them answers first, the other response is dropped with the tag
+                if (ret < 0)
+                    ret = r.wait(timeout - (posix_time::microsec_clock::local_time() - req_time));
+
+                if (ret >= 0 && r.source() == 1)
+                {
+                    // the primary is slower than that, leaving it out would pull its percentile down
+                    posix_time::time_duration late = posix_time::microsec_clock::local_time() - req_time;
+                    chooser_->report_late(s, max(late, hedge_delay));
+
+                    s = backup.get();
+                    req_time = backup_time;
+                }
+
+                if (likely(ret > 0)) {
+                    posix_time::time_duration elapsed = posix_time::microsec_clock::local_time() - req_time;
+                    DLOG(INFO) << "elapsed " << elapsed;
+                    chooser_->report_time(s, elapsed);
+                    return ret;
+                }
+
+                if (ret == 0)
+                    LOG(WARNING) << "server " << inet_ntoa(s.get_addr()) << ":" << s.get_port() << " empty response";
+                else if (!cut)
+                    LOG(WARNING) << "server " << inet_ntoa(s.get_addr()) << ":" << s.get_port() << " timeout";
 
+                if (!cut)
+                    chooser_->report_timeout(s);
             } while (1);
         } catch (std::exception& e) {
             LOG(ERROR) << e.what();
             return -1;
         }
     }
+
+    // fills the header of a CMD_OP request, returns the op specific part; key is NULL for key-less ops
+    unsigned char *op_header(unsigned char *req, accessl_key *key, int op, size_t data_len)
+    {
+        cmd *c = reinterpret_cast<cmd *>(req);
+        cmd_op *cop = reinterpret_cast<cmd_op *>(&c->op);
+
+        c->tag = 0; // set by perform
+        c->cmd = htonl(CMD_OP_TAGGED);
+
+        if (key)
+            memcpy(cop->key_fingerprint, key->fingerprint, KEY_FINGERPRINT_SIZE);
+        else
+            memset(cop->key_fingerprint, 0, KEY_FINGERPRINT_SIZE);
+        cop->op = htonl(op);
+        cop->len = htonl(data_len);
+
+        return cop->data;
+    }
+
+public:
+    int rsa_op(accessl_key *key, int op, int flen, const unsigned char *from, int tlen, unsigned char *to, int padding)
+    {
+        size_t req_len = 2*sizeof(uint32_t) + sizeof(cmd_op) + sizeof(cmd_op_rsa) + flen;
+        unsigned char req[req_len];
+        cmd_op_rsa *rsa_op = reinterpret_cast<cmd_op_rsa *>(op_header(req, key, op, sizeof(cmd_op_rsa) + flen));
+
+        rsa_op->len = htonl(flen);
+        rsa_op->pad = htonl(padding);
+        memcpy(rsa_op->data, from, flen);
+
+        return perform(req, req_len, tlen, to);
+    }
+
+    // result is r || s
+    int ecdsa_sign(accessl_key *key, const unsigned char *dgst, int dlen, int tlen, unsigned char *to)
+    {
+        size_t req_len = 2*sizeof(uint32_t) + sizeof(cmd_op) + sizeof(cmd_op_ecdsa) + dlen;
+        unsigned char req[req_len];
+        cmd_op_ecdsa *ecdsa_op = reinterpret_cast<cmd_op_ecdsa *>(op_header(req, key, CMD_OP_ECDSA_SIGN, sizeof(cmd_op_ecdsa) + dlen));
+
+        ecdsa_op->len = htonl(dlen);
+        memcpy(ecdsa_op->data, dgst, dlen);
+
+        return perform(req, req_len, tlen, to);
+    }
+
+    // Ed25519 signs the message itself, it has to fit in one request; result is R || S
+    int ed25519_sign(accessl_key *key, const unsigned char *msg, int mlen, int tlen, unsigned char *to)
+    {
+        size_t req_len = 2*sizeof(uint32_t) + sizeof(cmd_op) + sizeof(cmd_op_ed25519) + mlen;
+
+        if (req_len > CMD_MAX_LEN)
+            return -1;
+
+        unsigned char req[req_len];
+        cmd_op_ed25519 *ed25519_op = reinterpret_cast<cmd_op_ed25519 *>(op_header(req, key, CMD_OP_ED25519_SIGN, sizeof(cmd_op_ed25519) + mlen));
+
+        ed25519_op->len = htonl(mlen);
+        memcpy(ed25519_op->data, msg, mlen);
+
+        return perform(req, req_len, tlen, to);
+    }
+
+    // CMD_OP_TICKET_SEAL or CMD_OP_TICKET_OPEN, ticket keys are known only to workers
+    int ticket_op(int op, const unsigned char *from, int flen, int tlen, unsigned char *to)
+    {
+        size_t req_len = 2*sizeof(uint32_t) + sizeof(cmd_op) + sizeof(cmd_op_ticket) + flen;
+
+        if (req_len > CMD_MAX_LEN)
+            return -1;
+
+        unsigned char req[req_len];
+        cmd_op_ticket *ticket_op = reinterpret_cast<cmd_op_ticket *>(op_header(req, NULL, op, sizeof(cmd_op_ticket) + flen));
+
+        ticket_op->len = htonl(flen);
+        memcpy(ticket_op->data, from, flen);
+
+        return perform(req, req_len, tlen, to);
+    }
+
+    // worker pads the digest itself, pad is RSA_PKCS1_PADDING or RSA_PKCS1_PSS_PADDING
+    int rsa_sign(accessl_key *key, int nid, int pad, uint32_t saltlen, const unsigned char *m, int mlen, int tlen, unsigned char *to)
+    {
+        size_t req_len = 2*sizeof(uint32_t) + sizeof(cmd_op) + sizeof(cmd_op_rsa_sign) + mlen;
+
+        if (req_len > CMD_MAX_LEN)
+            return -1;
+
+        unsigned char req[req_len];
+        cmd_op_rsa_sign *sign_op = reinterpret_cast<cmd_op_rsa_sign *>(op_header(req, key, CMD_OP_RSA_SIGN, sizeof(cmd_op_rsa_sign) + mlen));
+
+        sign_op->nid = htonl(nid);
+        sign_op->pad = htonl(pad);
+        sign_op->saltlen = htonl(saltlen);
+        sign_op->len = htonl(mlen);
+        memcpy(sign_op->data, m, mlen);
+
+        return perform(req, req_len, tlen, to);
+    }
+
+    /*
+     * One ephemeral key pair of a CMD_GROUP_*, private key to priv (32 bytes) and the public
+     * key share to pub (32 bytes for X25519, 65 for P-256); returns the public key length.
+     * Only every request-full of handshakes waits for a worker, the rest is served locally.
+     */
+    int keyshare(int group, unsigned char *priv, unsigned char *pub)
+    {
+        keyshare_pool *pool;
+        int pair_len;
+
+        switch (group) {
+        case CMD_GROUP_X25519:
+            pool = &x25519_pool_;
+            pair_len = CMD_KEYSHARE_X25519_LEN;
+            break;
+        case CMD_GROUP_SECP256R1:
+            pool = &secp256r1_pool_;
+            pair_len = CMD_KEYSHARE_SECP256R1_LEN;
+            break;
+        default:
+            return -1;
+        }
+
+        if (pool->left == 0)
+        {
+            // fetched aside, another job of this thread may use the pool while this one waits
+            unsigned char pairs[CMD_MAX_LEN];
+            int count = CMD_MAX_LEN / pair_len;
+            int ret = keyshare_fetch(group, count, pairs);
+
+            if (ret != count * pair_len)
+            {
+                wipe(pairs, sizeof(pairs));
+                LOG(WARNING) << "could not fetch key shares for group " << group;
+                return -1;
+            }
+            wipe(pool->pairs, sizeof(pool->pairs));
+            memcpy(pool->pairs, pairs, ret);
+            wipe(pairs, sizeof(pairs));
+            pool->left = count;
+        }
+
+        unsigned char *pair = pool->pairs + --pool->left * pair_len;
+
+        memcpy(priv, pair, 32);
+        memcpy(pub, pair + 32, pair_len - 32);
+        wipe(pair, pair_len);
+
+        return pair_len - 32;
+    }
+
+private:
+    int keyshare_fetch(int group, int count, unsigned char *to)
+    {
+        unsigned char req[2*sizeof(uint32_t) + sizeof(cmd_op) + sizeof(cmd_op_keyshare)];
+        cmd_op_keyshare *keyshare_op = reinterpret_cast<cmd_op_keyshare *>(op_header(req, NULL, CMD_OP_KEYSHARE, sizeof(cmd_op_keyshare)));
+
+        keyshare_op->group = htonl(group);
+        keyshare_op->count = htonl(count);
+
+        return perform(req, sizeof(req), CMD_MAX_LEN, to);
+    }
+
+    // memset the compiler can not drop
+    static void wipe(unsigned char *p, size_t len)
+    {
+        volatile unsigned char *v = p;
+
+        while (len--)
+            *v++ = 0;
+    }
 };
 
 };
@@ -0,0 +1,348 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef _MEMBERSHIP_HPP_
+#define _MEMBERSHIP_HPP_
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/tokenizer.hpp>
+
+#include <common/zmq.hpp>
+#include <common/compiler.h>
+
+#include <glog/logging.h>
+
+namespace accessl {
+
+using namespace std;
+
+/*
+ * Workers known to accessld, fetched and resolved once per process with one ZMQ context
+ * and shared by all engines. While operations go on the list is refreshed in the background
+ * every refresh_secs, engines pick up a changed one between operations. Only the first fetch
+ * of a process is waited for, at most get_timeout_ms, and a child forked after it inherits the list.
+ */
+class membership : private boost::noncopyable {
+public:
+    struct worker {
+        struct in_addr addr;
+        int port;
+
+        bool operator==(const worker& other) const
+        {
+            return addr.s_addr == other.addr.s_addr && port == other.port;
+        }
+    };
+
+    typedef vector<worker> worker_list;
+    typedef boost::shared_ptr<const worker_list> worker_list_ptr;
+
+    static const int refresh_secs = 30;
+    static const int get_timeout_ms = 2000; // accessld answers at once, a lost reply fails the fetch
+
+private:
+    string socket_;
+    zmq::context_t *zmq_ctx_; // made on first fetch, a forked child makes its own
+    pthread_mutex_t lock_;
+    worker_list_ptr workers_;
+    volatile unsigned version_; // changes with the list
+    volatile time_t next_refresh_;
+    bool refreshing_;
+
+    membership(const string& socket) :
+        socket_(socket),
+        zmq_ctx_(NULL),
+        version_(0),
+        next_refresh_(0),
+        refreshing_(false)
+    {
+        pthread_mutex_init(&lock_, NULL);
+    }
+
+    static time_t now()
+    {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return ts.tv_sec;
+    }
+
+    vector<string> get_servers()
+    {
+        pthread_mutex_lock(&lock_);
+        if (!zmq_ctx_)
+            zmq_ctx_ = new zmq::context_t(1);
+        zmq::context_t& ctx = *zmq_ctx_;
+        pthread_mutex_unlock(&lock_);
+
+        zmq::socket_t zmq_sock(ctx, ZMQ_REQ);
+        int linger = 0;
+        int timeout = get_timeout_ms;
+
+        // nothing left queued holds up closing the socket after a timeout
+        zmq_sock.setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+        zmq_sock.setsockopt(ZMQ_SNDTIMEO, &timeout, sizeof(timeout));
+        zmq_sock.setsockopt(ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
+        zmq_sock.connect(socket_.c_str());
+        string getmsg("GET");
+
+        zmq::message_t req(getmsg.size());
+        memcpy(req.data(), getmsg.data(), getmsg.size());
+        if (!zmq_sock.send(req))
+            throw runtime_error("zmq::socket_t.send: accessld at " + socket_ + " did not take GET in time");
+
+        zmq::message_t resp;
+        if (!zmq_sock.recv(&resp))
+            throw runtime_error("zmq::socket_t.recv: no reply from accessld at " + socket_ + " in time");
+
+        string respstr(reinterpret_cast<const char *>(resp.data()), resp.size());
+        typedef boost::tokenizer<boost::char_separator<char> > tok_t;
+        boost::char_separator<char> sep(",");
+        tok_t tok(respstr, sep);
+
+        vector<string> ret;
+
+        for(tok_t::iterator i = tok.begin(); i != tok.end(); ++i){
+            ret.push_back(*i);
+        }
+
+        return ret;
+    }
+
+    static worker_list resolve(const vector<string>& server_addrs)
+    {
+        vector<string>::const_iterator i;
+        struct addrinfo hints;
+        struct addrinfo *result;
+        worker_list ret;
+
+        memset(&hints, 0, sizeof(struct addrinfo));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        hints.ai_flags = 0;
+        hints.ai_protocol = 0;
+        hints.ai_canonname = NULL;
+        hints.ai_addr = NULL;
+        hints.ai_next = NULL;
+
+        for (i = server_addrs.begin(); i != server_addrs.end(); i++)
+        {
+            DLOG(INFO) << "resolve: " << *i;
+
+            string::size_type colon = i->find(':');
+            if (colon == string::npos)
+            {
+                LOG(WARNING) << "worker " << *i << " skipped - not in fomat host:port";
+                continue;
+            }
+
+            string host(*i, 0, colon), port(*i, colon+1);
+
+            int err = getaddrinfo(host.c_str(), port.c_str(), &hints, &result);
+            if (err != 0) {
+                LOG(WARNING) << "could not resolve " << *i << ": " << gai_strerror(err);
+                continue;
+            }
+
+            struct sockaddr_in *addr_in = (struct sockaddr_in *)result->ai_addr;
+            DLOG(INFO) << "resolve: " << *i << " is " << inet_ntoa(addr_in->sin_addr) << ":" << ntohs(addr_in->sin_port);
+
+            worker w;
+            w.addr = addr_in->sin_addr;
+            w.port = ntohs(addr_in->sin_port);
+            ret.push_back(w);
+
+            freeaddrinfo(result);
+        }
+
+        return ret;
+    }
+
+    // installs a fetched list, the version only moves if it differs
+    void update(const worker_list& workers)
+    {
+        pthread_mutex_lock(&lock_);
+        if (!workers_ || !(*workers_ == workers))
+        {
+            workers_.reset(new worker_list(workers));
+            version_++;
+        }
+        next_refresh_ = now() + refresh_secs;
+        pthread_mutex_unlock(&lock_);
+    }
+
+    static void *refresh_main(void *arg)
+    {
+        membership *m = reinterpret_cast<membership *>(arg);
+
+        try {
+            m->update(resolve(m->get_servers()));
+        } catch (std::exception& e) {
+            LOG(WARNING) << "could not refresh workers, keeping the old list: " << e.what();
+            pthread_mutex_lock(&m->lock_);
+            m->next_refresh_ = now() + refresh_secs;
+            pthread_mutex_unlock(&m->lock_);
+        }
+
+        pthread_mutex_lock(&m->lock_);
+        m->refreshing_ = false;
+        pthread_mutex_unlock(&m->lock_);
+
+        return NULL;
+    }
+
+    static membership *& instance()
+    {
+        static membership *m = NULL;
+        return m;
+    }
+
+    static pthread_mutex_t *instance_lock()
+    {
+        static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+        return &lock;
+    }
+
+    // the parent's ZMQ context and refresh thread are not usable in a child, the list is
+    static void atfork_child()
+    {
+        membership *m = instance();
+
+        if (m)
+        {
+            m->zmq_ctx_ = NULL;
+            m->refreshing_ = false;
+            pthread_mutex_init(&m->lock_, NULL);
+        }
+        pthread_mutex_init(instance_lock(), NULL);
+    }
+
+    static void register_atfork()
+    {
+        pthread_atfork(NULL, NULL, atfork_child);
+    }
+
+public:
+    // one accessld per process, the socket of the first caller is used
+    static membership& get(const string& socket)
+    {
+        static pthread_once_t once = PTHREAD_ONCE_INIT;
+        membership *m = instance();
+
+        if (likely(m))
+            return *m;
+
+        pthread_once(&once, register_atfork);
+
+        pthread_mutex_lock(instance_lock());
+        if (!instance())
+        {
+            m = new membership(socket);
+            __sync_synchronize();
+            instance() = m;
+        }
+        m = instance();
+        pthread_mutex_unlock(instance_lock());
+
+        return *m;
+    }
+
+    /*
+     * Current list and its version. The first call of a process fetches it and throws if that
+     * fails, later ones start a background refresh when it is due and return at once.
+     */
+    worker_list_ptr workers(unsigned& version)
+    {
+        worker_list_ptr ret;
+
+        pthread_mutex_lock(&lock_);
+        ret = workers_;
+        version = version_;
+        pthread_mutex_unlock(&lock_);
+
+        if (unlikely(!ret))
+        {
+            update(resolve(get_servers()));
+
+            pthread_mutex_lock(&lock_);
+            ret = workers_;
+            version = version_;
+            pthread_mutex_unlock(&lock_);
+        }
+        else
+        {
+            poll();
+        }
+
+        return ret;
+    }
+
+    // cheap enough for every operation: starts a refresh if one is due
+    void poll()
+    {
+        if (likely(now() < next_refresh_))
+            return;
+
+        pthread_mutex_lock(&lock_);
+        if (!refreshing_ && now() >= next_refresh_)
+        {
+            pthread_t refresher;
+
+            refreshing_ = true;
+            if (pthread_create(&refresher, NULL, refresh_main, this) == 0)
+            {
+                pthread_detach(refresher);
+            }
+            else
+            {
+                refreshing_ = false;
+                next_refresh_ = now() + refresh_secs;
+            }
+        }
+        pthread_mutex_unlock(&lock_);
+    }
+
+    unsigned version() const
+    {
+        return version_;
+    }
+};
+
+};
+
+#endif // _MEMBERSHIP_HPP_
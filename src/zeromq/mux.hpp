@@ -0,0 +1,533 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef _MUX_HPP_
+#define _MUX_HPP_
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <common/compiler.h>
+
+#include <glog/logging.h>
+
+#include <accessl-common/cmd.h>
+
+namespace accessl {
+
+using namespace std;
+
+/*
+ * One UDP socket shared by all threads of a process. Requests carry unique tags which
+ * workers echo (CMD_OP_TAGGED), a receiver thread hands each response to the request
+ * waiting for it and drops the ones nobody waits for any more, e.g. after a timeout.
+ * Lives as long as the process, a forked child gets its own on first use, so callers
+ * should not keep the reference across operations.
+ *
+ * With async hooks set, a wait inside an OpenSSL async job pauses the job instead of blocking
+ * the thread: the receiver makes the job's eventfd readable when the response arrives or the
+ * wait times out, so one thread can have as many requests in flight as it has jobs.
+ */
+class udp_mux : private boost::noncopyable {
+public:
+    // eventfd of the async job the caller runs in, -1 outside of jobs
+    typedef int async_wait_fd_t(void);
+    // suspends the job until its eventfd is readable, 0 if it could not
+    typedef int async_pause_t(void);
+
+    /*
+     * A request in flight, its tag is reserved for the lifetime of the object. It may be sent
+     * to a second worker too (hedged), the first response from either of them wins.
+     */
+    class request : private boost::noncopyable {
+    private:
+        friend class udp_mux;
+
+        static const int max_addrs = 2;
+
+        udp_mux& mux_;
+        uint32_t tag_;
+        struct sockaddr_in addrs_[max_addrs];
+        int naddrs_;
+        int source_; // index of the address that answered
+        unsigned char *to_;
+        int tlen_;
+        int len_; // -1 until the response arrives
+        pthread_cond_t cond_;
+        int wake_fd_; // eventfd of the job paused in wait, -1 if none
+        struct timespec deadline_; // of the paused job, for the receiver to wake it
+        bool woken_; // paused job was woken after deadline_
+
+    public:
+        request(udp_mux& mux, const struct sockaddr_in& addr, int tlen, unsigned char *to) :
+            mux_(mux),
+            naddrs_(1),
+            source_(-1),
+            to_(to),
+            tlen_(tlen),
+            len_(-1),
+            wake_fd_(-1),
+            woken_(false)
+        {
+            addrs_[0] = addr;
+
+            pthread_condattr_t attr;
+
+            pthread_condattr_init(&attr);
+            pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+            pthread_cond_init(&cond_, &attr);
+            pthread_condattr_destroy(&attr);
+
+            mux_.add(this);
+        }
+
+        ~request()
+        {
+            mux_.remove(this);
+            pthread_cond_destroy(&cond_);
+        }
+
+        uint32_t tag() const
+        {
+            return tag_;
+        }
+
+        // accept the response from addr as well, false if there is no room for it
+        bool add_addr(const struct sockaddr_in& addr)
+        {
+            bool ret = false;
+
+            pthread_mutex_lock(&mux_.lock_);
+            if (naddrs_ < max_addrs)
+            {
+                addrs_[naddrs_++] = addr;
+                ret = true;
+            }
+            pthread_mutex_unlock(&mux_.lock_);
+
+            return ret;
+        }
+
+        // index of the address (in order of adding) the response came from, valid once wait succeeded
+        int source() const
+        {
+            return source_;
+        }
+
+        // response length, -1 if none came within timeout
+        int wait(boost::posix_time::time_duration timeout)
+        {
+            int64_t timeout_us = max<int64_t>(timeout.total_microseconds(), 0);
+            struct timespec deadline;
+            int ret;
+
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_sec += timeout_us / 1000000;
+            deadline.tv_nsec += (timeout_us % 1000000) * 1000;
+            if (deadline.tv_nsec >= 1000000000)
+            {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+
+            int fd = async_hooks().wait_fd ? async_hooks().wait_fd() : -1;
+            bool expired = false;
+
+            pthread_mutex_lock(&mux_.lock_);
+            if (fd >= 0)
+            {
+                wake_fd_ = fd;
+                deadline_ = deadline;
+                woken_ = false;
+                mux_.async_waits_++;
+                if (timespec_less(deadline, mux_.poll_until_))
+                    mux_.notify(mux_.kick_fd_);
+
+                // other jobs of this thread run while this one is paused, possibly waiting on the mux too
+                while (len_ < 0 && !woken_)
+                {
+                    pthread_mutex_unlock(&mux_.lock_);
+                    int paused = async_hooks().pause();
+                    drain(fd);
+                    pthread_mutex_lock(&mux_.lock_);
+                    if (unlikely(!paused))
+                        break;
+                }
+
+                expired = woken_;
+                wake_fd_ = -1;
+                mux_.async_waits_--;
+            }
+
+            // outside of jobs, or if the job could not be paused
+            while (len_ < 0 && !expired)
+                expired = pthread_cond_timedwait(&cond_, &mux_.lock_, &deadline) == ETIMEDOUT;
+            ret = len_;
+            pthread_mutex_unlock(&mux_.lock_);
+
+            return ret;
+        }
+    };
+
+private:
+    typedef boost::unordered_map<uint32_t, request *> request_map;
+
+    int sock_;
+    int kick_fd_; // wakes the receiver when a paused job needs it sooner than it planned to
+    pthread_mutex_t lock_;
+    uint32_t next_tag_;
+    request_map requests_;
+    int async_waits_; // requests with a paused job
+    struct timespec poll_until_; // when the receiver wakes up on its own
+
+    udp_mux() :
+        next_tag_(0),
+        async_waits_(0)
+    {
+        pthread_t receiver;
+
+        sock_ = socket(AF_INET, SOCK_DGRAM, 0);
+        if (sock_ == -1)
+            throw runtime_error(string("could not create UDP socket: ") + strerror(errno));
+
+        kick_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (kick_fd_ == -1)
+        {
+            int err = errno;
+            close(sock_);
+            throw runtime_error(string("could not create eventfd: ") + strerror(err));
+        }
+
+        poll_until_.tv_sec = numeric_limits<time_t>::max();
+        poll_until_.tv_nsec = 0;
+
+        pthread_mutex_init(&lock_, NULL);
+
+        int err = pthread_create(&receiver, NULL, receiver_main, this);
+        if (err != 0)
+        {
+            close(sock_);
+            close(kick_fd_);
+            pthread_mutex_destroy(&lock_);
+            throw runtime_error(string("could not start UDP receiver: ") + strerror(err));
+        }
+        pthread_detach(receiver);
+    }
+
+    void add(request *r)
+    {
+        pthread_mutex_lock(&lock_);
+        do {
+            r->tag_ = next_tag_++;
+        } while (unlikely(requests_.count(r->tag_)));
+        requests_[r->tag_] = r;
+        pthread_mutex_unlock(&lock_);
+    }
+
+    void remove(request *r)
+    {
+        pthread_mutex_lock(&lock_);
+        requests_.erase(r->tag_);
+        pthread_mutex_unlock(&lock_);
+    }
+
+    void dispatch(const unsigned char *buf, size_t len, const struct sockaddr_in& src)
+    {
+        uint32_t tag;
+
+        if (unlikely(len < sizeof(tag)))
+            return;
+        memcpy(&tag, buf, sizeof(tag));
+        tag = ntohl(tag);
+
+        pthread_mutex_lock(&lock_);
+
+        request_map::iterator i = requests_.find(tag);
+        if (i == requests_.end())
+        {
+            DLOG(INFO) << "dropping late response " << tag << " from " << inet_ntoa(src.sin_addr) << ":" << ntohs(src.sin_port);
+        }
+        else
+        {
+            request *r = i->second;
+            int source;
+
+            for (source = 0; source < r->naddrs_; ++source)
+            {
+                if (src.sin_port == r->addrs_[source].sin_port && src.sin_addr.s_addr == r->addrs_[source].sin_addr.s_addr)
+                    break;
+            }
+
+            if (unlikely(source == r->naddrs_))
+            {
+                LOG(WARNING) << "received packet from strange source " <<
+                    inet_ntoa(src.sin_addr) << ":" << ntohs(src.sin_port) <<
+                    " for request " << tag;
+            }
+            else if (r->len_ < 0)
+            {
+                r->len_ = min<size_t>(len - sizeof(tag), r->tlen_);
+                r->source_ = source;
+                memcpy(r->to_, buf + sizeof(tag), r->len_);
+                pthread_cond_signal(&r->cond_);
+                if (r->wake_fd_ >= 0)
+                    notify(r->wake_fd_);
+            }
+        }
+
+        pthread_mutex_unlock(&lock_);
+    }
+
+    // wakes paused jobs past their deadline, returns milliseconds until the next one is due or -1
+    int expire_async()
+    {
+        struct timespec now;
+        int64_t next_ns = -1;
+
+        pthread_mutex_lock(&lock_);
+        if (async_waits_ > 0)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+
+            for (request_map::iterator i = requests_.begin(); i != requests_.end(); ++i)
+            {
+                request *r = i->second;
+
+                if (r->wake_fd_ < 0 || r->woken_ || r->len_ >= 0)
+                    continue;
+
+                int64_t left_ns = (int64_t)(r->deadline_.tv_sec - now.tv_sec) * 1000000000 + (r->deadline_.tv_nsec - now.tv_nsec);
+                if (left_ns <= 0)
+                {
+                    r->woken_ = true;
+                    notify(r->wake_fd_);
+                }
+                else if (next_ns < 0 || left_ns < next_ns)
+                {
+                    next_ns = left_ns;
+                }
+            }
+        }
+
+        if (next_ns < 0)
+        {
+            poll_until_.tv_sec = numeric_limits<time_t>::max();
+            poll_until_.tv_nsec = 0;
+        }
+        else
+        {
+            poll_until_.tv_sec = now.tv_sec + next_ns / 1000000000;
+            poll_until_.tv_nsec = now.tv_nsec + next_ns % 1000000000;
+            if (poll_until_.tv_nsec >= 1000000000)
+            {
+                poll_until_.tv_sec++;
+                poll_until_.tv_nsec -= 1000000000;
+            }
+        }
+        pthread_mutex_unlock(&lock_);
+
+        // rounded up, waking early would only mean another round
+        return next_ns < 0 ? -1 : (int)min<int64_t>((next_ns + 999999) / 1000000, numeric_limits<int>::max());
+    }
+
+    static void *receiver_main(void *arg)
+    {
+        udp_mux *mux = reinterpret_cast<udp_mux *>(arg);
+        unsigned char buf[sizeof(uint32_t) + CMD_MAX_LEN];
+        struct pollfd fds[2];
+
+        fds[0].fd = mux->sock_;
+        fds[0].events = POLLIN;
+        fds[1].fd = mux->kick_fd_;
+        fds[1].events = POLLIN;
+
+        while (1)
+        {
+            int ret = poll(fds, 2, mux->expire_async());
+
+            if (unlikely(ret < 0))
+            {
+                if (errno != EINTR)
+                    PLOG(WARNING) << "UDP receiver error";
+                continue;
+            }
+
+            if (fds[1].revents & POLLIN)
+                drain(mux->kick_fd_);
+
+            if (!(fds[0].revents & POLLIN))
+                continue;
+
+            while (1)
+            {
+                struct sockaddr_in src;
+                socklen_t srclen = sizeof(src);
+
+                ssize_t len = recvfrom(mux->sock_, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr *)&src, &srclen);
+
+                if (len < 0)
+                {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                        PLOG(WARNING) << "UDP receiver error";
+                    break;
+                }
+
+                mux->dispatch(buf, len, src);
+            }
+        }
+
+        return NULL;
+    }
+
+    static void notify(int fd)
+    {
+        uint64_t one = 1;
+
+        if (unlikely(write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN))
+            PLOG(WARNING) << "could not signal eventfd " << fd;
+    }
+
+    static void drain(int fd)
+    {
+        uint64_t count;
+
+        if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+            PLOG(WARNING) << "could not read eventfd " << fd;
+    }
+
+    static bool timespec_less(const struct timespec& a, const struct timespec& b)
+    {
+        return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+    }
+
+    struct async_hooks_t {
+        async_wait_fd_t *wait_fd;
+        async_pause_t *pause;
+    };
+
+    static async_hooks_t& async_hooks()
+    {
+        static async_hooks_t hooks = { NULL, NULL };
+        return hooks;
+    }
+
+    static udp_mux *& instance()
+    {
+        static udp_mux *mux = NULL;
+        return mux;
+    }
+
+    static pthread_mutex_t *instance_lock()
+    {
+        static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+        return &lock;
+    }
+
+    // the receiver thread is not inherited, the child leaves the parent's socket alone and makes its own
+    static void atfork_child()
+    {
+        udp_mux *& mux = instance();
+
+        if (mux)
+        {
+            close(mux->sock_);
+            close(mux->kick_fd_);
+        }
+        mux = NULL;
+        pthread_mutex_init(instance_lock(), NULL);
+    }
+
+    static void register_atfork()
+    {
+        pthread_atfork(NULL, NULL, atfork_child);
+    }
+
+public:
+    /*
+     * Both hooks are set together, before any request is made; wait_fd must return a
+     * non-blocking eventfd that stays open while the job lives.
+     */
+    static void set_async(async_wait_fd_t *wait_fd, async_pause_t *pause)
+    {
+        async_hooks().wait_fd = pause ? wait_fd : NULL;
+        async_hooks().pause = pause;
+    }
+
+    static udp_mux& get()
+    {
+        static pthread_once_t once = PTHREAD_ONCE_INIT;
+        udp_mux *mux = instance();
+
+        // set once per process, published only after it is fully constructed
+        if (likely(mux))
+            return *mux;
+
+        pthread_once(&once, register_atfork);
+
+        pthread_mutex_lock(instance_lock());
+        try {
+            if (!instance())
+            {
+                mux = new udp_mux();
+                __sync_synchronize();
+                instance() = mux;
+            }
+        } catch (...) {
+            pthread_mutex_unlock(instance_lock());
+            throw;
+        }
+        mux = instance();
+        pthread_mutex_unlock(instance_lock());
+
+        return *mux;
+    }
+
+    bool send(const unsigned char *req, size_t len, const struct sockaddr_in& addr)
+    {
+        ssize_t sent = sendto(sock_, req, len, 0, (const struct sockaddr *)&addr, sizeof(addr));
+
+        return sent >= 0 && (size_t)sent == len;
+    }
+};
+
+};
+
+#endif // _MUX_HPP_
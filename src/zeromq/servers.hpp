@@ -22,9 +22,14 @@
 #define _SERVERS_HPP_
 
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include <common/compiler.h>
 
@@ -42,6 +47,8 @@
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/unordered_map.hpp>
 
+#include <glog/logging.h>
+
 #include "idgen.hpp"
 #include "counted_tree.hpp"
 
@@ -138,7 +145,15 @@ private:
     int64_t reqs_sec;
     int64_t rto;
 
+    // running estimate of the hedge_percentile of round trip times, hedged requests wait that long
+    int64_t hedge_rtt;
+    int64_t samples;
+
 public:
+    static const int hedge_percentile = 95;
+    // samples needed before hedge_rtt is trusted
+    static const int hedge_min_samples = 16;
+
     speed_estimator_t() :
         srtt(0),
         mdev(0),
@@ -147,7 +162,9 @@ public:
         // 100k reqs/sec is a huge number wich will lead to selecting this server
         // after that we will update its response time
         reqs_sec(100000),
-        rto((boost::posix_time::milliseconds(200)).total_microseconds())
+        rto((boost::posix_time::milliseconds(200)).total_microseconds()),
+        hedge_rtt(0),
+        samples(0)
     { }
 
     void update_rtt(int64_t last_rtt)
@@ -190,9 +207,43 @@ public:
             rto = srtt + 4*rttvar;
         }
 
+        update_hedge_rtt(last_rtt);
+
         reqs_sec = 1000*1000 / srtt;
     }
 
+    /*
+     * Stochastic approximation of the percentile, steps up by p and down by 100 - p parts,
+     * so it settles where p% of samples are below. Step scales with srtt.
+     */
+    void update_hedge_rtt(int64_t last_rtt)
+    {
+        if (samples++ == 0)
+        {
+            hedge_rtt = last_rtt;
+            return;
+        }
+
+        int64_t step = max(srtt / 8, (int64_t)1);
+
+        if (last_rtt > hedge_rtt)
+            hedge_rtt += step * hedge_percentile / 100;
+        else
+            hedge_rtt -= step * (100 - hedge_percentile) / 100;
+        if (hedge_rtt < 1)
+            hedge_rtt = 1;
+    }
+
+    /*
+     * A request still unanswered after at_least microseconds, like the primary of a hedge the
+     * backup won. Its time is only known to be above the estimate when at_least is.
+     */
+    void update_hedge_censored(int64_t at_least)
+    {
+        if (samples > 0 && at_least >= hedge_rtt)
+            update_hedge_rtt(max(at_least, hedge_rtt + 1));
+    }
+
     void update_timeout()
     {
         // if the server failed to respond we quite rapidly decrease our estimate of how many
@@ -209,62 +260,359 @@ public:
     {
         return reqs_sec;
     }
+
+    // 0 until there are enough samples
+    int64_t get_hedge_rtt() const
+    {
+        return samples >= hedge_min_samples ? hedge_rtt : 0;
+    }
+
+    int64_t get_samples() const
+    {
+        return samples;
+    }
+};
+
+/*
+ * Caps hedged requests at percent of all requests: each request earns percent credits,
+ * a hedge costs 100. Up to burst hedges can be saved up.
+ */
+class hedge_budget {
+private:
+    int percent_;
+    int credits_;
+    int max_credits_;
+
+public:
+    hedge_budget(int percent, int burst) :
+        percent_(percent),
+        credits_(0),
+        max_credits_(burst * 100)
+    { }
+
+    void earn()
+    {
+        credits_ = min(credits_ + percent_, max_credits_);
+    }
+
+    bool available() const
+    {
+        return credits_ >= 100;
+    }
+
+    void spend()
+    {
+        credits_ -= 100;
+    }
+};
+
+/*
+ * Worker estimators of all engines on the host, in a named shared memory segment keyed by
+ * worker address. Every thread and process learns from all requests and the estimates
+ * outlive the processes, e.g. over nginx reloads. Slots are claimed on the first report
+ * about a worker and never freed; the mapping is inherited by forked children.
+ */
+class shared_estimators : private boost::noncopyable {
+public:
+    struct slot {
+        // robust, a process dying in the middle of an update leaves a usable estimate
+        pthread_mutex_t lock;
+        volatile uint64_t key; // 0 while free
+        speed_estimator_t est;
+    };
+
+    static const int slots = 1024;
+
+private:
+    // the layout version is in both, an engine never maps a table it does not understand
+    static const char *name() { return "/accessl-estimators.1"; }
+    static const uint32_t table_magic = 0xacce5501;
+
+    struct table {
+        volatile uint32_t magic; // set once the creator initialised all slots
+        uint32_t slot_size;
+        uint32_t nslots;
+        slot s[slots];
+    };
+
+    table *table_;
+
+    shared_estimators(table *t) :
+        table_(t)
+    { }
+
+    static uint64_t key(const server& w)
+    {
+        return (1ULL << 48) | ((uint64_t)ntohl(w.get_addr().s_addr) << 16) | (uint16_t)w.get_port();
+    }
+
+    static void init(table *t)
+    {
+        pthread_mutexattr_t attr;
+
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+
+        for (int i = 0; i < slots; ++i)
+        {
+            pthread_mutex_init(&t->s[i].lock, &attr);
+            t->s[i].key = 0;
+            new (&t->s[i].est) speed_estimator_t();
+        }
+
+        pthread_mutexattr_destroy(&attr);
+
+        t->slot_size = sizeof(slot);
+        t->nslots = slots;
+        __sync_synchronize();
+        t->magic = table_magic;
+    }
+
+    // another process may be creating it, give it a second
+    static bool wait_ready(int fd, table *t)
+    {
+        for (int i = 0; i < 100; ++i)
+        {
+            struct stat st;
+
+            if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(table) &&
+                (!t || t->magic == table_magic))
+                return true;
+            usleep(10000);
+        }
+
+        return false;
+    }
+
+    static table *open_table()
+    {
+        int fd = shm_open(name(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        bool creator = fd != -1;
+        table *t = NULL;
+
+        if (!creator && errno == EEXIST)
+            fd = shm_open(name(), O_RDWR, 0);
+        if (fd == -1)
+        {
+            PLOG(WARNING) << "could not open shared memory " << name() << ", worker estimates are per thread";
+            return NULL;
+        }
+
+        if (creator ? ftruncate(fd, sizeof(table)) == -1 : !wait_ready(fd, NULL))
+        {
+            LOG(WARNING) << "shared memory " << name() << " has no table, worker estimates are per thread";
+            if (creator)
+                shm_unlink(name());
+            close(fd);
+            return NULL;
+        }
+
+        void *p = mmap(NULL, sizeof(table), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED)
+        {
+            PLOG(WARNING) << "could not map shared memory " << name() << ", worker estimates are per thread";
+            if (creator)
+                shm_unlink(name());
+            close(fd);
+            return NULL;
+        }
+        t = reinterpret_cast<table *>(p);
+
+        if (creator)
+            init(t);
+        else if (!wait_ready(fd, t) || t->slot_size != sizeof(slot) || t->nslots != slots)
+        {
+            LOG(WARNING) << "shared memory " << name() << " was not set up, remove it; worker estimates are per thread";
+            munmap(p, sizeof(table));
+            t = NULL;
+        }
+        close(fd);
+
+        return t;
+    }
+
+    static shared_estimators *& instance()
+    {
+        static shared_estimators *estimators = NULL;
+        return estimators;
+    }
+
+    static void create()
+    {
+        table *t = open_table();
+
+        if (t)
+            instance() = new shared_estimators(t);
+    }
+
+public:
+    // NULL if the segment can not be used
+    static shared_estimators *get()
+    {
+        static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+        pthread_once(&once, create);
+
+        return instance();
+    }
+
+    // slot of w, with claim a free one is taken for it; NULL if there is none
+    slot *find(const server& w, bool claim)
+    {
+        uint64_t k = key(w);
+        uint32_t start = (uint32_t)((k * 0x9e3779b97f4a7c15ULL) >> 32) % slots;
+
+        for (int i = 0; i < slots; ++i)
+        {
+            slot *s = &table_->s[(start + i) % slots];
+            uint64_t sk = s->key;
+
+            if (sk == 0)
+            {
+                if (!claim)
+                    return NULL;
+                sk = __sync_val_compare_and_swap(&s->key, 0, k);
+                if (sk == 0)
+                    return s;
+            }
+            if (sk == k)
+                return s;
+        }
+
+        return NULL;
+    }
+
+    static void lock(slot *s)
+    {
+        if (unlikely(pthread_mutex_lock(&s->lock) == EOWNERDEAD))
+            pthread_mutex_consistent(&s->lock);
+    }
+
+    static void unlock(slot *s)
+    {
+        pthread_mutex_unlock(&s->lock);
+    }
 };
 
 class server_times {
 private:
-    typedef boost::unordered_map<server::id_t, speed_estimator_t::shptr> server_speed_container;
+    // estimator of a worker, in the shared table or this thread's own if it can not be used
+    class estimator {
+    private:
+        shared_estimators::slot *shared_;
+        speed_estimator_t::shptr local_;
+
+    public:
+        estimator(shared_estimators::slot *shared) :
+            shared_(shared)
+        {
+            if (!shared_)
+                local_.reset(new speed_estimator_t());
+        }
+
+        speed_estimator_t *lock()
+        {
+            if (!shared_)
+                return local_.get();
+            shared_estimators::lock(shared_);
+            return &shared_->est;
+        }
+
+        void unlock()
+        {
+            if (shared_)
+                shared_estimators::unlock(shared_);
+        }
+    };
+
+    typedef boost::unordered_map<server::id_t, estimator> server_speed_container;
     server_speed_container speed;
+    shared_estimators *shared_;
 
-    speed_estimator_t::shptr& server_find(server::id_t id)
+    estimator& server_find(const server& w)
     {
-        server_speed_container::iterator i = speed.find(id);
+        server_speed_container::iterator i = speed.find(w.get_id());
         if (i != speed.end())
             return i->second;
         else
         {
-            speed_estimator_t::shptr server_speed(new speed_estimator_t());
-            pair<server_speed_container::iterator, bool> ret = speed.insert(server_speed_container::value_type(id, server_speed));
+            estimator server_speed(shared_ ? shared_->find(w, true) : NULL);
+            pair<server_speed_container::iterator, bool> ret = speed.insert(server_speed_container::value_type(w.get_id(), server_speed));
             return ret.first->second;
         }
     }
 
-    speed_estimator_t::shptr& server_find(const server& w)
-    {
-        return server_find(w.get_id());
-    }
-
 public:
-    server_times()
+    server_times() :
+        shared_(shared_estimators::get())
     { }
 
     void update_resp_time(const server& w, uint32_t microsecs)
     {
-        server_find(w)->update_rtt(microsecs);
+        estimator& e = server_find(w);
+        e.lock()->update_rtt(microsecs);
+        e.unlock();
     }
 
-    void update_resp_time(server::id_t server_id, uint32_t microsecs)
+    // w had not answered after microsecs, only its hedge percentile learns from that
+    void update_resp_censored(const server& w, uint32_t microsecs)
     {
-        server_find(server_id)->update_rtt(microsecs);
+        estimator& e = server_find(w);
+        e.lock()->update_hedge_censored(microsecs);
+        e.unlock();
     }
 
-    void update_resp_timeout(server::id_t server_id)
+    void update_resp_timeout(const server& w)
     {
-        server_find(server_id)->update_timeout();
+        estimator& e = server_find(w);
+        e.lock()->update_timeout();
+        e.unlock();
     }
 
     uint32_t req_timeout(const server& w)
     {
-        speed_estimator_t::cshptr server_speed = server_find(w);
-        return server_speed->get_rto();
+        estimator& e = server_find(w);
+        uint32_t ret = e.lock()->get_rto();
+        e.unlock();
+        return ret;
     }
 
     uint32_t reqs_sec(const server& w)
     {
-        speed_estimator_t::cshptr server_speed = server_find(w);
-        return server_speed->get_reqs_sec();
+        estimator& e = server_find(w);
+        uint32_t ret = e.lock()->get_reqs_sec();
+        e.unlock();
+        return ret;
     }
 
+    uint32_t hedge_rtt(const server& w)
+    {
+        estimator& e = server_find(w);
+        uint32_t ret = e.lock()->get_hedge_rtt();
+        e.unlock();
+        return ret;
+    }
+
+    /*
+     * What all engines learned about w, 0 if nothing. At least 1 once known, a worker that
+     * stopped answering for a while still gets a request now and then to find it is back.
+     */
+    uint32_t learned_reqs_sec(const server& w)
+    {
+        shared_estimators::slot *s = shared_ ? shared_->find(w, false) : NULL;
+        uint32_t ret = 0;
+
+        if (s)
+        {
+            shared_estimators::lock(s);
+            if (s->est.get_samples() > 0)
+                ret = max<int64_t>(s->est.get_reqs_sec(), 1);
+            shared_estimators::unlock(s);
+        }
+
+        return ret;
+    }
 };
 
 class servers_chooser {
@@ -275,6 +623,21 @@ private:
     server_tree_iter_map servers_map_;
     server_times server_times_;
     boost::mt19937 rng_;
+    uint32_t chosen_;
+
+    // weights follow what other engines learn through the shared estimators every that many choices
+    static const uint32_t refresh_every = 256;
+
+    void refresh_servers()
+    {
+        for (server_tree_iter_map::const_iterator it = servers_map_.begin(); it != servers_map_.end(); ++it)
+        {
+            uint32_t learned = server_times_.learned_reqs_sec(*it->second);
+
+            if (learned)
+                servers_.change_count(it->second, learned);
+        }
+    }
 
     void update_server(const server& s, uint32_t new_reqs_sec)
     {
@@ -294,19 +657,24 @@ private:
 public:
     typedef boost::optional<server> optional_server;
 
-    servers_chooser()
+    servers_chooser() :
+        chosen_(0)
     {
         boost::random_device dev;
         rng_.seed(dev());
     }
 
+    // reqs_sec is the starting weight unless other engines already know better
     void push_back(const server& s, uint32_t reqs_sec)
     {
-        servers_.push_back(s, reqs_sec);
+        uint32_t learned = server_times_.learned_reqs_sec(s);
+
+        servers_.push_back(s, learned ? learned : reqs_sec);
         update_servers_map();
     }
 
-    optional_server choose()
+private:
+    optional_server pick()
     {
         size_t reqs_total = servers_.total_count();
 
@@ -323,17 +691,49 @@ public:
         return optional_server(*(servers_.find_by_count(req_random)));
     }
 
+public:
+    optional_server choose()
+    {
+        if (unlikely(++chosen_ % refresh_every == 0))
+            refresh_servers();
+
+        return pick();
+    }
+
+    // like choose, but never s; none if no other server has any weight
+    optional_server choose_other(const server& s)
+    {
+        server_tree_iter_map::const_iterator it = servers_map_.find(s.get_id());
+
+        if (unlikely(it == servers_map_.end()))
+            return choose();
+
+        size_t count = servers_.get_count(it->second);
+
+        servers_.change_count(it->second, 0);
+        optional_server ret = pick();
+        servers_.change_count(it->second, count);
+
+        return ret;
+    }
+
     void report_time(const server& s, boost::posix_time::time_duration time)
     {
-        server_times_.update_resp_time(s.get_id(), time.total_microseconds());
+        server_times_.update_resp_time(s, time.total_microseconds());
         uint32_t new_reqs_sec = server_times_.reqs_sec(s);
 
         update_server(s, new_reqs_sec);
     }
 
+    // s was still silent after time when another worker answered for it
+    void report_late(const server& s, boost::posix_time::time_duration time)
+    {
+        server_times_.update_resp_censored(s, time.total_microseconds());
+    }
+
     void report_timeout(const server& s)
     {
-        server_times_.update_resp_timeout(s.get_id());
+        server_times_.update_resp_timeout(s);
         uint32_t new_reqs_sec = server_times_.reqs_sec(s);
 
         update_server(s, new_reqs_sec);
@@ -343,6 +743,12 @@ public:
     {
         return boost::posix_time::microseconds(server_times_.req_timeout(s));
     }
+
+    // how long to wait for s before hedging, 0 while unknown
+    boost::posix_time::time_duration get_hedge_delay(const server& s)
+    {
+        return boost::posix_time::microseconds(server_times_.hedge_rtt(s));
+    }
 };
 
 };
@@ -0,0 +1,124 @@
+/*
+    This file is part of AcceSSL.
+
+    Copyright 2011-2014 Marcin Gozdalik <gozdal@gmail.com>
+
+    AcceSSL is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    AcceSSL is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with AcceSSL; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#define BOOST_TEST_MODULE servers
+
+#include <boost/test/included/unit_test.hpp>
+
+#include "servers.hpp"
+
+using namespace std;
+using namespace accessl;
+
+BOOST_AUTO_TEST_CASE( hedge_budget_earns_percent )
+{
+    hedge_budget budget(5, 10);
+
+    BOOST_CHECK( !budget.available() );
+    for (int i = 0; i < 19; i++)
+        budget.earn();
+    BOOST_CHECK( !budget.available() );
+
+    budget.earn();
+    BOOST_CHECK( budget.available() );
+
+    budget.spend();
+    BOOST_CHECK( !budget.available() );
+}
+
+BOOST_AUTO_TEST_CASE( hedge_budget_burst )
+{
+    hedge_budget budget(5, 10);
+
+    for (int i = 0; i < 100000; i++)
+        budget.earn();
+
+    for (int i = 0; i < 10; i++) {
+        BOOST_CHECK( budget.available() );
+        budget.spend();
+    }
+    BOOST_CHECK( !budget.available() );
+}
+
+BOOST_AUTO_TEST_CASE( hedge_rtt_needs_samples )
+{
+    speed_estimator_t est;
+
+    for (int i = 0; i < speed_estimator_t::hedge_min_samples - 1; i++)
+        est.update_rtt(1000);
+    BOOST_CHECK( est.get_hedge_rtt() == 0 );
+
+    est.update_rtt(1000);
+    BOOST_CHECK( est.get_hedge_rtt() > 0 );
+}
+
+// uniform response times 1000-2000us, the 95th percentile is 1950us
+BOOST_AUTO_TEST_CASE( hedge_rtt_converges )
+{
+    speed_estimator_t est;
+    boost::mt19937 gen(42);
+    boost::uniform_int<> dist(1000, 2000);
+
+    for (int i = 0; i < 20000; i++)
+        est.update_rtt(dist(gen));
+
+    BOOST_CHECK( est.get_hedge_rtt() > 1850 );
+    BOOST_CHECK( est.get_hedge_rtt() < 2050 );
+}
+
+// a hedged primary that lost is only known to take longer than the hedge delay
+BOOST_AUTO_TEST_CASE( hedge_rtt_censored )
+{
+    speed_estimator_t est;
+    boost::mt19937 gen(42);
+    boost::uniform_int<> dist(1000, 2000);
+
+    for (int i = 0; i < 20000; i++) {
+        int64_t rtt = dist(gen);
+        int64_t delay = est.get_hedge_rtt();
+
+        if (delay && rtt > delay)
+            est.update_hedge_censored(delay);
+        else
+            est.update_rtt(rtt);
+    }
+
+    BOOST_CHECK( est.get_hedge_rtt() > 1850 );
+    BOOST_CHECK( est.get_hedge_rtt() < 2050 );
+}
+
+BOOST_AUTO_TEST_CASE( hedge_rtt_censored_below_estimate )
+{
+    speed_estimator_t est;
+
+    for (int i = 0; i < speed_estimator_t::hedge_min_samples; i++)
+        est.update_rtt(1000);
+
+    int64_t before = est.get_hedge_rtt();
+    int64_t samples = est.get_samples();
+
+    // still waiting after less than the estimate says nothing about the percentile
+    est.update_hedge_censored(before / 2);
+    BOOST_CHECK( est.get_hedge_rtt() == before );
+    BOOST_CHECK( est.get_samples() == samples );
+
+    est.update_hedge_censored(before);
+    BOOST_CHECK( est.get_hedge_rtt() > before );
+}
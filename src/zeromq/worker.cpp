@@ -22,10 +22,17 @@
 #include <netinet/in.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <openssl/rsa.h>
 #include <openssl/md5.h>
 #include <openssl/bn.h>
+#include <openssl/ec.h>
+#include <openssl/obj_mac.h>
 
 #include <iostream>
 #include <exception>
@@ -68,6 +75,14 @@ struct config_t {
     int port;
     int count;
     vector<string> keys;
+    vector<string> ticket_keys;
+    bool latency_mode;
+    int stats_interval;
+    string profile;
+    bool recalibrate;
+    int ecdsa_pool;
+    int ecdsa_pool_rate;
+    string isa;
 };
 
 bool analyze_options(int argc, char *argv[], config_t & config)
@@ -78,6 +93,14 @@ bool analyze_options(int argc, char *argv[], config_t & config)
         ("host,o", po::value< string >(&config.host)->default_value("0.0.0.0"), "host address to bind to")
         ("port,p", po::value< int >(&config.port)->default_value(10000), "UDP port to bind to")
         ("key,k", po::value< vector<string> >(&config.keys), "key to load (may be specified more than once)")
+        ("ticket-key", po::value< vector<string> >(&config.ticket_keys), "session ticket key, 48 or 80 bytes as for nginx ssl_session_ticket_key; the first one seals, all of them open")
+        ("latency-mode,l", po::bool_switch(&config.latency_mode), "use spare cores to cut latency of single operations, turned off automatically under load")
+        ("stats-interval,s", po::value< int >(&config.stats_interval)->default_value(0), "log per-key statistics every given number of seconds (0 disables)")
+        ("profile", po::value< string >(&config.profile), "file to keep accelerator calibration results in between runs")
+        ("recalibrate", po::bool_switch(&config.recalibrate), "ignore saved calibration results and benchmark again")
+        ("ecdsa-pool", po::value< int >(&config.ecdsa_pool)->default_value(ACCEL_ECDSA_POOL_DEFAULT), "ECDSA nonces precomputed on idle cores per key (0 disables)")
+        ("ecdsa-pool-rate", po::value< int >(&config.ecdsa_pool_rate)->default_value(0), "most ECDSA nonces precomputed per second and key (0 for no limit)")
+        ("isa", po::value< string >(&config.isa)->default_value("native"), "highest instruction set kernels may use: base, bmi2, avx2, avx512 or native")
         ;
 
     po::variables_map vm;
@@ -103,7 +126,7 @@ static void serialize_bn(const BIGNUM *bn, unsigned char **ptr)
 }
 
 
-void convert_rsa_key(const RSA *rsa)
+void convert_rsa_key(const RSA *rsa, const vector<BIGNUM *>& other_primes = vector<BIGNUM *>())
 {
     MD5_CTX md5_ctx;
     int n_len = BN_num_bytes(rsa->n);
@@ -146,6 +169,12 @@ void convert_rsa_key(const RSA *rsa)
             6 * sizeof(unsigned int);
     }
 
+    if (other_primes.size() % 3 || other_primes.size() / 3 > CMD_RSA_MAX_PRIMES - 2)
+        throw accessl::openssl::crypto_error("Unsupported number of RSA primes");
+
+    for (vector<BIGNUM *>::const_iterator it = other_primes.begin(); it != other_primes.end(); it++)
+        key_len += BN_num_bytes(*it) + sizeof(unsigned int);
+
     unsigned char data[key_len];
 
     unsigned char *ptr = data;
@@ -157,12 +186,104 @@ void convert_rsa_key(const RSA *rsa)
     serialize_bn(rsa->dmp1, &ptr);
     serialize_bn(rsa->dmq1, &ptr);
     serialize_bn(rsa->iqmp, &ptr);
+    for (vector<BIGNUM *>::const_iterator it = other_primes.begin(); it != other_primes.end(); it++)
+        serialize_bn(*it, &ptr);
 
     void *priv = accel_add_key(CMD_KEY_RSA, key_len, data);
 
     worker_keys.add(f, data, key_len, priv);
 }
 
+// curve, d and the public point, fingerprint is MD5 of the point as the engine sees it
+void convert_ec_key(const EC_KEY *ec)
+{
+    const EC_GROUP *group = EC_KEY_get0_group(ec);
+    const EC_POINT *pub = EC_KEY_get0_public_key(ec);
+    const BIGNUM *d = EC_KEY_get0_private_key(ec);
+    const int d_len = 32;
+    unsigned char point[1 + 2 * d_len];
+    unsigned char f[KEY_FINGERPRINT_SIZE];
+
+    if (!group || EC_GROUP_get_curve_name(group) != NID_X9_62_prime256v1)
+        throw key_loading_error("Unsupported EC curve, only P-256 keys can be loaded");
+
+    if (!pub || !d)
+        throw accessl::openssl::crypto_error("Need public and private key, only public given");
+
+    if (EC_POINT_point2oct(group, pub, POINT_CONVERSION_UNCOMPRESSED, point, sizeof(point), NULL) != sizeof(point) ||
+        BN_num_bytes(d) > d_len)
+    {
+        throw accessl::openssl::crypto_error("Malformed EC key");
+    }
+
+    if (!MD5(point, sizeof(point), f))
+        throw accessl::openssl::crypto_error("MD5 failure");
+
+    size_t key_len = 3 * sizeof(unsigned int) + sizeof(uint32_t) + d_len + sizeof(point);
+    unsigned char data[key_len];
+    unsigned char *ptr = data;
+
+    *(unsigned int *)ptr = htonl(sizeof(uint32_t));
+    ptr += sizeof(unsigned int);
+    *(uint32_t *)ptr = htonl(CMD_EC_CURVE_P256);
+    ptr += sizeof(uint32_t);
+
+    *(unsigned int *)ptr = htonl(d_len);
+    ptr += sizeof(unsigned int);
+    memset(ptr, 0, d_len);
+    BN_bn2bin(d, ptr + d_len - BN_num_bytes(d));
+    ptr += d_len;
+
+    *(unsigned int *)ptr = htonl(sizeof(point));
+    ptr += sizeof(unsigned int);
+    memcpy(ptr, point, sizeof(point));
+
+    void *priv = accel_add_key(CMD_KEY_EC, key_len, data);
+
+    if (priv)
+        worker_keys.add(f, data, key_len, priv);
+    OPENSSL_cleanse(data, key_len);
+
+    if (!priv)
+        throw key_loading_error("No accelerator accepted the EC key");
+}
+
+// seed and public key, fingerprint is MD5 of the public key as the engine sees it
+void convert_ed25519_key(const unsigned char *seed)
+{
+    const size_t key_bytes = 32;
+    unsigned char pub[key_bytes];
+    unsigned char f[KEY_FINGERPRINT_SIZE];
+
+    if (accel_ed25519_public_key(seed, pub) < 0)
+        throw accessl::openssl::crypto_error("Malformed Ed25519 key");
+
+    if (!MD5(pub, sizeof(pub), f))
+        throw accessl::openssl::crypto_error("MD5 failure");
+
+    size_t key_len = 2 * (sizeof(unsigned int) + key_bytes);
+    unsigned char data[key_len];
+    unsigned char *ptr = data;
+
+    *(unsigned int *)ptr = htonl(key_bytes);
+    ptr += sizeof(unsigned int);
+    memcpy(ptr, seed, key_bytes);
+    ptr += key_bytes;
+
+    *(unsigned int *)ptr = htonl(key_bytes);
+    ptr += sizeof(unsigned int);
+    memcpy(ptr, pub, key_bytes);
+
+    void *priv = accel_add_key(CMD_KEY_ED25519, key_len, data);
+
+    if (priv)
+        worker_keys.add(f, data, key_len, priv);
+    OPENSSL_cleanse(data, key_len);
+
+    if (!priv)
+        throw key_loading_error("No accelerator accepted the Ed25519 key");
+}
+
 string get_openssl_error(const string& msg)
 {
     stringstream sstr;
@@ -203,8 +324,45 @@ void setup_default_keys()
 
 void load_key(const string& filename)
 {
-    RSA *rsa = accessl::openssl::crypto_t::rsa_private_key_from_pem(filename);
-    convert_rsa_key(rsa);
+    unsigned char seed[32];
+    if (accessl::openssl::crypto_t::ed25519_private_key_from_pem(filename, seed))
+    {
+        try {
+            convert_ed25519_key(seed);
+        } catch (...) {
+            OPENSSL_cleanse(seed, sizeof(seed));
+            throw;
+        }
+        OPENSSL_cleanse(seed, sizeof(seed));
+        return;
+    }
+
+    EC_KEY *ec = accessl::openssl::crypto_t::ec_private_key_from_pem(filename);
+    if (ec)
+    {
+        try {
+            convert_ec_key(ec);
+        } catch (...) {
+            EC_KEY_free(ec);
+            throw;
+        }
+        EC_KEY_free(ec);
+        return;
+    }
+
+    vector<BIGNUM *> other_primes;
+    RSA *rsa = accessl::openssl::crypto_t::rsa_private_key_from_pem(filename, &other_primes);
+
+    try {
+        convert_rsa_key(rsa, other_primes);
+    } catch (...) {
+        for (vector<BIGNUM *>::iterator it = other_primes.begin(); it != other_primes.end(); it++)
+            BN_clear_free(*it);
+        throw;
+    }
+
+    for (vector<BIGNUM *>::iterator it = other_primes.begin(); it != other_primes.end(); it++)
+        BN_clear_free(*it);
 }
 
 void load_keys(const vector<string>& filenames)
@@ -213,28 +371,171 @@ void load_keys(const vector<string>& filenames)
         load_key(*it);
 } 
 
-int process_req(const unsigned char *req, unsigned char *resp)
+/*
+ * Ticket key files use the nginx layout: 16-byte name, then HMAC and AES keys of 16 or 32 bytes each.
+ * Tickets are AES-GCM so the HMAC key is not needed, the AES key size picks AES-128 or AES-256.
+ */
+void load_ticket_key(const string& filename)
+{
+    const size_t name_len = CMD_TICKET_NAME_LEN;
+    unsigned char buf[81];
+    unsigned char f[KEY_FINGERPRINT_SIZE];
+    size_t len;
+
+    FILE *fp = fopen(filename.c_str(), "rb");
+    if (!fp)
+        throw key_loading_error("Could not open ticket key " + filename + ": " + strerror(errno));
+    len = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+
+    if (len != 48 && len != 80)
+    {
+        OPENSSL_cleanse(buf, sizeof(buf));
+        throw key_loading_error("Ticket key " + filename + " is neither 48 nor 80 bytes long");
+    }
+
+    size_t aes_len = (len - name_len) / 2;
+    size_t key_len = 2 * sizeof(unsigned int) + name_len + aes_len;
+    unsigned char data[key_len];
+    unsigned char *ptr = data;
+
+    *(unsigned int *)ptr = htonl(name_len);
+    ptr += sizeof(unsigned int);
+    memcpy(ptr, buf, name_len);
+    ptr += name_len;
+
+    *(unsigned int *)ptr = htonl(aes_len);
+    ptr += sizeof(unsigned int);
+    memcpy(ptr, buf + name_len + aes_len, aes_len);
+
+    OPENSSL_cleanse(buf, sizeof(buf));
+
+    void *priv = NULL;
+    if (MD5(data + sizeof(unsigned int), name_len, f))
+        priv = accel_add_key(CMD_KEY_TICKET, key_len, data);
+
+    if (priv)
+        worker_keys.add(f, data, key_len, priv);
+    OPENSSL_cleanse(data, key_len);
+
+    if (!priv)
+        throw key_loading_error("No accelerator accepted the ticket key " + filename);
+}
+
+void load_ticket_keys(const vector<string>& filenames)
+{
+    for (vector<string>::const_iterator it = filenames.begin(); it != filenames.end(); it++)
+        load_ticket_key(*it);
+}
+
+/*
+ * Fills op for the request of req_len bytes and the response header, returns false if it
+ * can't be performed. Op parsers trust op.len, it must not go past what was received.
+ */
+bool prepare_req(const unsigned char *req, size_t req_len, unsigned char *resp, accel_op& op, size_t& resp_hdr)
 {
     try {
         const cmd *c = reinterpret_cast<const cmd *>(req);
-        if (ntohl(c->cmd) != CMD_OP)
-            return -1;
 
-        int opcode = ntohl(c->op.op);
-        int cmd_len = ntohl(c->op.len);
+        if (req_len < sizeof(cmd))
+        {
+            LOG(ERROR) << "request of " << req_len << " bytes is too short";
+            return false;
+        }
 
-        key& k = worker_keys.find(c->op.key_fingerprint);
+        int type = ntohl(c->cmd);
+
+        if (type == CMD_OP_TAGGED)
+        {
+            memcpy(resp, &c->tag, sizeof(c->tag));
+            resp_hdr = sizeof(c->tag);
+        }
+        else if (type == CMD_OP)
+            resp_hdr = 0;
+        else
+            return false;
+
+        int opcode = ntohl(c->op.op);
+        size_t cmd_len = ntohl(c->op.len);
 
         DLOG(INFO) << "req " << opcode << " for buf of " << cmd_len << " bytes";
 
-        return accel_perform(k.get_priv(), opcode, cmd_len, c->op.data, resp);
+        if (cmd_len > req_len - sizeof(cmd))
+        {
+            LOG(ERROR) << "req " << opcode << " claims " << cmd_len << " bytes, got " << req_len - sizeof(cmd);
+            return false;
+        }
+
+        // key shares are made from scratch and accel picks ticket keys by itself, there is no key to look up
+        if (opcode == CMD_OP_KEYSHARE || opcode == CMD_OP_TICKET_SEAL || opcode == CMD_OP_TICKET_OPEN)
+            op.key = NULL;
+        else
+            op.key = worker_keys.find(c->op.key_fingerprint).get_priv();
+        op.op = opcode;
+        op.len = cmd_len;
+        op.data = c->op.data;
+        op.result = resp + resp_hdr;
+        op.ret = -1;
+
+        return true;
     } catch (keys::not_found& e) {
         LOG(ERROR) << "key not found";
-        return -1;
+        return false;
     }
 }
 
-int processor(int port)
+class latency_mode_switch {
+private:
+    bool allowed_;
+    bool on_;
+    bool system_busy_;
+    time_t last_check_;
+    long cpus_;
+
+    // 1-minute load average is cheap to read and smoothes out short bursts
+    bool check_system_busy()
+    {
+        time_t now = time(NULL);
+
+        if (now != last_check_)
+        {
+            double load;
+
+            last_check_ = now;
+            if (getloadavg(&load, 1) == 1)
+                system_busy_ = load >= cpus_;
+        }
+
+        return system_busy_;
+    }
+
+public:
+    latency_mode_switch(bool allowed) :
+        allowed_(allowed),
+        on_(false),
+        system_busy_(false),
+        last_check_(0),
+        cpus_(sysconf(_SC_NPROCESSORS_ONLN))
+    { }
+
+    // called after each request, backlog tells if there are requests already waiting for us
+    void update(bool backlog)
+    {
+        if (!allowed_)
+            return;
+
+        bool on = !backlog && !check_system_busy();
+
+        if (on != on_)
+        {
+            DLOG(INFO) << "latency mode " << (on ? "on" : "off");
+            accel_set_latency_mode(on);
+            on_ = on;
+        }
+    }
+};
+
+int processor(int port, bool latency_mode, int stats_interval)
 {
     DLOG(INFO) << "processor starting at port " << port;
 
@@ -260,35 +561,79 @@ int processor(int port)
         return 1;
     }
 
-    while(1)
-    {
-        unsigned char req[CMD_MAX_LEN], resp[CMD_MAX_LEN];
+    latency_mode_switch latency(latency_mode);
+    time_t last_stats = time(NULL);
+
+    struct request_t {
+        unsigned char req[CMD_MAX_LEN];
+        unsigned char resp[sizeof(uint32_t) + CMD_MAX_LEN]; // tag of CMD_OP_TAGGED and the result
+        size_t resp_hdr;
         struct sockaddr_in src;
-        socklen_t addrlen = sizeof(src);
-        ssize_t ret = recvfrom(s, req, sizeof(req), 0, (struct sockaddr *)&src, &addrlen);
+        socklen_t addrlen;
+    };
+    request_t reqs[ACCEL_BATCH_MAX];
+    request_t *op_reqs[ACCEL_BATCH_MAX];
+    accel_op ops[ACCEL_BATCH_MAX];
+    bool running = true;
 
-        if (unlikely(ret == -1))
+    while (running)
+    {
+        int count = 0, op_count = 0;
+
+        // wait for the first request, then take whatever is already queued so it can be done in one batch
+        while (count < ACCEL_BATCH_MAX)
         {
-            LOG(ERROR) << "processor got error on recvfrom: " << strerror(errno);
-            break;
+            request_t& r = reqs[count];
+            r.addrlen = sizeof(r.src);
+            ssize_t ret = recvfrom(s, r.req, sizeof(r.req), count ? MSG_DONTWAIT : 0, (struct sockaddr *)&r.src, &r.addrlen);
+
+            if (ret == -1)
+            {
+                if (count > 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                    break;
+
+                LOG(ERROR) << "processor got error on recvfrom: " << strerror(errno);
+                running = false;
+                break;
+            }
+
+            DLOG(INFO) << "got packet from " << inet_ntoa(r.src.sin_addr) << ":" << ntohs(r.src.sin_port);
+
+            if (prepare_req(r.req, ret, r.resp, ops[op_count], r.resp_hdr))
+                op_reqs[op_count++] = &r;
+            ++count;
         }
 
-        DLOG(INFO) << "got packet from " << inet_ntoa(src.sin_addr) << ":" << ntohs(src.sin_port);
+        accel_perform_batch(ops, op_count);
 
-        int resp_len = process_req(req, resp);
-        if (resp_len < 0)
-            continue;
+        for (int i = 0; i < op_count && running; ++i)
+        {
+            request_t& r = *op_reqs[i];
+            int resp_len = ops[i].ret;
 
-        addrlen = sizeof(src);
+            if (resp_len < 0)
+                continue;
 
-        DLOG(INFO) << "returning " << resp_len << " bytes";
+            DLOG(INFO) << "returning " << resp_len << " bytes";
+
+            ssize_t ret = sendto(s, r.resp, r.resp_hdr + resp_len, 0, (const sockaddr *)&r.src, r.addrlen);
+
+            if (unlikely(ret == -1))
+            {
+                LOG(ERROR) << "processor got error on sendto: " << strerror(errno);
+                running = false;
+            }
+        }
 
-        ret = sendto(s, resp, resp_len, 0, (const sockaddr *)&src, addrlen);
+        int pending = 0;
+        if (ioctl(s, FIONREAD, &pending) < 0)
+            pending = 0;
+        latency.update(pending > 0);
 
-        if (unlikely(ret == -1))
+        if (stats_interval > 0 && time(NULL) - last_stats >= stats_interval)
         {
-            LOG(ERROR) << "processor got error on sendto: " << strerror(errno);
-            break;
+            accel_log_stats();
+            last_stats = time(NULL);
         }
     }
 
@@ -317,11 +662,15 @@ int main(int argc, char *argv[])
             return 0;
         }
 
-        accel_init();
+        if (accel_set_isa(config.isa.c_str()) < 0)
+            throw po::invalid_option_value(config.isa);
+        accel_init(config.profile.empty() ? NULL : config.profile.c_str(), config.recalibrate);
+        accel_set_ecdsa_pool(config.ecdsa_pool, config.ecdsa_pool_rate);
         setup_default_keys();
         load_keys(config.keys);
+        load_ticket_keys(config.ticket_keys);
 
-        ret = processor(config.port);
+        ret = processor(config.port, config.latency_mode, config.stats_interval);
     } catch (po::error& e) {
         cerr << "Invalid option: " << e.what() << endl;
         ret = 1;